@@ -70,6 +70,7 @@ int nExportNumViews;
 int nArchiveType;
 int nProcessPriority;
 unsigned nMaxThreads;
+bool bTrace;
 String strConfigFileName;
 boost::program_options::variables_map vm;
 } // namespace OPT
@@ -99,6 +100,7 @@ bool Application::Initialize(size_t argc, LPCTSTR* argv)
 		("archive-type", boost::program_options::value(&OPT::nArchiveType)->default_value(ARCHIVE_MVS), "project archive type: -1-interface, 0-text, 1-binary, 2-compressed binary")
 		("process-priority", boost::program_options::value(&OPT::nProcessPriority)->default_value(-1), "process priority (below normal by default)")
 		("max-threads", boost::program_options::value(&OPT::nMaxThreads)->default_value(0), "maximum number of threads (0 for using all available cores)")
+		("trace", boost::program_options::value(&OPT::bTrace)->default_value(false), "record the time spent by each thread on the dense reconstruction tasks and save it as a Chrome trace JSON timeline next to the output")
 		#if TD_VERBOSE != TD_VERBOSE_OFF
 		("verbosity,v", boost::program_options::value(&g_nVerbosityLevel)->default_value(
 			#if TD_VERBOSE == TD_VERBOSE_DEBUG
@@ -132,6 +134,7 @@ bool Application::Initialize(size_t argc, LPCTSTR* argv)
 	unsigned nEstimateColors;
 	unsigned nEstimateNormals;
 	unsigned nOptimize;
+	unsigned nFusionPartitions;
 	int nIgnoreMaskLabel;
 	bool bRemoveDmaps;
 	boost::program_options::options_description config("Densify options");
@@ -157,6 +160,7 @@ bool Application::Initialize(size_t argc, LPCTSTR* argv)
 		("sub-scene-area", boost::program_options::value(&OPT::fMaxSubsceneArea)->default_value(0.f), "split the scene in sub-scenes such that each sub-scene surface does not exceed the given maximum sampling area (0 - disabled)")
 		("sample-mesh", boost::program_options::value(&OPT::fSampleMesh)->default_value(0.f), "uniformly samples points on a mesh (0 - disabled, <0 - number of points, >0 - sample density per square unit)")
 		("fusion-mode", boost::program_options::value(&OPT::nFusionMode)->default_value(0), "depth-maps fusion mode (-2 - fuse disparity-maps, -1 - export disparity-maps only, 0 - depth-maps & fusion, 1 - export depth-maps only)")
+		("fusion-partitions", boost::program_options::value(&nFusionPartitions)->default_value(0), "number of partitions along the largest scene dimension used to fuse the depth-maps out-of-core, streaming the points directly to the output file (0 - disabled)")
 		("postprocess-dmaps", boost::program_options::value(&nOptimize)->default_value(7), "flags used to filter the depth-maps after estimation (0 - disabled, 1 - remove-speckles, 2 - fill-gaps, 4 - adjust-filter)")
 		("filter-point-cloud", boost::program_options::value(&OPT::thFilterPointCloud)->default_value(0), "filter dense point-cloud based on visibility (0 - disabled)")
 		("export-number-views", boost::program_options::value(&OPT::nExportNumViews)->default_value(0), "export points with >= number of views (0 - disabled, <0 - save MVS project too)")
@@ -249,6 +253,7 @@ bool Application::Initialize(size_t argc, LPCTSTR* argv)
 	OPTDENSE::nEstimateColors = nEstimateColors;
 	OPTDENSE::nEstimateNormals = nEstimateNormals;
 	OPTDENSE::nOptimize = nOptimize;
+	OPTDENSE::nFusionPartitions = nFusionPartitions;
 	OPTDENSE::nIgnoreMaskLabel = nIgnoreMaskLabel;
 	OPTDENSE::bRemoveDmaps = bRemoveDmaps;
 	if (!bValidConfig && !OPT::strDenseConfigFileName.empty())
@@ -400,7 +405,9 @@ int main(int argc, LPCTSTR* argv)
 		scene.pointcloud.SaveWithScale(baseFileName+_T("_scale.ply"), scene.images, OPT::fEstimateScale);
 		return EXIT_SUCCESS;
 	}
+	const String baseFileName(MAKE_PATH_SAFE(Util::getFileFullName(OPT::strOutputFileName)));
 	PointCloud sparsePointCloud;
+	bool bStreamed(false);
 	if ((ARCHIVE_TYPE)OPT::nArchiveType != ARCHIVE_MVS || sceneType == Scene::SCENE_INTERFACE) {
 		#if TD_VERBOSE != TD_VERBOSE_OFF
 		if (VERBOSITY_LEVEL > 1 && !scene.pointcloud.IsEmpty())
@@ -409,18 +416,30 @@ int main(int argc, LPCTSTR* argv)
 		if ((ARCHIVE_TYPE)OPT::nArchiveType == ARCHIVE_MVS)
 			sparsePointCloud = scene.pointcloud;
 		TD_TIMER_START();
-		if (!scene.DenseReconstruction(OPT::nFusionMode, OPT::bCrop2ROI, OPT::fBorderROI)) {
+		// if enabled, the dense point-cloud is fused out-of-core and streamed directly to disk
+		bStreamed = OPTDENSE::nFusionPartitions > 0 && OPT::nFusionMode == 0;
+		if (OPT::bTrace)
+			GET_TRACE().Start();
+		size_t numPointsStreamed(0);
+		const bool bReconstructed(scene.DenseReconstruction(OPT::nFusionMode, OPT::bCrop2ROI, OPT::fBorderROI, bStreamed ? baseFileName+_T(".ply") : String(),
+			(ARCHIVE_TYPE)OPT::nArchiveType == ARCHIVE_MVS, &numPointsStreamed));
+		if (OPT::bTrace) {
+			GET_TRACE().Stop();
+			if (GET_TRACE().Save(baseFileName+_T(".trace.json")))
+				VERBOSE("Timeline saved: %u spans recorded", GET_TRACE().GetNumSpans());
+		}
+		if (!bReconstructed) {
 			if (ABS(OPT::nFusionMode) != 1)
 				return EXIT_FAILURE;
 			VERBOSE("Depth-maps estimated (%s)", TD_TIMER_GET_FMT().c_str());
 			return EXIT_SUCCESS;
 		}
-		VERBOSE("Densifying point-cloud completed: %u points (%s)", scene.pointcloud.GetSize(), TD_TIMER_GET_FMT().c_str());
+		VERBOSE("Densifying point-cloud completed: %u points (%s)", (unsigned)(scene.pointcloud.IsEmpty() ? numPointsStreamed : scene.pointcloud.GetSize()), TD_TIMER_GET_FMT().c_str());
 	}
 
 	// save the final point-cloud
-	const String baseFileName(MAKE_PATH_SAFE(Util::getFileFullName(OPT::strOutputFileName)));
-	scene.pointcloud.Save(baseFileName+_T(".ply"), (ARCHIVE_TYPE)OPT::nArchiveType == ARCHIVE_MVS);
+	if (!bStreamed || !scene.pointcloud.IsEmpty())
+		scene.pointcloud.Save(baseFileName+_T(".ply"), (ARCHIVE_TYPE)OPT::nArchiveType == ARCHIVE_MVS);
 	#if TD_VERBOSE != TD_VERBOSE_OFF
 	if (VERBOSITY_LEVEL > 2)
 		scene.ExportCamerasMLP(baseFileName+_T(".mlp"), baseFileName+_T(".ply"));
@@ -31,6 +31,7 @@
 
 #include "../../libs/MVS/Common.h"
 #include "../../libs/MVS/Scene.h"
+#include "../../libs/MVS/MaxFlow.h"
 #include <boost/program_options.hpp>
 
 using namespace MVS;
@@ -57,6 +58,8 @@ String strOutputFileName;
 String strMeshFileName;
 String strImportROIFileName;
 String strImagePointsFileName;
+String strExportGraphFileName;
+String strMaxFlowGraphFileName;
 bool bMeshExport;
 float fDistInsert;
 bool bUseOnlyROI;
@@ -64,6 +67,9 @@ bool bUseConstantWeight;
 bool bUseFreeSpaceSupport;
 float fThicknessFactor;
 float fQualityFactor;
+int nMaxFlowType;
+unsigned nMaxTilePoints;
+float fTileOverlap;
 float fDecimateMesh;
 unsigned nTargetFaceNum;
 float fRemoveSpurious;
@@ -134,6 +140,9 @@ bool Application::Initialize(size_t argc, LPCTSTR* argv)
 		("free-space-support,f", boost::program_options::value(&OPT::bUseFreeSpaceSupport)->default_value(false), "exploits the free-space support in order to reconstruct weakly-represented surfaces")
 		("thickness-factor", boost::program_options::value(&OPT::fThicknessFactor)->default_value(1.f), "multiplier adjusting the minimum thickness considered during visibility weighting")
 		("quality-factor", boost::program_options::value(&OPT::fQualityFactor)->default_value(1.f), "multiplier adjusting the quality weight considered during graph-cut")
+		("max-flow", boost::program_options::value(&OPT::nMaxFlowType)->default_value(MaxFlow::MAXFLOW_IBFS), "max-flow algorithm used by the graph-cut: 0 - IBFS, 1 - Boykov-Kolmogorov, 2 - multi-threaded push-relabel")
+		("max-tile-points", boost::program_options::value(&OPT::nMaxTilePoints)->default_value(0), "reconstruct the mesh in tiles containing at most this number of points, in order to limit the memory usage (0 - disabled)")
+		("tile-overlap", boost::program_options::value(&OPT::fTileOverlap)->default_value(0.05f), "overlap between neighbor tiles, relative to the tile size")
 		;
 	boost::program_options::options_description config_clean("Clean options");
 	config_clean.add_options()
@@ -157,6 +166,8 @@ bool Application::Initialize(size_t argc, LPCTSTR* argv)
 		("split-max-area", boost::program_options::value(&OPT::fSplitMaxArea)->default_value(0.f), "maximum surface area that a sub-mesh can contain (0 - disabled)")
 		("import-roi-file", boost::program_options::value<std::string>(&OPT::strImportROIFileName), "ROI file name to be imported into the scene")
 		("image-points-file", boost::program_options::value<std::string>(&OPT::strImagePointsFileName), "input filename containing the list of points from an image to project on the mesh (optional)")
+		("export-graph", boost::program_options::value<std::string>(&OPT::strExportGraphFileName), "file name where to save the graph built for the graph-cut (optional)")
+		("max-flow-graph", boost::program_options::value<std::string>(&OPT::strMaxFlowGraphFileName), "graph file name saved by export-graph to be solved by all max-flow algorithms, comparing their results and speed (skips the reconstruction step)")
 		;
 
 	boost::program_options::options_description cmdline_options;
@@ -194,12 +205,13 @@ bool Application::Initialize(size_t argc, LPCTSTR* argv)
 
 	// validate input
 	Util::ensureValidPath(OPT::strInputFileName);
-	if (OPT::vm.count("help") || OPT::strInputFileName.empty()) {
+	Util::ensureValidPath(OPT::strMaxFlowGraphFileName);
+	if (OPT::vm.count("help") || (OPT::strInputFileName.empty() && OPT::strMaxFlowGraphFileName.empty())) {
 		boost::program_options::options_description visible("Available options");
 		visible.add(generic).add(config_main).add(config_clean);
 		GET_LOG() << visible;
 	}
-	if (OPT::strInputFileName.empty())
+	if (OPT::strInputFileName.empty() && OPT::strMaxFlowGraphFileName.empty())
 		return false;
 	OPT::strExportType = OPT::strExportType.ToLower() == _T("obj") ? _T(".obj") : _T(".ply");
 
@@ -209,6 +221,7 @@ bool Application::Initialize(size_t argc, LPCTSTR* argv)
 	Util::ensureValidPath(OPT::strImportROIFileName);
 	Util::ensureValidPath(OPT::strImagePointsFileName);
 	Util::ensureValidPath(OPT::strMeshFileName);
+	Util::ensureValidPath(OPT::strExportGraphFileName);
 	if (OPT::strPointCloudFileName.empty() && (ARCHIVE_TYPE)OPT::nArchiveType == ARCHIVE_MVS)
 		OPT::strPointCloudFileName = Util::getFileFullName(OPT::strInputFileName) + _T(".ply");
 	if (OPT::strOutputFileName.empty())
@@ -333,6 +346,39 @@ bool Export3DProjections(Scene& scene, const String& inputFileName) {
 	return true;
 }
 
+// solve the given graph, as saved by ReconstructMesh, with all max-flow algorithms
+// and compare their flow, minimum cut and speed
+bool BenchmarkMaxFlow(const String& fileName)
+{
+	MaxFlowGraph graph;
+	if (!graph.Load(fileName)) {
+		VERBOSE("error: cannot load graph file: %s", fileName.c_str());
+		return false;
+	}
+	VERBOSE("Max-flow graph loaded: %u nodes, %u edges", (unsigned)graph.nodes.size(), (unsigned)graph.edges.size());
+	std::vector<bool> cutRef;
+	for (int type=0; type<MaxFlow::MAXFLOW_NUM_TYPES; ++type) {
+		TD_TIMER_START();
+		const MaxFlowPtr solver(MaxFlow::Create((MaxFlow::TYPE)type, OPT::nMaxThreads));
+		solver->SetGraph(graph);
+		const MaxFlow::value_type flow(solver->ComputeMaxFlow());
+		const String time(TD_TIMER_GET_FMT());
+		std::vector<bool> cut(graph.nodes.size());
+		size_t numSrcNodes(0), numDiffNodes(0);
+		FOREACH(n, cut) {
+			if ((cut[n] = solver->IsNodeOnSrcSide((MaxFlow::node_type)n)))
+				++numSrcNodes;
+			if (!cutRef.empty() && cut[n] != cutRef[n])
+				++numDiffNodes;
+		}
+		if (cutRef.empty())
+			cutRef.swap(cut);
+		VERBOSE("%s max-flow: %g flow, %u source nodes, %u nodes cut differently than %s (%s)",
+			MaxFlow::GetName((MaxFlow::TYPE)type), flow, (unsigned)numSrcNodes, (unsigned)numDiffNodes, MaxFlow::GetName(MaxFlow::MAXFLOW_IBFS), time.c_str());
+	}
+	return true;
+}
+
 int main(int argc, LPCTSTR* argv)
 {
 	#ifdef _DEBUGINFO
@@ -344,6 +390,9 @@ int main(int argc, LPCTSTR* argv)
 	if (!application.Initialize(argc, argv))
 		return EXIT_FAILURE;
 
+	if (!OPT::strMaxFlowGraphFileName.empty())
+		return BenchmarkMaxFlow(MAKE_PATH_SAFE(OPT::strMaxFlowGraphFileName)) ? EXIT_SUCCESS : EXIT_FAILURE;
+
 	Scene scene(OPT::nMaxThreads);
 	// load project
 	const Scene::SCENE_TYPE sceneType(scene.Load(MAKE_PATH_SAFE(OPT::strInputFileName),
@@ -411,6 +460,9 @@ int main(int argc, LPCTSTR* argv)
 		if (OPT::strMeshFileName.empty() && scene.mesh.IsEmpty()) {
 			// reset image resolution to the original size and
 			// make sure the image neighbors are initialized before deleting the point-cloud
+			ImagePointsIndex index;
+			if (scene.pointcloud.IsValid())
+				index.Init(scene.pointcloud, scene.images.size());
 			#ifdef RECMESH_USE_OPENMP
 			bool bAbort(false);
 			#pragma omp parallel for
@@ -439,7 +491,7 @@ int main(int argc, LPCTSTR* argv)
 				// select neighbor views
 				if (imageData.neighbors.empty()) {
 					IndexArr points;
-					scene.SelectNeighborViews(idxImage, points);
+					scene.SelectNeighborViews(idxImage, points, 3, 2, FD2R(12), 1, index.IsEmpty() ? NULL : &index);
 				}
 			}
 			#ifdef RECMESH_USE_OPENMP
@@ -450,7 +502,12 @@ int main(int argc, LPCTSTR* argv)
 			TD_TIMER_START();
 			if (OPT::bUseConstantWeight)
 				scene.pointcloud.pointWeights.Release();
-			if (!scene.ReconstructMesh(OPT::fDistInsert, OPT::bUseFreeSpaceSupport, OPT::bUseOnlyROI, 4, OPT::fThicknessFactor, OPT::fQualityFactor))
+			if (OPT::nMaxTilePoints > 0) {
+				if (!scene.ReconstructMeshTiled(OPT::nMaxTilePoints, OPT::fTileOverlap, OPT::fDistInsert, OPT::bUseFreeSpaceSupport, OPT::bUseOnlyROI, 4,
+						OPT::fThicknessFactor, OPT::fQualityFactor, OPT::nMaxFlowType))
+					return EXIT_FAILURE;
+			} else if (!scene.ReconstructMesh(OPT::fDistInsert, OPT::bUseFreeSpaceSupport, OPT::bUseOnlyROI, 4, OPT::fThicknessFactor, OPT::fQualityFactor,
+				4.f, 3.f, 0.1f, 1000.f, 400.f, (float)(INT_MAX/8), nullptr, OPT::nMaxFlowType, OPT::strExportGraphFileName.empty() ? String() : MAKE_PATH_SAFE(OPT::strExportGraphFileName)))
 				return EXIT_FAILURE;
 			VERBOSE("Mesh reconstruction completed: %u vertices, %u faces (%s)", scene.mesh.vertices.GetSize(), scene.mesh.faces.GetSize(), TD_TIMER_GET_FMT().c_str());
 			#if TD_VERBOSE != TD_VERBOSE_OFF
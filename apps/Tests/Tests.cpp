@@ -31,6 +31,7 @@
 
 #include "../../libs/MVS/Common.h"
 #include "../../libs/MVS/Scene.h"
+#include "../../libs/MVS/MaxFlow.h"
 
 using namespace MVS;
 
@@ -66,6 +67,23 @@ bool UnitTests()
 		VERBOSE("ERROR: TestRayTriangleIntersection<double> failed!");
 		return false;
 	}
+	if (!TestDepthDataEncoding(10000)) {
+		VERBOSE("ERROR: TestDepthDataEncoding failed!");
+		return false;
+	}
+	if (!TestMaxFlow(100)) {
+		VERBOSE("ERROR: TestMaxFlow failed!");
+		return false;
+	}
+	if (!STEREO::TestSemiGlobalAggregation(1000)) {
+		VERBOSE("ERROR: TestSemiGlobalAggregation failed!");
+		return false;
+	}
+	OPTDENSE::init();
+	if (!STEREO::TestSemiGlobalStrips((int)OPTDENSE::nSGMStripOverlap)) {
+		VERBOSE("ERROR: TestSemiGlobalStrips failed!");
+		return false;
+	}
 	VERBOSE("All unit tests passed (%s)", TD_TIMER_GET_FMT().c_str());
 	return true;
 }
@@ -88,6 +106,48 @@ bool PipelineTest(bool verbose=false)
 	}
 	if (verbose)
 		scene.pointcloud.Save(MAKE_PATH("scene_dense.ply"));
+	if (!TestDelaunayPartitions(scene, 4)) {
+		VERBOSE("ERROR: TestDataset failed merging the points triangulated in partitions!");
+		return false;
+	}
+	{
+		// reconstruct the mesh in two tiles, split at the median of the longest axis,
+		// and check the tiles are stitched without any border edge along the seam
+		const PointCloud::PointArr& points = scene.pointcloud.points;
+		const AABB3f aabb(scene.pointcloud.GetAABB());
+		int axis;
+		aabb.GetSize().maxCoeff(&axis);
+		std::vector<float> coords(points.size());
+		FOREACH(i, points)
+			coords[i] = points[i][axis];
+		std::nth_element(coords.begin(), coords.begin()+coords.size()/2, coords.end());
+		const float split(coords[coords.size()/2]);
+		const float band(aabb.GetSize()[axis]*0.01f);
+		if (!scene.ReconstructMeshTiled((unsigned)points.size()/2+1) || scene.mesh.faces.size() < 75000u) {
+			VERBOSE("ERROR: TestDataset failed reconstructing the mesh in tiles!");
+			return false;
+		}
+		Mesh& mesh = scene.mesh;
+		mesh.ListIncidenteFaces();
+		mesh.ListIncidenteFaceFaces();
+		unsigned numSeamBorders(0);
+		FOREACH(f, mesh.faces) {
+			const Mesh::Face& face = mesh.faces[f];
+			for (int v=0; v<3; ++v) {
+				if (mesh.faceFaces[f][v] != NO_ID)
+					continue;
+				if (ABS(mesh.vertices[face[v]][axis]-split) <= band || ABS(mesh.vertices[face[(v+1)%3]][axis]-split) <= band)
+					++numSeamBorders;
+			}
+		}
+		if (numSeamBorders > 0) {
+			VERBOSE("ERROR: TestDataset failed stitching the mesh tiles: %u border edges along the seam!", numSeamBorders);
+			return false;
+		}
+		if (verbose)
+			mesh.Save(MAKE_PATH("scene_dense_mesh_tiled.ply"));
+		mesh.Release();
+	}
 	if (!scene.ReconstructMesh() || scene.mesh.faces.size() < 75000u) {
 		VERBOSE("ERROR: TestDataset failed reconstructing the mesh!");
 		return false;
@@ -73,6 +73,23 @@ namespace SEACAVE { extern int g_nVerbosityLevel; }
 #endif
 
 
+// macros that record the time spans of the traced tasks
+#define TD_TRACE_OFF		0
+#define TD_TRACE_ON			1
+#ifndef TD_TRACE
+#define TD_TRACE			TD_TRACE_ON
+#endif
+
+#if TD_TRACE == TD_TRACE_OFF
+#define TD_TRACE_SCOPE(name)
+#define TD_TRACE_SCOPE_ARG(name, arg)
+#endif
+#if TD_TRACE == TD_TRACE_ON
+#define TD_TRACE_SCOPE(name)			SEACAVE::TraceScope traceScope(name)
+#define TD_TRACE_SCOPE_ARG(name, arg)	SEACAVE::TraceScope traceScope(name, (int)(arg))
+#endif
+
+
 // macros redirecting standard streams to the log
 #define LOG_OUT() GET_LOG() //or std::cout
 #define LOG_ERR() GET_LOG() //or std::cerr
@@ -73,6 +73,7 @@
 #else
 #include <unistd.h>
 #include <dirent.h>
+#include <sys/mman.h>
 #define _taccess access
 #endif
 #ifdef __APPLE__
@@ -681,6 +682,95 @@ private:
 typedef File* LPFILE;
 /*----------------------------------------------------------------*/
 
+
+// map the entire content of a file in memory;
+// the pages are read from disk only when first accessed,
+// and any modification is private to this process (copy-on-write)
+class GENERAL_API MappedFile {
+public:
+	inline MappedFile() : pData(NULL), nSize(0) {}
+	inline MappedFile(LPCTSTR aFileName) : pData(NULL), nSize(0) {
+		MappedFile::open(aFileName);
+	}
+	~MappedFile() {
+		MappedFile::close();
+	}
+
+	bool isOpen() const {
+		return pData != NULL;
+	}
+	inline uint8_t* getData() const { return pData; }
+	inline size_t getSize() const { return nSize; }
+
+#ifdef _MSC_VER
+	bool open(LPCTSTR aFileName) {
+		close();
+		const HANDLE hFile(::CreateFile(aFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+		if (hFile == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fileSize;
+		if (!::GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart == 0) {
+			::CloseHandle(hFile);
+			return false;
+		}
+		const HANDLE hMapping(::CreateFileMapping(hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL));
+		::CloseHandle(hFile);
+		if (hMapping == NULL)
+			return false;
+		pData = (uint8_t*)::MapViewOfFile(hMapping, FILE_MAP_COPY, 0, 0, 0);
+		::CloseHandle(hMapping);
+		if (pData == NULL)
+			return false;
+		nSize = (size_t)fileSize.QuadPart;
+		return true;
+	}
+
+	void close() {
+		if (pData != NULL) {
+			::UnmapViewOfFile(pData);
+			pData = NULL;
+			nSize = 0;
+		}
+	}
+#else // _MSC_VER
+	bool open(LPCTSTR aFileName) {
+		close();
+		const int fd(::open(aFileName, O_RDONLY));
+		if (fd == -1)
+			return false;
+		struct stat buf;
+		if (::fstat(fd, &buf) != 0 || buf.st_size == 0) {
+			::close(fd);
+			return false;
+		}
+		void* const p(::mmap(NULL, (size_t)buf.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0));
+		::close(fd);
+		if (p == MAP_FAILED)
+			return false;
+		pData = (uint8_t*)p;
+		nSize = (size_t)buf.st_size;
+		return true;
+	}
+
+	void close() {
+		if (pData != NULL) {
+			::munmap(pData, nSize);
+			pData = NULL;
+			nSize = 0;
+		}
+	}
+#endif // _MSC_VER
+
+protected:
+	uint8_t* pData;
+	size_t nSize;
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+};
+/*----------------------------------------------------------------*/
+
 } // namespace SEACAVE
 
 #endif // __SEACAVE_FILE_H__
@@ -0,0 +1,130 @@
+////////////////////////////////////////////////////////////////////
+// Trace.cpp
+//
+// Copyright 2007 cDc@seacave
+// Distributed under the Boost Software License, Version 1.0
+// (See http://www.boost.org/LICENSE_1_0.txt)
+
+#include "Common.h"
+#include "Trace.h"
+
+using namespace SEACAVE;
+
+
+// D E F I N E S ///////////////////////////////////////////////////
+
+
+// S T R U C T S ///////////////////////////////////////////////////
+
+// the buffer of the current thread, created the first time it records a span
+static THREADLOCAL Trace::ThreadSpans* g_pThreadSpans = NULL;
+
+Trace& Trace::GetInstance()
+{
+	static Trace instance;
+	return instance;
+}
+
+/**
+ * Constructor
+ */
+Trace::Trace()
+	:
+	m_bEnabled(false),
+	m_timeStart(0)
+{
+}
+
+Trace::~Trace()
+{
+	FOREACHPTR(ppThread, m_threads)
+		delete *ppThread;
+}
+/*----------------------------------------------------------------*/
+
+
+// discard any previous recording and start recording the spans
+void Trace::Start()
+{
+	Lock l(m_cs);
+	FOREACHPTR(ppThread, m_threads)
+		(*ppThread)->spans.Empty();
+	m_timeStart = Timer::GetSysTime();
+	m_bEnabled = true;
+}
+// stop recording the spans, keeping the ones recorded so far
+void Trace::Stop()
+{
+	m_bEnabled = false;
+}
+/*----------------------------------------------------------------*/
+
+
+// store the given span in the buffer of the calling thread
+void Trace::Record(LPCSTR name, Timer::SysType begin, Timer::SysType end, int arg)
+{
+	if (!m_bEnabled)
+		return;
+	Span& span = GetThreadSpans().spans.AddEmpty();
+	span.name = name;
+	span.begin = begin;
+	span.end = end;
+	span.arg = arg;
+}
+
+// return the buffer of the calling thread, registering it the first time
+Trace::ThreadSpans& Trace::GetThreadSpans()
+{
+	if (g_pThreadSpans == NULL) {
+		g_pThreadSpans = new ThreadSpans;
+		g_pThreadSpans->threadID = __THREAD__;
+		g_pThreadSpans->spans.Reserve(1024);
+		Lock l(m_cs);
+		m_threads.Insert(g_pThreadSpans);
+	}
+	return *g_pThreadSpans;
+}
+
+size_t Trace::GetNumSpans() const
+{
+	Lock l(m_cs);
+	size_t numSpans(0);
+	FOREACHPTR(ppThread, m_threads)
+		numSpans += (*ppThread)->spans.GetSize();
+	return numSpans;
+}
+/*----------------------------------------------------------------*/
+
+
+// save the recorded spans as complete events in the Chrome trace JSON format:
+// one track per thread, numbered in the order the threads started recording,
+// with the time in microseconds since the recording started
+bool Trace::Save(const String& fileName) const
+{
+	Util::ensureFolder(fileName);
+	std::ofstream fs(fileName, std::ios::out | std::ios::binary);
+	if (!fs.is_open())
+		return false;
+	const double timeFactor(1000.0*Timer::GetTimeFactor());
+	Lock l(m_cs);
+	fs << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool bFirst(true);
+	FOREACH(t, m_threads) {
+		const ThreadSpans& thread = *m_threads[t];
+		fs << (bFirst ? "\n" : ",\n");
+		bFirst = false;
+		fs << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << t
+			<< ",\"args\":{\"name\":\"thread " << t << " (" << thread.threadID << ")\"}}";
+		for (const Span& span: thread.spans) {
+			fs << ",\n{\"name\":\"" << span.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << t
+				<< ",\"ts\":" << String::FormatString("%.3f", timeFactor*(span.begin-m_timeStart))
+				<< ",\"dur\":" << String::FormatString("%.3f", timeFactor*(span.end-span.begin));
+			if (span.arg >= 0)
+				fs << ",\"args\":{\"id\":" << span.arg << "}";
+			fs << "}";
+		}
+	}
+	fs << "\n]}\n";
+	return !fs.fail();
+}
+/*----------------------------------------------------------------*/
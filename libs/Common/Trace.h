@@ -0,0 +1,87 @@
+////////////////////////////////////////////////////////////////////
+// Trace.h
+//
+// Copyright 2007 cDc@seacave
+// Distributed under the Boost Software License, Version 1.0
+// (See http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __SEACAVE_TRACE_H__
+#define __SEACAVE_TRACE_H__
+
+
+// I N C L U D E S /////////////////////////////////////////////////
+
+
+// D E F I N E S ///////////////////////////////////////////////////
+
+
+namespace SEACAVE {
+
+// S T R U C T S ///////////////////////////////////////////////////
+
+// records the time spans of the traced tasks, for each thread,
+// and saves them as a timeline in the Chrome trace event format
+// (to be inspected with chrome://tracing or https://ui.perfetto.dev);
+// recording is off by default, costing only a flag test per span;
+// each thread records in its own buffer, without locking, so Start() and Save()
+// must be called while no traced task is running
+class GENERAL_API Trace
+{
+	DEFINE_SINGLETON(Trace);
+
+public:
+	struct Span {
+		LPCSTR name; // task name (must be a static string)
+		Timer::SysType begin; // start time of the task
+		Timer::SysType end; // end time of the task
+		int arg; // optional task argument (ex. image ID), negative if none
+	};
+	typedef CLISTDEF0(Span) SpanArr;
+
+	struct ThreadSpans {
+		unsigned threadID; // system ID of the thread
+		SpanArr spans; // recorded spans, in the order they ended
+	};
+	typedef CLISTDEFIDX(ThreadSpans*,uint32_t) ThreadSpansArr;
+
+public:
+	~Trace();
+
+	inline bool IsEnabled() const { return m_bEnabled; }
+	void Start();
+	void Stop();
+
+	void Record(LPCSTR name, Timer::SysType begin, Timer::SysType end, int arg=-1);
+	size_t GetNumSpans() const;
+
+	bool Save(const String& fileName) const;
+
+protected:
+	ThreadSpans& GetThreadSpans();
+
+protected:
+	volatile bool m_bEnabled; // record spans
+	Timer::SysType m_timeStart; // time the recording started, origin of the timeline
+	ThreadSpansArr m_threads; // the buffers of all threads that recorded spans
+	mutable CriticalSection m_cs; // protects the list of thread buffers
+};
+#define GET_TRACE()			SEACAVE::Trace::GetInstance()
+/*----------------------------------------------------------------*/
+
+
+// records the time span between its construction and destruction
+class TraceScope
+{
+public:
+	inline TraceScope(LPCSTR _name, int _arg=-1) : name(_name), arg(_arg), begin(GET_TRACE().IsEnabled() ? Timer::GetSysTime() : 0) {}
+	inline ~TraceScope() { if (begin != 0) GET_TRACE().Record(name, begin, Timer::GetSysTime(), arg); }
+protected:
+	LPCSTR name;
+	int arg;
+	Timer::SysType begin;
+};
+/*----------------------------------------------------------------*/
+
+} // namespace SEACAVE
+
+#endif // __SEACAVE_TRACE_H__
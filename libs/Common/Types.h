@@ -403,6 +403,7 @@ typedef TAliasCast<double,int32_t> CastD2I;
 namespace SEACAVE {
 
 typedef class GENERAL_API CSharedPtr<File>				FilePtr;
+typedef class GENERAL_API CSharedPtr<MappedFile>		MappedFilePtr;
 
 typedef class GENERAL_API CSharedPtr<ISTREAM>			ISTREAMPTR;
 typedef ISTREAM*										LPISTREAM;
@@ -430,6 +431,7 @@ typedef class GENERAL_API cList<double, double, 0>      DoubleArr;
 } // namespace SEACAVE
 
 #include "Log.h"
+#include "Trace.h"
 #include "EventQueue.h"
 #include "SML.h"
 #include "ConfigTable.h"
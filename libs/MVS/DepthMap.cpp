@@ -41,12 +41,37 @@
 #include <CGAL/Simple_cartesian.h>
 #include <CGAL/property_map.h>
 #include <CGAL/pca_estimate_normals.h>
+// SIMD: batched patch scoring
+#if DENSE_SCORE == DENSE_SCORE_BATCH && defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 using namespace MVS;
 
 
 // D E F I N E S ///////////////////////////////////////////////////
 
+// SIMD instruction set used by the batched patch scoring engine:
+// the AVX2 path is compiled only if the compiler targets AVX2
+// (configure with -DENABLE_AVX2=ON, which adds -mavx2 or /arch:AVX2),
+// else the SSE path is used
+#if DENSE_SCORE == DENSE_SCORE_BATCH
+#if defined(__AVX2__)
+#define DENSE_SCORE_USE_AVX2
+#elif defined(_USE_SSE)
+#define DENSE_SCORE_USE_SSE
+#endif
+#endif
+
+// 64-bit file offsets, as the depth-data layers can be stored beyond 2GB
+#ifdef _WIN32
+#define DMAP_FSEEK _fseeki64
+#define DMAP_FTELL _ftelli64
+#else
+#define DMAP_FSEEK fseeko
+#define DMAP_FTELL ftello
+#endif
+
 #define DEFVAR_OPTDENSE_string(name, title, desc, ...)  DEFVAR_string(OPTDENSE, name, title, desc, __VA_ARGS__)
 #define DEFVAR_OPTDENSE_bool(name, title, desc, ...)    DEFVAR_bool(OPTDENSE, name, title, desc, __VA_ARGS__)
 #define DEFVAR_OPTDENSE_int32(name, title, desc, ...)   DEFVAR_int32(OPTDENSE, name, title, desc, __VA_ARGS__)
@@ -103,7 +128,21 @@ MDEFVAR_OPTDENSE_uint32(nEstimateNormals, "Estimate Normals", "should we estimat
 MDEFVAR_OPTDENSE_float(fNCCThresholdKeep, "NCC Threshold Keep", "Maximum 1-NCC score accepted for a match", "0.9", "0.5")
 DEFVAR_OPTDENSE_uint32(nEstimationIters, "Estimation Iters", "Number of patch-match iterations", "3")
 DEFVAR_OPTDENSE_uint32(nEstimationGeometricIters, "Estimation Geometric Iters", "Number of geometric consistent patch-match iterations (0 - disabled)", "2")
+MDEFVAR_OPTDENSE_uint32(nEstimationConcurrency, "Estimation Concurrency", "maximum number of depth-maps estimated in parallel, sharing the available threads (0 - auto)", "0", "1")
+MDEFVAR_OPTDENSE_uint32(nEstimationPropagation, "Estimation Propagation", "propagation scheme used during patch-match estimation (0 - zigzag sweeps, 1 - red-black checkerboard tiles)", "0", "1")
+MDEFVAR_OPTDENSE_uint32(nEstimationSeed, "Estimation Seed", "random generator seed used by the checkerboard propagation", "0")
+MDEFVAR_OPTDENSE_uint32(nEstimationSkipSettled, "Estimation Skip Settled", "number of iterations a pixel estimate and its neighbors must stay unchanged before the pixel is skipped by the next patch-match iterations (0 - disabled)", "2")
+MDEFVAR_OPTDENSE_uint32(nDepthMapEncoding, "Depth Map Encoding", "compact encoding of the saved depth-maps (0 - full precision, 16 - half-float depth, 32 - octahedral 16-bit normals, 64 - half-float confidence, 128 - 8-bit confidence)", "0")
+MDEFVAR_OPTDENSE_uint32(nCacheSize, "Cache Size", "memory budget (MB) used to keep released depth-maps loaded during filtering and fusion (0 - disabled)", "0")
+MDEFVAR_OPTDENSE_uint32(nImageCacheSize, "Image Cache Size", "memory budget (MB) used to share the scaled gray-scale images between the depth-maps estimated (0 - disabled)", "512")
+MDEFVAR_OPTDENSE_uint32(nFusionPartitions, "Fusion Partitions", "number of partitions along the largest scene dimension used to fuse the depth-maps out-of-core, streaming the points to disk (0 - disabled)", "0")
+MDEFVAR_OPTDENSE_uint32(nSGMPaths, "SGM Paths", "number of paths the semi-global matching costs are aggregated along (4 - horizontal and vertical, 8 - also diagonal)", "8", "4")
+MDEFVAR_OPTDENSE_uint32(nSGMMaxMemory, "SGM Max Memory", "memory budget (MB) of the semi-global matching cost volumes, split between the concurrent jobs; if exceeded, the costs are computed and aggregated in overlapping horizontal strips (0 - unlimited)", "0")
+MDEFVAR_OPTDENSE_uint32(nSGMStripOverlap, "SGM Strip Overlap", "number of rows each semi-global matching strip is extended with on both sides, letting the aggregation paths entering the strip converge", "32")
 MDEFVAR_OPTDENSE_float(fEstimationGeometricWeight, "Estimation Geometric Weight", "pairwise geometric consistency cost weight", "0.1")
+MDEFVAR_OPTDENSE_float(fEstimationGeometricScale, "Estimation Geometric Scale", "scale of the neighbor depth-maps used by the geometric-consistent estimation (1 - full resolution)", "1", "0.5")
+MDEFVAR_OPTDENSE_uint32(nEstimationGeometricCacheSize, "Estimation Geometric Cache Size", "memory budget (MB) used to keep the neighbor depth-maps of the geometric-consistent estimation loaded once not used anymore (0 - release them immediately)", "256")
+MDEFVAR_OPTDENSE_float(fEstimationDepthRange, "Estimation Depth Range", "depth margin (ratio) around the coarser resolution estimates limiting the random depth search at the finer resolution (0 - disabled)", "0.05")
 MDEFVAR_OPTDENSE_uint32(nRandomIters, "Random Iters", "Number of iterations for random assignment per pixel", "6")
 MDEFVAR_OPTDENSE_uint32(nRandomMaxScale, "Random Max Scale", "Maximum number of iterations to skip during random assignment", "2")
 MDEFVAR_OPTDENSE_float(fRandomDepthRatio, "Random Depth Ratio", "Depth range ratio of the current estimate for random plane assignment", "0.003", "0.004")
@@ -127,8 +166,12 @@ DepthData::DepthData(const DepthData& srcDepthData) :
 	depthMap(srcDepthData.depthMap),
 	normalMap(srcDepthData.normalMap),
 	confMap(srcDepthData.confMap),
+	normalMapOct(srcDepthData.normalMapOct),
+	confMapHalf(srcDepthData.confMapHalf),
 	dMin(srcDepthData.dMin),
 	dMax(srcDepthData.dMax),
+	fingerprint(srcDepthData.fingerprint),
+	mapping(srcDepthData.mapping),
 	references(srcDepthData.references)
 {}
 
@@ -139,9 +182,9 @@ void DepthData::GetNormal(const ImageRef& ir, Point3f& N, const TImage<Point3f>*
 	ASSERT(!IsEmpty());
 	ASSERT(depthMap(ir) > 0);
 	const Camera& camera = images.First().camera;
-	if (!normalMap.empty()) {
+	if (HasNormalMap()) {
 		// set available normal
-		N = camera.R.t()*Cast<REAL>(normalMap(ir));
+		N = camera.R.t()*Cast<REAL>(GetNormalMap(ir));
 		return;
 	}
 	// estimate normal based on the neighbor depths
@@ -231,16 +274,74 @@ void DepthData::ApplyIgnoreMask(const BitMatrix& mask)
 /*----------------------------------------------------------------*/
 
 
-bool DepthData::Save(const String& fileName) const
+// copy the maps referencing the memory-mapped file into memory owned by them,
+// and release the file (needed before the file is overwritten)
+void DepthData::ReleaseMapping()
 {
-	ASSERT(IsValid() && !depthMap.empty() && !confMap.empty());
+	if (mapping == NULL)
+		return;
+	if (!depthMap.empty())
+		depthMap = depthMap.clone();
+	if (!normalMap.empty())
+		normalMap = normalMap.clone();
+	if (!confMap.empty())
+		confMap = confMap.clone();
+	if (!viewsMap.empty())
+		viewsMap = viewsMap.clone();
+	if (!normalMapOct.empty())
+		normalMapOct = normalMapOct.clone();
+	if (!confMapHalf.empty())
+		confMapHalf = confMapHalf.clone();
+	mapping.Release();
+}
+
+// convert to half-float, flushing to zero the values too small and clamping the ones too large
+static inline hfloat Float2Half(float v) {
+	return ABS(v) < hfloat::min() ? hfloat(0.f) : hfloat(CLAMP(v, -hfloat::max(), hfloat::max()));
+}
+static void DecodeNormalMap(const NormalOctMap& normalMapOct, NormalMap& normalMap) {
+	normalMap.create(normalMapOct.size());
+	for (int i=0, n=normalMap.area(); i<n; ++i)
+		normalMap.getData()[i] = DepthData::DecodeNormal(normalMapOct.getData()[i]);
+}
+static void DecodeConfMap(const ConfidenceHalfMap& confMapHalf, ConfidenceMap& confMap) {
+	confMap.create(confMapHalf.size());
+	for (int i=0, n=confMap.area(); i<n; ++i)
+		confMap.getData()[i] = confMapHalf.getData()[i];
+}
+
+// decode the compact normal and confidence maps, if any, into the full ones
+void DepthData::ExpandCompactMaps()
+{
+	if (!normalMapOct.empty()) {
+		DecodeNormalMap(normalMapOct, normalMap);
+		normalMapOct.release();
+	}
+	if (!confMapHalf.empty()) {
+		DecodeConfMap(confMapHalf, confMap);
+		confMapHalf.release();
+	}
+}
+
+// save the depth-data, optionally with the given compact encoding of the maps
+// (lossy, so should be used only for the final depth-maps)
+bool DepthData::Save(const String& fileName, unsigned encoding) const
+{
+	ASSERT(IsValid() && !depthMap.empty() && HasConfMap());
 	const String fileNameTmp(fileName+".tmp"); {
 		// serialize out the current state
 		IIndexArr IDs(0, images.size());
 		for (const ViewData& image: images)
 			IDs.push_back(image.GetID());
 		const ViewData& image0 = GetView();
-		if (!ExportDepthDataRaw(fileNameTmp, image0.pImageData->name, IDs, depthMap.size(), image0.camera.K, image0.camera.R, image0.camera.C, dMin, dMax, depthMap, normalMap, confMap, viewsMap))
+		// the export expects the full maps
+		NormalMap normals(normalMap);
+		if (!normalMapOct.empty())
+			DecodeNormalMap(normalMapOct, normals);
+		ConfidenceMap confs(confMap);
+		if (!confMapHalf.empty())
+			DecodeConfMap(confMapHalf, confs);
+		if (!ExportDepthDataRaw(fileNameTmp, image0.pImageData->name, IDs, depthMap.size(), image0.camera.K, image0.camera.R, image0.camera.C, dMin, dMax, depthMap, normals, confs, viewsMap, encoding, fingerprint))
 			return false;
 	}
 	if (!File::renameFile(fileNameTmp, fileName)) {
@@ -257,7 +358,13 @@ bool DepthData::Load(const String& fileName, unsigned flags)
 	IIndexArr IDs;
 	cv::Size imageSize;
 	Camera camera;
-	if (!ImportDepthDataRaw(fileName, imageFileName, IDs, imageSize, camera.K, camera.R, camera.C, dMin, dMax, depthMap, normalMap, confMap, viewsMap, flags))
+	if ((flags & LOAD_MAPPED) != 0)
+		ReleaseMapping();
+	if (!ImportDepthDataRaw(fileName, imageFileName, IDs, imageSize, camera.K, camera.R, camera.C, dMin, dMax, depthMap, normalMap, confMap, viewsMap, flags,
+			(flags & LOAD_MAPPED) != 0 ? &mapping : NULL,
+			(flags & LOAD_COMPACT) != 0 ? &normalMapOct : NULL,
+			(flags & LOAD_COMPACT) != 0 ? &confMapHalf : NULL,
+			&fingerprint))
 		return false;
 	ASSERT(!IsValid() || (IDs.size() == images.size() && IDs.front() == GetView().GetID()));
 	ASSERT(depthMap.size() == imageSize);
@@ -271,11 +378,11 @@ unsigned DepthData::GetRef()
 	Lock l(cs);
 	return references;
 }
-unsigned DepthData::IncRef(const String& fileName)
+unsigned DepthData::IncRef(const String& fileName, unsigned flags)
 {
 	Lock l(cs);
 	ASSERT(!IsEmpty() || references==0);
-	if (IsEmpty() && !Load(fileName))
+	if (IsEmpty() && !Load(fileName, flags))
 		return 0;
 	return ++references;
 }
@@ -290,6 +397,401 @@ unsigned DepthData::DecRef()
 /*----------------------------------------------------------------*/
 
 
+DepthDataCache::DepthDataCache()
+	:
+	nBudget(0), nBytes(0),
+	nHits(0), nMisses(0), nEvictions(0), nPrefetches(0),
+	bStopPrefetch(false)
+{
+}
+DepthDataCache::~DepthDataCache()
+{
+	if (prefetchThread.isRunning()) {
+		{
+			Lock l(cs);
+			bStopPrefetch = true;
+		}
+		prefetchSem.Signal();
+		prefetchThread.join();
+	}
+	Clear();
+}
+
+// set the maximum memory size of the kept depth-maps;
+// 0 disables caching: depth-maps are unloaded as soon as they are not referenced anymore
+void DepthDataCache::SetBudget(size_t _nBudget)
+{
+	Lock l(cs);
+	nBudget = _nBudget;
+	Evict();
+}
+
+// load the depth-map if not already loaded and add a reference to it;
+// returns false if the depth-map could not be loaded
+bool DepthDataCache::Acquire(DepthData& depthData, const String& fileName, unsigned flags)
+{
+	{
+		Lock l(cs);
+		const EntryMap::iterator it(mapEntries.find(&depthData));
+		if (it != mapEntries.end()) {
+			// take over the reference owned by the cache
+			nBytes -= it->second->nBytes;
+			entries.erase(it->second);
+			mapEntries.erase(it);
+			++nHits;
+			return true;
+		}
+	}
+	const unsigned references(depthData.IncRef(fileName, flags));
+	if (references == 0)
+		return false;
+	Lock l(cs);
+	if (references == 1)
+		++nMisses;
+	else
+		++nHits;
+	return true;
+}
+
+// remove a reference to the depth-map;
+// if caching is enabled, the depth-map is kept loaded till evicted
+void DepthDataCache::Release(DepthData& depthData)
+{
+	Lock l(cs);
+	if (!IsEnabled()) {
+		depthData.DecRef();
+		return;
+	}
+	const EntryMap::iterator it(mapEntries.find(&depthData));
+	if (it != mapEntries.end()) {
+		// already owned by the cache, only mark it as recently used
+		entries.splice(entries.begin(), entries, it->second);
+		depthData.DecRef();
+		return;
+	}
+	entries.push_front(Entry{&depthData, depthData.GetMemorySize()});
+	mapEntries.emplace(&depthData, entries.begin());
+	nBytes += entries.front().nBytes;
+	Evict();
+}
+
+// request the depth-map to be loaded in advance on a background thread;
+// ignored if caching is disabled, the depth-map is already cached or the budget is full
+void DepthDataCache::Prefetch(DepthData& depthData, const String& fileName, unsigned flags)
+{
+	Lock l(cs);
+	if (!IsEnabled() || nBytes >= nBudget || mapEntries.find(&depthData) != mapEntries.end())
+		return;
+	if (!prefetchThread.isRunning()) {
+		bStopPrefetch = false;
+		prefetchThread.start(PrefetchThread, this);
+	}
+	prefetchQueue.AddTail(PrefetchRequest{&depthData, fileName, flags});
+	prefetchSem.Signal();
+}
+
+// drop all pending prefetch requests and release all cached depth-maps
+void DepthDataCache::Clear()
+{
+	Lock lp(csPrefetch);
+	Lock l(cs);
+	prefetchQueue.Empty();
+	for (const Entry& entry: entries)
+		entry.pDepthData->DecRef();
+	entries.clear();
+	mapEntries.clear();
+	nBytes = 0;
+}
+
+void DepthDataCache::LogStats() const
+{
+	Lock l(cs);
+	if (!IsEnabled())
+		return;
+	const size_t nRequests(nHits+nMisses);
+	DEBUG_EXTRA("Depth-maps cache: %u hits, %u misses (%.2f%% hit-rate), %u evictions, %u prefetched (%s budget)",
+		(unsigned)nHits, (unsigned)nMisses, nRequests ? 100.f*nHits/nRequests : 0.f, (unsigned)nEvictions, (unsigned)nPrefetches, Util::formatBytes(nBudget).c_str());
+}
+
+// release the least recently used depth-maps till the cache fits the budget
+// (the caller must hold the lock)
+void DepthDataCache::Evict()
+{
+	while (nBytes > nBudget && !entries.empty()) {
+		const Entry& entry = entries.back();
+		nBytes -= entry.nBytes;
+		mapEntries.erase(entry.pDepthData);
+		entry.pDepthData->DecRef();
+		entries.pop_back();
+		++nEvictions;
+	}
+}
+
+void DepthDataCache::ProcessPrefetch()
+{
+	while (true) {
+		prefetchSem.Wait();
+		Lock lp(csPrefetch);
+		PrefetchRequest request;
+		{
+			Lock l(cs);
+			if (bStopPrefetch)
+				break;
+			if (prefetchQueue.IsEmpty())
+				continue;
+			request = prefetchQueue.RemoveHead();
+			if (nBytes >= nBudget || mapEntries.find(request.pDepthData) != mapEntries.end())
+				continue;
+		}
+		const unsigned references(request.pDepthData->IncRef(request.fileName, request.flags));
+		if (references == 0)
+			continue;
+		{
+			Lock l(cs);
+			if (references == 1)
+				++nPrefetches;
+		}
+		Release(*request.pDepthData);
+	}
+}
+void* DepthDataCache::PrefetchThread(void* arg)
+{
+	((DepthDataCache*)arg)->ProcessPrefetch();
+	return NULL;
+}
+/*----------------------------------------------------------------*/
+
+
+ImagePyramidCache::ImagePyramidCache()
+	:
+	nBudget(0), nBytes(0),
+	nHits(0), nMisses(0), nEvictions(0)
+{
+}
+
+// set the maximum memory size of the kept images;
+// 0 disables caching: the images are computed each time they are requested
+void ImagePyramidCache::SetBudget(size_t _nBudget)
+{
+	Lock l(cs);
+	nBudget = _nBudget;
+	Evict();
+}
+
+// return the gray-scale image scaled as requested by a neighbor view (scale)
+// and further scaled down for a multi-resolution level (levelScale);
+// the images are computed the same way as by DepthData::ViewData::ScaleImage() and
+// DepthMapsData::ScaleDepthData(), each level being scaled from the one of the view
+Image32F ImagePyramidCache::GetImage(const Image& imageData, float scale, float levelScale)
+{
+	ASSERT(!imageData.image.empty() && levelScale <= 1);
+	if (!DepthData::ViewData::NeedScaleImage(scale))
+		scale = 1.f;
+	const uint64_t key(MakeKey(imageData.ID, scale, levelScale));
+	if (IsEnabled()) {
+		Lock l(cs);
+		const EntryMap::iterator it(mapEntries.find(key));
+		if (it != mapEntries.end()) {
+			entries.splice(entries.begin(), entries, it->second);
+			++nHits;
+			return it->second->image;
+		}
+	}
+	// compute the image
+	Image32F image;
+	if (levelScale == 1.f) {
+		imageData.image.toGray(image, cv::COLOR_BGR2GRAY, true);
+		DepthData::ViewData::ScaleImage(image, image, scale);
+	} else {
+		cv::resize(GetImage(imageData, scale), image, cv::Size(), levelScale, levelScale, cv::INTER_AREA);
+	}
+	if (!IsEnabled())
+		return image;
+	// and cache it, unless computed meanwhile by another thread
+	Lock l(cs);
+	++nMisses;
+	const EntryMap::iterator it(mapEntries.find(key));
+	if (it != mapEntries.end())
+		return it->second->image;
+	entries.push_front(Entry{key, image, image.total()*image.elemSize()});
+	mapEntries.emplace(key, entries.begin());
+	nBytes += entries.front().nBytes;
+	Evict();
+	return image;
+}
+
+// release all cached images
+void ImagePyramidCache::Clear()
+{
+	Lock l(cs);
+	entries.clear();
+	mapEntries.clear();
+	nBytes = 0;
+}
+
+void ImagePyramidCache::LogStats() const
+{
+	Lock l(cs);
+	if (!IsEnabled())
+		return;
+	const size_t nRequests(nHits+nMisses);
+	DEBUG_EXTRA("Images cache: %u hits, %u misses (%.2f%% hit-rate), %u evictions (%s budget)",
+		(unsigned)nHits, (unsigned)nMisses, nRequests ? 100.f*nHits/nRequests : 0.f, (unsigned)nEvictions, Util::formatBytes(nBudget).c_str());
+}
+
+// the scales are quantized to 1/1024 (the neighbor view scales are clamped by the view selection)
+uint64_t ImagePyramidCache::MakeKey(IIndex ID, float scale, float levelScale)
+{
+	return ((uint64_t)ID << 32) |
+		((uint64_t)(ROUND2INT(scale*1024.f) & 0xFFFF) << 16) |
+		(uint64_t)(ROUND2INT(levelScale*1024.f) & 0xFFFF);
+}
+
+// release the least recently used images till the cache fits the budget;
+// the images still used by some depth-map are freed once released by it too
+// (the caller must hold the lock)
+void ImagePyramidCache::Evict()
+{
+	while (nBytes > nBudget && !entries.empty()) {
+		const Entry& entry = entries.back();
+		nBytes -= entry.nBytes;
+		mapEntries.erase(entry.key);
+		entries.pop_back();
+		++nEvictions;
+	}
+}
+/*----------------------------------------------------------------*/
+
+
+DepthMapStore::DepthMapStore()
+	:
+	scale(1.f), nBudget(0), nBytes(0), nMaxBytes(0), nBytesUnused(0),
+	nLoads(0), nShares(0), nEvictions(0)
+{
+}
+
+// set the scale the depth-maps are loaded at (<1 - downscale them)
+// and the maximum memory size of the depth-maps kept loaded once not used anymore
+void DepthMapStore::Init(float _scale, size_t _nBudget)
+{
+	ASSERT(_scale > 0 && _scale <= 1);
+	Lock l(cs);
+	ASSERT(entries.empty());
+	scale = _scale;
+	nBudget = _nBudget;
+}
+
+// return the depth-map of the given image and its camera, sharing the stored data;
+// the depth-map is loaded only if not already in use or kept by the store,
+// and must be released when not used anymore
+bool DepthMapStore::Acquire(IIndex ID, const String& fileName, DepthMap& depthMap, Camera& camera)
+{
+	const auto use = [&](Entry& entry) {
+		if (entry.nRefs++ == 0 && entry.itUnused != unused.end()) {
+			unused.erase(entry.itUnused);
+			nBytesUnused -= entry.nBytes;
+		}
+		depthMap = entry.depthMap;
+		camera = entry.camera;
+	};
+	{
+		Lock l(cs);
+		const EntryMap::iterator it(entries.find(ID));
+		if (it != entries.end()) {
+			++nShares;
+			use(it->second);
+			return true;
+		}
+	}
+	// load the depth-map
+	Entry entry;
+	{
+		String imageFileName;
+		IIndexArr IDs;
+		cv::Size imageSize;
+		Depth dMin, dMax;
+		NormalMap normalMap;
+		ConfidenceMap confMap;
+		ViewsMap viewsMap;
+		if (!ImportDepthDataRaw(fileName, imageFileName, IDs, imageSize, entry.camera.K, entry.camera.R, entry.camera.C,
+				dMin, dMax, entry.depthMap, normalMap, confMap, viewsMap, 1))
+			return false;
+	}
+	if (scale < 1.f) {
+		// keep the nearest depth in order not to mix the depths across discontinuities
+		const cv::Size size(entry.depthMap.size());
+		cv::resize(entry.depthMap, entry.depthMap, cv::Size(), scale, scale, cv::INTER_NEAREST);
+		entry.camera.K = entry.camera.GetScaledK(size, entry.depthMap.size());
+	}
+	entry.nBytes = entry.depthMap.total()*entry.depthMap.elemSize();
+	entry.nRefs = 0;
+	// and store it, unless loaded meanwhile by another thread
+	Lock l(cs);
+	const std::pair<EntryMap::iterator,bool> ret(entries.emplace(ID, std::move(entry)));
+	if (ret.second) {
+		ret.first->second.itUnused = unused.end();
+		++nLoads;
+		nBytes += ret.first->second.nBytes;
+		if (nMaxBytes < nBytes)
+			nMaxBytes = nBytes;
+	} else {
+		++nShares;
+	}
+	use(ret.first->second);
+	return true;
+}
+
+// release the depth-map of the given image, previously acquired
+void DepthMapStore::Release(IIndex ID)
+{
+	Lock l(cs);
+	const EntryMap::iterator it(entries.find(ID));
+	ASSERT(it != entries.end() && it->second.nRefs > 0);
+	if (it == entries.end() || --it->second.nRefs > 0)
+		return;
+	unused.push_front(ID);
+	it->second.itUnused = unused.begin();
+	nBytesUnused += it->second.nBytes;
+	Evict();
+}
+
+// release all the stored depth-maps (to be called once the depth-maps change)
+void DepthMapStore::Clear()
+{
+	Lock l(cs);
+	entries.clear();
+	unused.clear();
+	nBytes = nBytesUnused = 0;
+}
+
+void DepthMapStore::LogStats() const
+{
+	Lock l(cs);
+	const size_t nRequests(nLoads+nShares);
+	if (nRequests == 0)
+		return;
+	DEBUG_EXTRA("Neighbor depth-maps: %u loaded, %u shared (%.2f%% share-rate), %u evictions, %s peak memory (%.2f scale)",
+		(unsigned)nLoads, (unsigned)nShares, 100.f*nShares/nRequests, (unsigned)nEvictions, Util::formatBytes(nMaxBytes).c_str(), scale);
+}
+
+// release the least recently released unused depth-maps till they fit the budget;
+// the depth-maps still used are not counted in the budget
+// (the caller must hold the lock)
+void DepthMapStore::Evict()
+{
+	while (nBytesUnused > nBudget) {
+		ASSERT(!unused.empty());
+		const EntryMap::iterator it(entries.find(unused.back()));
+		nBytesUnused -= it->second.nBytes;
+		nBytes -= it->second.nBytes;
+		entries.erase(it);
+		unused.pop_back();
+		++nEvictions;
+	}
+}
+/*----------------------------------------------------------------*/
+
+
 
 // S T R U C T S ///////////////////////////////////////////////////
 
@@ -355,6 +857,81 @@ void DepthEstimator::MapMatrix2ZigzagIdx(const Image8U::Size& size, DepthEstimat
 	}
 }
 
+// compute the depth search interval of each pixel from the estimates of the given (coarser resolution) depth-map:
+// the interval spans the good estimates in the 3x3 neighborhood of the pixel, extended by a margin
+// growing with the matching score; the pixels without a good estimate keep the whole [dMin,dMax] interval
+void DepthEstimator::ComputeDepthRangeMap(const DepthData& depthData, DepthRangeMap& depthRangeMap)
+{
+	const DepthMap& depthMap = depthData.depthMap;
+	const ConfidenceMap& confMap = depthData.confMap;
+	ASSERT(depthMap.size() == confMap.size());
+	const float thConf(OPTDENSE::fNCCThresholdKeep);
+	depthRangeMap.create(depthMap.size());
+	for (int r=0; r<depthMap.rows; ++r) {
+		for (int c=0; c<depthMap.cols; ++c) {
+			TPoint2<Depth>& range = depthRangeMap(r,c);
+			range.x = depthData.dMin;
+			range.y = depthData.dMax;
+			const Depth depth(depthMap(r,c));
+			const float conf(confMap(r,c));
+			if (depth <= 0 || conf >= thConf)
+				continue;
+			Depth dMin(depth), dMax(depth);
+			for (int i=MAXF(r-1,0); i<=MINF(r+1,depthMap.rows-1); ++i) {
+				for (int j=MAXF(c-1,0); j<=MINF(c+1,depthMap.cols-1); ++j) {
+					const Depth ndepth(depthMap(i,j));
+					if (ndepth <= 0 || confMap(i,j) >= thConf)
+						continue;
+					if (dMin > ndepth)
+						dMin = ndepth;
+					else if (dMax < ndepth)
+						dMax = ndepth;
+				}
+			}
+			const float margin(OPTDENSE::fEstimationDepthRange*(1.f+conf/thConf));
+			dMin = MAXF(dMin*(1.f-margin), depthData.dMin);
+			dMax = MINF(dMax*(1.f+margin), depthData.dMax);
+			if (dMin < dMax) {
+				range.x = dMin;
+				range.y = dMax;
+			}
+		}
+	}
+}
+
+// split the image in tiles of the given size and store the pixel coordinates of each tile contiguously,
+// first the "red" pixels (x+y even) of all tiles followed by the "black" pixels (x+y odd);
+// tiles[i] stores the index of the first pixel of tile i in coords, such that the red half-sweep
+// processes tiles [0,numTiles) and the black half-sweep tiles [numTiles,2*numTiles)
+void DepthEstimator::MapMatrix2CheckerboardIdx(const Image8U::Size& size, DepthEstimator::MapRefArr& coords, DepthEstimator::TileArr& tiles, const BitMatrix& mask, int tileSize)
+{
+	typedef DepthEstimator::MapRef MapRef;
+	ASSERT(tileSize > 0);
+	const int numTiles(((size.width+tileSize-1)/tileSize)*((size.height+tileSize-1)/tileSize));
+	coords.Empty();
+	coords.Reserve(size.area());
+	tiles.Empty();
+	tiles.Reserve(numTiles*2+1);
+	for (int color=0; color<2; ++color) {
+		for (int ty=0; ty<size.height; ty+=tileSize) {
+			const int ey(MIN(ty+tileSize, size.height));
+			for (int tx=0; tx<size.width; tx+=tileSize) {
+				const int ex(MIN(tx+tileSize, size.width));
+				tiles.Insert(coords.GetSize());
+				for (int y=ty; y<ey; ++y) {
+					for (int x=tx+((tx+y+color)&1); x<ex; x+=2) {
+						const MapRef pt(x, y);
+						if (mask.empty() || mask.isSet(pt))
+							coords.Insert(pt);
+					}
+				}
+			}
+		}
+	}
+	tiles.Insert(coords.GetSize());
+	ASSERT(tiles.GetSize() == (IDX)numTiles*2+1);
+}
+
 // replace POWI(0.5f, idxScaleRange):           0    1      2       3       4         5         6           7           8             9             10              11
 const float DepthEstimator::scaleRanges[12] = {1.f, 0.5f, 0.25f, 0.125f, 0.0625f, 0.03125f, 0.015625f, 0.0078125f, 0.00390625f, 0.001953125f, 0.0009765625f, 0.00048828125f};
 
@@ -385,9 +962,10 @@ DepthEstimator::DepthEstimator(
 	#if DENSE_NCC != DENSE_NCC_WEIGHTED
 	image0Sum(_image0Sum),
 	#endif
-	coords(_coords), size(_depthData0.images.First().image.size()),
+	coords(_coords), tiles(NULL), idxTileEnd(0), thConfKeep(OPTDENSE::fNCCThresholdKeep), settledMap(NULL), depthRangeMap(NULL), nSkipped(0), size(_depthData0.images.First().image.size()),
 	dMin(_depthData0.dMin), dMax(_depthData0.dMax),
 	dMinSqr(SQRT(_depthData0.dMin)), dMaxSqr(SQRT(_depthData0.dMax)),
+	dMinPixel(_depthData0.dMin), dMaxPixel(_depthData0.dMax),
 	dir(nIter%2 ? RB2LT : LT2RB),
 	#if DENSE_AGGNCC == DENSE_AGGNCC_NTH
 	idxScore((_depthData0.images.size()-1)/3),
@@ -415,6 +993,12 @@ DepthEstimator::DepthEstimator(
 bool DepthEstimator::PreparePixelPatch(const ImageRef& x)
 {
 	x0 = x;
+	if (depthRangeMap) {
+		// the range map has the size of the coarser resolution level
+		const TPoint2<Depth>& range = (*depthRangeMap)(x.y*depthRangeMap->rows/size.height, x.x*depthRangeMap->cols/size.width);
+		dMinPixel = range.x;
+		dMaxPixel = range.y;
+	}
 	return image0.image.isInside(ImageRef(x.x-nSizeHalfWindow, x.y-nSizeHalfWindow)) &&
 	       image0.image.isInside(ImageRef(x.x+nSizeHalfWindow, x.y+nSizeHalfWindow));
 }
@@ -436,11 +1020,10 @@ bool DepthEstimator::FillPixelPatch()
 		const float colCenter = image0.image(x0);
 		for (int i=-nSizeHalfWindow; i<=nSizeHalfWindow; i+=nSizeStep) {
 			for (int j=-nSizeHalfWindow; j<=nSizeHalfWindow; j+=nSizeStep) {
-				Weight::Pixel& pw = w.weights[n++];
 				w.normSq0 +=
-					(pw.tempWeight = image0.image(x0.y+i, x0.x+j)) *
-					(pw.weight = GetWeight(ImageRef(j,i), colCenter));
-				w.sumWeights += pw.weight;
+					(w.tempWeights[n] = image0.image(x0.y+i, x0.x+j)) *
+					(w.weights[n] = GetWeight(ImageRef(j,i), colCenter));
+				w.sumWeights += w.weights[n++];
 			}
 		}
 		ASSERT(n == nTexels);
@@ -448,9 +1031,8 @@ bool DepthEstimator::FillPixelPatch()
 		w.normSq0 = 0;
 		n = 0;
 		do {
-			Weight::Pixel& pw = w.weights[n];
-			const float t(pw.tempWeight - tm);
-			w.normSq0 += (pw.tempWeight = pw.weight * t) * t;
+			const float t(w.tempWeights[n] - tm);
+			w.normSq0 += (w.tempWeights[n] = w.weights[n] * t) * t;
 		} while (++n < nTexels);
 	}
 	normSq0 = w.normSq0;
@@ -489,11 +1071,10 @@ float DepthEstimator::ScorePixelImage(const DepthData::ViewData& image1, Depth d
 			sumSq += SQUARE(v);
 			num += texels0(n++)*v;
 			#elif DENSE_NCC == DENSE_NCC_WEIGHTED
-			const Weight::Pixel& pw = w.weights[n++];
-			const float vw(v*pw.weight);
+			const float vw(v*w.weights[n]);
 			sum += vw;
 			sumSq += v*vw;
-			num += v*pw.tempWeight;
+			num += v*w.tempWeights[n++];
 			#else
 			sum += texels1(n++)=v;
 			#endif
@@ -532,23 +1113,8 @@ float DepthEstimator::ScorePixelImage(const DepthData::ViewData& image1, Depth d
 		score *= (1.f - smoothBonusDepth * factorDepth) * (1.f - smoothBonusNormal * factorNormal);
 	}
 	#endif
-	if (!image1.depthMap.empty()) {
-		ASSERT(OPTDENSE::fEstimationGeometricWeight > 0);
-		float consistency(4.f);
-		const Point3f X1(image1.Tl*Point3f(float(X0.x)*depth,float(X0.y)*depth,depth)+image1.Tm); // Kj * Rj * (Ri.t() * X + Ci - Cj)
-		if (X1.z > 0) {
-			const Point2f x1(X1);
-			if (image1.depthMap.isInsideWithBorder<float,1>(x1)) {
-				Depth depth1;
-				if (image1.depthMap.sample(depth1, x1, [&X1](Depth d) { return IsDepthSimilar(X1.z, d, 0.03f); })) {
-					const Point2f xb(image1.Tr*Point3f(x1.x*depth1,x1.y*depth1,depth1)+image1.Tn); // Ki * Ri * (Rj.t() * Kj-1 * X + Cj - Ci)
-					const float dist(norm(Point2f(float(x0.x)-xb.x, float(x0.y)-xb.y)));
-					consistency = MINF(SQRT(dist*(dist+2.f)), consistency);
-				}
-			}
-		}
-		score += OPTDENSE::fEstimationGeometricWeight * consistency;
-	}
+	if (!image1.depthMap.empty())
+		score += ScoreGeometricConsistency(image1, depth);
 	// apply depth prior weight based on patch textureless
 	if (!lowResDepthMap.empty()) {
 		const Depth d0 = lowResDepthMap(x0);
@@ -563,14 +1129,301 @@ float DepthEstimator::ScorePixelImage(const DepthData::ViewData& image1, Depth d
 	return MIN(2.f, score);
 }
 
+// compute the geometric consistency cost of the given depth estimate
+// by projecting it in the target depth-map and back in the reference image
+float DepthEstimator::ScoreGeometricConsistency(const DepthData::ViewData& image1, Depth depth) const
+{
+	ASSERT(!image1.depthMap.empty() && OPTDENSE::fEstimationGeometricWeight > 0);
+	float consistency(4.f);
+	const Point3f X1(image1.Tl*Point3f(float(X0.x)*depth,float(X0.y)*depth,depth)+image1.Tm); // Kj * Rj * (Ri.t() * X + Ci - Cj)
+	if (X1.z > 0) {
+		const Point2f x1(X1);
+		if (image1.depthMap.isInsideWithBorder<float,1>(x1)) {
+			Depth depth1;
+			if (image1.depthMap.sample(depth1, x1, [&X1](Depth d) { return IsDepthSimilar(X1.z, d, 0.03f); })) {
+				const Point2f xb(image1.Tr*Point3f(x1.x*depth1,x1.y*depth1,depth1)+image1.Tn); // Ki * Ri * (Rj.t() * Kj-1 * X + Cj - Ci)
+				const float dist(norm(Point2f(float(x0.x)-xb.x, float(x0.y)-xb.y)));
+				consistency = MINF(SQRT(dist*(dist+2.f)), consistency);
+			}
+		}
+	}
+	return OPTDENSE::fEstimationGeometricWeight * consistency;
+}
+
+#if DENSE_SCORE == DENSE_SCORE_BATCH
+// texel coordinates (in patch step units) relative to the top-left patch corner,
+// stored in the same order as the texels of the reference patch
+static const struct TexelOffsets {
+	enum { nSize = (DepthEstimator::nSizeHalfWindow*2+DepthEstimator::nSizeStep)/DepthEstimator::nSizeStep };
+	float x[DepthEstimator::nTexels];
+	float y[DepthEstimator::nTexels];
+	TexelOffsets() {
+		int n(0);
+		for (int i=0; i<nSize; ++i) {
+			for (int j=0; j<nSize; ++j, ++n) {
+				x[n] = float(j);
+				y[n] = float(i);
+			}
+		}
+		ASSERT(n == DepthEstimator::nTexels);
+	}
+} texelOffsets;
+
+#if defined(DENSE_SCORE_USE_SSE) || defined(DENSE_SCORE_USE_AVX2)
+static inline float HorizontalSum(__m128 v) {
+	v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+	return _mm_cvtss_f32(v);
+}
+#endif
+#ifdef DENSE_SCORE_USE_AVX2
+static inline float HorizontalSum(__m256 v) {
+	return HorizontalSum(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+}
+#endif
+
+// warp the reference patch in the given target image and compute the NCC score;
+// same as the first part of ScorePixelImage(), but the texel positions are computed,
+// checked and bilinearly sampled in SIMD lanes (AVX2 or SSE), with a scalar tail/fallback;
+// returns false if the patch can not be scored (outside the image or texture-less)
+bool DepthEstimator::ScorePatchNCC(const DepthData::ViewData& image1, Depth depth, const Normal& normal, float& score) const
+{
+	// top-left patch corner and the patch steps along its rows and columns
+	const Matrix3x3f H(ComputeHomographyMatrix(image1, depth, normal));
+	Point3f X;
+	ProjectVertex_3x3_2_3(H.val, Point2f(float(x0.x-nSizeHalfWindow),float(x0.y-nSizeHalfWindow)).ptr(), X.ptr());
+	const Point3f dX(H[0]*float(nSizeStep), H[3]*float(nSizeStep), H[6]*float(nSizeStep));
+	const Point3f dY(H[1]*float(nSizeStep), H[4]*float(nSizeStep), H[7]*float(nSizeStep));
+	#if DENSE_NCC == DENSE_NCC_WEIGHTED
+	const Weight& w = weightMap0[x0.y*image0.image.width()+x0.x];
+	#endif
+	float sum(0);
+	#if DENSE_NCC != DENSE_NCC_DEFAULT
+	float sumSq(0), num(0);
+	#else
+	TexelVec texels1;
+	#endif
+	int n(0);
+	#if defined(DENSE_SCORE_USE_SSE) || defined(DENSE_SCORE_USE_AVX2)
+	const float* const pImage(image1.image.ptr<float>());
+	const int stride((int)image1.image.step1());
+	const float maxX(float(image1.image.width()-2)), maxY(float(image1.image.height()-2));
+	#endif
+	#ifdef DENSE_SCORE_USE_AVX2
+	{
+		const __m256 vX(_mm256_set1_ps(X.x)), vY(_mm256_set1_ps(X.y)), vZ(_mm256_set1_ps(X.z));
+		const __m256 vdXx(_mm256_set1_ps(dX.x)), vdXy(_mm256_set1_ps(dX.y)), vdXz(_mm256_set1_ps(dX.z));
+		const __m256 vdYx(_mm256_set1_ps(dY.x)), vdYy(_mm256_set1_ps(dY.y)), vdYz(_mm256_set1_ps(dY.z));
+		const __m256 vOne(_mm256_set1_ps(1.f)), vMaxX(_mm256_set1_ps(maxX)), vMaxY(_mm256_set1_ps(maxY));
+		const __m256i vStride(_mm256_set1_epi32(stride));
+		__m256 vSum(_mm256_setzero_ps());
+		#if DENSE_NCC != DENSE_NCC_DEFAULT
+		__m256 vSumSq(_mm256_setzero_ps()), vNum(_mm256_setzero_ps());
+		#endif
+		for (; n+8<=(int)nTexels; n+=8) {
+			// project the texels in the target image
+			const __m256 ox(_mm256_loadu_ps(texelOffsets.x+n)), oy(_mm256_loadu_ps(texelOffsets.y+n));
+			const __m256 z(_mm256_add_ps(_mm256_add_ps(vZ, _mm256_mul_ps(vdXz, ox)), _mm256_mul_ps(vdYz, oy)));
+			const __m256 px(_mm256_div_ps(_mm256_add_ps(_mm256_add_ps(vX, _mm256_mul_ps(vdXx, ox)), _mm256_mul_ps(vdYx, oy)), z));
+			const __m256 py(_mm256_div_ps(_mm256_add_ps(_mm256_add_ps(vY, _mm256_mul_ps(vdXy, ox)), _mm256_mul_ps(vdYy, oy)), z));
+			// all texels must be inside the image (leaving a one pixel border for interpolation)
+			const __m256 inside(_mm256_and_ps(
+				_mm256_and_ps(_mm256_cmp_ps(px, vOne, _CMP_GE_OQ), _mm256_cmp_ps(py, vOne, _CMP_GE_OQ)),
+				_mm256_and_ps(_mm256_cmp_ps(px, vMaxX, _CMP_LE_OQ), _mm256_cmp_ps(py, vMaxY, _CMP_LE_OQ))));
+			if (_mm256_movemask_ps(inside) != 0xFF)
+				return false;
+			// bilinear interpolation
+			const __m256i lx(_mm256_cvttps_epi32(px)), ly(_mm256_cvttps_epi32(py));
+			const __m256 fx(_mm256_sub_ps(px, _mm256_cvtepi32_ps(lx))), fx1(_mm256_sub_ps(vOne, fx));
+			const __m256 fy(_mm256_sub_ps(py, _mm256_cvtepi32_ps(ly))), fy1(_mm256_sub_ps(vOne, fy));
+			const __m256i idx(_mm256_add_epi32(_mm256_mullo_epi32(ly, vStride), lx));
+			const __m256 v00(_mm256_i32gather_ps(pImage, idx, 4)), v01(_mm256_i32gather_ps(pImage+1, idx, 4));
+			const __m256 v10(_mm256_i32gather_ps(pImage+stride, idx, 4)), v11(_mm256_i32gather_ps(pImage+stride+1, idx, 4));
+			const __m256 v(_mm256_add_ps(
+				_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(v00, fx1), _mm256_mul_ps(v01, fx)), fy1),
+				_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(v10, fx1), _mm256_mul_ps(v11, fx)), fy)));
+			// accumulate patch statistics
+			#if DENSE_NCC == DENSE_NCC_FAST
+			vSum = _mm256_add_ps(vSum, v);
+			vSumSq = _mm256_add_ps(vSumSq, _mm256_mul_ps(v, v));
+			vNum = _mm256_add_ps(vNum, _mm256_mul_ps(_mm256_loadu_ps(texels0.data()+n), v));
+			#elif DENSE_NCC == DENSE_NCC_WEIGHTED
+			const __m256 vw(_mm256_mul_ps(v, _mm256_loadu_ps(w.weights+n)));
+			vSum = _mm256_add_ps(vSum, vw);
+			vSumSq = _mm256_add_ps(vSumSq, _mm256_mul_ps(v, vw));
+			vNum = _mm256_add_ps(vNum, _mm256_mul_ps(v, _mm256_loadu_ps(w.tempWeights+n)));
+			#else
+			_mm256_storeu_ps(texels1.data()+n, v);
+			vSum = _mm256_add_ps(vSum, v);
+			#endif
+		}
+		sum = HorizontalSum(vSum);
+		#if DENSE_NCC != DENSE_NCC_DEFAULT
+		sumSq = HorizontalSum(vSumSq);
+		num = HorizontalSum(vNum);
+		#endif
+	}
+	#elif defined(DENSE_SCORE_USE_SSE)
+	{
+		const __m128 vX(_mm_set1_ps(X.x)), vY(_mm_set1_ps(X.y)), vZ(_mm_set1_ps(X.z));
+		const __m128 vdXx(_mm_set1_ps(dX.x)), vdXy(_mm_set1_ps(dX.y)), vdXz(_mm_set1_ps(dX.z));
+		const __m128 vdYx(_mm_set1_ps(dY.x)), vdYy(_mm_set1_ps(dY.y)), vdYz(_mm_set1_ps(dY.z));
+		const __m128 vOne(_mm_set1_ps(1.f)), vMaxX(_mm_set1_ps(maxX)), vMaxY(_mm_set1_ps(maxY));
+		__m128 vSum(_mm_setzero_ps());
+		#if DENSE_NCC != DENSE_NCC_DEFAULT
+		__m128 vSumSq(_mm_setzero_ps()), vNum(_mm_setzero_ps());
+		#endif
+		int ix[4], iy[4];
+		float v00[4], v01[4], v10[4], v11[4];
+		for (; n+4<=(int)nTexels; n+=4) {
+			// project the texels in the target image
+			const __m128 ox(_mm_loadu_ps(texelOffsets.x+n)), oy(_mm_loadu_ps(texelOffsets.y+n));
+			const __m128 z(_mm_add_ps(_mm_add_ps(vZ, _mm_mul_ps(vdXz, ox)), _mm_mul_ps(vdYz, oy)));
+			const __m128 px(_mm_div_ps(_mm_add_ps(_mm_add_ps(vX, _mm_mul_ps(vdXx, ox)), _mm_mul_ps(vdYx, oy)), z));
+			const __m128 py(_mm_div_ps(_mm_add_ps(_mm_add_ps(vY, _mm_mul_ps(vdXy, ox)), _mm_mul_ps(vdYy, oy)), z));
+			// all texels must be inside the image (leaving a one pixel border for interpolation)
+			const __m128 inside(_mm_and_ps(
+				_mm_and_ps(_mm_cmpge_ps(px, vOne), _mm_cmpge_ps(py, vOne)),
+				_mm_and_ps(_mm_cmple_ps(px, vMaxX), _mm_cmple_ps(py, vMaxY))));
+			if (_mm_movemask_ps(inside) != 0xF)
+				return false;
+			// bilinear interpolation (SSE2 has no gather, so fetch the corners one lane at a time)
+			const __m128i lx(_mm_cvttps_epi32(px)), ly(_mm_cvttps_epi32(py));
+			const __m128 fx(_mm_sub_ps(px, _mm_cvtepi32_ps(lx))), fx1(_mm_sub_ps(vOne, fx));
+			const __m128 fy(_mm_sub_ps(py, _mm_cvtepi32_ps(ly))), fy1(_mm_sub_ps(vOne, fy));
+			_mm_storeu_si128((__m128i*)ix, lx);
+			_mm_storeu_si128((__m128i*)iy, ly);
+			for (int k=0; k<4; ++k) {
+				const float* const p(pImage+iy[k]*stride+ix[k]);
+				v00[k] = p[0]; v01[k] = p[1];
+				v10[k] = p[stride]; v11[k] = p[stride+1];
+			}
+			const __m128 v(_mm_add_ps(
+				_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(v00), fx1), _mm_mul_ps(_mm_loadu_ps(v01), fx)), fy1),
+				_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(v10), fx1), _mm_mul_ps(_mm_loadu_ps(v11), fx)), fy)));
+			// accumulate patch statistics
+			#if DENSE_NCC == DENSE_NCC_FAST
+			vSum = _mm_add_ps(vSum, v);
+			vSumSq = _mm_add_ps(vSumSq, _mm_mul_ps(v, v));
+			vNum = _mm_add_ps(vNum, _mm_mul_ps(_mm_loadu_ps(texels0.data()+n), v));
+			#elif DENSE_NCC == DENSE_NCC_WEIGHTED
+			const __m128 vw(_mm_mul_ps(v, _mm_loadu_ps(w.weights+n)));
+			vSum = _mm_add_ps(vSum, vw);
+			vSumSq = _mm_add_ps(vSumSq, _mm_mul_ps(v, vw));
+			vNum = _mm_add_ps(vNum, _mm_mul_ps(v, _mm_loadu_ps(w.tempWeights+n)));
+			#else
+			_mm_storeu_ps(texels1.data()+n, v);
+			vSum = _mm_add_ps(vSum, v);
+			#endif
+		}
+		sum = HorizontalSum(vSum);
+		#if DENSE_NCC != DENSE_NCC_DEFAULT
+		sumSq = HorizontalSum(vSumSq);
+		num = HorizontalSum(vNum);
+		#endif
+	}
+	#endif
+	// process the remaining texels
+	for (; n<(int)nTexels; ++n) {
+		const float ox(texelOffsets.x[n]), oy(texelOffsets.y[n]);
+		const float z(X.z + dX.z*ox + dY.z*oy);
+		const Point2f pt((X.x + dX.x*ox + dY.x*oy)/z, (X.y + dX.y*ox + dY.y*oy)/z);
+		if (!image1.image.isInsideWithBorder<float,1>(pt))
+			return false;
+		const float v(image1.image.sample(pt));
+		#if DENSE_NCC == DENSE_NCC_FAST
+		sum += v;
+		sumSq += SQUARE(v);
+		num += texels0(n)*v;
+		#elif DENSE_NCC == DENSE_NCC_WEIGHTED
+		const float vw(v*w.weights[n]);
+		sum += vw;
+		sumSq += v*vw;
+		num += v*w.tempWeights[n];
+		#else
+		sum += texels1(n)=v;
+		#endif
+	}
+	// score similarity of the reference and target texture patches
+	#if DENSE_NCC == DENSE_NCC_FAST
+	const float normSq1(sumSq-SQUARE(sum/nSizeWindow));
+	#elif DENSE_NCC == DENSE_NCC_WEIGHTED
+	const float normSq1(sumSq-SQUARE(sum)/w.sumWeights);
+	#else
+	const float normSq1(normSqDelta<float,float,nTexels>(texels1.data(), sum/(float)nTexels));
+	#endif
+	const float nrmSq(normSq0*normSq1);
+	if (nrmSq <=1e-16f)
+		return false;
+	#if DENSE_NCC == DENSE_NCC_DEFAULT
+	const float num(texels0.dot(texels1));
+	#endif
+	const float ncc(CLAMP(num/SQRT(nrmSq), -1.f, 1.f));
+	score = 1.f-ncc;
+	return true;
+}
+
+// compute pixel's NCC score in all target images at once;
+// equivalent to calling ScorePixelImage() for each view, but the terms not depending
+// on the target image (smoothness bonus and low-resolution depth prior) are computed only once
+void DepthEstimator::ScorePixelImages(Depth depth, const Normal& normal)
+{
+	#if DENSE_SMOOTHNESS != DENSE_SMOOTHNESS_NA
+	// encourage smoothness
+	float smoothness(1.f);
+	for (const NeighborEstimate& neighbor: neighborsClose) {
+		ASSERT(neighbor.depth > 0);
+		#if DENSE_SMOOTHNESS == DENSE_SMOOTHNESS_PLANE
+		const float factorDepth(DENSE_EXP(SQUARE(plane.Distance(neighbor.X)/depth) * smoothSigmaDepth));
+		#else
+		const float factorDepth(DENSE_EXP(SQUARE((depth-neighbor.depth)/depth) * smoothSigmaDepth));
+		#endif
+		const float factorNormal(DENSE_EXP(SQUARE(ACOS(ComputeAngle(normal.ptr(), neighbor.normal.ptr()))) * smoothSigmaNormal));
+		smoothness *= (1.f - smoothBonusDepth * factorDepth) * (1.f - smoothBonusNormal * factorNormal);
+	}
+	#endif
+	// depth prior weight based on patch textureless
+	float factorDeltaDepth(0), deltaDepth(0);
+	if (!lowResDepthMap.empty()) {
+		const Depth d0 = lowResDepthMap(x0);
+		if (d0 > 0) {
+			deltaDepth = MINF(DepthSimilarity(d0, depth), 0.5f);
+			const float smoothSigmaDepth(-1.f / (1.f * 0.02f)); // 0.12: patch texture variance below 0.02 (0.12^2) is considered texture-less
+			factorDeltaDepth = DENSE_EXP(normSq0 * smoothSigmaDepth);
+		}
+	}
+	FOREACH(idxView, images) {
+		const DepthData::ViewData& image1 = images[idxView];
+		float score;
+		if (!ScorePatchNCC(image1, depth, normal, score)) {
+			scores[idxView] = thRobust;
+			continue;
+		}
+		#if DENSE_SMOOTHNESS != DENSE_SMOOTHNESS_NA
+		score *= smoothness;
+		#endif
+		if (!image1.depthMap.empty())
+			score += ScoreGeometricConsistency(image1, depth);
+		if (factorDeltaDepth > 0)
+			score = (1.f-factorDeltaDepth)*score + factorDeltaDepth*deltaDepth;
+		ASSERT(ISFINITE(score));
+		scores[idxView] = MIN(2.f, score);
+	}
+}
+#endif // DENSE_SCORE
+
 // compute pixel's NCC score
 float DepthEstimator::ScorePixel(Depth depth, const Normal& normal)
 {
 	ASSERT(depth > 0 && normal.dot(Cast<float>(X0)) <= 0);
 	// compute score for this pixel as seen in each view
 	ASSERT(scores.size() == images.size());
+	#if DENSE_SCORE == DENSE_SCORE_BATCH
+	ScorePixelImages(depth, normal);
+	#else
 	FOREACH(idxView, images)
 		scores[idxView] = ScorePixelImage(images[idxView], depth, normal);
+	#endif
 	#if DENSE_AGGNCC == DENSE_AGGNCC_NTH
 	// set score as the nth element
 	return scores.GetNth(idxScore);
@@ -629,9 +1482,61 @@ float DepthEstimator::ScorePixel(Depth depth, const Normal& normal)
 // the solution belonging to the target image can be also propagated
 void DepthEstimator::ProcessPixel(IDX idx)
 {
-	// compute pixel coordinates from pixel index and its neighbors
+	// compute pixel coordinates from pixel index
+	ASSERT(dir == LT2RB || dir == RB2LT);
+	ProcessPixel(dir == LT2RB ? coords[idx] : coords[coords.GetSize()-1-idx]);
+}
+// estimate the pixel, unless it settled: its estimate did not change during the last iterations
+// and neither did the estimates of its neighbors, in which case propagation and refinement
+// would most likely find nothing better;
+// in checkerboard mode the 4 neighbors have the other color, so their state is not modified
+// during the current half-sweep and the decision does not depend on the order the tiles are processed
+void DepthEstimator::ProcessPixel(const ImageRef& x)
+{
+	if (settledMap == NULL) {
+		EstimatePixel(x);
+		return;
+	}
+	uint8_t& settled = (*settledMap)(x);
+	if (IsPixelSettled(x)) {
+		++nSkipped;
+		return;
+	}
+	const Depth depth(depthMap0(x));
+	const Normal normal(normalMap0(x));
+	const float conf(confMap0(x));
+	EstimatePixel(x);
+	const Depth ndepth(depthMap0(x));
+	if (ndepth > 0 ?
+		depth > 0 && IsDepthSimilar(depth, ndepth, 1e-3f) && normal.dot(normalMap0(x)) > 0.9998f && ABS(confMap0(x)-conf) < 1e-3f :
+		depth <= 0)
+	{
+		if (settled < 255)
+			++settled;
+	} else {
+		settled = 0;
+	}
+}
+bool DepthEstimator::IsPixelSettled(const ImageRef& x) const
+{
+	ASSERT(settledMap != NULL && OPTDENSE::nEstimationSkipSettled > 0);
+	const SettledMap& map = *settledMap;
+	// only good estimates can settle, the others keep searching for a better estimate
+	if (map(x) < OPTDENSE::nEstimationSkipSettled || confMap0(x) >= OPTDENSE::fNCCThresholdKeep)
+		return false;
+	// the neighbors must not have changed the last time they were processed
+	if ((x.x > 0 && map(x.y,x.x-1) == 0) ||
+		(x.y > 0 && map(x.y-1,x.x) == 0) ||
+		(x.x+1 < map.width() && map(x.y,x.x+1) == 0) ||
+		(x.y+1 < map.height() && map(x.y+1,x.x) == 0))
+		return false;
+	return true;
+}
+// propagate the neighbor estimates and refine the current estimate of the given pixel
+void DepthEstimator::EstimatePixel(const ImageRef& x)
+{
 	ASSERT(dir == LT2RB || dir == RB2LT);
-	if (!PreparePixelPatch(dir == LT2RB ? coords[idx] : coords[coords.GetSize()-1-idx]) || !FillPixelPatch())
+	if (!PreparePixelPatch(x) || !FillPixelPatch())
 		return;
 	// find neighbors
 	neighbors.Empty();
@@ -810,7 +1715,7 @@ void DepthEstimator::ProcessPixel(IDX idx)
 		neighborsClose.Empty();
 		#endif
 		for (unsigned iter=0; iter<OPTDENSE::nRandomIters; ++iter) {
-			const Depth ndepth(RandomDepth(dMinSqr, dMaxSqr));
+			const Depth ndepth(RandomPixelDepth());
 			const Normal nnormal(RandomNormal(viewDir));
 			const float nconf(ScorePixel(ndepth, nnormal));
 			ASSERT(nconf >= 0);
@@ -831,7 +1736,7 @@ void DepthEstimator::ProcessPixel(IDX idx)
 	Normal nnormal;
 	for (unsigned iter=0; iter<OPTDENSE::nRandomIters; ++iter) {
 		const Depth ndepth(rnd.randomMeanRange(depth, depthRange*scaleRange));
-		if (!ISINSIDE(ndepth, dMin, dMax))
+		if (!ISINSIDE(ndepth, dMinPixel, dMaxPixel))
 			continue;
 		const Point2f np(rnd.randomMeanRange(p.x, angle1Range*scaleRange), rnd.randomMeanRange(p.y, angle2Range*scaleRange));
 		Dir2Normal(np, nnormal);
@@ -979,7 +1884,7 @@ DepthEstimator::PixelEstimate DepthEstimator::PerturbEstimate(const PixelEstimat
 	// perturb depth
 	const float minDepth = est.depth * (1.f-perturbation);
 	const float maxDepth = est.depth * (1.f+perturbation);
-	ptbEst.depth = CLAMP(rnd.randomUniform(minDepth, maxDepth), dMin, dMax);
+	ptbEst.depth = CLAMP(rnd.randomUniform(minDepth, maxDepth), dMinPixel, dMaxPixel);
 
 	// perturb normal
 	const Normal viewDir(Cast<float>(X0));
@@ -1871,11 +2776,14 @@ bool MVS::ExportPointCloud(const String& fileName, const Image& imageData, const
 /*----------------------------------------------------------------*/
 
 //  - IDs are the reference view ID and neighbor view IDs used to estimate the depth-map (global ID)
+//  - the maps are stored aligned (version 1), each at the offset listed after the pose
+//  - encoding selects the compact encodings of the maps (see HeaderDepthDataRaw::DEPTH_HALF, etc.)
 bool MVS::ExportDepthDataRaw(const String& fileName, const String& imageFileName,
 	const IIndexArr& IDs, const cv::Size& imageSize,
 	const KMatrix& K, const RMatrix& R, const CMatrix& C,
 	Depth dMin, Depth dMax,
-	const DepthMap& depthMap, const NormalMap& normalMap, const ConfidenceMap& confMap, const ViewsMap& viewsMap)
+	const DepthMap& depthMap, const NormalMap& normalMap, const ConfidenceMap& confMap, const ViewsMap& viewsMap,
+	unsigned encoding, uint64_t fingerprint)
 {
 	ASSERT(IDs.size() > 1 && IDs.size() < 256);
 	ASSERT(!depthMap.empty());
@@ -1893,6 +2801,7 @@ bool MVS::ExportDepthDataRaw(const String& fileName, const String& imageFileName
 	HeaderDepthDataRaw header;
 	header.name = HeaderDepthDataRaw::HeaderDepthDataRawName();
 	header.type = HeaderDepthDataRaw::HAS_DEPTH;
+	header.version = HeaderDepthDataRaw::VERSION_FINGERPRINT;
 	header.imageWidth = (uint32_t)imageSize.width;
 	header.imageHeight = (uint32_t)imageSize.height;
 	header.depthWidth = (uint32_t)depthMap.cols;
@@ -1905,6 +2814,16 @@ bool MVS::ExportDepthDataRaw(const String& fileName, const String& imageFileName
 		header.type |= HeaderDepthDataRaw::HAS_CONF;
 	if (!viewsMap.empty())
 		header.type |= HeaderDepthDataRaw::HAS_VIEWS;
+	if ((encoding & HeaderDepthDataRaw::DEPTH_HALF) != 0)
+		header.type |= HeaderDepthDataRaw::DEPTH_HALF;
+	if ((header.type & HeaderDepthDataRaw::HAS_NORMAL) != 0 && (encoding & HeaderDepthDataRaw::NORMAL_OCT) != 0)
+		header.type |= HeaderDepthDataRaw::NORMAL_OCT;
+	if ((header.type & HeaderDepthDataRaw::HAS_CONF) != 0) {
+		if ((encoding & HeaderDepthDataRaw::CONF_BYTE) != 0)
+			header.type |= HeaderDepthDataRaw::CONF_BYTE;
+		else if ((encoding & HeaderDepthDataRaw::CONF_HALF) != 0)
+			header.type |= HeaderDepthDataRaw::CONF_HALF;
+	}
 	fwrite(&header, sizeof(HeaderDepthDataRaw), 1, f);
 
 	// write image file name
@@ -1926,31 +2845,79 @@ bool MVS::ExportDepthDataRaw(const String& fileName, const String& imageFileName
 	fwrite(R.val, sizeof(REAL), 9, f);
 	fwrite(C.ptr(), sizeof(REAL), 3, f);
 
-	// write depth-map
-	fwrite(depthMap.getData(), sizeof(float), depthMap.area(), f);
+	// encode the maps
+	const int area(depthMap.area());
+	cv::Mat layers[4] = {depthMap, normalMap, confMap, viewsMap};
+	if ((header.type & HeaderDepthDataRaw::DEPTH_HALF) != 0) {
+		Image16F depthMapHalf(depthMap.size());
+		for (int i=0; i<area; ++i)
+			depthMapHalf.getData()[i] = Float2Half(depthMap.getData()[i]);
+		layers[0] = depthMapHalf;
+	}
+	if ((header.type & HeaderDepthDataRaw::NORMAL_OCT) != 0) {
+		NormalOctMap normalMapOct(normalMap.size());
+		for (int i=0; i<area; ++i)
+			normalMapOct.getData()[i] = DepthData::EncodeNormal(normalMap.getData()[i]);
+		layers[1] = normalMapOct;
+	}
+	if ((header.type & HeaderDepthDataRaw::CONF_BYTE) != 0) {
+		Image8U confMapByte(confMap.size());
+		for (int i=0; i<area; ++i)
+			confMapByte.getData()[i] = DepthData::EncodeConfidence8(confMap.getData()[i]);
+		layers[2] = confMapByte;
+	} else
+	if ((header.type & HeaderDepthDataRaw::CONF_HALF) != 0) {
+		ConfidenceHalfMap confMapHalf(confMap.size());
+		for (int i=0; i<area; ++i)
+			confMapHalf.getData()[i] = Float2Half(confMap.getData()[i]);
+		layers[2] = confMapHalf;
+	}
 
-	// write normal-map
-	if ((header.type & HeaderDepthDataRaw::HAS_NORMAL) != 0)
-		fwrite(normalMap.getData(), sizeof(float)*3, normalMap.area(), f);
+	// write maps offsets
+	uint64_t offsets[4];
+	uint64_t offset((uint64_t)DMAP_FTELL(f)+sizeof(offsets)+sizeof(uint64_t));
+	for (int l=0; l<4; ++l) {
+		if (layers[l].empty()) {
+			offsets[l] = 0;
+			continue;
+		}
+		offsets[l] = ((offset+HeaderDepthDataRaw::LAYER_ALIGNMENT-1)/HeaderDepthDataRaw::LAYER_ALIGNMENT)*HeaderDepthDataRaw::LAYER_ALIGNMENT;
+		offset = offsets[l]+layers[l].total()*layers[l].elemSize();
+	}
+	fwrite(offsets, sizeof(uint64_t), 4, f);
 
-	// write confidence-map
-	if ((header.type & HeaderDepthDataRaw::HAS_CONF) != 0)
-		fwrite(confMap.getData(), sizeof(float), confMap.area(), f);
+	// write the fingerprint of the estimation inputs
+	fwrite(&fingerprint, sizeof(uint64_t), 1, f);
 
-	// write views-map
-	if ((header.type & HeaderDepthDataRaw::HAS_VIEWS) != 0)
-		fwrite(viewsMap.getData(), sizeof(uint8_t)*4, viewsMap.area(), f);
+	// write depth, normal, confidence and views maps
+	for (int l=0; l<4; ++l) {
+		if (layers[l].empty())
+			continue;
+		ASSERT(layers[l].isContinuous());
+		static const uint8_t padding[HeaderDepthDataRaw::LAYER_ALIGNMENT] = {0};
+		fwrite(padding, sizeof(uint8_t), (size_t)(offsets[l]-(uint64_t)DMAP_FTELL(f)), f);
+		fwrite(layers[l].data, layers[l].elemSize(), layers[l].total(), f);
+	}
 
 	const bool bRet(ferror(f) == 0);
 	fclose(f);
 	return bRet;
 } // ExportDepthDataRaw
 
+//  - flags select the maps to be loaded (see HeaderDepthDataRaw::HAS_*), the rest are skipped
+//  - if pMapping is given and the file stores aligned maps, the file is mapped in memory and
+//    the maps are returned as views into it, paging in only the data actually accessed
+//  - if pNormalMapOct/pConfMapHalf are given and the normal/confidence maps are stored compact,
+//    they are returned in the compact form (and the corresponding full map is released)
+//  - if pFingerprint is given, it receives the fingerprint of the estimation inputs (0 if unknown);
+//    use flags 0 to read only the header
 bool MVS::ImportDepthDataRaw(const String& fileName, String& imageFileName,
 	IIndexArr& IDs, cv::Size& imageSize,
 	KMatrix& K, RMatrix& R, CMatrix& C,
 	Depth& dMin, Depth& dMax,
-	DepthMap& depthMap, NormalMap& normalMap, ConfidenceMap& confMap, ViewsMap& viewsMap, unsigned flags)
+	DepthMap& depthMap, NormalMap& normalMap, ConfidenceMap& confMap, ViewsMap& viewsMap,
+	unsigned flags, MappedFilePtr* pMapping,
+	NormalOctMap* pNormalMapOct, ConfidenceHalfMap* pConfMapHalf, uint64_t* pFingerprint)
 {
 	FILE* f = fopen(fileName, "rb");
 	if (f == NULL) {
@@ -1962,11 +2929,14 @@ bool MVS::ImportDepthDataRaw(const String& fileName, String& imageFileName,
 	HeaderDepthDataRaw header;
 	if (fread(&header, sizeof(HeaderDepthDataRaw), 1, f) != 1 ||
 		header.name != HeaderDepthDataRaw::HeaderDepthDataRawName() ||
+		header.version > HeaderDepthDataRaw::VERSION_LAST ||
 		(header.type & HeaderDepthDataRaw::HAS_DEPTH) == 0 ||
+		(header.version < HeaderDepthDataRaw::VERSION_ALIGNED && header.type > 15) ||
 		header.depthWidth <= 0 || header.depthHeight <= 0 ||
 		header.imageWidth < header.depthWidth || header.imageHeight < header.depthHeight)
 	{
 		DEBUG("error: invalid depth-data file '%s'", fileName.c_str());
+		fclose(f);
 		return false;
 	}
 
@@ -1991,45 +2961,139 @@ bool MVS::ImportDepthDataRaw(const String& fileName, String& imageFileName,
 	fread(R.val, sizeof(REAL), 9, f);
 	fread(C.ptr(), sizeof(REAL), 3, f);
 
-	// read depth-map
+	// read maps offsets
 	dMin = header.dMin;
 	dMax = header.dMax;
 	imageSize.width = header.imageWidth;
 	imageSize.height = header.imageHeight;
-	if ((flags & HeaderDepthDataRaw::HAS_DEPTH) != 0) {
-		depthMap.create(header.depthHeight, header.depthWidth);
-		fread(depthMap.getData(), sizeof(float), depthMap.area(), f);
+	const int layerTypes[4] = {
+		(header.type & HeaderDepthDataRaw::DEPTH_HALF) != 0 ? cv::DataType<hfloat>::type : CV_32FC1,
+		(header.type & HeaderDepthDataRaw::NORMAL_OCT) != 0 ? cv::DataType<uint32_t>::type : CV_32FC3,
+		(header.type & HeaderDepthDataRaw::CONF_BYTE) != 0 ? CV_8UC1 :
+		(header.type & HeaderDepthDataRaw::CONF_HALF) != 0 ? cv::DataType<hfloat>::type : CV_32FC1,
+		CV_8UC4
+	};
+	const size_t area((size_t)header.depthWidth*header.depthHeight);
+	size_t layerSizes[4];
+	for (int l=0; l<4; ++l)
+		layerSizes[l] = CV_ELEM_SIZE(layerTypes[l])*area;
+	uint64_t offsets[4];
+	uint64_t fingerprint(0);
+	if (header.version >= HeaderDepthDataRaw::VERSION_ALIGNED) {
+		fread(offsets, sizeof(uint64_t), 4, f);
+		if (header.version >= HeaderDepthDataRaw::VERSION_FINGERPRINT)
+			fread(&fingerprint, sizeof(uint64_t), 1, f);
 	} else {
-		fseek(f, sizeof(float)*header.depthWidth*header.depthHeight, SEEK_CUR);
+		// maps stored contiguously
+		uint64_t offset((uint64_t)DMAP_FTELL(f));
+		for (int l=0; l<4; ++l) {
+			if ((header.type & (1<<l)) == 0) {
+				offsets[l] = 0;
+				continue;
+			}
+			offsets[l] = offset;
+			offset += layerSizes[l];
+		}
+	}
+	if (ferror(f) != 0) {
+		fclose(f);
+		return false;
+	}
+	if (pFingerprint != NULL)
+		*pFingerprint = fingerprint;
+
+	// map the file in memory if requested and possible
+	if (pMapping != NULL) {
+		pMapping->Release();
+		if (header.version >= HeaderDepthDataRaw::VERSION_ALIGNED) {
+			MappedFilePtr mapping(new MappedFile(fileName));
+			if (mapping->isOpen()) {
+				for (int l=0; l<4; ++l) {
+					if ((header.type & (1<<l)) != 0 && offsets[l]+layerSizes[l] > mapping->getSize()) {
+						DEBUG("error: invalid depth-data file '%s'", fileName.c_str());
+						fclose(f);
+						return false;
+					}
+				}
+				*pMapping = mapping;
+			}
+		}
+	}
+	const cv::Size size((int)header.depthWidth, (int)header.depthHeight);
+	const auto loadLayer = [&](int l, cv::Mat& map) {
+		if (pMapping != NULL && *pMapping != NULL) {
+			map = cv::Mat(size, layerTypes[l], (*pMapping)->getData()+offsets[l]);
+		} else {
+			map.create(size, layerTypes[l]);
+			DMAP_FSEEK(f, (int64_t)offsets[l], SEEK_SET);
+			fread(map.data, layerSizes[l], 1, f);
+		}
+	};
+	const auto isLayerRequested = [&](int l) {
+		return (header.type & (1<<l)) != 0 && (flags & (1<<l)) != 0;
+	};
+
+	// read depth-map
+	if (isLayerRequested(0)) {
+		if (layerTypes[0] == CV_32FC1) {
+			loadLayer(0, depthMap);
+		} else {
+			Image16F depthMapHalf;
+			loadLayer(0, depthMapHalf);
+			depthMap.create(size);
+			for (size_t i=0; i<area; ++i)
+				depthMap.getData()[i] = depthMapHalf.getData()[i];
+		}
 	}
 
 	// read normal-map
-	if ((header.type & HeaderDepthDataRaw::HAS_NORMAL) != 0) {
-		if ((flags & HeaderDepthDataRaw::HAS_NORMAL) != 0) {
-			normalMap.create(header.depthHeight, header.depthWidth);
-			fread(normalMap.getData(), sizeof(float)*3, normalMap.area(), f);
+	if (isLayerRequested(1)) {
+		if (layerTypes[1] == CV_32FC3) {
+			loadLayer(1, normalMap);
+			if (pNormalMapOct != NULL)
+				pNormalMapOct->release();
+		} else if (pNormalMapOct != NULL) {
+			loadLayer(1, *pNormalMapOct);
+			normalMap.release();
 		} else {
-			fseek(f, sizeof(float)*3*header.depthWidth*header.depthHeight, SEEK_CUR);
+			NormalOctMap normalMapOct;
+			loadLayer(1, normalMapOct);
+			DecodeNormalMap(normalMapOct, normalMap);
 		}
 	}
 
 	// read confidence-map
-	if ((header.type & HeaderDepthDataRaw::HAS_CONF) != 0) {
-		if ((flags & HeaderDepthDataRaw::HAS_CONF) != 0) {
-			confMap.create(header.depthHeight, header.depthWidth);
-			fread(confMap.getData(), sizeof(float), confMap.area(), f);
+	if (isLayerRequested(2)) {
+		if (layerTypes[2] == CV_32FC1) {
+			loadLayer(2, confMap);
+			if (pConfMapHalf != NULL)
+				pConfMapHalf->release();
+		} else if (layerTypes[2] == CV_8UC1) {
+			Image8U confMapByte;
+			loadLayer(2, confMapByte);
+			if (pConfMapHalf != NULL) {
+				pConfMapHalf->create(size);
+				for (size_t i=0; i<area; ++i)
+					pConfMapHalf->getData()[i] = DepthData::DecodeConfidence8(confMapByte.getData()[i]);
+				confMap.release();
+			} else {
+				confMap.create(size);
+				for (size_t i=0; i<area; ++i)
+					confMap.getData()[i] = DepthData::DecodeConfidence8(confMapByte.getData()[i]);
+			}
+		} else if (pConfMapHalf != NULL) {
+			loadLayer(2, *pConfMapHalf);
+			confMap.release();
 		} else {
-			fseek(f, sizeof(float)*header.depthWidth*header.depthHeight, SEEK_CUR);
+			ConfidenceHalfMap confMapHalf;
+			loadLayer(2, confMapHalf);
+			DecodeConfMap(confMapHalf, confMap);
 		}
 	}
 
-	// read visibility-map
-	if ((header.type & HeaderDepthDataRaw::HAS_VIEWS) != 0) {
-		if ((flags & HeaderDepthDataRaw::HAS_VIEWS) != 0) {
-			viewsMap.create(header.depthHeight, header.depthWidth);
-			fread(viewsMap.getData(), sizeof(uint8_t)*4, viewsMap.area(), f);
-		}
-	}
+	// read views-map
+	if (isLayerRequested(3))
+		loadLayer(3, viewsMap);
 
 	const bool bRet(ferror(f) == 0);
 	fclose(f);
@@ -2156,3 +3220,34 @@ void MVS::CompareNormalMaps(const NormalMap& normalMap, const NormalMap& normalM
 	);
 }
 /*----------------------------------------------------------------*/
+
+
+// test the round-trip of the compact normal encoding:
+// unit normals must be recovered within a small angular error,
+// and the invalid (zero) normal must stay invalid
+bool MVS::TestDepthDataEncoding(unsigned iters)
+{
+	const float thCosAngle(COS(FD2R(0.1f)));
+	const auto roundTrip = [thCosAngle](const Normal& normal) {
+		const uint32_t code(DepthData::EncodeNormal(normal));
+		if (code == DepthData::NORMAL_OCT_ZERO)
+			return false;
+		return DepthData::DecodeNormal(code).dot(normal) >= thCosAngle;
+	};
+	if (DepthData::EncodeNormal(Normal::ZERO) != DepthData::NORMAL_OCT_ZERO ||
+		DepthData::DecodeNormal(DepthData::NORMAL_OCT_ZERO) != Normal::ZERO)
+		return false;
+	for (int axis=0; axis<3; ++axis) {
+		Normal normal(Normal::ZERO);
+		normal[axis] = 1.f;
+		if (!roundTrip(normal) || !roundTrip(-normal))
+			return false;
+	}
+	for (unsigned iter=0; iter<iters; ++iter) {
+		const Normal normal(normalized(Normal(randomGaussian(), randomGaussian(), randomGaussian())));
+		if (!roundTrip(normal))
+			return false;
+	}
+	return true;
+}
+/*----------------------------------------------------------------*/
@@ -69,6 +69,11 @@
 #define DENSE_EXP_FAST FEXP<true> // ~10% faster, but slightly less precise
 #define DENSE_EXP DENSE_EXP_DEFUALT
 
+// patch scoring engine used during depth-map estimation
+#define DENSE_SCORE_SINGLE 0 // score each view independently, sampling one texel at a time
+#define DENSE_SCORE_BATCH 1 // score all views in one call, warping and sampling texels with SSE/AVX2 if available
+#define DENSE_SCORE DENSE_SCORE_BATCH
+
 #define ComposeDepthFilePath(i, e) MAKE_PATH(String::FormatString(("depth%04u." + String(e)).c_str(), i))
 
 
@@ -127,7 +132,21 @@ extern unsigned nEstimateNormals;
 extern float fNCCThresholdKeep;
 extern unsigned nEstimationIters;
 extern unsigned nEstimationGeometricIters;
+extern unsigned nEstimationConcurrency;
+extern unsigned nEstimationPropagation;
+extern unsigned nEstimationSeed;
+extern unsigned nEstimationSkipSettled;
+extern unsigned nCacheSize;
+extern unsigned nImageCacheSize;
+extern unsigned nFusionPartitions;
+extern unsigned nDepthMapEncoding;
+extern unsigned nSGMPaths;
+extern unsigned nSGMMaxMemory;
+extern unsigned nSGMStripOverlap;
 extern float fEstimationGeometricWeight;
+extern float fEstimationDepthRange;
+extern float fEstimationGeometricScale;
+extern unsigned nEstimationGeometricCacheSize;
 extern unsigned nRandomIters;
 extern unsigned nRandomMaxScale;
 extern float fRandomDepthRatio;
@@ -141,20 +160,24 @@ extern float fRandomSmoothBonus;
 
 
 typedef TImage<ViewsID> ViewsMap;
+typedef TImage<uint32_t> NormalOctMap; // normal-map encoded compactly (see DepthData::EncodeNormal())
+typedef Image16F ConfidenceHalfMap; // confidence-map stored as half-floats
 
 template <int nTexels>
 struct WeightedPatchFix {
-	struct Pixel {
-		float weight;
-		float tempWeight;
-	};
-	Pixel weights[nTexels];
+	// stored as structure-of-arrays so that the texels can be processed in SIMD lanes
+	float weights[nTexels];
+	float tempWeights[nTexels];
 	float sumWeights;
 	float normSq0;
 	WeightedPatchFix() : normSq0(0) {}
 };
 
 struct MVS_API DepthData {
+	enum {
+		LOAD_MAPPED = (1<<4), // load flag: map the file in memory and page in only the accessed data
+		LOAD_COMPACT = (1<<5), // load flag: keep the normal and confidence maps compact, if stored so
+	};
 	struct ViewData {
 		float scale; // image scale relative to the reference image
 		Camera camera; // camera matrix corresponding to this image
@@ -213,11 +236,15 @@ struct MVS_API DepthData {
 	NormalMap normalMap; // normal-map in camera space
 	ConfidenceMap confMap; // confidence-map
 	ViewsMap viewsMap; // view-IDs map (indexing images vector starting after first view)
+	NormalOctMap normalMapOct; // compact normal-map, used instead of the normal-map if loaded compact
+	ConfidenceHalfMap confMapHalf; // compact confidence-map, used instead of the confidence-map if loaded compact
 	float dMin, dMax; // global depth range for this image
+	uint64_t fingerprint; // hash of the inputs this depth-map was estimated from (0 - unknown)
+	MappedFilePtr mapping; // file the maps are views into, if loaded memory-mapped
 	unsigned references; // how many times this depth-map is referenced (on 0 can be safely unloaded)
 	CriticalSection cs; // used to count references
 
-	inline DepthData() : references(0) {}
+	inline DepthData() : fingerprint(0), references(0) {}
 	DepthData(const DepthData&);
 
 	inline void ReleaseImages() {
@@ -231,6 +258,9 @@ struct MVS_API DepthData {
 		normalMap.release();
 		confMap.release();
 		viewsMap.release();
+		normalMapOct.release();
+		confMapHalf.release();
+		mapping.Release();
 	}
 
 	inline bool IsValid() const {
@@ -239,6 +269,66 @@ struct MVS_API DepthData {
 	inline bool IsEmpty() const {
 		return depthMap.empty();
 	}
+	inline size_t GetMemorySize() const {
+		return
+			depthMap.total()*depthMap.elemSize() +
+			normalMap.total()*normalMap.elemSize() +
+			confMap.total()*confMap.elemSize() +
+			viewsMap.total()*viewsMap.elemSize() +
+			normalMapOct.total()*normalMapOct.elemSize() +
+			confMapHalf.total()*confMapHalf.elemSize();
+	}
+
+	// access the normal (in camera space) and confidence maps, whether full or compact
+	inline bool HasNormalMap() const { return !normalMap.empty() || !normalMapOct.empty(); }
+	inline bool HasConfMap() const { return !confMap.empty() || !confMapHalf.empty(); }
+	inline Normal GetNormalMap(const ImageRef& x) const {
+		return normalMap.empty() ? DecodeNormal(normalMapOct(x)) : normalMap(x);
+	}
+	inline float GetConfMap(const ImageRef& x) const {
+		return confMap.empty() ? float(confMapHalf(x)) : confMap(x);
+	}
+	void ExpandCompactMaps();
+
+	// octahedral encoding of an unit normal as two 16-bit signed normalized values;
+	// the invalid (zero) normal is encoded as both values -32768, never produced by an unit normal
+	enum { NORMAL_OCT_ZERO = 0x80008000u };
+	static inline uint32_t EncodeNormal(const Normal& n) {
+		if (n == Normal::ZERO)
+			return NORMAL_OCT_ZERO;
+		const float invL1(1.f/(ABS(n.x)+ABS(n.y)+ABS(n.z)));
+		float u(n.x*invL1), v(n.y*invL1);
+		if (n.z < 0) {
+			const float pu(u);
+			u = (1.f-ABS(v))*(pu >= 0 ? 1.f : -1.f);
+			v = (1.f-ABS(pu))*(v >= 0 ? 1.f : -1.f);
+		}
+		const uint16_t qu((uint16_t)(int16_t)ROUND2INT(u*32767.f));
+		const uint16_t qv((uint16_t)(int16_t)ROUND2INT(v*32767.f));
+		return (uint32_t)qu | ((uint32_t)qv << 16);
+	}
+	static inline Normal DecodeNormal(uint32_t code) {
+		if (code == NORMAL_OCT_ZERO)
+			return Normal::ZERO;
+		Normal n(
+			(float)(int16_t)(uint16_t)(code & 0xFFFF)*(1.f/32767.f),
+			(float)(int16_t)(uint16_t)(code >> 16)*(1.f/32767.f),
+			0.f);
+		n.z = 1.f-ABS(n.x)-ABS(n.y);
+		if (n.z < 0) {
+			const float px(n.x);
+			n.x = (1.f-ABS(n.y))*(px >= 0 ? 1.f : -1.f);
+			n.y = (1.f-ABS(px))*(n.y >= 0 ? 1.f : -1.f);
+		}
+		return normalized(n);
+	}
+	// 8-bit encoding of a positive confidence, finer for small values
+	static inline uint8_t EncodeConfidence8(float c) {
+		return c <= 0 ? uint8_t(0) : (uint8_t)MINF(ROUND2INT(255.f*c/(1.f+c)), 254);
+	}
+	static inline float DecodeConfidence8(uint8_t q) {
+		return (float)q/(float)(255-q);
+	}
 
 	const ViewData& GetView() const { return images.front(); }
 	const Camera& GetCamera() const { return GetView().camera; }
@@ -248,11 +338,13 @@ struct MVS_API DepthData {
 
 	void ApplyIgnoreMask(const BitMatrix&);
 
-	bool Save(const String& fileName) const;
+	void ReleaseMapping();
+
+	bool Save(const String& fileName, unsigned encoding=0) const;
 	bool Load(const String& fileName, unsigned flags=15);
 
 	unsigned GetRef();
-	unsigned IncRef(const String& fileName);
+	unsigned IncRef(const String& fileName, unsigned flags=15);
 	unsigned DecRef();
 
 	#ifdef _USE_BOOST
@@ -273,6 +365,144 @@ typedef MVS_API CLISTDEFIDX(DepthData,IIndex) DepthDataArr;
 /*----------------------------------------------------------------*/
 
 
+// keeps released depth-maps loaded as long as they fit in the given memory budget,
+// evicting the least recently released ones first;
+// the cache owns one reference of each depth-map it keeps, which is handed over
+// to the first client acquiring it again; optionally depth-maps about to be needed
+// can be loaded in advance on a background thread
+class MVS_API DepthDataCache {
+public:
+	DepthDataCache();
+	~DepthDataCache();
+
+	void SetBudget(size_t nBytes);
+	inline size_t GetBudget() const { return nBudget; }
+	inline bool IsEnabled() const { return nBudget > 0; }
+
+	bool Acquire(DepthData&, const String& fileName, unsigned flags=15);
+	void Release(DepthData&);
+	void Prefetch(DepthData&, const String& fileName, unsigned flags=15);
+	void Clear();
+
+	void LogStats() const;
+
+protected:
+	void Evict();
+	void ProcessPrefetch();
+	static void* PrefetchThread(void*);
+
+protected:
+	struct Entry {
+		DepthData* pDepthData;
+		size_t nBytes;
+	};
+	typedef std::list<Entry> EntryList;
+	typedef std::unordered_map<const DepthData*, EntryList::iterator> EntryMap;
+	struct PrefetchRequest {
+		DepthData* pDepthData;
+		String fileName;
+		unsigned flags;
+	};
+	typedef cQueue<PrefetchRequest,const PrefetchRequest&,1> PrefetchQueue;
+
+	EntryList entries; // depth-maps kept loaded, most recently released first
+	EntryMap mapEntries; // fast look-up of the cached depth-maps
+	size_t nBudget; // maximum memory size of the cached depth-maps (0 - disabled)
+	size_t nBytes; // current memory size of the cached depth-maps
+	size_t nHits, nMisses, nEvictions, nPrefetches; // statistics
+	mutable CriticalSection cs; // protects the entries and statistics
+
+	PrefetchQueue prefetchQueue; // depth-maps waiting to be loaded in advance
+	Semaphore prefetchSem; // signals a new prefetch request
+	CriticalSection csPrefetch; // held while a prefetch request is processed
+	SEACAVE::Thread prefetchThread;
+	bool bStopPrefetch;
+};
+/*----------------------------------------------------------------*/
+
+
+// keeps the gray-scale images used to estimate the depth-maps, for each image and scale
+// requested by the neighbor views and the multi-resolution levels, so that each one is computed
+// only once and then shared by all depth-maps using it; the returned images share the cached data
+// and must not be modified; the least recently used images are evicted once over the memory budget
+class MVS_API ImagePyramidCache {
+public:
+	ImagePyramidCache();
+
+	void SetBudget(size_t nBytes);
+	inline size_t GetBudget() const { return nBudget; }
+	inline bool IsEnabled() const { return nBudget > 0; }
+
+	Image32F GetImage(const Image& imageData, float scale, float levelScale=1.f);
+	void Clear();
+
+	void LogStats() const;
+
+protected:
+	static uint64_t MakeKey(IIndex ID, float scale, float levelScale);
+	void Evict();
+
+protected:
+	struct Entry {
+		uint64_t key;
+		Image32F image;
+		size_t nBytes;
+	};
+	typedef std::list<Entry> EntryList;
+	typedef std::unordered_map<uint64_t, EntryList::iterator> EntryMap;
+
+	EntryList entries; // cached images, most recently used first
+	EntryMap mapEntries; // fast look-up of the cached images
+	size_t nBudget; // maximum memory size of the cached images (0 - disabled)
+	size_t nBytes; // current memory size of the cached images
+	size_t nHits, nMisses, nEvictions; // statistics
+	mutable CriticalSection cs; // protects the entries and statistics
+};
+/*----------------------------------------------------------------*/
+
+
+// keeps the neighbor depth-maps used by the geometric-consistent estimation, each loaded
+// only once (optionally at reduced resolution) and shared read-only by all the reference images using it;
+// the depth-maps are reference counted, and once released by all the reference images they are kept
+// till over the memory budget, the least recently released first
+class MVS_API DepthMapStore {
+public:
+	DepthMapStore();
+
+	void Init(float scale, size_t nBudget);
+
+	bool Acquire(IIndex ID, const String& fileName, DepthMap& depthMap, Camera& camera);
+	void Release(IIndex ID);
+	void Clear();
+
+	void LogStats() const;
+
+protected:
+	void Evict();
+
+protected:
+	typedef std::list<IIndex> IndexList;
+	struct Entry {
+		DepthMap depthMap;
+		Camera camera; // camera matrix corresponding to the depth-map
+		size_t nBytes;
+		unsigned nRefs; // number of reference images using the depth-map
+		IndexList::iterator itUnused; // position in the list of unused depth-maps (valid only if not referenced)
+	};
+	typedef std::unordered_map<IIndex, Entry> EntryMap;
+
+	EntryMap entries; // loaded depth-maps
+	IndexList unused; // depth-maps not referenced anymore, most recently released first
+	float scale; // scale of the loaded depth-maps
+	size_t nBudget; // maximum memory size of the unused depth-maps
+	size_t nBytes, nMaxBytes; // current and peak memory size of the loaded depth-maps
+	size_t nBytesUnused; // current memory size of the unused depth-maps
+	size_t nLoads, nShares, nEvictions; // statistics
+	mutable CriticalSection cs; // protects the entries and statistics
+};
+/*----------------------------------------------------------------*/
+
+
 struct MVS_API DepthEstimator {
 	enum { nSizeHalfWindow = 4 };
 	enum { nSizeWindow = nSizeHalfWindow*2+1 };
@@ -286,8 +516,17 @@ struct MVS_API DepthEstimator {
 		DIRS
 	};
 
+	enum ENPROPAGATION {
+		PROP_ZIGZAG = 0, // sequential sweeps over the zigzag ordered pixels, shared among all threads
+		PROP_CHECKERBOARD, // red-black half-sweeps over independent image tiles (deterministic)
+	};
+	enum { nTileSize = 64 }; // size of the tiles processed by one thread during checkerboard propagation
+
 	typedef TPoint2<uint16_t> MapRef;
 	typedef CLISTDEF0(MapRef) MapRefArr;
+	typedef CLISTDEF0(IDX) TileArr;
+	typedef TImage<uint8_t> SettledMap;
+	typedef TImage<TPoint2<Depth>> DepthRangeMap;
 
 	typedef Eigen::Matrix<float,nTexels,1> TexelVec;
 	struct NeighborData {
@@ -359,9 +598,16 @@ struct MVS_API DepthEstimator {
 	const Image64F& image0Sum; // integral image used to fast compute patch mean intensity
 	#endif
 	const MapRefArr& coords;
+	const TileArr* tiles; // index of the first pixel of each tile in coords (checkerboard propagation only)
+	IDX idxTileEnd; // process tiles till this index (current half-sweep)
+	float thConfKeep; // maximum score of the estimates kept when finalizing the depth-map
+	SettledMap* settledMap; // number of consecutive iterations each pixel estimate did not change (NULL - process all pixels)
+	const DepthRangeMap* depthRangeMap; // depth search interval of each pixel, estimated at the coarser resolution level (NULL - [dMin,dMax])
+	size_t nSkipped; // number of settled pixels skipped by this estimator
 	const Image8U::Size size;
 	const Depth dMin, dMax;
 	const Depth dMinSqr, dMaxSqr;
+	Depth dMinPixel, dMaxPixel; // depth search interval of the current pixel
 	const ENDIRECTION dir;
 	#if DENSE_AGGNCC == DENSE_AGGNCC_NTH || DENSE_AGGNCC == DENSE_AGGNCC_MINMEAN
 	const IDX idxScore;
@@ -379,8 +625,16 @@ struct MVS_API DepthEstimator {
 	bool PreparePixelPatch(const ImageRef&);
 	bool FillPixelPatch();
 	float ScorePixelImage(const DepthData::ViewData& image1, Depth, const Normal&);
+	#if DENSE_SCORE == DENSE_SCORE_BATCH
+	bool ScorePatchNCC(const DepthData::ViewData& image1, Depth, const Normal&, float& score) const;
+	void ScorePixelImages(Depth, const Normal&);
+	#endif
+	float ScoreGeometricConsistency(const DepthData::ViewData& image1, Depth) const;
 	float ScorePixel(Depth, const Normal&);
 	void ProcessPixel(IDX idx);
+	void ProcessPixel(const ImageRef&);
+	void EstimatePixel(const ImageRef&);
+	bool IsPixelSettled(const ImageRef&) const;
 	Depth InterpolatePixel(const ImageRef&, Depth, const Normal&) const;
 	#if DENSE_SMOOTHNESS == DENSE_SMOOTHNESS_PLANE
 	void InitPlane(Depth, const Normal&);
@@ -432,10 +686,23 @@ struct MVS_API DepthEstimator {
 	}
 
 	// generate random depth and normal
+	// reset the random generator to a state depending only on the given tile,
+	// such that the estimates do not depend on the order the tiles are processed
+	inline void SeedTile(IDX idxTile, unsigned pass) {
+		std::seed_seq seq{OPTDENSE::nEstimationSeed, nIteration, pass, (unsigned)idxTile};
+		rnd.seed(seq);
+	}
+
 	inline Depth RandomDepth(Depth dMinSqr, Depth dMaxSqr) {
 		ASSERT(dMinSqr > 0 && dMinSqr < dMaxSqr);
 		return SQUARE(rnd.randomRange(dMinSqr, dMaxSqr));
 	}
+	// random depth inside the search interval of the current pixel
+	inline Depth RandomPixelDepth() {
+		if (depthRangeMap == NULL)
+			return RandomDepth(dMinSqr, dMaxSqr);
+		return RandomDepth(SQRT(dMinPixel), SQRT(dMaxPixel));
+	}
 	inline Normal RandomNormal(const Point3f& viewRay) {
 		Normal normal;
 		Dir2Normal(Point2f(rnd.randomRange(FD2R(0.f),FD2R(180.f)), rnd.randomRange(FD2R(90.f),FD2R(180.f))), normal);
@@ -453,7 +720,9 @@ struct MVS_API DepthEstimator {
 	}
 
 	static bool ImportIgnoreMask(const Image&, const Image8U::Size&, uint16_t nIgnoreMaskLabel, BitMatrix&, Image8U* =NULL);
+	static void MapMatrix2CheckerboardIdx(const Image8U::Size& size, DepthEstimator::MapRefArr& coords, DepthEstimator::TileArr& tiles, const BitMatrix& mask, int tileSize);
 	static void MapMatrix2ZigzagIdx(const Image8U::Size& size, DepthEstimator::MapRefArr& coords, const BitMatrix& mask, int rawStride=16);
+	static void ComputeDepthRangeMap(const DepthData& depthData, DepthRangeMap& depthRangeMap);
 
 	const float smoothBonusDepth, smoothBonusNormal;
 	const float smoothSigmaDepth, smoothSigmaNormal;
@@ -506,19 +775,30 @@ MVS_API bool ExportNormalMap(const String& fileName, const NormalMap& normalMap)
 MVS_API bool ExportConfidenceMap(const String& fileName, const ConfidenceMap& confMap);
 MVS_API bool ExportPointCloud(const String& fileName, const Image&, const DepthMap&, const NormalMap&);
 
+// 64-bit FNV-1a hash, used to fingerprint the inputs of the depth-maps
+inline uint64_t HashFNV64(const void* data, size_t size, uint64_t hash=0xcbf29ce484222325ull) {
+	const uint8_t* const bytes((const uint8_t*)data);
+	for (size_t i=0; i<size; ++i)
+		hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+	return hash;
+}
+
 MVS_API bool ExportDepthDataRaw(const String&, const String& imageFileName,
 	const IIndexArr&, const cv::Size& imageSize,
 	const KMatrix&, const RMatrix&, const CMatrix&,
 	Depth dMin, Depth dMax,
-	const DepthMap&, const NormalMap&, const ConfidenceMap&, const ViewsMap&);
+	const DepthMap&, const NormalMap&, const ConfidenceMap&, const ViewsMap&, unsigned encoding=0, uint64_t fingerprint=0);
 MVS_API bool ImportDepthDataRaw(const String&, String& imageFileName,
 	IIndexArr&, cv::Size& imageSize,
 	KMatrix&, RMatrix&, CMatrix&,
 	Depth& dMin, Depth& dMax,
-	DepthMap&, NormalMap&, ConfidenceMap&, ViewsMap&, unsigned flags=15);
+	DepthMap&, NormalMap&, ConfidenceMap&, ViewsMap&, unsigned flags=15, MappedFilePtr* pMapping=NULL,
+	NormalOctMap* pNormalMapOct=NULL, ConfidenceHalfMap* pConfMapHalf=NULL, uint64_t* pFingerprint=NULL);
 
 MVS_API void CompareDepthMaps(const DepthMap& depthMap, const DepthMap& depthMapGT, uint32_t idxImage, float threshold=0.01f);
 MVS_API void CompareNormalMaps(const NormalMap& normalMap, const NormalMap& normalMapGT, uint32_t idxImage);
+
+MVS_API bool TestDepthDataEncoding(unsigned iters);
 /*----------------------------------------------------------------*/
 
 } // namespace MVS
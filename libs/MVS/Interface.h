@@ -770,24 +770,40 @@ struct Interface
 //  - normal-map (optional): the 3D point normal in camera space; same resolution as the depth-map
 //  - confidence-map (optional): the 3D point confidence (usually a value in [0,1]); same resolution as the depth-map
 //  - views-map (optional): the pixels' views, indexing image-IDs starting after first view (up to 4); same resolution as the depth-map
+// starting with version 1, each map is stored at an offset aligned to the page size,
+// so that it can be read independently or memory-mapped and used in place
 struct HeaderDepthDataRaw {
 	enum {
 		HAS_DEPTH = (1<<0),
 		HAS_NORMAL = (1<<1),
 		HAS_CONF = (1<<2),
 		HAS_VIEWS = (1<<3),
+		// compact encodings (version 1 only)
+		DEPTH_HALF = (1<<4), // depth stored as 16-bit float
+		NORMAL_OCT = (1<<5), // normal stored octahedral encoded as two 16-bit signed normalized values
+		CONF_HALF = (1<<6), // confidence stored as 16-bit float
+		CONF_BYTE = (1<<7), // confidence c stored as 8-bit unsigned normalized value of c/(1+c)
 	};
+	enum {
+		VERSION_CONTIGUOUS = 0, // maps stored one after the other right after the pose
+		VERSION_ALIGNED = 1, // maps stored at the offsets listed right after the pose
+		VERSION_FINGERPRINT = 2, // as version 1, plus the fingerprint of the estimation inputs right after the offsets
+		VERSION_LAST = VERSION_FINGERPRINT
+	};
+	enum { LAYER_ALIGNMENT = 4096 }; // alignment of the maps in version 1 files
 	uint16_t name; // file type
 	uint8_t type; // content type
-	uint8_t padding; // reserve
+	uint8_t version; // file format version (0 in older files, where this was reserved)
 	uint32_t imageWidth, imageHeight; // image resolution
 	uint32_t depthWidth, depthHeight; // depth-map resolution
 	float dMin, dMax; // depth range for this view
 	// image file name length followed by the characters: uint16_t nFileNameSize; char* FileName
 	// number of view IDs followed by view ID and neighbor view IDs: uint32_t nIDs; uint32_t* IDs
 	// camera, rotation and position matrices (row-major) at image resolution: double K[3][3], R[3][3], C[3]
+	// version 1+ only: file offset of each map (0 if missing), multiple of LAYER_ALIGNMENT: uint64_t depthOffset, normalOffset, confOffset, viewsOffset
+	// version 2+ only: hash of the images, poses and options the maps were estimated from (0 if unknown): uint64_t fingerprint
 	// depth, normal, confidence maps: float depthMap[height][width], normalMap[height][width][3], confMap[height][width]
-	inline HeaderDepthDataRaw() : name(0), type(0), padding(0) {}
+	inline HeaderDepthDataRaw() : name(0), type(0), version(0) {}
 	static uint16_t HeaderDepthDataRawName() { return *reinterpret_cast<const uint16_t*>("DR"); }
 };
 /*----------------------------------------------------------------*/
@@ -0,0 +1,564 @@
+/*
+* MaxFlow.cpp
+*
+* Copyright (c) 2014-2024 SEACAVE
+*
+* Author(s):
+*
+*      cDc <cdc.seacave@gmail.com>
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+* Additional Terms:
+*
+*      You are required to preserve legal notices and author attributions in
+*      that material or in the Appropriate Legal Notices displayed by works
+*      containing it.
+*/
+
+
+#include "Common.h"
+#include "MaxFlow.h"
+#include "../Math/IBFS/IBFS.h"
+#include <boost/graph/graph_traits.hpp>
+#include <boost/graph/one_bit_color_map.hpp>
+#include <boost/property_map/property_map.hpp>
+#include <boost/graph/adjacency_list.hpp>
+#include <boost/graph/boykov_kolmogorov_max_flow.hpp>
+#include <atomic>
+
+using namespace MVS;
+
+
+// D E F I N E S ///////////////////////////////////////////////////
+
+#define MAXFLOWGRAPH_HEADER "MFG"
+#define MAXFLOWGRAPH_VERSION 1
+
+
+// S T R U C T S ///////////////////////////////////////////////////
+
+void MaxFlowGraph::Init(size_t numNodes, size_t numEdges)
+{
+	nodes.assign(numNodes, Node{0, 0});
+	edges.clear();
+	edges.reserve(numEdges);
+}
+void MaxFlowGraph::Release()
+{
+	std::vector<Node>().swap(nodes);
+	std::vector<Edge>().swap(edges);
+}
+/*----------------------------------------------------------------*/
+
+
+// load/save the graph in a binary file containing:
+// the header, the number of nodes and edges, followed by the raw nodes and edges
+bool MaxFlowGraph::Load(const String& fileName)
+{
+	File f(fileName, File::READ, File::OPEN);
+	if (!f.isOpen())
+		return false;
+	char header[4];
+	uint32_t version;
+	uint64_t numNodes, numEdges;
+	if (f.read(header, 4) != 4 || strncmp(header, MAXFLOWGRAPH_HEADER, 4) != 0 ||
+		f.read(&version, sizeof(uint32_t)) != sizeof(uint32_t) || version != MAXFLOWGRAPH_VERSION ||
+		f.read(&numNodes, sizeof(uint64_t)) != sizeof(uint64_t) ||
+		f.read(&numEdges, sizeof(uint64_t)) != sizeof(uint64_t))
+		return false;
+	nodes.resize((size_t)numNodes);
+	edges.resize((size_t)numEdges);
+	return
+		f.read(nodes.data(), sizeof(Node)*nodes.size()) == sizeof(Node)*nodes.size() &&
+		f.read(edges.data(), sizeof(Edge)*edges.size()) == sizeof(Edge)*edges.size();
+}
+bool MaxFlowGraph::Save(const String& fileName) const
+{
+	File f(fileName, File::WRITE, File::CREATE | File::TRUNCATE);
+	if (!f.isOpen())
+		return false;
+	const uint32_t version(MAXFLOWGRAPH_VERSION);
+	const uint64_t numNodes(nodes.size()), numEdges(edges.size());
+	return
+		f.write(MAXFLOWGRAPH_HEADER, 4) == 4 &&
+		f.write(&version, sizeof(uint32_t)) == sizeof(uint32_t) &&
+		f.write(&numNodes, sizeof(uint64_t)) == sizeof(uint64_t) &&
+		f.write(&numEdges, sizeof(uint64_t)) == sizeof(uint64_t) &&
+		f.write(nodes.data(), sizeof(Node)*nodes.size()) == sizeof(Node)*nodes.size() &&
+		f.write(edges.data(), sizeof(Edge)*edges.size()) == sizeof(Edge)*edges.size();
+}
+/*----------------------------------------------------------------*/
+
+
+namespace {
+
+// max-flow solver using the IBFS algorithm
+// (fast, but not clear license policy)
+class MaxFlowIBFS : public MaxFlow
+{
+public:
+	void Init(size_t numNodes, size_t numEdges) override {
+		graph.initSize((int)numNodes, (int)numEdges);
+	}
+
+	void AddNode(node_type n, value_type source, value_type sink) override {
+		ASSERT(ISFINITE(source) && source >= 0 && ISFINITE(sink) && sink >= 0);
+		graph.addNode((int)n, source, sink);
+	}
+
+	void AddEdge(node_type n1, node_type n2, value_type capacity, value_type reverseCapacity) override {
+		ASSERT(ISFINITE(capacity) && capacity >= 0 && ISFINITE(reverseCapacity) && reverseCapacity >= 0);
+		graph.addEdge((int)n1, (int)n2, capacity, reverseCapacity);
+	}
+
+	value_type ComputeMaxFlow() override {
+		graph.initGraph();
+		return graph.computeMaxFlow();
+	}
+
+	bool IsNodeOnSrcSide(node_type n) const override {
+		return graph.isNodeOnSrcSide((int)n);
+	}
+
+protected:
+	IBFS::IBFSGraph graph;
+};
+/*----------------------------------------------------------------*/
+
+
+// max-flow solver using the Boykov-Kolmogorov algorithm implemented in Boost
+class MaxFlowBK : public MaxFlow
+{
+public:
+	// Type-Definitions
+	typedef boost::vecS out_edge_list_t;
+	typedef boost::vecS vertex_list_t;
+	typedef boost::adjacency_list_traits<out_edge_list_t, vertex_list_t, boost::directedS> graph_traits;
+	typedef graph_traits::edge_descriptor edge_descriptor;
+	typedef graph_traits::vertex_descriptor vertex_descriptor;
+	typedef graph_traits::vertices_size_type vertex_size_type;
+	struct Edge {
+		value_type capacity;
+		value_type residual;
+		edge_descriptor reverse;
+	};
+	typedef boost::adjacency_list<out_edge_list_t, vertex_list_t, boost::directedS, size_t, Edge> graph_type;
+
+public:
+	void Init(size_t numNodes, size_t /*numEdges*/) override {
+		graph_type(numNodes+2).swap(graph);
+		S = (node_type)numNodes;
+		T = (node_type)numNodes+1;
+	}
+
+	void AddNode(node_type n, value_type source, value_type sink) override {
+		ASSERT(ISFINITE(source) && source >= 0 && ISFINITE(sink) && sink >= 0);
+		if (source > 0)
+			LinkNodes(S, n, source, 0);
+		if (sink > 0)
+			LinkNodes(n, T, sink, 0);
+	}
+
+	void AddEdge(node_type n1, node_type n2, value_type capacity, value_type reverseCapacity) override {
+		ASSERT(ISFINITE(capacity) && capacity >= 0 && ISFINITE(reverseCapacity) && reverseCapacity >= 0);
+		LinkNodes(n1, n2, capacity, reverseCapacity);
+	}
+
+	value_type ComputeMaxFlow() override {
+		const vertex_size_type n_verts(boost::num_vertices(graph));
+		color.resize(n_verts);
+		std::vector<edge_descriptor> pred(n_verts);
+		std::vector<vertex_size_type> dist(n_verts);
+		const value_type flow(boost::boykov_kolmogorov_max_flow(graph,
+			boost::get(&Edge::capacity, graph),
+			boost::get(&Edge::residual, graph),
+			boost::get(&Edge::reverse, graph),
+			&pred[0],
+			&color[0],
+			&dist[0],
+			boost::get(boost::vertex_index, graph),
+			S, T
+		));
+		// only the colors are needed to find the minimum cut
+		graph_type().swap(graph);
+		return flow;
+	}
+
+	bool IsNodeOnSrcSide(node_type n) const override {
+		return (color[n] != boost::white_color);
+	}
+
+protected:
+	void LinkNodes(node_type n1, node_type n2, value_type capacity, value_type reverseCapacity) {
+		const edge_descriptor e(boost::add_edge(n1, n2, graph).first);
+		const edge_descriptor er(boost::add_edge(n2, n1, graph).first);
+		graph[e].capacity = capacity;
+		graph[er].capacity = reverseCapacity;
+		graph[e].reverse = er;
+		graph[er].reverse = e;
+	}
+
+protected:
+	graph_type graph;
+	node_type S, T; // source and sink nodes
+	std::vector<boost::default_color_type> color;
+};
+/*----------------------------------------------------------------*/
+
+
+// multi-threaded max-flow solver using the lock-free push-relabel algorithm from:
+// "An asynchronous multithreaded algorithm for the maximum network flow problem with nonblocking global relabeling heuristic",
+// Hong and He, 2011
+// each active node is discharged by a single thread, pushing its excess to its lowest residual neighbor
+// (or relabeling itself), while the excess and residual capacities are updated atomically;
+// the active nodes are processed in rounds, between which the heights are periodically set
+// to the exact distances to the sink by a breadth-first search (global relabeling);
+// only the first phase is run (maximum pre-flow), enough to find the flow value and the minimum cut
+class MaxFlowPushRelabel : public MaxFlow
+{
+public:
+	typedef uint32_t arc_type;
+
+public:
+	MaxFlowPushRelabel(unsigned _nMaxThreads) : nMaxThreads(_nMaxThreads) {}
+
+	void Init(size_t _numNodes, size_t numEdges) override {
+		numNodes = (node_type)_numNodes;
+		nodes.assign(numNodes, MaxFlowGraph::Node{0, 0});
+		edges.clear();
+		edges.reserve(numEdges);
+	}
+
+	void AddNode(node_type n, value_type source, value_type sink) override {
+		ASSERT(ISFINITE(source) && source >= 0 && ISFINITE(sink) && sink >= 0);
+		nodes[n] = MaxFlowGraph::Node{source, sink};
+	}
+
+	void AddEdge(node_type n1, node_type n2, value_type capacity, value_type reverseCapacity) override {
+		ASSERT(ISFINITE(capacity) && capacity >= 0 && ISFINITE(reverseCapacity) && reverseCapacity >= 0);
+		ASSERT(n1 < numNodes && n2 < numNodes && n1 != n2);
+		edges.push_back(MaxFlowGraph::Edge{n1, n2, capacity, reverseCapacity});
+	}
+
+	value_type ComputeMaxFlow() override {
+		hMax = numNodes+1;
+		ASSERT(edges.size()*2 < std::numeric_limits<arc_type>::max());
+		numArcs = (arc_type)edges.size()*2;
+		InitGraph();
+		// discharge the active nodes in rounds
+		std::vector<node_type> activeNodes;
+		const size_t thWork((size_t)numNodes*6+numArcs);
+		std::vector<std::vector<node_type>> threadsActiveNodes(nMaxThreads);
+		std::vector<double> threadsFlow(nMaxThreads, 0.0);
+		std::vector<size_t> threadsWork(nMaxThreads, 0);
+		size_t work(0);
+		for (uint32_t round=1; ; ++round) {
+			if (activeNodes.empty() || work > thWork) {
+				// update the heights, and stop if no active node is left,
+				// the nodes not reaching anymore the sink forming the source side of the minimum cut
+				GlobalRelabel(activeNodes);
+				if (activeNodes.empty())
+					break;
+				work = 0;
+			}
+			#ifdef _USE_OPENMP
+			#pragma omp parallel for schedule(dynamic, 64) num_threads(nMaxThreads)
+			for (int64_t i=0; i<(int64_t)activeNodes.size(); ++i) {
+				const int idxThread(omp_get_thread_num());
+			#else
+			for (size_t i=0; i<activeNodes.size(); ++i) {
+				const int idxThread(0);
+			#endif
+				Discharge(activeNodes[i], round+1, threadsActiveNodes[idxThread], threadsFlow[idxThread], threadsWork[idxThread]);
+			}
+			activeNodes.clear();
+			for (unsigned t=0; t<nMaxThreads; ++t) {
+				activeNodes.insert(activeNodes.end(), threadsActiveNodes[t].cbegin(), threadsActiveNodes[t].cend());
+				threadsActiveNodes[t].clear();
+				work += threadsWork[t];
+				threadsWork[t] = 0;
+			}
+		}
+		for (double f: threadsFlow)
+			flow += f;
+		// release the residual graph, keeping only the heights
+		ReleaseGraph();
+		return (value_type)flow;
+	}
+
+	bool IsNodeOnSrcSide(node_type n) const override {
+		return heights[n] >= hMax;
+	}
+
+protected:
+	// build the residual graph in compressed sparse row layout, releasing the added edges,
+	// and push directly the flow from the source to the sink through each node
+	void InitGraph() {
+		arcsBegin.assign(numNodes+1, 0);
+		for (const MaxFlowGraph::Edge& e: edges) {
+			++arcsBegin[e.n1+1];
+			++arcsBegin[e.n2+1];
+		}
+		for (node_type n=0; n<numNodes; ++n)
+			arcsBegin[n+1] += arcsBegin[n];
+		std::vector<arc_type> arcsEnd(arcsBegin.cbegin(), arcsBegin.cend()-1);
+		heads.resize(numArcs);
+		reverses.resize(numArcs);
+		residuals = std::vector<std::atomic<value_type>>(numArcs);
+		for (const MaxFlowGraph::Edge& e: edges) {
+			const arc_type a(arcsEnd[e.n1]++), ar(arcsEnd[e.n2]++);
+			heads[a] = e.n2; residuals[a] = e.capacity; reverses[a] = ar;
+			heads[ar] = e.n1; residuals[ar] = e.reverseCapacity; reverses[ar] = a;
+		}
+		std::vector<MaxFlowGraph::Edge>().swap(edges);
+		excesses = std::vector<std::atomic<value_type>>(numNodes);
+		sinkResiduals.resize(numNodes);
+		heights = std::vector<std::atomic<node_type>>(numNodes);
+		stamps = std::vector<std::atomic<uint32_t>>(numNodes);
+		flow = 0;
+		FOREACH(n, nodes) {
+			const MaxFlowGraph::Node& node = nodes[n];
+			const value_type f(MINF(node.source, node.sink));
+			flow += f;
+			excesses[n] = node.source-f;
+			sinkResiduals[n] = node.sink-f;
+			stamps[n] = 0;
+		}
+		std::vector<MaxFlowGraph::Node>().swap(nodes);
+	}
+	void ReleaseGraph() {
+		std::vector<arc_type>().swap(arcsBegin);
+		std::vector<node_type>().swap(heads);
+		std::vector<arc_type>().swap(reverses);
+		std::vector<std::atomic<value_type>>().swap(residuals);
+		std::vector<std::atomic<value_type>>().swap(excesses);
+		std::vector<value_type>().swap(sinkResiduals);
+		std::vector<std::atomic<uint32_t>>().swap(stamps);
+	}
+
+	// push the excess of the given node to its lowest residual neighbors, relabeling it as needed,
+	// until it has no excess left or it cannot reach the sink anymore;
+	// the neighbors receiving excess are scheduled for the next round
+	void Discharge(node_type u, uint32_t nextRound, std::vector<node_type>& nextActiveNodes, double& flowSink, size_t& work) {
+		node_type h(heights[u]);
+		value_type e;
+		while ((e=excesses[u]) > 0 && h < hMax) {
+			// find the lowest residual neighbor, the sink being the lowest
+			node_type hMin(hMax);
+			arc_type aMin(NO_ID);
+			if (sinkResiduals[u] > 0) {
+				hMin = 0;
+			} else {
+				for (arc_type a=arcsBegin[u]; a<arcsBegin[u+1]; ++a) {
+					if (residuals[a] <= 0)
+						continue;
+					const node_type hw(heights[heads[a]]);
+					if (hMin > hw) {
+						hMin = hw;
+						aMin = a;
+					}
+				}
+				work += arcsBegin[u+1]-arcsBegin[u];
+			}
+			if (h <= hMin) {
+				// relabel
+				h = hMin+1;
+				heights[u] = h;
+				continue;
+			}
+			// push
+			if (aMin == NO_ID) {
+				const value_type d(MINF(e, sinkResiduals[u]));
+				sinkResiduals[u] -= d;
+				AtomicAdd(excesses[u], -d);
+				flowSink += d;
+			} else {
+				const value_type d(MINF(e, residuals[aMin].load()));
+				AtomicAdd(residuals[aMin], -d);
+				AtomicAdd(residuals[reverses[aMin]], d);
+				AtomicAdd(excesses[u], -d);
+				const node_type w(heads[aMin]);
+				if (AtomicAdd(excesses[w], d) <= 0)
+					Schedule(w, nextRound, nextActiveNodes);
+			}
+		}
+	}
+
+	// set the heights to the distance to the sink in the residual graph, using a parallel breadth-first search,
+	// the nodes not reaching the sink getting the height hMax, and collect the active nodes
+	void GlobalRelabel(std::vector<node_type>& activeNodes) {
+		std::vector<node_type> frontier;
+		for (node_type n=0; n<numNodes; ++n) {
+			if (sinkResiduals[n] > 0) {
+				heights[n] = 1;
+				frontier.push_back(n);
+			} else {
+				heights[n] = hMax;
+			}
+		}
+		std::vector<std::vector<node_type>> threadsFrontier(nMaxThreads);
+		for (node_type h=2; !frontier.empty(); ++h) {
+			#ifdef _USE_OPENMP
+			#pragma omp parallel for schedule(dynamic, 256) num_threads(nMaxThreads)
+			for (int64_t i=0; i<(int64_t)frontier.size(); ++i) {
+				std::vector<node_type>& nextFrontier = threadsFrontier[omp_get_thread_num()];
+			#else
+			for (size_t i=0; i<frontier.size(); ++i) {
+				std::vector<node_type>& nextFrontier = threadsFrontier[0];
+			#endif
+				const node_type u(frontier[i]);
+				for (arc_type a=arcsBegin[u]; a<arcsBegin[u+1]; ++a) {
+					// the reverse arc goes from the neighbor to this node
+					if (residuals[reverses[a]] <= 0)
+						continue;
+					const node_type w(heads[a]);
+					node_type hw(hMax);
+					if (heights[w] == hMax && heights[w].compare_exchange_strong(hw, h))
+						nextFrontier.push_back(w);
+				}
+			}
+			frontier.clear();
+			for (std::vector<node_type>& nextFrontier: threadsFrontier) {
+				frontier.insert(frontier.end(), nextFrontier.cbegin(), nextFrontier.cend());
+				nextFrontier.clear();
+			}
+		}
+		activeNodes.clear();
+		for (node_type n=0; n<numNodes; ++n) {
+			if (excesses[n] > 0 && heights[n] < hMax)
+				activeNodes.push_back(n);
+		}
+	}
+
+	// add the node to the active nodes of the next round, if not already scheduled
+	void Schedule(node_type n, uint32_t nextRound, std::vector<node_type>& nextActiveNodes) {
+		uint32_t round(stamps[n]);
+		if (round != nextRound && stamps[n].compare_exchange_strong(round, nextRound))
+			nextActiveNodes.push_back(n);
+	}
+
+	// add atomically the given value and return the previous one
+	static value_type AtomicAdd(std::atomic<value_type>& a, value_type v) {
+		value_type prev(a);
+		while (!a.compare_exchange_weak(prev, prev+v));
+		return prev;
+	}
+
+protected:
+	const unsigned nMaxThreads;
+	std::vector<MaxFlowGraph::Node> nodes; // capacities of the added nodes (released once the residual graph is built)
+	std::vector<MaxFlowGraph::Edge> edges; // added edges (released once the residual graph is built)
+	node_type numNodes;
+	node_type hMax; // height of the nodes not reaching the sink (longer than any path to the sink)
+	arc_type numArcs;
+	std::vector<arc_type> arcsBegin; // first arc of each node, plus the total number of arcs
+	std::vector<node_type> heads; // node each arc points to
+	std::vector<arc_type> reverses; // reverse of each arc
+	std::vector<std::atomic<value_type>> residuals; // residual capacity of each arc
+	std::vector<std::atomic<value_type>> excesses; // excess flow of each node
+	std::vector<value_type> sinkResiduals; // residual capacity from each node to the sink
+	std::vector<std::atomic<node_type>> heights; // distance label of each node
+	std::vector<std::atomic<uint32_t>> stamps; // last round each node was scheduled for
+	double flow; // flow pushed to the sink
+};
+/*----------------------------------------------------------------*/
+
+} // unnamed namespace
+
+
+// add the given graph to the solver
+void MaxFlow::SetGraph(const MaxFlowGraph& graph)
+{
+	Init(graph.nodes.size(), graph.edges.size());
+	FOREACH(n, graph.nodes)
+		AddNode((node_type)n, graph.nodes[n].source, graph.nodes[n].sink);
+	for (const MaxFlowGraph::Edge& e: graph.edges)
+		AddEdge(e.n1, e.n2, e.capacity, e.reverseCapacity);
+}
+
+MaxFlow* MaxFlow::Create(TYPE type, unsigned nMaxThreads)
+{
+	switch (type) {
+	case MAXFLOW_IBFS:
+		return new MaxFlowIBFS;
+	case MAXFLOW_BK:
+		return new MaxFlowBK;
+	case MAXFLOW_PUSHRELABEL:
+		return new MaxFlowPushRelabel(Thread::getMaxThreads(nMaxThreads));
+	default:
+		return NULL;
+	}
+}
+
+LPCSTR MaxFlow::GetName(TYPE type)
+{
+	switch (type) {
+	case MAXFLOW_IBFS:
+		return "IBFS";
+	case MAXFLOW_BK:
+		return "Boykov-Kolmogorov";
+	case MAXFLOW_PUSHRELABEL:
+		return "push-relabel";
+	default:
+		return "unknown";
+	}
+}
+/*----------------------------------------------------------------*/
+
+
+// test the solvers on small random graphs with integer capacities:
+// all must find the same flow, equal to the capacity of the cut each of them finds
+// (so the cut is a valid minimum cut)
+bool MVS::TestMaxFlow(unsigned iters)
+{
+	for (unsigned iter=0; iter<iters; ++iter) {
+		MaxFlowGraph graph;
+		const MaxFlowGraph::node_type numNodes(2+RAND()%200);
+		const unsigned numEdges(RAND()%(numNodes*4));
+		graph.Init(numNodes, numEdges);
+		for (MaxFlowGraph::node_type n=0; n<numNodes; ++n)
+			graph.AddNode(n, RAND()%3 == 0 ? (float)(RAND()%100) : 0.f, RAND()%3 == 0 ? (float)(RAND()%100) : 0.f);
+		for (unsigned e=0; e<numEdges; ++e) {
+			const MaxFlowGraph::node_type n1(RAND()%numNodes), n2(RAND()%numNodes);
+			if (n1 != n2)
+				graph.AddEdge(n1, n2, (float)(RAND()%50), (float)(RAND()%50));
+		}
+		double flowRef(0);
+		for (int type=0; type<MaxFlow::MAXFLOW_NUM_TYPES; ++type) {
+			const MaxFlowPtr solver(MaxFlow::Create((MaxFlow::TYPE)type, 4));
+			solver->SetGraph(graph);
+			const double flow(solver->ComputeMaxFlow());
+			double cut(0);
+			FOREACH(n, graph.nodes)
+				cut += solver->IsNodeOnSrcSide((MaxFlow::node_type)n) ? graph.nodes[n].sink : graph.nodes[n].source;
+			for (const MaxFlowGraph::Edge& e: graph.edges) {
+				const bool bSrc1(solver->IsNodeOnSrcSide(e.n1)), bSrc2(solver->IsNodeOnSrcSide(e.n2));
+				if (bSrc1 && !bSrc2)
+					cut += e.capacity;
+				else if (bSrc2 && !bSrc1)
+					cut += e.reverseCapacity;
+			}
+			if (type == MaxFlow::MAXFLOW_IBFS)
+				flowRef = flow;
+			const double th(1e-4*MAXF(flowRef, 1.0));
+			if (ABS(cut-flow) > th || ABS(flow-flowRef) > th)
+				return false;
+		}
+	}
+	return true;
+}
+/*----------------------------------------------------------------*/
@@ -0,0 +1,135 @@
+/*
+* MaxFlow.h
+*
+* Copyright (c) 2014-2024 SEACAVE
+*
+* Author(s):
+*
+*      cDc <cdc.seacave@gmail.com>
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+* Additional Terms:
+*
+*      You are required to preserve legal notices and author attributions in
+*      that material or in the Appropriate Legal Notices displayed by works
+*      containing it.
+*/
+
+
+#ifndef _MVS_MAXFLOW_H_
+#define _MVS_MAXFLOW_H_
+
+
+// I N C L U D E S /////////////////////////////////////////////////
+
+
+// D E F I N E S ///////////////////////////////////////////////////
+
+
+// S T R U C T S ///////////////////////////////////////////////////
+
+namespace MVS {
+
+// graph of a max-flow / min-cut problem: each node is linked to the source and the sink
+// by the given capacities, and the nodes are linked by edges with a capacity in each direction;
+// can be saved and loaded, in order to compare the solvers on real graphs
+class MVS_API MaxFlowGraph
+{
+public:
+	typedef uint32_t node_type;
+	typedef float value_type;
+
+	struct Node {
+		value_type source; // capacity from the source
+		value_type sink; // capacity to the sink
+	};
+	struct Edge {
+		node_type n1, n2; // linked nodes
+		value_type capacity; // capacity from n1 to n2
+		value_type reverseCapacity; // capacity from n2 to n1
+	};
+
+public:
+	std::vector<Node> nodes;
+	std::vector<Edge> edges;
+
+public:
+	void Init(size_t numNodes, size_t numEdges=0);
+	void Release();
+
+	inline bool IsEmpty() const { return nodes.empty(); }
+
+	inline void AddNode(node_type n, value_type source, value_type sink) {
+		ASSERT(ISFINITE(source) && source >= 0 && ISFINITE(sink) && sink >= 0);
+		nodes[n].source = source;
+		nodes[n].sink = sink;
+	}
+	inline void AddEdge(node_type n1, node_type n2, value_type capacity, value_type reverseCapacity) {
+		ASSERT(ISFINITE(capacity) && capacity >= 0 && ISFINITE(reverseCapacity) && reverseCapacity >= 0);
+		ASSERT(n1 < nodes.size() && n2 < nodes.size() && n1 != n2);
+		edges.push_back(Edge{n1, n2, capacity, reverseCapacity});
+	}
+
+	bool Load(const String& fileName);
+	bool Save(const String& fileName) const;
+};
+/*----------------------------------------------------------------*/
+
+
+// interface of the max-flow / min-cut solvers, selected at runtime;
+// each solver builds the graph directly in its own representation
+class MVS_API MaxFlow
+{
+public:
+	typedef MaxFlowGraph::node_type node_type;
+	typedef MaxFlowGraph::value_type value_type;
+
+	enum TYPE {
+		MAXFLOW_IBFS = 0, // incremental breadth-first search (Goldberg et al., 2011)
+		MAXFLOW_BK, // Boykov-Kolmogorov (Boost implementation)
+		MAXFLOW_PUSHRELABEL, // multi-threaded lock-free push-relabel (Hong and He, 2011)
+		MAXFLOW_NUM_TYPES
+	};
+
+public:
+	virtual ~MaxFlow() {}
+
+	// allocate the graph for the given number of nodes and (approximate) number of edges
+	virtual void Init(size_t numNodes, size_t numEdges) = 0;
+	// set the capacities linking the node to the source and to the sink
+	virtual void AddNode(node_type n, value_type source, value_type sink) = 0;
+	// link two nodes by an edge with the given capacity in each direction
+	virtual void AddEdge(node_type n1, node_type n2, value_type capacity, value_type reverseCapacity) = 0;
+	// compute the maximum flow from the source to the sink, and the corresponding minimum cut;
+	// the graph is released as soon as it is not needed anymore
+	virtual value_type ComputeMaxFlow() = 0;
+	// return true if the node is on the source side of the minimum cut
+	virtual bool IsNodeOnSrcSide(node_type n) const = 0;
+
+	void SetGraph(const MaxFlowGraph&);
+
+	static MaxFlow* Create(TYPE type, unsigned nMaxThreads=0);
+	static LPCSTR GetName(TYPE type);
+};
+typedef CAutoPtr<MaxFlow> MaxFlowPtr;
+
+MVS_API bool TestMaxFlow(unsigned iters);
+/*----------------------------------------------------------------*/
+
+} // namespace MVS
+
+#endif // _MVS_MAXFLOW_H_
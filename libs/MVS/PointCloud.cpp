@@ -38,6 +38,11 @@ using namespace MVS;
 
 // D E F I N E S ///////////////////////////////////////////////////
 
+// uncomment to enable multi-threading based on OpenMP
+#ifdef _USE_OPENMP
+#define POINTCLOUD_USE_OPENMP
+#endif
+
 
 // S T R U C T S ///////////////////////////////////////////////////
 
@@ -694,3 +699,148 @@ void PointCloud::PrintStatistics(const Image* pImages, const OBB3f* pObb) const
 	);
 } // PrintStatistics
 /*----------------------------------------------------------------*/
+
+
+// write a point-cloud incrementally
+PointCloudStreamWriter::PointCloudStreamWriter()
+	:
+	numPoints(0), bColors(false), bNormals(false), bViews(false), bOpen(false)
+{
+}
+PointCloudStreamWriter::~PointCloudStreamWriter()
+{
+	if (bOpen)
+		Close();
+}
+
+// create the PLY file and describe the vertex properties;
+// the points are written directly to disk as they come,
+// and the header is added at the end once the number of points is known
+bool PointCloudStreamWriter::Open(const String& _fileName, bool _bColors, bool _bNormals, bool _bViews, bool bLegacyTypes, bool bBinary)
+{
+	ASSERT(!bOpen && !_fileName.empty());
+	fileName = _fileName;
+	Util::ensureFolder(fileName);
+	using namespace PointCloudInternal;
+	if (bLegacyTypes)
+		ply.set_legacy_type_names();
+	if (!ply.write(fileName, 1, BasicPLY::elem_names, bBinary?PLY::BINARY_LE:PLY::ASCII))
+		return false;
+	bColors = _bColors;
+	bNormals = _bNormals;
+	bViews = _bViews;
+	BasicPLY::Vertex::InitSaveProps(ply, 0, bColors, bNormals, bViews, bViews);
+	numPoints = 0;
+	bOpen = true;
+	return true;
+}
+
+// append the given chunk of points to the file
+void PointCloudStreamWriter::Write(const PointCloud& pointcloud)
+{
+	ASSERT(bOpen);
+	ASSERT(!bColors || pointcloud.colors.size() == pointcloud.points.size());
+	ASSERT(!bNormals || pointcloud.normals.size() == pointcloud.points.size());
+	ASSERT(!bViews || (pointcloud.pointViews.size() == pointcloud.points.size() && pointcloud.pointWeights.size() == pointcloud.points.size()));
+	using namespace PointCloudInternal;
+	BasicPLY::Vertex vertex;
+	FOREACH(i, pointcloud.points) {
+		vertex.p = pointcloud.points[i];
+		if (bColors)
+			vertex.c = pointcloud.colors[i];
+		if (bNormals)
+			vertex.n = pointcloud.normals[i];
+		if (bViews) {
+			vertex.views.num = pointcloud.pointViews[i].size();
+			vertex.views.pIndices = pointcloud.pointViews[i].data();
+			vertex.views.pWeights = pointcloud.pointWeights[i].data();
+		}
+		ply.put_element(&vertex);
+	}
+	numPoints += pointcloud.points.size();
+}
+
+// write the header and close the file;
+// an empty file is removed
+bool PointCloudStreamWriter::Close()
+{
+	ASSERT(bOpen);
+	bOpen = false;
+	if (numPoints == 0) {
+		ply.release();
+		File::deleteFile(fileName);
+		return false;
+	}
+	ASSERT(ply.get_current_element_count() == (int)numPoints);
+	const bool bRet(ply.header_complete());
+	ply.release();
+	DEBUG_EXTRA("Point-cloud '%s' saved: %u points", Util::getFileNameExt(fileName).c_str(), numPoints);
+	return bRet;
+}
+/*----------------------------------------------------------------*/
+
+
+// build the index from the views of each point;
+// the points are split in chunks, each chunk counting and then filling in parallel
+// its own part of the list of each image, so the points stay in increasing order
+void ImagePointsIndex::Init(const PointCloud& pointcloud, IIndex numImages)
+{
+	TD_TIMER_STARTD();
+	ASSERT(pointcloud.pointViews.size() == pointcloud.points.size());
+	const PointCloud::Index numPoints(pointcloud.pointViews.size());
+	const PointCloud::Index chunkSize(MAXF(numPoints/256, (PointCloud::Index)(16*1024)));
+	const PointCloud::Index numChunks((numPoints+chunkSize-1)/chunkSize);
+	// count the points seen by each image in each chunk
+	CLISTDEF0(size_t) counts(numChunks*numImages);
+	counts.Memset(0);
+	#ifdef POINTCLOUD_USE_OPENMP
+	#pragma omp parallel for
+	for (int_t c=0; c<(int_t)numChunks; ++c) {
+	#else
+	for (PointCloud::Index c=0; c<numChunks; ++c) {
+	#endif
+		size_t* const chunkCounts(counts.data()+(size_t)c*numImages);
+		const PointCloud::Index idxEnd(MINF(numPoints, (PointCloud::Index)(c+1)*chunkSize));
+		for (PointCloud::Index idx=(PointCloud::Index)c*chunkSize; idx<idxEnd; ++idx) {
+			for (const PointCloud::View view: pointcloud.pointViews[idx]) {
+				ASSERT(view < numImages);
+				++chunkCounts[view];
+			}
+		}
+	}
+	// compute where each image, and each chunk inside it, starts
+	offsets.resize(numImages+1);
+	size_t offset(0);
+	for (IIndex ID=0; ID<numImages; ++ID) {
+		offsets[ID] = offset;
+		for (PointCloud::Index c=0; c<numChunks; ++c) {
+			size_t& count = counts[c*numImages+ID];
+			const size_t numChunkPoints(count);
+			count = offset;
+			offset += numChunkPoints;
+		}
+	}
+	offsets[numImages] = offset;
+	// fill the point lists
+	points.resize(offset);
+	#ifdef POINTCLOUD_USE_OPENMP
+	#pragma omp parallel for
+	for (int_t c=0; c<(int_t)numChunks; ++c) {
+	#else
+	for (PointCloud::Index c=0; c<numChunks; ++c) {
+	#endif
+		size_t* const chunkOffsets(counts.data()+(size_t)c*numImages);
+		const PointCloud::Index idxEnd(MINF(numPoints, (PointCloud::Index)(c+1)*chunkSize));
+		for (PointCloud::Index idx=(PointCloud::Index)c*chunkSize; idx<idxEnd; ++idx)
+			for (const PointCloud::View view: pointcloud.pointViews[idx])
+				points[chunkOffsets[view]++] = (uint32_t)idx;
+	}
+	DEBUG_ULTIMATE("Image-points index built: %u images, %u point views (%s)", numImages, offset, TD_TIMER_GET_FMT().c_str());
+}
+
+void ImagePointsIndex::Release()
+{
+	offsets.Release();
+	points.Release();
+}
+/*----------------------------------------------------------------*/
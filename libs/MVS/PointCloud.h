@@ -123,6 +123,56 @@ public:
 /*----------------------------------------------------------------*/
 
 
+// write a point-cloud to a PLY file incrementally, chunk by chunk,
+// without knowing in advance the total number of points
+class MVS_API PointCloudStreamWriter
+{
+public:
+	PointCloudStreamWriter();
+	~PointCloudStreamWriter();
+
+	bool Open(const String& fileName, bool bColors, bool bNormals, bool bViews, bool bLegacyTypes=false, bool bBinary=true);
+	void Write(const PointCloud&);
+	bool Close();
+
+	inline bool IsOpen() const { return bOpen; }
+	inline size_t GetNumPoints() const { return numPoints; }
+
+protected:
+	PLY ply;
+	String fileName;
+	size_t numPoints;
+	bool bColors, bNormals, bViews;
+	bool bOpen;
+};
+/*----------------------------------------------------------------*/
+
+
+// inverted index listing for each image the points seen by it (in increasing order),
+// stored in compressed sparse row layout: the points of image ID are
+// points[offsets[ID]] to points[offsets[ID+1]-1]
+class MVS_API ImagePointsIndex
+{
+public:
+	typedef CLISTDEF0(size_t) OffsetArr;
+
+public:
+	OffsetArr offsets; // start of the points of each image, plus the total number of points
+	IndexArr points; // point indices, grouped by image
+
+public:
+	void Init(const PointCloud&, IIndex numImages);
+	void Release();
+
+	inline bool IsEmpty() const { return offsets.empty(); }
+	inline IIndex GetNumImages() const { return offsets.empty() ? 0 : (IIndex)offsets.size()-1; }
+	inline size_t GetNumPoints(IIndex ID) const { ASSERT(ID < GetNumImages()); return offsets[ID+1]-offsets[ID]; }
+	inline const uint32_t* Begin(IIndex ID) const { ASSERT(ID < GetNumImages()); return points.data()+offsets[ID]; }
+	inline const uint32_t* End(IIndex ID) const { ASSERT(ID < GetNumImages()); return points.data()+offsets[ID+1]; }
+};
+/*----------------------------------------------------------------*/
+
+
 struct IndexDist {
 	IDX idx;
 	REAL dist;
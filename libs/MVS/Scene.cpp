@@ -796,17 +796,20 @@ bool Scene::EstimateNeighborViewsPointCloud(unsigned maxResolution)
 // compute visibility for the reference image
 // and select the best views for reconstructing the dense point-cloud;
 // extract also all 3D points seen by the reference image;
-// (inspired by: "Multi-View Stereo for Community Photo Collections", Goesele, 2007)
+// (inspired by: "Multi-View Stereo for Community Photo Collections", Goesele, 2007);
+// if the neighbor views are already selected, only the 3D points are extracted
 //  - nInsideROI: 0 - ignore ROI, 1 - weight more ROI points, 2 - consider only ROI points
-bool Scene::SelectNeighborViews(uint32_t ID, IndexArr& points, unsigned nMinViews, unsigned nMinPointViews, float fOptimAngle, unsigned nInsideROI)
+//  - pIndex: if given, the image-points index used to visit only the points seen by the reference image
+bool Scene::SelectNeighborViews(uint32_t ID, IndexArr& points, unsigned nMinViews, unsigned nMinPointViews, float fOptimAngle, unsigned nInsideROI, const ImagePointsIndex* pIndex)
 {
 	ASSERT(points.empty());
+	ASSERT(pIndex == NULL || pIndex->GetNumImages() == images.size());
 
 	// extract the estimated 3D points and the corresponding 2D projections for the reference image
 	Image& imageData = images[ID];
 	ASSERT(imageData.IsValid());
 	ViewScoreArr& neighbors = imageData.neighbors;
-	ASSERT(neighbors.empty());
+	const bool bScoreViews(neighbors.empty());
 	struct Score {
 		float score;
 		float avgScale;
@@ -822,27 +825,28 @@ bool Scene::SelectNeighborViews(uint32_t ID, IndexArr& points, unsigned nMinView
 	const float sigmaAngleSmall(-1.f/(2.f*SQUARE(fOptimAngle*0.38f)));
 	const float sigmaAngleLarge(-1.f/(2.f*SQUARE(fOptimAngle*0.7f)));
 	const bool bCheckInsideROI(nInsideROI > 0 && IsBounded());
-	FOREACH(idx, pointcloud.points) {
+	const auto ProcessPoint = [&](uint32_t idx) {
 		const PointCloud::ViewArr& views = pointcloud.pointViews[idx];
 		ASSERT(views.IsSorted());
-		if (views.FindFirst(ID) == PointCloud::ViewArr::NO_INDEX)
-			continue;
+		ASSERT(views.FindFirst(ID) != PointCloud::ViewArr::NO_INDEX);
 		const PointCloud::Point& point = pointcloud.points[idx];
 		float wROI(1.f);
 		if (bCheckInsideROI && !obb.Intersects(point)) {
 			if (nInsideROI > 1)
-				continue;
+				return;
 			wROI = 0.7f;
 		}
 		const Depth depth((float)imageData.camera.PointDepth(point));
 		ASSERT(depth > 0);
 		if (depth <= 0)
-			continue;
+			return;
 		// store this point
 		if (views.size() >= nMinPointViews)
-			points.push_back((uint32_t)idx);
+			points.push_back(idx);
 		imageData.avgDepth += depth;
 		++nPoints;
+		if (!bScoreViews)
+			return;
 		// score shared views
 		const Point3f V1(imageData.camera.C - Cast<REAL>(point));
 		const float footprint1(imageData.camera.GetFootprintImage(point));
@@ -868,12 +872,21 @@ bool Scene::SelectNeighborViews(uint32_t ID, IndexArr& points, unsigned nMinView
 			score.avgAngle += fAngle;
 			++score.points;
 		}
+	};
+	if (pIndex) {
+		for (const uint32_t* pIdx=pIndex->Begin(ID); pIdx!=pIndex->End(ID); ++pIdx)
+			ProcessPoint(*pIdx);
+	} else {
+		FOREACH(idx, pointcloud.points) {
+			if (pointcloud.pointViews[idx].FindFirst(ID) != PointCloud::ViewArr::NO_INDEX)
+				ProcessPoint((uint32_t)idx);
+		}
 	}
 	if(nPoints > 3)
 		imageData.avgDepth /= nPoints;
 
 	// select best neighborViews
-	if (neighbors.empty()) {
+	if (bScoreViews) {
 		Point2fArr projs(0, points.size());
 		FOREACH(IDB, images) {
 			const Image& imageDataB = images[IDB];
@@ -935,15 +948,21 @@ bool Scene::SelectNeighborViews(uint32_t ID, IndexArr& points, unsigned nMinView
 
 void Scene::SelectNeighborViews(unsigned nMinViews, unsigned nMinPointViews, float fOptimAngle, unsigned nInsideROI)
 {
+	// list the points seen by each image once for all images
+	ImagePointsIndex index;
+	index.Init(pointcloud, images.size());
 	#ifdef SCENE_USE_OPENMP
+	#pragma omp parallel for schedule(dynamic)
 	for (int_t ID=0; ID<(int_t)images.size(); ++ID) {
 		const IIndex idxImage((IIndex)ID);
 	#else
 	FOREACH(idxImage, images) {
 	#endif
 		// select image neighbors
+		if (!images[idxImage].IsValid() || !images[idxImage].neighbors.empty())
+			continue;
 		IndexArr points;
-		SelectNeighborViews(idxImage, points, nMinViews, nMinPointViews, fOptimAngle, nInsideROI);
+		SelectNeighborViews(idxImage, points, nMinViews, nMinPointViews, fOptimAngle, nInsideROI, &index);
 	}
 } // SelectNeighborViews
 /*----------------------------------------------------------------*/
@@ -1135,7 +1154,7 @@ unsigned Scene::Split(ImagesChunkArr& chunks, float maxArea, int depthMapStep) c
 			if (!imageData.IsValid())
 				continue;
 			DepthData depthData;
-			depthData.Load(ComposeDepthFilePath(imageData.ID, "dmap"), 1);
+			depthData.Load(ComposeDepthFilePath(imageData.ID, "dmap"), HeaderDepthDataRaw::HAS_DEPTH|DepthData::LOAD_MAPPED);
 			if (depthData.IsEmpty())
 				continue;
 			const IIndex numPointsBegin(visibility.size());
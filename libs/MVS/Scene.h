@@ -93,7 +93,7 @@ public:
 	void SampleMeshWithVisibility(unsigned maxResolution=320);
 	bool ExportMeshToDepthMaps(const String& baseName);
 
-	bool SelectNeighborViews(uint32_t ID, IndexArr& points, unsigned nMinViews = 3, unsigned nMinPointViews = 2, float fOptimAngle = FD2R(12), unsigned nInsideROI = 1);
+	bool SelectNeighborViews(uint32_t ID, IndexArr& points, unsigned nMinViews = 3, unsigned nMinPointViews = 2, float fOptimAngle = FD2R(12), unsigned nInsideROI = 1, const ImagePointsIndex* pIndex = NULL);
 	void SelectNeighborViews(unsigned nMinViews = 3, unsigned nMinPointViews = 2, float fOptimAngle = FD2R(12), unsigned nInsideROI = 1);
 	static bool FilterNeighborViews(ViewScoreArr& neighbors, float fMinArea=0.1f, float fMinScale=0.2f, float fMaxScale=2.4f, float fMinAngle=FD2R(3), float fMaxAngle=FD2R(45), unsigned nMaxViews=12);
 
@@ -128,7 +128,7 @@ public:
 	PointCloud BuildTowerMesh(const PointCloud& origPointCloud, const Point2f& centerPoint, const float fRadius, const float fROIRadius, const float zMin, const float zMax, const float minCamZ, bool bFixRadius = false);
 	
 	// Dense reconstruction
-	bool DenseReconstruction(int nFusionMode=0, bool bCrop2ROI=true, float fBorderROI=0);
+	bool DenseReconstruction(int nFusionMode=0, bool bCrop2ROI=true, float fBorderROI=0, const String& fileNameStream=String(), bool bStreamViews=false, size_t* pNumPointsStream=NULL);
 	bool ComputeDepthMaps(DenseDepthMapData& data);
 	void DenseReconstructionEstimate(void*);
 	void DenseReconstructionFilter(void*);
@@ -138,7 +138,9 @@ public:
 	bool ReconstructMesh(float distInsert=2, bool bUseFreeSpaceSupport=true, bool bUseOnlyROI=false, unsigned nItersFixNonManifold=4,
 						 float kSigma=2.f, float kQual=1.f, float kb=4.f,
 						 float kf=3.f, float kRel=0.1f/*max 0.3*/, float kAbs=1000.f/*min 500*/, float kOutl=400.f/*max 700.f*/,
-						 float kInf=(float)(INT_MAX/8), Util::Progress::Callback callback = nullptr);
+						 float kInf=(float)(INT_MAX/8), Util::Progress::Callback callback = nullptr, int nMaxFlowType=0, const String& fileExportGraph=String());
+	bool ReconstructMeshTiled(unsigned nMaxPointsTile, float fOverlapTile=0.05f, float distInsert=2, bool bUseFreeSpaceSupport=true, bool bUseOnlyROI=false,
+							  unsigned nItersFixNonManifold=4, float kSigma=2.f, float kQual=1.f, int nMaxFlowType=0);
 
 	// Mesh refinement
 	bool RefineMesh(unsigned nResolutionLevel, unsigned nMinResolution, unsigned nMaxViews, float fDecimateMesh, unsigned nCloseHoles, unsigned nEnsureEdgeSize,
@@ -166,6 +168,8 @@ public:
 	}
 	#endif
 };
+
+MVS_API bool TestDelaunayPartitions(const Scene&, unsigned numPartitions, float distInsert=2, float tolerance=0.02f);
 /*----------------------------------------------------------------*/
 
 } // namespace MVS
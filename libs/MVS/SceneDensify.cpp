@@ -46,6 +46,11 @@ using namespace MVS;
 #define DENSE_USE_OPENMP
 #endif
 
+// load flags used by the stages only reading the depth-maps:
+// all maps are memory-mapped, only the accessed data being paged in,
+// and the normal and confidence maps are kept compact if stored so
+#define DENSE_LOAD_READONLY (15|DepthData::LOAD_MAPPED|DepthData::LOAD_COMPACT)
+
 
 // S T R U C T S ///////////////////////////////////////////////////
 
@@ -131,6 +136,9 @@ DepthMapsData::DepthMapsData(Scene& _scene)
 	scene(_scene),
 	arrDepthData(_scene.images.GetSize())
 {
+	depthDataCache.SetBudget((size_t)OPTDENSE::nCacheSize*1024*1024);
+	imageCache.SetBudget((size_t)OPTDENSE::nImageCacheSize*1024*1024);
+	depthMapStore.Init(CLAMP(OPTDENSE::fEstimationGeometricScale, 0.1f, 1.f), (size_t)OPTDENSE::nEstimationGeometricCacheSize*1024*1024);
 } // constructor
 
 DepthMapsData::~DepthMapsData()
@@ -270,14 +278,18 @@ bool DepthMapsData::SelectViews(IIndexArr& images, IIndexArr& imagesMap, IIndexA
 // compute visibility for the reference image (the first image in "images")
 // and select the best views for reconstructing the depth-map;
 // extract also all 3D points seen by the reference image
-bool DepthMapsData::SelectViews(DepthData& depthData)
+// (if the neighbor views are already known, only if the image-points index is given)
+bool DepthMapsData::SelectViews(DepthData& depthData, const ImagePointsIndex* pIndex)
 {
 	// find and sort valid neighbor views
 	const IIndex idxImage((IIndex)(&depthData-arrDepthData.Begin()));
 	ASSERT(depthData.neighbors.IsEmpty());
-	if (scene.images[idxImage].neighbors.empty() &&
-		!scene.SelectNeighborViews(idxImage, depthData.points, OPTDENSE::nMinViews, OPTDENSE::nMinViewsTrustPoint>1?OPTDENSE::nMinViewsTrustPoint:2, FD2R(OPTDENSE::fOptimAngle), OPTDENSE::nPointInsideROI))
-		return false;
+	if (scene.images[idxImage].neighbors.empty()) {
+		if (!scene.SelectNeighborViews(idxImage, depthData.points, OPTDENSE::nMinViews, OPTDENSE::nMinViewsTrustPoint>1?OPTDENSE::nMinViewsTrustPoint:2, FD2R(OPTDENSE::fOptimAngle), OPTDENSE::nPointInsideROI, pIndex))
+			return false;
+	} else if (pIndex) {
+		scene.SelectNeighborViews(idxImage, depthData.points, OPTDENSE::nMinViews, OPTDENSE::nMinViewsTrustPoint>1?OPTDENSE::nMinViewsTrustPoint:2, FD2R(OPTDENSE::fOptimAngle), OPTDENSE::nPointInsideROI, pIndex);
+	}
 	depthData.neighbors.CopyOf(scene.images[idxImage].neighbors);
 
 	// remove invalid neighbor views
@@ -321,8 +333,8 @@ bool DepthMapsData::InitViews(DepthData& depthData, IIndex idxNeighbor, IIndex n
 		viewTrg.scale = neighbor.scale;
 		viewTrg.camera = viewTrg.pImageData->camera;
 		if (loadImages) {
-			viewTrg.pImageData->image.toGray(viewTrg.image, cv::COLOR_BGR2GRAY, true);
-			if (DepthData::ViewData::ScaleImage(viewTrg.image, viewTrg.image, viewTrg.scale))
+			viewTrg.image = imageCache.GetImage(*viewTrg.pImageData, viewTrg.scale);
+			if (DepthData::ViewData::NeedScaleImage(viewTrg.scale))
 				viewTrg.camera = viewTrg.pImageData->GetCamera(scene.platforms, viewTrg.image.size());
 		} else {
 			if (DepthData::ViewData::NeedScaleImage(viewTrg.scale))
@@ -342,8 +354,8 @@ bool DepthMapsData::InitViews(DepthData& depthData, IIndex idxNeighbor, IIndex n
 			viewTrg.scale = neighbor.scale;
 			viewTrg.camera = viewTrg.pImageData->camera;
 			if (loadImages) {
-				viewTrg.pImageData->image.toGray(viewTrg.image, cv::COLOR_BGR2GRAY, true);
-				if (DepthData::ViewData::ScaleImage(viewTrg.image, viewTrg.image, viewTrg.scale))
+				viewTrg.image = imageCache.GetImage(*viewTrg.pImageData, viewTrg.scale);
+				if (DepthData::ViewData::NeedScaleImage(viewTrg.scale))
 					viewTrg.camera = viewTrg.pImageData->GetCamera(scene.platforms, viewTrg.image.size());
 			} else {
 				if (DepthData::ViewData::NeedScaleImage(viewTrg.scale))
@@ -372,24 +384,14 @@ bool DepthMapsData::InitViews(DepthData& depthData, IIndex idxNeighbor, IIndex n
 	viewRef.pImageData = &scene.images[idxImage];
 	viewRef.camera = viewRef.pImageData->camera;
 	if (loadImages)
-		viewRef.pImageData->image.toGray(viewRef.image, cv::COLOR_BGR2GRAY, true);
+		viewRef.image = imageCache.GetImage(*viewRef.pImageData, 1.f);
 
 	// initialize views
 	for (IIndex i=1; i<depthData.images.size(); ++i) {
 		DepthData::ViewData& view = depthData.images[i];
 		if (loadDepthMaps > 0) {
-			// load known depth-map
-			String imageFileName;
-			IIndexArr IDs;
-			cv::Size imageSize;
-			Depth dMin, dMax;
-			NormalMap normalMap;
-			ConfidenceMap confMap;
-			ViewsMap viewsMap;
-			ImportDepthDataRaw(ComposeDepthFilePath(view.GetID(), "dmap"),
-				imageFileName, IDs, imageSize, view.cameraDepthMap.K, view.cameraDepthMap.R, view.cameraDepthMap.C,
-				dMin, dMax, view.depthMap, normalMap, confMap, viewsMap, 1);
-			ASSERT(viewRef.image.size() == view.depthMap.size());
+			// get known depth-map, shared with all the other reference images using it
+			depthMapStore.Acquire(view.GetID(), ComposeDepthFilePath(view.GetID(), "dmap"), view.depthMap, view.cameraDepthMap);
 		}
 		view.Init(viewRef.camera);
 	}
@@ -405,7 +407,10 @@ bool DepthMapsData::InitViews(DepthData& depthData, IIndex idxNeighbor, IIndex n
 		if (!ImportDepthDataRaw(ComposeDepthFilePath(viewRef.GetID(), "dmap"),
 				imageFileName, IDs, imageSize, camera.K, camera.R, camera.C, depthData.dMin, depthData.dMax,
 				depthData.depthMap, depthData.normalMap, confMap, viewsMap, 3))
+		{
+			ReleaseViewDepthMaps(depthData);
 			return false;
+		}
 		ASSERT(viewRef.image.size() == depthData.depthMap.size());
 		ASSERT(depthData.normalMap.empty() || viewRef.image.size() == depthData.normalMap.size());
 		if (depthData.normalMap.empty()) {
@@ -457,6 +462,19 @@ bool DepthMapsData::InitViews(DepthData& depthData, IIndex idxNeighbor, IIndex n
 	}
 	return true;
 } // InitViews
+
+// release the neighbor depth-maps used by the geometric-consistent estimation,
+// once the depth-map of the reference image is estimated
+void DepthMapsData::ReleaseViewDepthMaps(DepthData& depthData)
+{
+	for (IIndex i=1; i<depthData.images.size(); ++i) {
+		DepthData::ViewData& view = depthData.images[i];
+		if (view.depthMap.empty())
+			continue;
+		view.depthMap.release();
+		depthMapStore.Release(view.GetID());
+	}
+} // ReleaseViewDepthMaps
 /*----------------------------------------------------------------*/
 
 // roughly estimate depth and normal maps by triangulating the sparse point cloud
@@ -490,21 +508,19 @@ bool DepthMapsData::InitDepthMap(DepthData& depthData)
 void* STCALL DepthMapsData::ScoreDepthMapTmp(void* arg)
 {
 	DepthEstimator& estimator = *((DepthEstimator*)arg);
-	IDX idx;
-	while ((idx=(IDX)Thread::safeInc(estimator.idxPixel)) < estimator.coords.GetSize()) {
-		const ImageRef& x = estimator.coords[idx];
+	const auto scorePixel = [&estimator](const ImageRef& x) {
 		if (!estimator.PreparePixelPatch(x) || !estimator.FillPixelPatch()) {
 			estimator.depthMap0(x) = 0;
 			estimator.normalMap0(x) = Normal::ZERO;
 			estimator.confMap0(x) = 2.f;
-			continue;
+			return;
 		}
 		Depth& depth = estimator.depthMap0(x);
 		Normal& normal = estimator.normalMap0(x);
 		const Normal viewDir(Cast<float>(static_cast<const Point3&>(estimator.X0)));
 		if (!ISINSIDE(depth, estimator.dMin, estimator.dMax)) {
 			// init with random values
-			depth = estimator.RandomDepth(estimator.dMinSqr, estimator.dMaxSqr);
+			depth = estimator.RandomPixelDepth();
 			normal = estimator.RandomNormal(viewDir);
 		} else if (normal.dot(viewDir) >= 0) {
 			// replace invalid normal with random values
@@ -512,6 +528,19 @@ void* STCALL DepthMapsData::ScoreDepthMapTmp(void* arg)
 		}
 		ASSERT(ISEQUAL(norm(normal), 1.f));
 		estimator.confMap0(x) = estimator.ScorePixel(depth, normal);
+	};
+	IDX idx;
+	if (estimator.tiles) {
+		// process whole tiles, each with its own random sequence
+		const DepthEstimator::TileArr& tiles = *estimator.tiles;
+		while ((idx=(IDX)Thread::safeInc(estimator.idxPixel)) < estimator.idxTileEnd) {
+			estimator.SeedTile(idx, 0);
+			for (IDX i=tiles[idx]; i<tiles[idx+1]; ++i)
+				scorePixel(estimator.coords[i]);
+		}
+	} else {
+		while ((idx=(IDX)Thread::safeInc(estimator.idxPixel)) < estimator.coords.GetSize())
+			scorePixel(estimator.coords[idx]);
 	}
 	return NULL;
 }
@@ -520,24 +549,40 @@ void* STCALL DepthMapsData::EstimateDepthMapTmp(void* arg)
 {
 	DepthEstimator& estimator = *((DepthEstimator*)arg);
 	IDX idx;
-	while ((idx=(IDX)Thread::safeInc(estimator.idxPixel)) < estimator.coords.GetSize())
-		estimator.ProcessPixel(idx);
+	if (estimator.tiles) {
+		// checkerboard half-sweep: process the pixels of one color in whole tiles;
+		// all the neighbors used during propagation have the other color, so they are not modified
+		// during this half-sweep and the result does not depend on the order the tiles are processed
+		const DepthEstimator::TileArr& tiles = *estimator.tiles;
+		while ((idx=(IDX)Thread::safeInc(estimator.idxPixel)) < estimator.idxTileEnd) {
+			estimator.SeedTile(idx, 1);
+			const IDX idxBegin(tiles[idx]), idxEnd(tiles[idx+1]);
+			if (estimator.dir == DepthEstimator::LT2RB) {
+				for (IDX i=idxBegin; i<idxEnd; ++i)
+					estimator.ProcessPixel(estimator.coords[i]);
+			} else {
+				for (IDX i=idxEnd; i-- > idxBegin; )
+					estimator.ProcessPixel(estimator.coords[i]);
+			}
+		}
+	} else {
+		while ((idx=(IDX)Thread::safeInc(estimator.idxPixel)) < estimator.coords.GetSize())
+			estimator.ProcessPixel(idx);
+	}
 	return NULL;
 }
 // remove all estimates with too big score and invert confidence map
 void* STCALL DepthMapsData::EndDepthMapTmp(void* arg)
 {
 	DepthEstimator& estimator = *((DepthEstimator*)arg);
-	IDX idx;
 	MAYBEUNUSED const float fOptimAngle(FD2R(OPTDENSE::fOptimAngle));
-	while ((idx=(IDX)Thread::safeInc(estimator.idxPixel)) < estimator.coords.GetSize()) {
-		const ImageRef& x = estimator.coords[idx];
+	const auto endPixel = [&](const ImageRef& x) {
 		ASSERT(estimator.depthMap0(x) >= 0);
 		Depth& depth = estimator.depthMap0(x);
 		float& conf = estimator.confMap0(x);
 		// check if the score is good enough
 		// and that the cross-estimates is close enough to the current estimate
-		if (depth <= 0 || conf >= OPTDENSE::fNCCThresholdKeep) {
+		if (depth <= 0 || conf >= estimator.thConfKeep) {
 			conf = 0;
 			depth = 0;
 			estimator.normalMap0(x) = Normal::ZERO;
@@ -571,11 +616,22 @@ void* STCALL DepthMapsData::EndDepthMapTmp(void* arg)
 			#endif
 			#endif
 		}
+	};
+	IDX idx;
+	if (estimator.tiles) {
+		const DepthEstimator::TileArr& tiles = *estimator.tiles;
+		while ((idx=(IDX)Thread::safeInc(estimator.idxPixel)) < estimator.idxTileEnd)
+			for (IDX i=tiles[idx]; i<tiles[idx+1]; ++i)
+				endPixel(estimator.coords[i]);
+	} else {
+		while ((idx=(IDX)Thread::safeInc(estimator.idxPixel)) < estimator.coords.GetSize())
+			endPixel(estimator.coords[idx]);
 	}
 	return NULL;
 }
 
-DepthData DepthMapsData::ScaleDepthData(const DepthData& inputDeptData, float scale) {
+//  - pImageCache: if given, the scaled images are taken from it instead of being computed
+DepthData DepthMapsData::ScaleDepthData(const DepthData& inputDeptData, float scale, ImagePyramidCache* pImageCache) {
 	ASSERT(scale <= 1);
 	if (scale == 1)
 		return inputDeptData;
@@ -583,7 +639,10 @@ DepthData DepthMapsData::ScaleDepthData(const DepthData& inputDeptData, float sc
 	FOREACH (idxView, rescaledDepthData.images) {
 		DepthData::ViewData& viewData = rescaledDepthData.images[idxView];
 		ASSERT(viewData.depthMap.empty() || viewData.image.size() == viewData.depthMap.size());
-		cv::resize(viewData.image, viewData.image, cv::Size(), scale, scale, cv::INTER_AREA);
+		if (pImageCache)
+			viewData.image = pImageCache->GetImage(*viewData.pImageData, viewData.scale, scale);
+		else
+			cv::resize(viewData.image, viewData.image, cv::Size(), scale, scale, cv::INTER_AREA);
 		viewData.camera = viewData.pImageData->camera;
 		viewData.camera.K = viewData.camera.GetScaledK(viewData.pImageData->GetSize(), viewData.image.size());
 		if (!viewData.depthMap.empty()) {
@@ -613,7 +672,8 @@ DepthData DepthMapsData::ScaleDepthData(const DepthData& inputDeptData, float sc
 // In order to ensure some smoothness while locally estimating each pixel, a bonus is added to the NCC score if the estimate for this pixel is close to the estimates for the neighbor pixels.
 // Optionally, the occluded pixels can be detected by extending the described iterations to the target image and removing the estimates that do not have similar values in both views.
 //  - nGeometricIter: current geometric-consistent estimation iteration (-1 - normal patch-match)
-bool DepthMapsData::EstimateDepthMap(IIndex idxImage, int nGeometricIter)
+//  - pThreadBudget: if given, the number of threads used by each pass is requested from it for the job idxJob
+bool DepthMapsData::EstimateDepthMap(IIndex idxImage, int nGeometricIter, ThreadBudget* pThreadBudget, IDX idxJob)
 {
 	#ifdef _USE_CUDA
 	if (pmCUDA) {
@@ -640,18 +700,38 @@ bool DepthMapsData::EstimateDepthMap(IIndex idxImage, int nGeometricIter)
 	// Multi-Resolution : 
 	DepthData& fullResDepthData(arrDepthData[idxImage]);
 	const unsigned totalScaleNumber(nGeometricIter < 0 ? OPTDENSE::nSubResolutionLevels : 0u);
+
+	// estimate the remaining work (pixels times passes) in order to request
+	// the number of threads to be used by each pass from the thread budget
+	ASSERT(pThreadBudget == NULL || idxJob != NO_IDX);
+	size_t workLeft(0);
+	for (unsigned scaleNumber=0; scaleNumber<=totalScaleNumber; ++scaleNumber)
+		workLeft += ((size_t)fullResDepthData.images.front().image.area() >> (2*scaleNumber)) * (iterEnd-iterBegin+1);
+	const auto getNumThreads = [&](size_t workPass) -> unsigned {
+		const unsigned nThreads(pThreadBudget ? MINF(pThreadBudget->GetThreads(idxJob, workLeft), nMaxThreads) : nMaxThreads);
+		workLeft -= MINF(workPass, workLeft);
+		return nThreads;
+	};
+	// pixels to be processed and their order
+	DepthEstimator::MapRefArr coords; // map pixel index to zigzag/checkerboard matrix coordinates
+	DepthEstimator::TileArr tiles; // tile ranges in coords (checkerboard propagation only)
+	Image8U::Size coordsSize(0, 0); // size of the depth-map the coordinates were computed for
 	DepthMap lowResDepthMap;
 	NormalMap lowResNormalMap;
+	DepthEstimator::DepthRangeMap lowResDepthRangeMap; // depth search interval of each pixel, estimated at the previous level
 	#if DENSE_NCC == DENSE_NCC_WEIGHTED
 	DepthEstimator::WeightMap weightMap0;
 	#else
 	Image64F imageSum0;
 	#endif
 	DepthMap currentSizeResDepthMap;
+	// settled pixels can be skipped only if there are enough iterations left after they settle
+	DepthEstimator::SettledMap settledMap;
+	const bool bSkipSettled(OPTDENSE::nEstimationSkipSettled > 0 && iterEnd-iterBegin > OPTDENSE::nEstimationSkipSettled);
 	for (unsigned scaleNumber = totalScaleNumber+1; scaleNumber-- > 0; ) {
 		// initialize
 		float scale = 1.f / POWI(2, scaleNumber);
-		DepthData currentDepthData(ScaleDepthData(fullResDepthData, scale));
+		DepthData currentDepthData(ScaleDepthData(fullResDepthData, scale, &imageCache));
 		DepthData& depthData(scaleNumber==0 ? fullResDepthData : currentDepthData);
 		ASSERT(depthData.images.size() > 1);
 		const DepthData::ViewData& image(depthData.images.front());
@@ -670,17 +750,25 @@ bool DepthMapsData::EstimateDepthMap(IIndex idxImage, int nGeometricIter)
 		depthData.confMap.create(size);
 
 		// init integral images and index to image-ref map for the reference data
-		#if DENSE_NCC == DENSE_NCC_WEIGHTED
-		weightMap0.clear();
-		weightMap0.resize(size.area()-(size.width+1)*DepthEstimator::nSizeHalfWindow);
-		#else
-		cv::integral(image.image, imageSum0, CV_64F);
-		#endif
-		if (prevDepthMapSize != size || OPTDENSE::nIgnoreMaskLabel >= 0) {
+		{
+			TD_TRACE_SCOPE_ARG("integral image", idxImage);
+			#if DENSE_NCC == DENSE_NCC_WEIGHTED
+			weightMap0.clear();
+			weightMap0.resize(size.area()-(size.width+1)*DepthEstimator::nSizeHalfWindow);
+			#else
+			cv::integral(image.image, imageSum0, CV_64F);
+			#endif
+		}
+		const bool bCheckerboard(OPTDENSE::nEstimationPropagation == DepthEstimator::PROP_CHECKERBOARD);
+		if (coordsSize != size || OPTDENSE::nIgnoreMaskLabel >= 0) {
 			BitMatrix mask;
 			if (OPTDENSE::nIgnoreMaskLabel >= 0 && DepthEstimator::ImportIgnoreMask(*image.pImageData, depthData.depthMap.size(), (uint16_t)OPTDENSE::nIgnoreMaskLabel, mask))
 				depthData.ApplyIgnoreMask(mask);
-			DepthEstimator::MapMatrix2ZigzagIdx(size, coords, mask, MAXF(64,(int)nMaxThreads*8));
+			if (bCheckerboard) {
+				DepthEstimator::MapMatrix2CheckerboardIdx(size, coords, tiles, mask, DepthEstimator::nTileSize);
+			} else {
+				DepthEstimator::MapMatrix2ZigzagIdx(size, coords, mask, MAXF(64,(int)nMaxThreads*8));
+			}
 			#if 0 && !defined(_RELEASE)
 			// show pixels to be processed
 			Image8U cmask(size);
@@ -689,15 +777,19 @@ bool DepthMapsData::EstimateDepthMap(IIndex idxImage, int nGeometricIter)
 				cmask(x.y, x.x) = 255;
 			cmask.Show("cmask");
 			#endif
-			prevDepthMapSize = size;
+			coordsSize = size;
 		}
 
+		const IDX numTiles(bCheckerboard ? (tiles.size()-1)/2 : 0);
+
 		// initialize the reference confidence map (NCC score map) with the score of the current estimates
 		{
+			TD_TRACE_SCOPE_ARG("score depth-map", idxImage);
 			// create working threads
+			const unsigned nThreads(getNumThreads(size.area()));
 			idxPixel = -1;
 			ASSERT(estimators.empty());
-			while (estimators.size() < nMaxThreads) {
+			while (estimators.size() < nThreads) {
 				estimators.emplace_back(iterBegin, depthData, idxPixel,
 					#if DENSE_NCC == DENSE_NCC_WEIGHTED
 					weightMap0,
@@ -706,9 +798,15 @@ bool DepthMapsData::EstimateDepthMap(IIndex idxImage, int nGeometricIter)
 					#endif
 					coords);
 				estimators.Last().lowResDepthMap = currentSizeResDepthMap;
+				if (!lowResDepthRangeMap.empty())
+					estimators.Last().depthRangeMap = &lowResDepthRangeMap;
+				if (bCheckerboard) {
+					estimators.Last().tiles = &tiles;
+					estimators.Last().idxTileEnd = numTiles*2;
+				}
 			}
-			ASSERT(estimators.size() == threads.size()+1);
-			FOREACH(i, threads)
+			ASSERT(estimators.size() <= threads.size()+1);
+			for (unsigned i=0; i+1<nThreads; ++i)
 				threads[i].start(ScoreDepthMapTmp, &estimators[i]);
 			ScoreDepthMapTmp(&estimators.back());
 			// wait for the working threads to close
@@ -726,28 +824,50 @@ bool DepthMapsData::EstimateDepthMap(IIndex idxImage, int nGeometricIter)
 		}
 
 		// run propagation and random refinement cycles on the reference data
+		if (bSkipSettled) {
+			settledMap.create(size);
+			settledMap.memset(0);
+		}
 		for (unsigned iter=iterBegin; iter<iterEnd; ++iter) {
-			// create working threads
-			idxPixel = -1;
-			ASSERT(estimators.empty());
-			while (estimators.size() < nMaxThreads) {
-				estimators.emplace_back(iter, depthData, idxPixel,
-					#if DENSE_NCC == DENSE_NCC_WEIGHTED
-					weightMap0,
-					#else
-					imageSum0,
-					#endif
-					coords);
-				estimators.Last().lowResDepthMap = currentSizeResDepthMap;
+			TD_TRACE_SCOPE_ARG("propagation iteration", idxImage);
+			size_t nSkipped(0);
+			// in checkerboard mode each iteration is split in two half-sweeps (red and black pixels)
+			for (unsigned halfSweep=0; halfSweep<(bCheckerboard?2u:1u); ++halfSweep) {
+				// create working threads
+				const unsigned nThreads(getNumThreads(bCheckerboard ? size.area()/2 : size.area()));
+				idxPixel = (Thread::safe_t)(numTiles*halfSweep)-1;
+				ASSERT(estimators.empty());
+				while (estimators.size() < nThreads) {
+					estimators.emplace_back(iter, depthData, idxPixel,
+						#if DENSE_NCC == DENSE_NCC_WEIGHTED
+						weightMap0,
+						#else
+						imageSum0,
+						#endif
+						coords);
+					estimators.Last().lowResDepthMap = currentSizeResDepthMap;
+					if (!lowResDepthRangeMap.empty())
+						estimators.Last().depthRangeMap = &lowResDepthRangeMap;
+					if (bSkipSettled)
+						estimators.Last().settledMap = &settledMap;
+					if (bCheckerboard) {
+						estimators.Last().tiles = &tiles;
+						estimators.Last().idxTileEnd = numTiles*(halfSweep+1);
+					}
+				}
+				ASSERT(estimators.size() <= threads.size()+1);
+				for (unsigned i=0; i+1<nThreads; ++i)
+					threads[i].start(EstimateDepthMapTmp, &estimators[i]);
+				EstimateDepthMapTmp(&estimators.back());
+				// wait for the working threads to close
+				FOREACHPTR(pThread, threads)
+					pThread->join();
+				for (const DepthEstimator& estimator: estimators)
+					nSkipped += estimator.nSkipped;
+				estimators.clear();
 			}
-			ASSERT(estimators.size() == threads.size()+1);
-			FOREACH(i, threads)
-				threads[i].start(EstimateDepthMapTmp, &estimators[i]);
-			EstimateDepthMapTmp(&estimators.back());
-			// wait for the working threads to close
-			FOREACHPTR(pThread, threads)
-				pThread->join();
-			estimators.clear();
+			if (bSkipSettled)
+				DEBUG_ULTIMATE("Depth-map %3u iteration %u (%dx%d): %.2f%% settled pixels skipped", image.GetID(), iter, size.width, size.height, 100.f*nSkipped/MAXF(coords.size(),(IDX)1));
 			#if 1 && TD_VERBOSE != TD_VERBOSE_OFF
 			// save intermediate depth map as image
 			if (g_nVerbosityLevel > 4) {
@@ -765,19 +885,24 @@ bool DepthMapsData::EstimateDepthMap(IIndex idxImage, int nGeometricIter)
 		if (scaleNumber > 0) {
 			lowResDepthMap = depthData.depthMap;
 			lowResNormalMap = depthData.normalMap;
+			// limit the random depth search at the next level around the current estimates
+			if (OPTDENSE::fEstimationDepthRange > 0)
+				DepthEstimator::ComputeDepthRangeMap(depthData, lowResDepthRangeMap);
 		}
 	}
 
 	DepthData& depthData(fullResDepthData);
 	// remove all estimates with too big score and invert confidence map
 	{
-		const float fNCCThresholdKeep(OPTDENSE::fNCCThresholdKeep);
-		if (nGeometricIter < 0 && OPTDENSE::nEstimationGeometricIters)
-			OPTDENSE::fNCCThresholdKeep *= 1.333f;
+		// keep more estimates if they are going to be refined by the geometric iterations
+		TD_TRACE_SCOPE_ARG("finalize depth-map", idxImage);
+		const float thConfKeep(nGeometricIter < 0 && OPTDENSE::nEstimationGeometricIters ?
+			OPTDENSE::fNCCThresholdKeep * 1.333f : OPTDENSE::fNCCThresholdKeep);
 		// create working threads
+		const unsigned nThreads(getNumThreads(0));
 		idxPixel = -1;
 		ASSERT(estimators.empty());
-		while (estimators.size() < nMaxThreads)
+		while (estimators.size() < nThreads) {
 			estimators.emplace_back(0, depthData, idxPixel,
 				#if DENSE_NCC == DENSE_NCC_WEIGHTED
 				weightMap0,
@@ -785,15 +910,20 @@ bool DepthMapsData::EstimateDepthMap(IIndex idxImage, int nGeometricIter)
 				imageSum0,
 				#endif
 				coords);
-		ASSERT(estimators.size() == threads.size()+1);
-		FOREACH(i, threads)
+			estimators.Last().thConfKeep = thConfKeep;
+			if (!tiles.empty()) {
+				estimators.Last().tiles = &tiles;
+				estimators.Last().idxTileEnd = tiles.size()-1;
+			}
+		}
+		ASSERT(estimators.size() <= threads.size()+1);
+		for (unsigned i=0; i+1<nThreads; ++i)
 			threads[i].start(EndDepthMapTmp, &estimators[i]);
 		EndDepthMapTmp(&estimators.back());
 		// wait for the working threads to close
 		FOREACHPTR(pThread, threads)
 			pThread->join();
 		estimators.clear();
-		OPTDENSE::fNCCThresholdKeep = fNCCThresholdKeep;
 	}
 
 	DEBUG_EXTRA("Depth-map for image %3u %s: %dx%d (%s)", depthData.images.front().GetID(),
@@ -806,102 +936,121 @@ bool DepthMapsData::EstimateDepthMap(IIndex idxImage, int nGeometricIter)
 /*----------------------------------------------------------------*/
 
 
-// filter out small depth segments from the given depth map
-bool DepthMapsData::RemoveSmallSegments(DepthData& depthData)
+// run the given function on nThreads bands of work, in parallel,
+// the calling thread processing the last band
+template <typename FNC>
+static void ProcessBands(unsigned nThreads, const FNC& fnc)
+{
+	struct Band {
+		const FNC* pFnc;
+		unsigned idx;
+		static void* STCALL Process(void* arg) {
+			const Band& band = *((const Band*)arg);
+			(*band.pFnc)(band.idx);
+			return NULL;
+		}
+	};
+	ASSERT(nThreads > 0);
+	cList<Band> bands(nThreads);
+	cList<SEACAVE::Thread> threads(nThreads-1);
+	FOREACH(i, bands) {
+		bands[i].pFnc = &fnc;
+		bands[i].idx = (unsigned)i;
+	}
+	FOREACH(i, threads)
+		threads[i].start(Band::Process, &bands[i]);
+	Band::Process(&bands.back());
+	FOREACHPTR(pThread, threads)
+		pThread->join();
+}
+
+// filter out small depth segments from the given depth map:
+// label the connected segments of similar depths using union-find, first independently
+// on horizontal bands of rows in parallel and next merging the labels across the bands,
+// each segment being represented by its pixel with the smallest index
+bool DepthMapsData::RemoveSmallSegments(DepthData& depthData, unsigned nThreads)
 {
 	const float fDepthDiffThreshold(OPTDENSE::fDepthDiffThreshold*0.7f);
-	unsigned speckle_size = OPTDENSE::nSpeckleSize;
+	const unsigned speckle_size = OPTDENSE::nSpeckleSize;
 	DepthMap& depthMap = depthData.depthMap;
 	NormalMap& normalMap = depthData.normalMap;
 	ConfidenceMap& confMap = depthData.confMap;
-	ASSERT(!depthMap.empty());
+	ASSERT(!depthMap.empty() && depthMap.isContinuous());
 	const ImageRef size(depthMap.size());
+	const uint32_t area((uint32_t)size.x*size.y);
+	nThreads = CLAMP(nThreads, 1u, (unsigned)size.y);
+	const Depth* const depths(depthMap.ptr<const Depth>());
+
+	// the parent of each pixel in its segment tree, always smaller or equal to its index
+	IndexArr parents(area);
+	const auto Find = [&parents](uint32_t idx) -> uint32_t {
+		while (parents[idx] != idx)
+			idx = parents[idx] = parents[parents[idx]];
+		return idx;
+	};
+	const auto Union = [&](uint32_t idxPrev, uint32_t idx) {
+		// join the two pixels if valid and similar
+		// (the depth of the pixel already visited being the reference)
+		if (depths[idxPrev] <= 0 || !IsDepthSimilar(depths[idxPrev], depths[idx], fDepthDiffThreshold))
+			return;
+		const uint32_t rootPrev(Find(idxPrev)), root(Find(idx));
+		if (rootPrev < root)
+			parents[root] = rootPrev;
+		else if (root < rootPrev)
+			parents[rootPrev] = root;
+	};
 
-	// allocate memory on heap for dynamic programming arrays
-	TImage<bool> done_map(size, false);
-	CAutoPtrArr<ImageRef> seg_list(new ImageRef[size.x*size.y]);
-	unsigned seg_list_count;
-	unsigned seg_list_curr;
-	ImageRef neighbor[4];
-
-	// for all pixels do
-	for (int u=0; u<size.x; ++u) {
-		for (int v=0; v<size.y; ++v) {
-			// if the first pixel in this segment has been already processed => skip
-			if (done_map(v,u))
-				continue;
-
-			// init segment list (add first element
-			// and set it to be the next element to check)
-			seg_list[0] = ImageRef(u,v);
-			seg_list_count = 1;
-			seg_list_curr  = 0;
-
-			// add neighboring segments as long as there
-			// are none-processed pixels in the seg_list;
-			// none-processed means: seg_list_curr<seg_list_count
-			while (seg_list_curr < seg_list_count) {
-				// get address of current pixel in this segment
-				const ImageRef addr_curr(seg_list[seg_list_curr]);
-				const Depth& depth_curr = depthMap(addr_curr);
-
-				if (depth_curr>0) {
-					// fill list with neighbor positions
-					neighbor[0] = ImageRef(addr_curr.x-1, addr_curr.y  );
-					neighbor[1] = ImageRef(addr_curr.x+1, addr_curr.y  );
-					neighbor[2] = ImageRef(addr_curr.x  , addr_curr.y-1);
-					neighbor[3] = ImageRef(addr_curr.x  , addr_curr.y+1);
-
-					// for all neighbors do
-					for (int i=0; i<4; ++i) {
-						// get neighbor pixel address
-						const ImageRef& addr_neighbor(neighbor[i]);
-						// check if neighbor is inside image
-						if (addr_neighbor.x>=0 && addr_neighbor.y>=0 && addr_neighbor.x<size.x && addr_neighbor.y<size.y) {
-							// check if neighbor has not been added yet
-							bool& done = done_map(addr_neighbor);
-							if (!done) {
-								// check if the neighbor is valid and similar to the current pixel
-								// (belonging to the current segment)
-								const Depth& depth_neighbor = depthMap(addr_neighbor);
-								if (depth_neighbor>0 && IsDepthSimilar(depth_curr, depth_neighbor, fDepthDiffThreshold)) {
-									// add neighbor coordinates to segment list
-									seg_list[seg_list_count++] = addr_neighbor;
-									// set neighbor pixel in done_map to "done"
-									// (otherwise a pixel may be added 2 times to the list, as
-									//  neighbor of one pixel and as neighbor of another pixel)
-									done = true;
-								}
-							}
-						}
-					}
-				}
-
-				// set current pixel in seg_list to "done"
-				++seg_list_curr;
-
-				// set current pixel in done_map to "done"
-				done_map(addr_curr) = true;
-			} // end: while (seg_list_curr < seg_list_count)
-
-			// if segment NOT large enough => invalidate pixels
-			if (seg_list_count < speckle_size) {
-				// for all pixels in current segment invalidate pixels
-				for (unsigned i=0; i<seg_list_count; ++i) {
-					depthMap(seg_list[i]) = 0;
-					if (!normalMap.empty()) normalMap(seg_list[i]) = Normal::ZERO;
-					if (!confMap.empty()) confMap(seg_list[i]) = 0;
-				}
+	// label each band of rows independently
+	ProcessBands(nThreads, [&](unsigned band) {
+		const int rowBegin(size.y*band/nThreads), rowEnd(size.y*(band+1)/nThreads);
+		for (int r=rowBegin; r<rowEnd; ++r) {
+			for (int c=0; c<size.x; ++c) {
+				const uint32_t idx((uint32_t)r*size.x+c);
+				parents[idx] = idx;
+				if (depths[idx] <= 0)
+					continue;
+				if (c > 0)
+					Union(idx-1, idx);
+				if (r > rowBegin)
+					Union(idx-size.x, idx);
 			}
 		}
+	});
+	// merge the labels across the bands
+	for (unsigned band=1; band<nThreads; ++band) {
+		const int r(size.y*band/nThreads);
+		for (int c=0; c<size.x; ++c) {
+			const uint32_t idx((uint32_t)r*size.x+c);
+			if (depths[idx] > 0)
+				Union(idx-size.x, idx);
+		}
 	}
-
+	// point each pixel directly to its segment root and count the segment sizes
+	IndexArr sizes(area);
+	sizes.Memset(0);
+	for (uint32_t idx=0; idx<area; ++idx)
+		++sizes[parents[idx] = parents[parents[idx]]];
+
+	// invalidate the pixels of the segments not large enough
+	ProcessBands(nThreads, [&](unsigned band) {
+		const int rowBegin(size.y*band/nThreads), rowEnd(size.y*(band+1)/nThreads);
+		for (int r=rowBegin; r<rowEnd; ++r) {
+			for (int c=0; c<size.x; ++c) {
+				if (sizes[parents[(uint32_t)r*size.x+c]] >= speckle_size)
+					continue;
+				depthMap(r,c) = 0;
+				if (!normalMap.empty()) normalMap(r,c) = Normal::ZERO;
+				if (!confMap.empty()) confMap(r,c) = 0;
+			}
+		}
+	});
 	return true;
 } // RemoveSmallSegments
 /*----------------------------------------------------------------*/
 
-// try to fill small gaps in the depth map
-bool DepthMapsData::GapInterpolation(DepthData& depthData)
+// try to fill small gaps in the depth map,
+// first along the rows and next along the columns, each processed in parallel bands
+bool DepthMapsData::GapInterpolation(DepthData& depthData, unsigned nThreads)
 {
 	const float fDepthDiffThreshold(OPTDENSE::fDepthDiffThreshold*2.5f);
 	unsigned nIpolGapSize = OPTDENSE::nIpolGapSize;
@@ -913,139 +1062,174 @@ bool DepthMapsData::GapInterpolation(DepthData& depthData)
 
 	// 1. Row-wise:
 	// for each row do
-	for (int v=0; v<size.y; ++v) {
-		// init counter
-		unsigned count = 0;
-
-		// for each element of the row do
-		for (int u=0; u<size.x; ++u) {
-			// get depth of this location
-			const Depth& depth = depthMap(v,u);
-
-			// if depth not valid => count and skip it
-			if (depth <= 0) {
-				++count;
-				continue;
-			}
-			if (count == 0)
-				continue;
+	const unsigned nRowBands(CLAMP(nThreads, 1u, (unsigned)size.y));
+	ProcessBands(nRowBands, [&](unsigned band) {
+		for (int v=size.y*band/nRowBands, vEnd=size.y*(band+1)/nRowBands; v<vEnd; ++v) {
+			// init counter
+			unsigned count = 0;
+
+			// for each element of the row do
+			for (int u=0; u<size.x; ++u) {
+				// get depth of this location
+				const Depth& depth = depthMap(v,u);
+
+				// if depth not valid => count and skip it
+				if (depth <= 0) {
+					++count;
+					continue;
+				}
+				if (count == 0)
+					continue;
 
-			// check if speckle is small enough
-			// and value in range
-			if (count <= nIpolGapSize && (unsigned)u > count) {
-				// first value index for interpolation
-				int u_curr(u-count);
-				const int u_first(u_curr-1);
-				// compute mean depth
-				const Depth& depthFirst = depthMap(v,u_first);
-				if (IsDepthSimilar(depthFirst, depth, fDepthDiffThreshold)) {
-					#if 0
-					// set all values with the average
-					const Depth avg((depthFirst+depth)*0.5f);
-					do {
-						depthMap(v,u_curr) = avg;
-					} while (++u_curr<u);						
-					#else
-					// interpolate values
-					const Depth diff((depth-depthFirst)/(count+1));
-					Depth d(depthFirst);
-					const float c(confMap.empty() ? 0.f : MINF(confMap(v,u_first), confMap(v,u)));
-					if (normalMap.empty()) {
-						do {
-							depthMap(v,u_curr) = (d+=diff);
-							if (!confMap.empty()) confMap(v,u_curr) = c;
-						} while (++u_curr<u);						
-					} else {
-						Point2f dir1, dir2;
-						Normal2Dir(normalMap(v,u_first), dir1);
-						Normal2Dir(normalMap(v,u), dir2);
-						const Point2f dirDiff((dir2-dir1)/float(count+1));
+				// check if speckle is small enough
+				// and value in range
+				if (count <= nIpolGapSize && (unsigned)u > count) {
+					// first value index for interpolation
+					int u_curr(u-count);
+					const int u_first(u_curr-1);
+					// compute mean depth
+					const Depth& depthFirst = depthMap(v,u_first);
+					if (IsDepthSimilar(depthFirst, depth, fDepthDiffThreshold)) {
+						#if 0
+						// set all values with the average
+						const Depth avg((depthFirst+depth)*0.5f);
 						do {
-							depthMap(v,u_curr) = (d+=diff);
-							dir1 += dirDiff;
-							Dir2Normal(dir1, normalMap(v,u_curr));
-							if (!confMap.empty()) confMap(v,u_curr) = c;
+							depthMap(v,u_curr) = avg;
 						} while (++u_curr<u);						
+						#else
+						// interpolate values
+						const Depth diff((depth-depthFirst)/(count+1));
+						Depth d(depthFirst);
+						const float c(confMap.empty() ? 0.f : MINF(confMap(v,u_first), confMap(v,u)));
+						if (normalMap.empty()) {
+							do {
+								depthMap(v,u_curr) = (d+=diff);
+								if (!confMap.empty()) confMap(v,u_curr) = c;
+							} while (++u_curr<u);						
+						} else {
+							Point2f dir1, dir2;
+							Normal2Dir(normalMap(v,u_first), dir1);
+							Normal2Dir(normalMap(v,u), dir2);
+							const Point2f dirDiff((dir2-dir1)/float(count+1));
+							do {
+								depthMap(v,u_curr) = (d+=diff);
+								dir1 += dirDiff;
+								Dir2Normal(dir1, normalMap(v,u_curr));
+								if (!confMap.empty()) confMap(v,u_curr) = c;
+							} while (++u_curr<u);						
+						}
+						#endif
 					}
-					#endif
 				}
-			}
 
-			// reset counter
-			count = 0;
+				// reset counter
+				count = 0;
+			}
 		}
-	}
+	});
 
 	// 2. Column-wise:
 	// for each column do
-	for (int u=0; u<size.x; ++u) {
+	const unsigned nColBands(CLAMP(nThreads, 1u, (unsigned)size.x));
+	ProcessBands(nColBands, [&](unsigned band) {
+		for (int u=size.x*band/nColBands, uEnd=size.x*(band+1)/nColBands; u<uEnd; ++u) {
 
-		// init counter
-		unsigned count = 0;
+			// init counter
+			unsigned count = 0;
 
-		// for each element of the column do
-		for (int v=0; v<size.y; ++v) {
-			// get depth of this location
-			const Depth& depth = depthMap(v,u);
+			// for each element of the column do
+			for (int v=0; v<size.y; ++v) {
+				// get depth of this location
+				const Depth& depth = depthMap(v,u);
 
-			// if depth not valid => count and skip it
-			if (depth <= 0) {
-				++count;
-				continue;
-			}
-			if (count == 0)
-				continue;
+				// if depth not valid => count and skip it
+				if (depth <= 0) {
+					++count;
+					continue;
+				}
+				if (count == 0)
+					continue;
 
-			// check if gap is small enough
-			// and value in range
-			if (count <= nIpolGapSize && (unsigned)v > count) {
-				// first value index for interpolation
-				int v_curr(v-count);
-				const int v_first(v_curr-1);
-				// compute mean depth
-				const Depth& depthFirst = depthMap(v_first,u);
-				if (IsDepthSimilar(depthFirst, depth, fDepthDiffThreshold)) {
-					#if 0
-					// set all values with the average
-					const Depth avg((depthFirst+depth)*0.5f);
-					do {
-						depthMap(v_curr,u) = avg;
-					} while (++v_curr<v);						
-					#else
-					// interpolate values
-					const Depth diff((depth-depthFirst)/(count+1));
-					Depth d(depthFirst);
-					const float c(confMap.empty() ? 0.f : MINF(confMap(v_first,u), confMap(v,u)));
-					if (normalMap.empty()) {
+				// check if gap is small enough
+				// and value in range
+				if (count <= nIpolGapSize && (unsigned)v > count) {
+					// first value index for interpolation
+					int v_curr(v-count);
+					const int v_first(v_curr-1);
+					// compute mean depth
+					const Depth& depthFirst = depthMap(v_first,u);
+					if (IsDepthSimilar(depthFirst, depth, fDepthDiffThreshold)) {
+						#if 0
+						// set all values with the average
+						const Depth avg((depthFirst+depth)*0.5f);
 						do {
-							depthMap(v_curr,u) = (d+=diff);
-							if (!confMap.empty()) confMap(v_curr,u) = c;
-						} while (++v_curr<v);						
-					} else {
-						Point2f dir1, dir2;
-						Normal2Dir(normalMap(v_first,u), dir1);
-						Normal2Dir(normalMap(v,u), dir2);
-						const Point2f dirDiff((dir2-dir1)/float(count+1));
-						do {
-							depthMap(v_curr,u) = (d+=diff);
-							dir1 += dirDiff;
-							Dir2Normal(dir1, normalMap(v_curr,u));
-							if (!confMap.empty()) confMap(v_curr,u) = c;
+							depthMap(v_curr,u) = avg;
 						} while (++v_curr<v);						
+						#else
+						// interpolate values
+						const Depth diff((depth-depthFirst)/(count+1));
+						Depth d(depthFirst);
+						const float c(confMap.empty() ? 0.f : MINF(confMap(v_first,u), confMap(v,u)));
+						if (normalMap.empty()) {
+							do {
+								depthMap(v_curr,u) = (d+=diff);
+								if (!confMap.empty()) confMap(v_curr,u) = c;
+							} while (++v_curr<v);						
+						} else {
+							Point2f dir1, dir2;
+							Normal2Dir(normalMap(v_first,u), dir1);
+							Normal2Dir(normalMap(v,u), dir2);
+							const Point2f dirDiff((dir2-dir1)/float(count+1));
+							do {
+								depthMap(v_curr,u) = (d+=diff);
+								dir1 += dirDiff;
+								Dir2Normal(dir1, normalMap(v_curr,u));
+								if (!confMap.empty()) confMap(v_curr,u) = c;
+							} while (++v_curr<v);						
+						}
+						#endif
 					}
-					#endif
 				}
-			}
 
-			// reset counter
-			count = 0;
+				// reset counter
+				count = 0;
+			}
 		}
-	}
+	});
 	return true;
 } // GapInterpolation
 /*----------------------------------------------------------------*/
 
 
+// maps the pixels of a source image with known depth to a target image:
+// the image coordinates of pixel x at depth d are given by the homogeneous point d*H*[x 1]+e,
+// the target camera depth being its third component;
+// for each row the term H*[x 1] is affine in the column, so it is computed incrementally
+struct DepthReprojector {
+	Matrix3x3 H; // homography mapping the source pixels to target pixels at infinite depth
+	Point3 e; // epipole, projection of the source camera center in the target image
+	DepthReprojector(const Camera& cameraSrc, const Camera& cameraTrg)
+		: H(cameraTrg.K*cameraTrg.R*cameraSrc.R.t()*cameraSrc.GetInvK()), e(cameraTrg.K*(cameraTrg.R*(cameraSrc.C-cameraTrg.C))) {}
+	// project the pixels of the given row to the target image;
+	// the target coordinates and depth are stored for all pixels, including the invalid ones
+	void ProjectRow(int row, const Depth* depths, int cols, REAL* xs, REAL* ys, REAL* zs) const {
+		const REAL hx(H(0,1)*row+H(0,2)), hy(H(1,1)*row+H(1,2)), hz(H(2,1)*row+H(2,2));
+		for (int c=0; c<cols; ++c) {
+			const REAL d(depths[c]);
+			const REAL z(d*(hz+H(2,0)*c)+e.z);
+			const REAL invZ(z != 0 ? REAL(1)/z : REAL(0));
+			xs[c] = (d*(hx+H(0,0)*c)+e.x)*invZ;
+			ys[c] = (d*(hy+H(1,0)*c)+e.y)*invZ;
+			zs[c] = z;
+		}
+	}
+	// project one pixel to the target image
+	inline Point2 Project(const ImageRef& x, Depth depth) const {
+		const Point3 X(H*Point3(REAL(x.x), REAL(x.y), REAL(1))*REAL(depth)+e);
+		return Point2(X.x/X.z, X.y/X.z);
+	}
+};
+
 // filter depth-map, one pixel at a time, using confidence based fusion or neighbor pixels
 bool DepthMapsData::FilterDepthMap(DepthData& depthDataRef, const IIndexArr& idxNeighbors, bool bAdjust)
 {
@@ -1068,6 +1252,7 @@ bool DepthMapsData::FilterDepthMap(DepthData& depthDataRef, const IIndexArr& idx
 	const Camera& cameraRef = imageRef.camera;
 	DepthMapArr depthMaps(N);
 	ConfidenceMapArr confMaps(N);
+	CLISTDEF0(REAL) rowXs, rowYs, rowZs;
 	FOREACH(n, depthMaps) {
 		DepthMap& depthMap = depthMaps[n];
 		depthMap.create(sizeRef);
@@ -1079,22 +1264,25 @@ bool DepthMapsData::FilterDepthMap(DepthData& depthDataRef, const IIndexArr& idx
 		}
 		const IIndex idxView = depthDataRef.neighbors[idxNeighbors[(IIndex)n]].ID;
 		const DepthData& depthData = arrDepthData[idxView];
-		const Camera& camera = depthData.images.First().camera;
+		const DepthReprojector reprojector(depthData.images.First().camera, cameraRef);
 		const Image8U::Size size(depthData.depthMap.size());
+		rowXs.resize(size.width); rowYs.resize(size.width); rowZs.resize(size.width);
 		for (int i=0; i<size.height; ++i) {
+			// project the entire row at once, then splat the valid depths
+			const Depth* const depths(depthData.depthMap.ptr<const Depth>(i));
+			reprojector.ProjectRow(i, depths, size.width, rowXs.data(), rowYs.data(), rowZs.data());
 			for (int j=0; j<size.width; ++j) {
 				const ImageRef x(j,i);
-				const Depth depth(depthData.depthMap(x));
+				const Depth depth(depths[j]);
 				if (depth == 0)
 					continue;
 				ASSERT(depth > 0);
-				const Point3 X(camera.TransformPointI2W(Point3(x.x,x.y,depth)));
-				const Point3 camX(cameraRef.TransformPointW2C(X));
+				const Point3 camX(rowXs[j], rowYs[j], rowZs[j]);
 				if (camX.z <= 0)
 					continue;
 				#if 0
 				// set depth on the rounded image projection only
-				const ImageRef xRef(ROUND2INT(cameraRef.TransformPointC2I(camX)));
+				const ImageRef xRef(ROUND2INT(camX.x), ROUND2INT(camX.y));
 				if (!depthMap.isInside(xRef))
 					continue;
 				Depth& depthRef(depthMap(xRef));
@@ -1102,10 +1290,10 @@ bool DepthMapsData::FilterDepthMap(DepthData& depthDataRef, const IIndexArr& idx
 					continue;
 				depthRef = camX.z;
 				if (bAdjust)
-					confMap(xRef) = depthData.confMap(x);
+					confMap(xRef) = depthData.GetConfMap(x);
 				#else
 				// set depth on the 4 pixels around the image projection
-				const Point2 imgX(cameraRef.TransformPointC2I(camX));
+				const Point2 imgX(camX.x, camX.y);
 				const ImageRef xRefs[4] = {
 					ImageRef(FLOOR2INT(imgX.x), FLOOR2INT(imgX.y)),
 					ImageRef(FLOOR2INT(imgX.x), CEIL2INT(imgX.y)),
@@ -1121,7 +1309,7 @@ bool DepthMapsData::FilterDepthMap(DepthData& depthDataRef, const IIndexArr& idx
 						continue;
 					depthRef = (Depth)camX.z;
 					if (bAdjust)
-						confMap(xRef) = depthData.confMap(x);
+						confMap(xRef) = depthData.GetConfMap(x);
 				}
 				#endif
 			}
@@ -1139,6 +1327,10 @@ bool DepthMapsData::FilterDepthMap(DepthData& depthDataRef, const IIndexArr& idx
 	size_t nProcessed(0), nDiscarded(0);
 	#endif
 	if (bAdjust) {
+		// map the reference pixels back to the neighbor depth-maps, to check the free-space violations
+		CLISTDEF0(DepthReprojector) reprojectors(0, N);
+		FOREACH(n, depthMaps)
+			reprojectors.emplace_back(cameraRef, arrDepthData[depthDataRef.neighbors[idxNeighbors[n]].ID].images.First().camera);
 		// average similar depths, and decrease confidence if depths do not agree
 		// (inspired by: "Real-Time Visibility-Based Fusion of Depth Maps", Merrell, 2007)
 		for (int i=0; i<sizeRef.height; ++i) {
@@ -1155,7 +1347,7 @@ bool DepthMapsData::FilterDepthMap(DepthData& depthDataRef, const IIndexArr& idx
 				++nProcessed;
 				#endif
 				// update best depth and confidence estimate with all estimates
-				float posConf(depthDataRef.confMap(xRef)), negConf(0);
+				float posConf(depthDataRef.GetConfMap(xRef)), negConf(0);
 				Depth avgDepth(depth*posConf);
 				unsigned nPosViews(0), nNegViews(0);
 				unsigned n(N);
@@ -1181,11 +1373,9 @@ bool DepthMapsData::FilterDepthMap(DepthData& depthDataRef, const IIndexArr& idx
 						} else {
 							// free-space violation
 							const DepthData& depthData = arrDepthData[depthDataRef.neighbors[idxNeighbors[n]].ID];
-							const Camera& camera = depthData.images.First().camera;
-							const Point3 X(cameraRef.TransformPointI2W(Point3(xRef.x,xRef.y,depth)));
-							const ImageRef x(ROUND2INT(camera.TransformPointW2I(X)));
-							if (depthData.confMap.isInside(x)) {
-								const float c(depthData.confMap(x));
+							const ImageRef x(ROUND2INT(reprojectors[n].Project(xRef, depth)));
+							if (depthData.HasConfMap() && depthData.depthMap.isInside(x)) {
+								const float c(depthData.GetConfMap(x));
 								negConf += (c > 0 ? c : confMaps[n](xRef));
 							} else
 								negConf += confMaps[n](xRef);
@@ -1285,7 +1475,7 @@ bool DepthMapsData::FilterDepthMap(DepthData& depthDataRef, const IIndexArr& idx
 				}
 				// enough good views, keep it
 				newDepthMap(xRef) = depth;
-				newConfMap(xRef) = depthDataRef.confMap(xRef);
+				newConfMap(xRef) = depthDataRef.GetConfMap(xRef);
 			}
 		}
 	}
@@ -1305,34 +1495,99 @@ bool DepthMapsData::FilterDepthMap(DepthData& depthDataRef, const IIndexArr& idx
 void DepthMapsData::MergeDepthMaps(PointCloud& pointcloud, bool bEstimateColor, bool bEstimateNormal)
 {
 	TD_TIMER_STARTD();
+	TD_TRACE_SCOPE("merge depth-maps");
 
-	// estimate total number of 3D points that will be generated
-	size_t nPointsEstimate(0);
-	for (const DepthData& depthData: arrDepthData)
-		if (depthData.IsValid())
-			nPointsEstimate += (size_t)depthData.depthMap.size().area()*7/10;
+	// count the valid depths of each depth-map
+	SizeArr offsets(arrDepthData.size()+1);
+	offsets.Memset(0);
+	#ifdef DENSE_USE_OPENMP
+	bool bAbort(false);
+	#pragma omp parallel for shared(offsets, bAbort) schedule(dynamic)
+	for (int64_t i=0; i<(int64_t)arrDepthData.size(); ++i) {
+		#pragma omp flush (bAbort)
+		if (bAbort)
+			continue;
+		const IIndex idxImage((IIndex)i);
+	#else
+	FOREACH(idxImage, arrDepthData) {
+	#endif
+		DepthData& depthData = arrDepthData[idxImage];
+		ASSERT(depthData.GetView().GetLocalID(scene.images) == idxImage);
+		if (!depthData.IsValid())
+			continue;
+		if (!depthDataCache.Acquire(depthData, ComposeDepthFilePath(depthData.GetView().GetID(), "dmap"), DENSE_LOAD_READONLY)) {
+			#ifdef DENSE_USE_OPENMP
+			bAbort = true;
+			#pragma omp flush (bAbort)
+			continue;
+			#else
+			return;
+			#endif
+		}
+		ASSERT(!depthData.IsEmpty());
+		size_t nDepths(0);
+		for (int i=0; i<depthData.depthMap.rows; ++i) {
+			const Depth* const depths(depthData.depthMap.ptr<const Depth>(i));
+			for (int j=0; j<depthData.depthMap.cols; ++j)
+				if (depths[j] != 0)
+					++nDepths;
+		}
+		offsets[idxImage+1] = nDepths;
+		depthDataCache.Release(depthData);
+	}
+	#ifdef DENSE_USE_OPENMP
+	if (bAbort)
+		return;
+	#endif
 
-	// fuse all depth-maps
-	size_t nDepthMaps(0), nDepths(0);
-	pointcloud.points.reserve(nPointsEstimate);
-	pointcloud.pointViews.reserve(nPointsEstimate);
+	// compute where the points of each depth-map start,
+	// so that they are stored in the order of the depth-maps and pixels
+	size_t nDepthMaps(0);
+	FOREACH(idxImage, arrDepthData) {
+		if (arrDepthData[idxImage].IsValid())
+			++nDepthMaps;
+		offsets[idxImage+1] += offsets[idxImage];
+	}
+	const size_t nDepths(offsets.back());
+	ASSERT(pointcloud.IsEmpty());
+	pointcloud.points.resize(nDepths);
+	pointcloud.pointViews.resize(nDepths);
 	if (bEstimateColor)
-		pointcloud.colors.reserve(nPointsEstimate);
+		pointcloud.colors.resize(nDepths);
 	if (bEstimateNormal)
-		pointcloud.normals.reserve(nPointsEstimate);
+		pointcloud.normals.resize(nDepths);
+
+	// back-project the depths of all depth-maps
 	Util::Progress progress(_T("Merged depth-maps"), arrDepthData.size());
 	GET_LOGCONSOLE().Pause();
+	#ifdef DENSE_USE_OPENMP
+	#pragma omp parallel for shared(pointcloud, offsets, progress, bAbort) schedule(dynamic)
+	for (int64_t i=0; i<(int64_t)arrDepthData.size(); ++i) {
+		#pragma omp flush (bAbort)
+		if (bAbort)
+			continue;
+		const IIndex idxImage((IIndex)i);
+	#else
 	FOREACH(idxImage, arrDepthData) {
+	#endif
 		TD_TIMER_STARTD();
 		DepthData& depthData = arrDepthData[idxImage];
-		ASSERT(depthData.GetView().GetLocalID(scene.images) == idxImage);
-		if (!depthData.IsValid())
+		if (!depthData.IsValid()) {
+			++progress;
 			continue;
-		if (depthData.IncRef(ComposeDepthFilePath(depthData.GetView().GetID(), "dmap")) == 0)
+		}
+		if (!depthDataCache.Acquire(depthData, ComposeDepthFilePath(depthData.GetView().GetID(), "dmap"), DENSE_LOAD_READONLY)) {
+			#ifdef DENSE_USE_OPENMP
+			bAbort = true;
+			#pragma omp flush (bAbort)
+			continue;
+			#else
 			return;
+			#endif
+		}
 		ASSERT(!depthData.IsEmpty());
 		const DepthData::ViewData& image = depthData.GetView();
-		const size_t nNumPointsPrev(pointcloud.points.size());
+		size_t idxPoint(offsets[idxImage]);
 		for (int i=0; i<depthData.depthMap.rows; ++i) {
 			for (int j=0; j<depthData.depthMap.cols; ++j) {
 				// ignore invalid depth
@@ -1342,24 +1597,31 @@ void DepthMapsData::MergeDepthMaps(PointCloud& pointcloud, bool bEstimateColor,
 					continue;
 				ASSERT(ISINSIDE(depth, depthData.dMin, depthData.dMax));
 				// create the corresponding 3D point
-				pointcloud.points.emplace_back(image.camera.TransformPointI2W(Point3(Cast<float>(x),depth)));
-				pointcloud.pointViews.emplace_back().push_back(idxImage);
+				pointcloud.points[idxPoint] = image.camera.TransformPointI2W(Point3(Cast<float>(x),depth));
+				pointcloud.pointViews[idxPoint].push_back(idxImage);
 				if (bEstimateColor)
-					pointcloud.colors.emplace_back(image.pImageData->image(x));
+					pointcloud.colors[idxPoint] = image.pImageData->image(x);
 				if (bEstimateNormal)
-					depthData.GetNormal(x, pointcloud.normals.emplace_back());
-				++nDepths;
+					depthData.GetNormal(x, pointcloud.normals[idxPoint]);
+				++idxPoint;
 			}
 		}
-		depthData.DecRef();
-		++nDepthMaps;
-		ASSERT(pointcloud.points.size() == pointcloud.pointViews.size());
+		ASSERT(idxPoint == offsets[idxImage+1]);
+		depthDataCache.Release(depthData);
 		DEBUG_ULTIMATE("Depths map for reference image %3u merged using %u depths maps: %u new points (%s)",
-			idxImage, depthData.images.size()-1, pointcloud.points.size()-nNumPointsPrev, TD_TIMER_GET_FMT().c_str());
-		progress.display(idxImage+1);
+			idxImage, depthData.images.size()-1, offsets[idxImage+1]-offsets[idxImage], TD_TIMER_GET_FMT().c_str());
+		++progress;
 	}
 	GET_LOGCONSOLE().Play();
 	progress.close();
+	depthDataCache.LogStats();
+	depthDataCache.Clear();
+	#ifdef DENSE_USE_OPENMP
+	if (bAbort) {
+		pointcloud.Release();
+		return;
+	}
+	#endif
 
 	DEBUG_EXTRA("Depth-maps merged: %u depth-maps, %u depths, %u points (%d%%%%) (%s)",
 		nDepthMaps, nDepths, pointcloud.points.size(), ROUND2INT(100.f*pointcloud.points.size()/nDepths), TD_TIMER_GET_FMT().c_str());
@@ -1372,6 +1634,7 @@ void DepthMapsData::MergeDepthMaps(PointCloud& pointcloud, bool bEstimateColor,
 void DepthMapsData::FuseDepthMaps(PointCloud& pointcloud, bool bEstimateColor, bool bEstimateNormal)
 {
 	TD_TIMER_STARTD();
+	TD_TRACE_SCOPE("fuse depth-maps");
 
 	struct Proj {
 		union {
@@ -1411,7 +1674,7 @@ void DepthMapsData::FuseDepthMaps(PointCloud& pointcloud, bool bEstimateColor, b
 			continue;
 		}
 		const String fileName(ComposeDepthFilePath(depthData.GetView().GetID(), "dmap"));
-		if (depthData.IncRef(fileName) == 0) {
+		if (!depthDataCache.Acquire(depthData, fileName, DENSE_LOAD_READONLY)) {
 			#ifdef DENSE_USE_OPENMP
 			bAbort = true;
 			#pragma omp flush (bAbort)
@@ -1423,9 +1686,11 @@ void DepthMapsData::FuseDepthMaps(PointCloud& pointcloud, bool bEstimateColor, b
 		ASSERT(!depthData.IsEmpty());
 		connection.idx = idxImage;
 		connection.score = (float)scene.images[idxImage].neighbors.size();
-		if (bEstimateNormal && depthData.normalMap.empty()) {
+		if (bEstimateNormal && !depthData.HasNormalMap()) {
 			EstimateNormalMap(depthData.images.front().camera.K, depthData.depthMap, depthData.normalMap);
-			if (!depthData.Save(fileName)) {
+			depthData.ReleaseMapping();
+			// the fused depth-maps are final, and re-encoding their decoded maps is lossless
+			if (!depthData.Save(fileName, OPTDENSE::nDepthMapEncoding)) {
 				#ifdef DENSE_USE_OPENMP
 				bAbort = true;
 				#pragma omp flush (bAbort)
@@ -1440,9 +1705,12 @@ void DepthMapsData::FuseDepthMaps(PointCloud& pointcloud, bool bEstimateColor, b
 		#endif
 		{
 		nPointsEstimate += ROUND2INT(depthData.depthMap.area()*(0.5f/*valid*/*0.3f/*new*/));
-		if (depthData.normalMap.empty())
+		if (!depthData.HasNormalMap())
 			bNormalMap = false;
 		}
+		// if caching is enabled, the depth-maps are loaded again only when needed
+		if (depthDataCache.IsEnabled())
+			depthDataCache.Release(depthData);
 	}
 	#ifdef DENSE_USE_OPENMP
 	if (bAbort)
@@ -1459,7 +1727,10 @@ void DepthMapsData::FuseDepthMaps(PointCloud& pointcloud, bool bEstimateColor, b
 	// fuse all depth-maps, processing the best connected images first
 	const unsigned nMinViewsFuse(MINF(OPTDENSE::nMinViewsFuse, scene.images.size()));
 	const float normalError(COS(FD2R(OPTDENSE::fNormalDiffThreshold)));
-	CLISTDEF0(Depth*) invalidDepths(0, 32);
+	// neighbor depths that do not agree with a fused point are marked as discarded in the index map
+	// instead of being reset in the depth-map, as the depth-map might be unloaded and loaded again later
+	const uint32_t idxDiscarded(NO_ID-1);
+	CLISTDEF0(uint32_t*) invalidDepths(0, 32);
 	size_t nDepths(0);
 	typedef TImage<cuint32_t> DepthIndex;
 	typedef cList<DepthIndex> DepthIndexArr;
@@ -1479,8 +1750,29 @@ void DepthMapsData::FuseDepthMaps(PointCloud& pointcloud, bool bEstimateColor, b
 	for (const IndexScore& connection: connections) {
 		TD_TIMER_STARTD();
 		const uint32_t idxImage(connection.idx);
-		const DepthData& depthData(arrDepthData[idxImage]);
+		DepthData& depthData(arrDepthData[idxImage]);
 		ASSERT(!depthData.images.empty() && !depthData.neighbors.empty());
+		if (depthDataCache.IsEnabled()) {
+			// load the depth-maps of this image and its neighbors
+			if (!depthDataCache.Acquire(depthData, ComposeDepthFilePath(depthData.GetView().GetID(), "dmap"), DENSE_LOAD_READONLY))
+				return;
+			for (const ViewScore& neighbor: depthData.neighbors) {
+				DepthData& depthDataB = arrDepthData[neighbor.ID];
+				if (depthDataB.IsValid() && !depthDataCache.Acquire(depthDataB, ComposeDepthFilePath(depthDataB.GetView().GetID(), "dmap"), DENSE_LOAD_READONLY))
+					return;
+			}
+			// and start loading the ones needed next
+			const IndexScore* pConnectionNext(&connection+1);
+			if (pConnectionNext < connections.end()) {
+				DepthData& depthDataNext = arrDepthData[pConnectionNext->idx];
+				depthDataCache.Prefetch(depthDataNext, ComposeDepthFilePath(depthDataNext.GetView().GetID(), "dmap"), DENSE_LOAD_READONLY);
+				for (const ViewScore& neighbor: depthDataNext.neighbors) {
+					DepthData& depthDataB = arrDepthData[neighbor.ID];
+					if (depthDataB.IsValid())
+						depthDataCache.Prefetch(depthDataB, ComposeDepthFilePath(depthDataB.GetView().GetID(), "dmap"), DENSE_LOAD_READONLY);
+				}
+			}
+		}
 		for (const ViewScore& neighbor: depthData.neighbors) {
 			DepthIndex& depthIdxs = arrDepthIdx[neighbor.ID];
 			if (!depthIdxs.empty())
@@ -1507,9 +1799,11 @@ void DepthMapsData::FuseDepthMaps(PointCloud& pointcloud, bool bEstimateColor, b
 				const Depth depth(depthData.depthMap(x));
 				if (depth == 0)
 					continue;
+				uint32_t& idxPoint = depthIdxs(x);
+				if (idxPoint == idxDiscarded)
+					continue;
 				++nDepths;
 				ASSERT(ISINSIDE(depth, depthData.dMin, depthData.dMax));
-				uint32_t& idxPoint = depthIdxs(x);
 				if (idxPoint != NO_ID)
 					continue;
 				// create the corresponding 3D point
@@ -1519,10 +1813,10 @@ void DepthMapsData::FuseDepthMaps(PointCloud& pointcloud, bool bEstimateColor, b
 				PointCloud::ViewArr& views = pointcloud.pointViews.emplace_back();
 				views.emplace_back(idxImage);
 				PointCloud::WeightArr& weights = pointcloud.pointWeights.emplace_back();
-				REAL confidence(weights.emplace_back(Conf2Weight(depthData.confMap.empty() ? 1.f : depthData.confMap(x),depth)));
+				REAL confidence(weights.emplace_back(Conf2Weight(depthData.HasConfMap() ? depthData.GetConfMap(x) : 1.f,depth)));
 				ProjArr& pointProjs = projs.emplace_back();
 				pointProjs.emplace_back(Proj(x));
-				const PointCloud::Normal normal(bNormalMap ? Cast<Normal::Type>(imageData.camera.R.t()*Cast<REAL>(depthData.normalMap(x))) : Normal(0,0,-1));
+				const PointCloud::Normal normal(bNormalMap ? Cast<Normal::Type>(imageData.camera.R.t()*Cast<REAL>(depthData.GetNormalMap(x))) : Normal(0,0,-1));
 				ASSERT(ISEQUAL(norm(normal), 1.f));
 				// check the projection in the neighbor depth-maps
 				Point3 X(point*confidence);
@@ -1539,10 +1833,10 @@ void DepthMapsData::FuseDepthMaps(PointCloud& pointcloud, bool bEstimateColor, b
 					if (pt.z <= 0)
 						continue;
 					const ImageRef xB(ROUND2INT(pt.x/pt.z), ROUND2INT(pt.y/pt.z));
-					DepthMap& depthMapB = depthDataB.depthMap;
+					const DepthMap& depthMapB = depthDataB.depthMap;
 					if (!depthMapB.isInside(xB))
 						continue;
-					Depth& depthB = depthMapB(xB);
+					const Depth depthB(depthMapB(xB));
 					if (depthB == 0)
 						continue;
 					uint32_t& idxPointB = arrDepthIdx[idxImageB](xB);
@@ -1550,12 +1844,12 @@ void DepthMapsData::FuseDepthMaps(PointCloud& pointcloud, bool bEstimateColor, b
 						continue;
 					if (IsDepthSimilar(pt.z, depthB, OPTDENSE::fDepthDiffThreshold)) {
 						// check if normals agree
-						const PointCloud::Normal normalB(bNormalMap ? Cast<Normal::Type>(imageDataB.camera.R.t()*Cast<REAL>(depthDataB.normalMap(xB))) : Normal(0,0,-1));
+						const PointCloud::Normal normalB(bNormalMap ? Cast<Normal::Type>(imageDataB.camera.R.t()*Cast<REAL>(depthDataB.GetNormalMap(xB))) : Normal(0,0,-1));
 						ASSERT(ISEQUAL(norm(normalB), 1.f));
 						if (normal.dot(normalB) > normalError) {
 							// add view to the 3D point
 							ASSERT(views.FindFirst(idxImageB) == PointCloud::ViewArr::NO_INDEX);
-							const float confidenceB(Conf2Weight(depthDataB.confMap.empty() ? 1.f : depthDataB.confMap(xB),depthB));
+							const float confidenceB(Conf2Weight(depthDataB.HasConfMap() ? depthDataB.GetConfMap(xB) : 1.f,depthB));
 							const IIndex idx(views.InsertSort(idxImageB));
 							weights.InsertAt(idx, confidenceB);
 							pointProjs.InsertAt(idx, Proj(xB));
@@ -1571,7 +1865,7 @@ void DepthMapsData::FuseDepthMaps(PointCloud& pointcloud, bool bEstimateColor, b
 					}
 					if (pt.z < depthB) {
 						// discard depth
-						invalidDepths.emplace_back(&depthB);
+						invalidDepths.emplace_back(&idxPointB);
 					}
 				}
 				if (views.size() < nMinViewsFuse) {
@@ -1596,12 +1890,20 @@ void DepthMapsData::FuseDepthMaps(PointCloud& pointcloud, bool bEstimateColor, b
 					if (bEstimateNormal)
 						pointcloud.normals.emplace_back(normalized(N*(float)nrm));
 					// invalidate all neighbor depths that do not agree with it
-					for (Depth* pDepth: invalidDepths)
-						*pDepth = 0;
+					for (uint32_t* pIdxPoint: invalidDepths)
+						*pIdxPoint = idxDiscarded;
 				}
 			}
 		}
 		ASSERT(pointcloud.points.size() == pointcloud.pointViews.size() && pointcloud.points.size() == pointcloud.pointWeights.size() && pointcloud.points.size() == projs.size());
+		if (depthDataCache.IsEnabled()) {
+			for (const ViewScore& neighbor: depthData.neighbors) {
+				DepthData& depthDataB = arrDepthData[neighbor.ID];
+				if (depthDataB.IsValid())
+					depthDataCache.Release(depthDataB);
+			}
+			depthDataCache.Release(depthData);
+		}
 		DEBUG_ULTIMATE("Depths map for reference image %3u fused using %u depths maps: %u new points (%s)", idxImage, depthData.images.size()-1, pointcloud.points.size()-nNumPointsPrev, TD_TIMER_GET_FMT().c_str());
 		progress.display(&connection-connections.data());
 	}
@@ -1612,9 +1914,17 @@ void DepthMapsData::FuseDepthMaps(PointCloud& pointcloud, bool bEstimateColor, b
 	DEBUG_EXTRA("Depth-maps fused and filtered: %u depth-maps, %u depths, %u points (%d%%%%) (%s)",
 		connections.size(), nDepths, pointcloud.points.size(), ROUND2INT((100.f*pointcloud.points.size())/nDepths), TD_TIMER_GET_FMT().c_str());
 
-	if (bEstimateNormal && !pointcloud.points.empty() && pointcloud.normals.empty()) {
+	const bool bEstimateNormalFromMaps(bEstimateNormal && !pointcloud.points.empty() && pointcloud.normals.empty());
+	if (bEstimateNormalFromMaps) {
 		// estimate normal also if requested (quite expensive if normal-maps not available)
 		TD_TIMER_STARTD();
+		if (depthDataCache.IsEnabled()) {
+			for (const IndexScore& connection: connections) {
+				DepthData& depthData = arrDepthData[connection.idx];
+				if (!depthDataCache.Acquire(depthData, ComposeDepthFilePath(depthData.GetView().GetID(), "dmap"), DENSE_LOAD_READONLY))
+					return;
+			}
+		}
 		pointcloud.normals.resize(pointcloud.points.size());
 		const int64_t nPoints((int64_t)pointcloud.points.size());
 		#ifdef DENSE_USE_OPENMP
@@ -1640,29 +1950,452 @@ void DepthMapsData::FuseDepthMaps(PointCloud& pointcloud, bool bEstimateColor, b
 	}
 
 	// release all depth-maps
-	for (DepthData& depthData: arrDepthData)
-		if (depthData.IsValid())
-			depthData.DecRef();
+	if (depthDataCache.IsEnabled()) {
+		if (bEstimateNormalFromMaps) {
+			for (const IndexScore& connection: connections)
+				depthDataCache.Release(arrDepthData[connection.idx]);
+		}
+		depthDataCache.LogStats();
+		depthDataCache.Clear();
+	} else {
+		for (DepthData& depthData: arrDepthData)
+			if (depthData.IsValid())
+				depthData.DecRef();
+	}
 } // FuseDepthMaps
 /*----------------------------------------------------------------*/
 
+// fuse all valid depth-maps out-of-core, streaming the fused points to the given PLY file:
+// the scene volume is split in a grid of cells fused one at a time, each cell using only the
+// reference images that see it; a depth is consumed by at most one fused point, so points
+// are not duplicated across cell borders, and the per-pixel fusion state of an image
+// is released as soon as the last cell using it is fused;
+// the points are saved as by PointCloud::Save(), with the views if bViews,
+// and the number of points written is returned in pNumPoints if given
+bool DepthMapsData::FuseDepthMapsStream(const String& fileName, const OBB3f* pROI, bool bEstimateColor, bool bEstimateNormal, bool bViews, bool bLegacyTypes, size_t* pNumPoints)
+{
+	TD_TIMER_STARTD();
+	TD_TRACE_SCOPE("fuse depth-maps");
+	ASSERT(OPTDENSE::nFusionPartitions > 0);
+
+	// find best connected images and the bounding-box of the points seen by each of them
+	IndexScoreArr connections(scene.images.size());
+	cList<AABB3f> boxes(scene.images.size());
+	bool bNormalMap(true);
+	#ifdef DENSE_USE_OPENMP
+	bool bAbort(false);
+	#pragma omp parallel for shared(connections, boxes, bNormalMap, bAbort)
+	for (int64_t i=0; i<(int64_t)scene.images.size(); ++i) {
+		#pragma omp flush (bAbort)
+		if (bAbort)
+			continue;
+		const IIndex idxImage((IIndex)i);
+	#else
+	FOREACH(idxImage, scene.images) {
+	#endif
+		IndexScore& connection = connections[idxImage];
+		DepthData& depthData = arrDepthData[idxImage];
+		if (!depthData.IsValid()) {
+			connection.idx = NO_ID;
+			connection.score = 0;
+			continue;
+		}
+		const String fileNameDepth(ComposeDepthFilePath(depthData.GetView().GetID(), "dmap"));
+		if (!depthDataCache.Acquire(depthData, fileNameDepth, DENSE_LOAD_READONLY)) {
+			#ifdef DENSE_USE_OPENMP
+			bAbort = true;
+			#pragma omp flush (bAbort)
+			continue;
+			#else
+			return false;
+			#endif
+		}
+		ASSERT(!depthData.IsEmpty());
+		connection.idx = idxImage;
+		connection.score = (float)scene.images[idxImage].neighbors.size();
+		if (bEstimateNormal && !depthData.HasNormalMap()) {
+			EstimateNormalMap(depthData.images.front().camera.K, depthData.depthMap, depthData.normalMap);
+			depthData.ReleaseMapping();
+			// the fused depth-maps are final, and re-encoding their decoded maps is lossless
+			if (!depthData.Save(fileNameDepth, OPTDENSE::nDepthMapEncoding)) {
+				#ifdef DENSE_USE_OPENMP
+				bAbort = true;
+				#pragma omp flush (bAbort)
+				continue;
+				#else
+				return false;
+				#endif
+			}
+		}
+		const Camera& camera = scene.images[idxImage].camera;
+		AABB3f& box = boxes[idxImage];
+		box = AABB3f(true);
+		for (int r=0; r<depthData.depthMap.rows; ++r) {
+			for (int c=0; c<depthData.depthMap.cols; ++c) {
+				const ImageRef x(c,r);
+				const Depth depth(depthData.depthMap(x));
+				if (depth > 0)
+					box.InsertFull(Cast<float>(camera.TransformPointI2W(Point3(Point2f(x),depth))));
+			}
+		}
+		if (box.IsEmpty())
+			connection.score = 0;
+		if (!depthData.HasNormalMap()) {
+			#ifdef DENSE_USE_OPENMP
+			#pragma omp critical
+			#endif
+			bNormalMap = false;
+		}
+		// the depth-maps are loaded again only while fusing the cells they see
+		depthDataCache.Release(depthData);
+	}
+	#ifdef DENSE_USE_OPENMP
+	if (bAbort)
+		return false;
+	#endif
+	connections.Sort();
+	while (!connections.empty() && connections.back().score <= 0)
+		connections.pop_back();
+	if (connections.empty()) {
+		DEBUG("error: no valid depth-maps found");
+		return false;
+	}
+
+	// split the scene volume in a grid of cubic cells
+	AABB3f bounds(true);
+	for (const IndexScore& connection: connections)
+		bounds.Insert(boxes[connection.idx]);
+	if (pROI)
+		bounds.BoundBy(pROI->GetAABB());
+	const AABB3f::POINT boundsSize(bounds.GetSize());
+	if (!(boundsSize.minCoeff() >= 0)) {
+		DEBUG("error: no depth-map sees the region-of-interest");
+		return false;
+	}
+	const float cellSize(MAXF(boundsSize.maxCoeff()/OPTDENSE::nFusionPartitions, FLT_EPSILON));
+	const Point3i numCells(
+		FLOOR2INT(boundsSize.x()/cellSize)+1,
+		FLOOR2INT(boundsSize.y()/cellSize)+1,
+		FLOOR2INT(boundsSize.z()/cellSize)+1);
+
+	// collect the reference images seeing each cell, in the order of their connectivity,
+	// and find the last cell where each image is needed as reference or neighbor
+	struct Cell {
+		AABB3f box;
+		IIndexArr images;
+	};
+	cList<Cell> cells(0, numCells.x*numCells.y*numCells.z);
+	IIndexArr lastCell(scene.images.size());
+	lastCell.MemsetValue(NO_ID);
+	for (int z=0; z<numCells.z; ++z) {
+		for (int y=0; y<numCells.y; ++y) {
+			for (int x=0; x<numCells.x; ++x) {
+				const AABB3f::POINT ptMin(bounds.ptMin+AABB3f::POINT((float)x,(float)y,(float)z)*cellSize);
+				Cell& cell = cells.emplace_back();
+				cell.box.Set(ptMin, ptMin+AABB3f::POINT::Constant(cellSize));
+				for (const IndexScore& connection: connections) {
+					if (!cell.box.Intersects(boxes[connection.idx]))
+						continue;
+					cell.images.emplace_back(connection.idx);
+					lastCell[connection.idx] = cells.size()-1;
+					for (const ViewScore& neighbor: arrDepthData[connection.idx].neighbors)
+						lastCell[neighbor.ID] = cells.size()-1;
+				}
+				if (cell.images.empty())
+					cells.pop_back();
+			}
+		}
+	}
+	boxes.Release();
+
+	// open the output file
+	if (bEstimateNormal && !bNormalMap)
+		bEstimateNormal = false;
+	PointCloudStreamWriter writer;
+	if (!writer.Open(fileName, bEstimateColor, bEstimateNormal, bViews, bLegacyTypes)) {
+		DEBUG("error: can not write the point-cloud '%s'", fileName.c_str());
+		return false;
+	}
+
+	// fuse the cells one by one, processing the best connected images first
+	const unsigned nMinViewsFuse(MINF(OPTDENSE::nMinViewsFuse, scene.images.size()));
+	const float normalError(COS(FD2R(OPTDENSE::fNormalDiffThreshold)));
+	// fusion state of each depth: free, used by a fused point, or discarded by a fused point
+	enum : uint8_t { DEPTH_FREE = 0, DEPTH_USED, DEPTH_DISCARDED };
+	typedef TImage<uint8_t> DepthState;
+	cList<DepthState> arrDepthState(scene.images.size());
+	CLISTDEF0(uint8_t*) usedDepths(0, 32), invalidDepths(0, 32);
+	PointCloud pointcloud;
+	size_t nMaxPoints(0);
+	Util::Progress progress(_T("Fused cells"), cells.size());
+	GET_LOGCONSOLE().Pause();
+	FOREACH(idxCell, cells) {
+		const Cell& cell = cells[idxCell];
+		FOREACH(idxRef, cell.images) {
+			const IIndex idxImage(cell.images[idxRef]);
+			DepthData& depthData(arrDepthData[idxImage]);
+			ASSERT(!depthData.images.empty() && !depthData.neighbors.empty());
+			// load the depth-maps of this image and its neighbors
+			if (!depthDataCache.Acquire(depthData, ComposeDepthFilePath(depthData.GetView().GetID(), "dmap"), DENSE_LOAD_READONLY))
+				return false;
+			for (const ViewScore& neighbor: depthData.neighbors) {
+				DepthData& depthDataB = arrDepthData[neighbor.ID];
+				if (depthDataB.IsValid() && !depthDataCache.Acquire(depthDataB, ComposeDepthFilePath(depthDataB.GetView().GetID(), "dmap"), DENSE_LOAD_READONLY))
+					return false;
+			}
+			// and start loading the ones needed next
+			if (depthDataCache.IsEnabled()) {
+				const IIndex idxImageNext(idxRef+1 < cell.images.size() ? cell.images[idxRef+1] : (idxCell+1 < cells.size() ? cells[idxCell+1].images.front() : NO_ID));
+				if (idxImageNext != NO_ID) {
+					DepthData& depthDataNext = arrDepthData[idxImageNext];
+					depthDataCache.Prefetch(depthDataNext, ComposeDepthFilePath(depthDataNext.GetView().GetID(), "dmap"), DENSE_LOAD_READONLY);
+					for (const ViewScore& neighbor: depthDataNext.neighbors) {
+						DepthData& depthDataB = arrDepthData[neighbor.ID];
+						if (depthDataB.IsValid())
+							depthDataCache.Prefetch(depthDataB, ComposeDepthFilePath(depthDataB.GetView().GetID(), "dmap"), DENSE_LOAD_READONLY);
+					}
+				}
+			}
+			for (const ViewScore& neighbor: depthData.neighbors) {
+				DepthState& depthStates = arrDepthState[neighbor.ID];
+				const DepthData& depthDataB(arrDepthData[neighbor.ID]);
+				if (!depthStates.empty() || depthDataB.IsEmpty())
+					continue;
+				depthStates.create(depthDataB.depthMap.size());
+				depthStates.memset(DEPTH_FREE);
+			}
+			ASSERT(!depthData.IsEmpty());
+			const Image8U::Size sizeMap(depthData.depthMap.size());
+			const Image& imageData = *depthData.images.front().pImageData;
+			ASSERT(&imageData-scene.images.data() == idxImage);
+			DepthState& depthStates = arrDepthState[idxImage];
+			if (depthStates.empty()) {
+				depthStates.create(sizeMap);
+				depthStates.memset(DEPTH_FREE);
+			}
+			for (int i=0; i<sizeMap.height; ++i) {
+				for (int j=0; j<sizeMap.width; ++j) {
+					const ImageRef x(j,i);
+					const Depth depth(depthData.depthMap(x));
+					if (depth == 0)
+						continue;
+					uint8_t& state = depthStates(x);
+					if (state != DEPTH_FREE)
+						continue;
+					// only the depths inside this cell are fused now, the rest later
+					const PointCloud::Point point(Cast<float>(imageData.camera.TransformPointI2W(Point3(Point2f(x),depth))));
+					if (!cell.box.Intersects(point))
+						continue;
+					ASSERT(ISINSIDE(depth, depthData.dMin, depthData.dMax));
+					// create the corresponding 3D point
+					state = DEPTH_USED;
+					PointCloud::ViewArr& views = pointcloud.pointViews.emplace_back();
+					views.emplace_back(idxImage);
+					PointCloud::WeightArr& weights = pointcloud.pointWeights.emplace_back();
+					REAL confidence(weights.emplace_back(Conf2Weight(depthData.HasConfMap() ? depthData.GetConfMap(x) : 1.f,depth)));
+					usedDepths.clear();
+					usedDepths.emplace_back(&state);
+					const PointCloud::Normal normal(bNormalMap ? Cast<Normal::Type>(imageData.camera.R.t()*Cast<REAL>(depthData.GetNormalMap(x))) : Normal(0,0,-1));
+					ASSERT(ISEQUAL(norm(normal), 1.f));
+					// check the projection in the neighbor depth-maps
+					Point3 X(point*confidence);
+					Pixel32F C(Cast<float>(imageData.image(x))*confidence);
+					PointCloud::Normal N(normal*confidence);
+					invalidDepths.clear();
+					for (const ViewScore& neighbor: depthData.neighbors) {
+						const IIndex idxImageB(neighbor.ID);
+						DepthData& depthDataB = arrDepthData[idxImageB];
+						if (depthDataB.IsEmpty())
+							continue;
+						const Image& imageDataB = scene.images[idxImageB];
+						const Point3f pt(imageDataB.camera.ProjectPointP3(point));
+						if (pt.z <= 0)
+							continue;
+						const ImageRef xB(ROUND2INT(pt.x/pt.z), ROUND2INT(pt.y/pt.z));
+						const DepthMap& depthMapB = depthDataB.depthMap;
+						if (!depthMapB.isInside(xB))
+							continue;
+						const Depth depthB(depthMapB(xB));
+						if (depthB == 0)
+							continue;
+						uint8_t& stateB = arrDepthState[idxImageB](xB);
+						if (stateB != DEPTH_FREE)
+							continue;
+						if (IsDepthSimilar(pt.z, depthB, OPTDENSE::fDepthDiffThreshold)) {
+							// check if normals agree
+							const PointCloud::Normal normalB(bNormalMap ? Cast<Normal::Type>(imageDataB.camera.R.t()*Cast<REAL>(depthDataB.GetNormalMap(xB))) : Normal(0,0,-1));
+							ASSERT(ISEQUAL(norm(normalB), 1.f));
+							if (normal.dot(normalB) > normalError) {
+								// add view to the 3D point
+								ASSERT(views.FindFirst(idxImageB) == PointCloud::ViewArr::NO_INDEX);
+								const float confidenceB(Conf2Weight(depthDataB.HasConfMap() ? depthDataB.GetConfMap(xB) : 1.f,depthB));
+								const IIndex idx(views.InsertSort(idxImageB));
+								weights.InsertAt(idx, confidenceB);
+								stateB = DEPTH_USED;
+								usedDepths.emplace_back(&stateB);
+								X += imageDataB.camera.TransformPointI2W(Point3(Point2f(xB),depthB))*REAL(confidenceB);
+								if (bEstimateColor)
+									C += Cast<float>(imageDataB.image(xB))*confidenceB;
+								if (bEstimateNormal)
+									N += normalB*confidenceB;
+								confidence += confidenceB;
+								continue;
+							}
+						}
+						if (pt.z < depthB) {
+							// discard depth
+							invalidDepths.emplace_back(&stateB);
+						}
+					}
+					if (views.size() < nMinViewsFuse) {
+						// remove point
+						for (uint8_t* pState: usedDepths)
+							*pState = DEPTH_FREE;
+						pointcloud.pointWeights.pop_back();
+						pointcloud.pointViews.pop_back();
+						continue;
+					}
+					// invalidate all neighbor depths that do not agree with it
+					for (uint8_t* pState: invalidDepths)
+						*pState = DEPTH_DISCARDED;
+					// this point is valid, store it if inside the region-of-interest
+					const REAL nrm(REAL(1)/confidence);
+					const PointCloud::Point pointFused(Cast<float>(X*nrm));
+					ASSERT(ISFINITE(pointFused));
+					if (pROI && !pROI->Intersects(pointFused)) {
+						pointcloud.pointWeights.pop_back();
+						pointcloud.pointViews.pop_back();
+						continue;
+					}
+					pointcloud.points.emplace_back(pointFused);
+					if (bEstimateColor)
+						pointcloud.colors.emplace_back((C*(float)nrm).cast<uint8_t>());
+					if (bEstimateNormal)
+						pointcloud.normals.emplace_back(normalized(N*(float)nrm));
+				}
+			}
+			ASSERT(pointcloud.points.size() == pointcloud.pointViews.size() && pointcloud.points.size() == pointcloud.pointWeights.size());
+			for (const ViewScore& neighbor: depthData.neighbors) {
+				DepthData& depthDataB = arrDepthData[neighbor.ID];
+				if (depthDataB.IsValid())
+					depthDataCache.Release(depthDataB);
+			}
+			depthDataCache.Release(depthData);
+		}
+		// stream the points of this cell to disk
+		DEBUG_ULTIMATE("Cell %u fused using %u reference images: %u points", idxCell, cell.images.size(), pointcloud.points.size());
+		if (nMaxPoints < pointcloud.points.size())
+			nMaxPoints = pointcloud.points.size();
+		writer.Write(pointcloud);
+		pointcloud.Release();
+		// and release the fusion state of the images not needed anymore
+		FOREACH(idxImage, arrDepthState)
+			if (lastCell[idxImage] == idxCell)
+				arrDepthState[idxImage].release();
+		progress.display(idxCell);
+	}
+	GET_LOGCONSOLE().Play();
+	progress.close();
+	arrDepthState.Release();
+	depthDataCache.LogStats();
+	depthDataCache.Clear();
+
+	const size_t numPoints(writer.GetNumPoints());
+	if (pNumPoints != NULL)
+		*pNumPoints = numPoints;
+	if (!writer.Close()) {
+		DEBUG("error: no points fused");
+		return false;
+	}
+	DEBUG_EXTRA("Depth-maps fused and streamed: %u depth-maps, %u cells, %u points (max %u points per cell) (%s)",
+		connections.size(), cells.size(), numPoints, nMaxPoints, TD_TIMER_GET_FMT().c_str());
+	return true;
+} // FuseDepthMapsStream
+/*----------------------------------------------------------------*/
+
 
 
 // S T R U C T S ///////////////////////////////////////////////////
 
+void ThreadBudget::Init(unsigned _nMaxThreads, unsigned _nMaxJobs)
+{
+	ASSERT(_nMaxThreads > 0 && _nMaxJobs > 0);
+	nMaxThreads = _nMaxThreads;
+	nMaxJobs = _nMaxJobs;
+	workloads.resize(nMaxJobs);
+	workloads.Memset(0);
+	sem.Clear(nMaxJobs);
+}
+
+// wait till a job slot is free and register the new job with the given workload
+IDX ThreadBudget::Start(size_t workload)
+{
+	sem.Wait();
+	Lock l(cs);
+	FOREACH(idxJob, workloads) {
+		if (workloads[idxJob] == 0) {
+			workloads[idxJob] = MAXF(workload, size_t(1));
+			return idxJob;
+		}
+	}
+	ASSERT("Should not happen!" == NULL);
+	return NO_IDX;
+}
+
+// update the remaining work of the given job and
+// return the number of threads it should use for its next step
+unsigned ThreadBudget::GetThreads(IDX idxJob, size_t workload)
+{
+	Lock l(cs);
+	ASSERT(workloads[idxJob] > 0);
+	workloads[idxJob] = MAXF(workload, size_t(1));
+	size_t totalWorkload(0);
+	for (size_t w: workloads)
+		totalWorkload += w;
+	const unsigned nThreads((unsigned)((double)nMaxThreads*workloads[idxJob]/totalWorkload + 0.5));
+	return CLAMP(nThreads, 1u, nMaxThreads);
+}
+
+// free the job slot
+void ThreadBudget::Finish(IDX idxJob)
+{
+	{
+		Lock l(cs);
+		ASSERT(workloads[idxJob] > 0);
+		workloads[idxJob] = 0;
+	}
+	sem.Signal();
+}
+/*----------------------------------------------------------------*/
+
 DenseDepthMapData::DenseDepthMapData(Scene& _scene, int _nFusionMode)
 	: scene(_scene), depthMaps(_scene), idxImage(0), sem(1), nEstimationGeometricIter(-1), nFusionMode(_nFusionMode)
 {
 	if (nFusionMode < 0) {
-		STEREO::SemiGlobalMatcher::CreateThreads(scene.nMaxThreads);
+		if (scene.nMaxThreads > 1)
+			sgmScheduler = new STEREO::SemiGlobalMatcher::Scheduler(scene.nMaxThreads);
 		if (nFusionMode == -1)
 			OPTDENSE::nOptimize = 0;
 	}
 }
 DenseDepthMapData::~DenseDepthMapData()
 {
-	if (nFusionMode < 0)
-		STEREO::SemiGlobalMatcher::DestroyThreads();
+	// the matchers must be done with the scheduler before it is destroyed
+	sgms.Release();
+}
+
+// create a semi-global matcher for each concurrent job, all sharing the same worker threads
+// and image pairs, and splitting the cost volume memory budget
+void DenseDepthMapData::InitSemiGlobalMatchers(unsigned nMaxJobs)
+{
+	ASSERT(nMaxJobs > 0);
+	sgms.resize(nMaxJobs);
+	for (STEREO::SemiGlobalMatcher& sgm: sgms) {
+		sgm.SetScheduler(sgmScheduler);
+		sgm.SetMatchedPairs(&sgmPairs);
+		sgm.SetNumPaths(OPTDENSE::nSGMPaths > 4 ? 8u : 4u);
+		sgm.SetMaxMemory((size_t)OPTDENSE::nSGMMaxMemory*1024*1024/nMaxJobs, (int)OPTDENSE::nSGMStripOverlap);
+	}
 }
 
 void DenseDepthMapData::SignalCompleteDepthmapFilter()
@@ -1673,6 +2406,112 @@ void DenseDepthMapData::SignalCompleteDepthmapFilter()
 }
 /*----------------------------------------------------------------*/
 
+// compute the fingerprint of the inputs the depth-map of the given image is estimated from:
+// the pixels and poses of the reference and neighbor images, and the estimation options
+uint64_t DenseDepthMapData::ComputeFingerprint(IIndex idxImage) const
+{
+	const auto hashCamera = [](const Camera& camera, uint64_t hash) {
+		hash = HashFNV64(camera.K.val, sizeof(REAL)*9, hash);
+		hash = HashFNV64(camera.R.val, sizeof(REAL)*9, hash);
+		return HashFNV64(camera.C.ptr(), sizeof(REAL)*3, hash);
+	};
+	// estimation options
+	const unsigned options[] = {
+		OPTDENSE::nResolutionLevel, OPTDENSE::nMaxResolution, OPTDENSE::nMinResolution, OPTDENSE::nSubResolutionLevels,
+		OPTDENSE::nMinViews, OPTDENSE::nMinViewsTrustPoint, OPTDENSE::nNumViews, OPTDENSE::nOptimize,
+		OPTDENSE::nMinViewsFilter, OPTDENSE::nMinViewsFilterAdjust, OPTDENSE::bFilterAdjust, OPTDENSE::bAddCorners, OPTDENSE::bInitSparse,
+		OPTDENSE::nSpeckleSize, OPTDENSE::nIpolGapSize, (unsigned)OPTDENSE::nIgnoreMaskLabel,
+		OPTDENSE::nEstimationIters, OPTDENSE::nEstimationGeometricIters, OPTDENSE::nEstimationPropagation, OPTDENSE::nEstimationSeed,
+		OPTDENSE::nEstimationSkipSettled, OPTDENSE::nRandomIters, OPTDENSE::nRandomMaxScale, OPTDENSE::nDepthMapEncoding
+	};
+	const float optionsFloat[] = {
+		OPTDENSE::fViewMinScore, OPTDENSE::fViewMinScoreRatio, OPTDENSE::fDescriptorMinMagnitudeThreshold,
+		OPTDENSE::fDepthDiffThreshold, OPTDENSE::fNormalDiffThreshold, OPTDENSE::fPairwiseMul, OPTDENSE::fOptimizerEps,
+		OPTDENSE::fNCCThresholdKeep, OPTDENSE::fEstimationGeometricWeight, OPTDENSE::fEstimationGeometricScale, OPTDENSE::fEstimationDepthRange, OPTDENSE::fRandomDepthRatio,
+		OPTDENSE::fRandomAngle1Range, OPTDENSE::fRandomAngle2Range,
+		OPTDENSE::fRandomSmoothDepth, OPTDENSE::fRandomSmoothNormal, OPTDENSE::fRandomSmoothBonus
+	};
+	uint64_t hash(HashFNV64(options, sizeof(options)));
+	hash = HashFNV64(optionsFloat, sizeof(optionsFloat), hash);
+	// reference image
+	hash = HashFNV64(&imageHashes[idxImage], sizeof(uint64_t), hash);
+	hash = hashCamera(scene.images[idxImage].camera, hash);
+	// neighbor images
+	for (const ViewScore& neighbor: depthMaps.arrDepthData[idxImage].neighbors) {
+		hash = HashFNV64(&neighbor.ID, sizeof(IIndex), hash);
+		hash = HashFNV64(&neighbor.scale, sizeof(float), hash);
+		hash = HashFNV64(&imageHashes[neighbor.ID], sizeof(uint64_t), hash);
+		hash = hashCamera(scene.images[neighbor.ID].camera, hash);
+	}
+	// 0 stands for unknown inputs
+	return hash != 0 ? hash : 1;
+}
+
+// decide for each image if its depth-map is estimated, only refined or reused,
+// by comparing the fingerprint of its current inputs with the one stored in the existing depth-map;
+// (the depth-maps of unknown inputs, saved before the fingerprints were introduced, are estimated again);
+// the depth-maps depending on re-estimated or refined neighbors are refined as well,
+// as the neighbors are used during the geometric-consistent estimation and filtering,
+// propagating the changes till no other depth-map is affected
+void DenseDepthMapData::InitDepthMapStates()
+{
+	TD_TIMER_START();
+	fingerprints.resize(scene.images.size());
+	states.resize(scene.images.size());
+	states.Memset(DMAP_VALID);
+	#ifdef DENSE_USE_OPENMP
+	#pragma omp parallel for
+	for (int_t i=0; i<(int_t)images.size(); ++i) {
+		const IIndex idxImage(images[(IIndex)i]);
+	#else
+	for (IIndex idxImage: images) {
+	#endif
+		fingerprints[idxImage] = ComputeFingerprint(idxImage);
+		states[idxImage] = DMAP_ESTIMATE;
+		const String fileName(ComposeDepthFilePath(scene.images[idxImage].ID, "dmap"));
+		if (!File::access(fileName))
+			continue;
+		String imageFileName;
+		IIndexArr IDs;
+		cv::Size imageSize;
+		Camera camera;
+		Depth dMin, dMax;
+		DepthMap depthMap;
+		NormalMap normalMap;
+		ConfidenceMap confMap;
+		ViewsMap viewsMap;
+		uint64_t fingerprint;
+		if (!ImportDepthDataRaw(fileName, imageFileName, IDs, imageSize, camera.K, camera.R, camera.C, dMin, dMax,
+				depthMap, normalMap, confMap, viewsMap, 0, NULL, NULL, NULL, &fingerprint))
+			continue;
+		states[idxImage] = (uint8_t)(fingerprint == fingerprints[idxImage] ? DMAP_VALID : DMAP_ESTIMATE);
+	}
+	if (OPTDENSE::nEstimationGeometricIters || (OPTDENSE::nOptimize & OPTDENSE::ADJUST_FILTER)) {
+		bool bChanged;
+		do {
+			bChanged = false;
+			for (IIndex idxImage: images) {
+				if (states[idxImage] != DMAP_VALID)
+					continue;
+				for (const ViewScore& neighbor: depthMaps.arrDepthData[idxImage].neighbors) {
+					if (states[neighbor.ID] != DMAP_VALID) {
+						states[idxImage] = DMAP_REFINE;
+						bChanged = true;
+						break;
+					}
+				}
+			}
+		} while (bChanged);
+	}
+	#if TD_VERBOSE != TD_VERBOSE_OFF
+	unsigned numStates[3] = {0, 0, 0};
+	for (IIndex idxImage: images)
+		++numStates[states[idxImage]];
+	VERBOSE("Depth-maps to be estimated: %u new, %u refined, %u up to date (%s)", numStates[DMAP_ESTIMATE], numStates[DMAP_REFINE], numStates[DMAP_VALID], TD_TIMER_GET_FMT().c_str());
+	#endif
+}
+/*----------------------------------------------------------------*/
+
 
 
 // S T R U C T S ///////////////////////////////////////////////////
@@ -1680,7 +2519,7 @@ void DenseDepthMapData::SignalCompleteDepthmapFilter()
 static void* DenseReconstructionEstimateTmp(void*);
 static void* DenseReconstructionFilterTmp(void*);
 
-bool Scene::DenseReconstruction(int nFusionMode, bool bCrop2ROI, float fBorderROI)
+bool Scene::DenseReconstruction(int nFusionMode, bool bCrop2ROI, float fBorderROI, const String& fileNameStream, bool bStreamViews, size_t* pNumPointsStream)
 {
 	DenseDepthMapData data(*this, nFusionMode);
 
@@ -1692,6 +2531,13 @@ bool Scene::DenseReconstruction(int nFusionMode, bool bCrop2ROI, float fBorderRO
 
 	// fuse all depth-maps
 	pointcloud.Release();
+	if (OPTDENSE::nFusionPartitions > 0 && OPTDENSE::nMinViewsFuse >= 2 && !fileNameStream.empty()) {
+		// fuse depth-maps out-of-core, streaming the points directly to disk;
+		// the colors and normals can be only estimated during fusion
+		const OBB3f ROI(fBorderROI == 0 ? obb : (fBorderROI > 0 ? OBB3f(obb).EnlargePercent(fBorderROI) : OBB3f(obb).Enlarge(-fBorderROI)));
+		if (!data.depthMaps.FuseDepthMapsStream(fileNameStream, bCrop2ROI && IsBounded() ? &ROI : NULL, OPTDENSE::nEstimateColors != 0, OPTDENSE::nEstimateNormals != 0, bStreamViews, false, pNumPointsStream))
+			return false;
+	} else
 	if (OPTDENSE::nMinViewsFuse < 2) {
 		// merge depth-maps
 		data.depthMaps.MergeDepthMaps(pointcloud, OPTDENSE::nEstimateColors == 2, OPTDENSE::nEstimateNormals == 2);
@@ -1773,6 +2619,7 @@ bool Scene::ComputeDepthMaps(DenseDepthMapData& data)
 	{
 		TD_TIMER_START();
 		data.images.Reserve(images.GetSize());
+		data.imageHashes.Resize(images.GetSize());
 		imagesMap.Resize(images.GetSize());
 		#ifdef DENSE_USE_OPENMP
 		bool bAbort(false);
@@ -1815,6 +2662,11 @@ bool Scene::ComputeDepthMaps(DenseDepthMapData& data)
 				#endif
 			}
 			imageData.UpdateCamera(platforms);
+			// hash the image content, used to detect the depth-maps estimated from different images
+			uint64_t& imageHash = data.imageHashes[idxImage];
+			imageHash = HashFNV64(&imageData.image.cols, sizeof(int));
+			for (int r=0; r<imageData.image.rows; ++r)
+				imageHash = HashFNV64(imageData.image.ptr(r), imageData.image.cols*imageData.image.elemSize(), imageHash);
 			// print image camera
 			DEBUG_ULTIMATE("K%d = \n%s", idxImage, cvMat2String(imageData.camera.K).c_str());
 			DEBUG_LEVEL(3, "R%d = \n%s", idxImage, cvMat2String(imageData.camera.R).c_str());
@@ -1834,6 +2686,10 @@ bool Scene::ComputeDepthMaps(DenseDepthMapData& data)
 	// select images to be used for dense reconstruction
 	{
 		TD_TIMER_START();
+		// list the points seen by each image once for all images
+		ImagePointsIndex index;
+		if (pointcloud.IsValid())
+			index.Init(pointcloud, images.size());
 		// for each image, find all useful neighbor views
 		IIndexArr invalidIDs;
 		#ifdef DENSE_USE_OPENMP
@@ -1846,7 +2702,7 @@ bool Scene::ComputeDepthMaps(DenseDepthMapData& data)
 			const IIndex idxImage(data.images[idx]);
 			ASSERT(imagesMap[idxImage] != NO_ID);
 			DepthData& depthData(data.depthMaps.arrDepthData[idxImage]);
-			if (!data.depthMaps.SelectViews(depthData)) {
+			if (!data.depthMaps.SelectViews(depthData, index.IsEmpty() ? NULL : &index)) {
 				#ifdef DENSE_USE_OPENMP
 				#pragma omp critical
 				#endif
@@ -1869,6 +2725,10 @@ bool Scene::ComputeDepthMaps(DenseDepthMapData& data)
 	}
 	}
 
+	// find the depth-maps that are up to date and need not be estimated again
+	if (data.nFusionMode >= 0)
+		data.InitDepthMapStates();
+
 	#ifdef _USE_CUDA
 	// initialize CUDA
 	if (CUDA::desiredDeviceID >= -1 && data.nFusionMode >= 0) {
@@ -1880,6 +2740,21 @@ bool Scene::ComputeDepthMaps(DenseDepthMapData& data)
 	}
 	#endif // _USE_CUDA
 
+	// decide how many depth-maps are estimated concurrently:
+	// the CUDA estimator is not reentrant, so it processes one image at a time,
+	// while each SGM job uses its own matcher
+	unsigned nMaxJobs(OPTDENSE::nEstimationConcurrency ? OPTDENSE::nEstimationConcurrency : MAXF(nMaxThreads/8, 1u));
+	#ifdef _USE_CUDA
+	if (data.nFusionMode >= 0 && data.depthMaps.pmCUDA)
+		nMaxJobs = 1;
+	#endif // _USE_CUDA
+	nMaxJobs = MAXF(MINF(nMaxJobs, MINF(nMaxThreads, (unsigned)data.images.size())), 1u);
+	data.threadBudget.Init(nMaxThreads, nMaxJobs);
+	if (data.nFusionMode < 0)
+		data.InitSemiGlobalMatchers(nMaxJobs);
+	// one working thread per concurrent estimation plus one loading and saving the images and depth-maps
+	const unsigned nEstimateThreads(nMaxJobs+1);
+
 	// initialize the queue of images to be processed
 	const int nOptimize(OPTDENSE::nOptimize);
 	if (OPTDENSE::nEstimationGeometricIters && data.nFusionMode >= 0)
@@ -1892,7 +2767,7 @@ bool Scene::ComputeDepthMaps(DenseDepthMapData& data)
 	GET_LOGCONSOLE().Pause();
 	if (nMaxThreads > 1) {
 		// multi-thread execution
-		cList<SEACAVE::Thread> threads(2);
+		cList<SEACAVE::Thread> threads(nEstimateThreads);
 		FOREACHPTR(pThread, threads)
 			pThread->start(DenseReconstructionEstimateTmp, (void*)&data);
 		FOREACHPTR(pThread, threads)
@@ -1926,7 +2801,7 @@ bool Scene::ComputeDepthMaps(DenseDepthMapData& data)
 			GET_LOGCONSOLE().Pause();
 			if (nMaxThreads > 1) {
 				// multi-thread execution
-				cList<SEACAVE::Thread> threads(2);
+				cList<SEACAVE::Thread> threads(nEstimateThreads);
 				FOREACHPTR(pThread, threads)
 					pThread->start(DenseReconstructionEstimateTmp, (void*)&data);
 				FOREACHPTR(pThread, threads)
@@ -1939,10 +2814,13 @@ bool Scene::ComputeDepthMaps(DenseDepthMapData& data)
 			if (!data.events.IsEmpty())
 				return false;
 			data.progress.Release();
+			// the neighbor depth-maps are replaced next
+			data.depthMaps.depthMapStore.LogStats();
+			data.depthMaps.depthMapStore.Clear();
 			// replace raw depth-maps with the geometric-consistent ones
 			for (IIndex idx: data.images) {
 				const DepthData& depthData(data.depthMaps.arrDepthData[idx]);
-				if (!depthData.IsValid())
+				if (!depthData.IsValid() || data.IsDepthMapValid(idx))
 					continue;
 				const String rawName(ComposeDepthFilePath(depthData.GetView().GetID(), "dmap"));
 				File::deleteFile(rawName);
@@ -1951,6 +2829,9 @@ bool Scene::ComputeDepthMaps(DenseDepthMapData& data)
 		}
 		data.nEstimationGeometricIter = -1;
 	}
+	// the scaled images are not needed anymore
+	data.depthMaps.imageCache.LogStats();
+	data.depthMaps.imageCache.Clear();
 
 	if ((OPTDENSE::nOptimize & OPTDENSE::ADJUST_FILTER) != 0) {
 		// initialize the queue of depth-maps to be filtered
@@ -1974,6 +2855,8 @@ bool Scene::ComputeDepthMaps(DenseDepthMapData& data)
 			DenseReconstructionFilter((void*)&data);
 		}
 		GET_LOGCONSOLE().Play();
+		data.depthMaps.depthDataCache.LogStats();
+		data.depthMaps.depthDataCache.Clear();
 		if (!data.events.IsEmpty())
 			return false;
 		data.progress.Release();
@@ -1993,21 +2876,27 @@ void Scene::DenseReconstructionEstimate(void* pData)
 {
 	DenseDepthMapData& data = *((DenseDepthMapData*)pData);
 	while (true) {
-		CAutoPtr<Event> evt(data.events.GetEvent());
+		CAutoPtr<Event> evt;
+		{
+			TD_TRACE_SCOPE("wait event");
+			evt = data.events.GetEvent();
+		}
 		switch (evt->GetID()) {
 		case EVT_PROCESSIMAGE: {
 			const EVTProcessImage& evtImage = *((EVTProcessImage*)(Event*)evt);
 			if (evtImage.idxImage >= data.images.size()) {
 				if (nMaxThreads > 1) {
-					// close working threads
-					data.events.AddEvent(new EVTClose);
+					// close the other working threads
+					for (unsigned i=0; i<data.threadBudget.GetMaxJobs(); ++i)
+						data.events.AddEvent(new EVTClose);
 				}
 				return;
 			}
 			// select views to reconstruct the depth-map for this image
 			const IIndex idx = data.images[evtImage.idxImage];
+			TD_TRACE_SCOPE_ARG("process image", idx);
 			DepthData& depthData(data.depthMaps.arrDepthData[idx]);
-			const bool depthmapComputed(data.nFusionMode < 0 || (data.nFusionMode >= 0 && data.nEstimationGeometricIter < 0 && File::access(ComposeDepthFilePath(data.scene.images[idx].ID, "dmap"))));
+			const bool depthmapComputed(data.nFusionMode < 0 || (data.nFusionMode >= 0 && (data.IsDepthMapValid(idx) || (data.nEstimationGeometricIter < 0 && data.states[idx] == DenseDepthMapData::DMAP_REFINE))));
 			// initialize images pair: reference image and the best neighbor view
 			ASSERT(data.neighborsMap.IsEmpty() || data.neighborsMap[evtImage.idxImage] != NO_ID);
 			if (!data.depthMaps.InitViews(depthData, data.neighborsMap.IsEmpty()?NO_ID:data.neighborsMap[evtImage.idxImage], OPTDENSE::nNumViews, !depthmapComputed, depthmapComputed ? -1 : (data.nEstimationGeometricIter >= 0 ? 1 : 0))) {
@@ -2015,6 +2904,12 @@ void Scene::DenseReconstructionEstimate(void* pData)
 				data.events.AddEvent(new EVTProcessImage((IIndex)Thread::safeInc(data.idxImage)));
 				break;
 			}
+			// skip the depth-maps estimated from the same inputs
+			if (data.nFusionMode >= 0 && data.IsDepthMapValid(idx)) {
+				data.progress->operator++();
+				data.events.AddEvent(new EVTProcessImage((uint32_t)Thread::safeInc(data.idxImage)));
+				break;
+			}
 			// try to load already compute depth-map for this image
 			if (depthmapComputed && data.nFusionMode >= 0) {
 				if (OPTDENSE::nOptimize & OPTDENSE::OPTIMIZE) {
@@ -2037,26 +2932,33 @@ void Scene::DenseReconstructionEstimate(void* pData)
 			const EVTEstimateDepthMap& evtImage = *((EVTEstimateDepthMap*)(Event*)evt);
 			// request next image initialization to be performed while computing this depth-map
 			data.events.AddEvent(new EVTProcessImage((uint32_t)Thread::safeInc(data.idxImage)));
-			// extract depth map
-			data.sem.Wait();
+			// extract depth map, once a slot is free in the thread budget
+			const IIndex idx(data.images[evtImage.idxImage]);
+			TD_TRACE_SCOPE_ARG("estimate depth-map", idx);
+			IDX idxJob;
+			{
+				TD_TRACE_SCOPE_ARG("wait thread budget", idx);
+				idxJob = data.threadBudget.Start(data.depthMaps.arrDepthData[idx].images.front().image.area());
+			}
 			if (data.nFusionMode >= 0) {
 				// extract depth-map using Patch-Match algorithm
-				data.depthMaps.EstimateDepthMap(data.images[evtImage.idxImage], data.nEstimationGeometricIter);
+				data.depthMaps.EstimateDepthMap(idx, data.nEstimationGeometricIter, &data.threadBudget, idxJob);
+				if (data.nEstimationGeometricIter >= 0)
+					data.depthMaps.ReleaseViewDepthMaps(data.depthMaps.arrDepthData[idx]);
 			} else {
 				// extract disparity-maps using SGM algorithm
 				if (data.nFusionMode == -1) {
-					data.sgm.Match(*this, data.images[evtImage.idxImage], OPTDENSE::nNumViews);
+					data.sgms[idxJob].Match(*this, data.images[evtImage.idxImage], OPTDENSE::nNumViews);
 				} else {
 					// fuse existing disparity-maps
-					const IIndex idx(data.images[evtImage.idxImage]);
 					DepthData& depthData(data.depthMaps.arrDepthData[idx]);
-					data.sgm.Fuse(*this, data.images[evtImage.idxImage], OPTDENSE::nNumViews, 2, depthData.depthMap, depthData.confMap);
+					data.sgms[idxJob].Fuse(*this, data.images[evtImage.idxImage], OPTDENSE::nNumViews, 2, depthData.depthMap, depthData.confMap);
 					if (OPTDENSE::nEstimateNormals == 2)
 						EstimateNormalMap(depthData.images.front().camera.K, depthData.depthMap, depthData.normalMap);
 					depthData.dMin = ZEROTOLERANCE<float>(); depthData.dMax = FLT_MAX;
 				}
 			}
-			data.sem.Signal();
+			data.threadBudget.Finish(idxJob);
 			if (OPTDENSE::nOptimize & OPTDENSE::OPTIMIZE) {
 				// optimize depth-map
 				data.events.AddEventFirst(new EVTOptimizeDepthMap(evtImage.idxImage));
@@ -2069,22 +2971,26 @@ void Scene::DenseReconstructionEstimate(void* pData)
 		case EVT_OPTIMIZEDEPTHMAP: {
 			const EVTOptimizeDepthMap& evtImage = *((EVTOptimizeDepthMap*)(Event*)evt);
 			const IIndex idx = data.images[evtImage.idxImage];
+			TD_TRACE_SCOPE_ARG("optimize depth-map", idx);
 			DepthData& depthData(data.depthMaps.arrDepthData[idx]);
 			#if TD_VERBOSE != TD_VERBOSE_OFF
 			// save depth map as image
 			if (g_nVerbosityLevel > 3)
 				ExportDepthMap(ComposeDepthFilePath(depthData.GetView().GetID(), "raw.png"), depthData.depthMap);
 			#endif
-			// apply filters
+			// apply filters, using the share of threads of a concurrent estimation
+			const unsigned nThreads(MAXF(data.threadBudget.GetMaxThreads()/data.threadBudget.GetMaxJobs(), 1u));
 			if (OPTDENSE::nOptimize & (OPTDENSE::REMOVE_SPECKLES)) {
+				TD_TRACE_SCOPE_ARG("remove speckles", idx);
 				TD_TIMER_START();
-				if (data.depthMaps.RemoveSmallSegments(depthData)) {
+				if (data.depthMaps.RemoveSmallSegments(depthData, nThreads)) {
 					DEBUG_ULTIMATE("Depth-map %3u filtered: remove small segments (%s)", depthData.GetView().GetID(), TD_TIMER_GET_FMT().c_str());
 				}
 			}
 			if (OPTDENSE::nOptimize & (OPTDENSE::FILL_GAPS)) {
+				TD_TRACE_SCOPE_ARG("fill gaps", idx);
 				TD_TIMER_START();
-				if (data.depthMaps.GapInterpolation(depthData)) {
+				if (data.depthMaps.GapInterpolation(depthData, nThreads)) {
 					DEBUG_ULTIMATE("Depth-map %3u filtered: gap interpolation (%s)", depthData.GetView().GetID(), TD_TIMER_GET_FMT().c_str());
 				}
 			}
@@ -2095,6 +3001,7 @@ void Scene::DenseReconstructionEstimate(void* pData)
 		case EVT_SAVEDEPTHMAP: {
 			const EVTSaveDepthMap& evtImage = *((EVTSaveDepthMap*)(Event*)evt);
 			const IIndex idx = data.images[evtImage.idxImage];
+			TD_TRACE_SCOPE_ARG("save depth-map", idx);
 			DepthData& depthData(data.depthMaps.arrDepthData[idx]);
 			#if TD_VERBOSE != TD_VERBOSE_OFF
 			// save depth map as image
@@ -2108,9 +3015,15 @@ void Scene::DenseReconstructionEstimate(void* pData)
 				}
 			}
 			#endif
-			// save compute depth-map for this image
+			// save compute depth-map for this image, storing the fingerprint of its inputs
+			// and using the compact encoding only if this is its final estimate
+			// (the intermediate ones are used as input by the next passes)
+			const bool bFinal(data.nEstimationGeometricIter+1 == (int)OPTDENSE::nEstimationGeometricIters && !(OPTDENSE::nOptimize & OPTDENSE::ADJUST_FILTER));
+			depthData.fingerprint = 0;
+			if (data.nFusionMode >= 0 && bFinal)
+				depthData.fingerprint = data.fingerprints[idx];
 			if (!depthData.depthMap.empty())
-				depthData.Save(ComposeDepthFilePath(depthData.GetView().GetID(), data.nEstimationGeometricIter < 0 ? "dmap" : "geo.dmap"));
+				depthData.Save(ComposeDepthFilePath(depthData.GetView().GetID(), data.nEstimationGeometricIter < 0 ? "dmap" : "geo.dmap"), bFinal ? OPTDENSE::nDepthMapEncoding : 0u);
 			depthData.ReleaseImages();
 			depthData.Release();
 			data.progress->operator++();
@@ -2142,13 +3055,19 @@ void Scene::DenseReconstructionFilter(void* pData)
 		case EVT_FILTERDEPTHMAP: {
 			const EVTFilterDepthMap& evtImage = *((EVTFilterDepthMap*)(Event*)evt);
 			const IIndex idx = data.images[evtImage.idxImage];
+			TD_TRACE_SCOPE_ARG("filter depth-map", idx);
 			DepthData& depthData(data.depthMaps.arrDepthData[idx]);
-			if (!depthData.IsValid()) {
+			if (!depthData.IsValid() || data.IsDepthMapValid(idx)) {
 				data.SignalCompleteDepthmapFilter();
 				break;
 			}
 			// make sure all depth-maps are loaded
-			depthData.IncRef(ComposeDepthFilePath(depthData.GetView().GetID(), "dmap"));
+			DepthDataCache& cache = data.depthMaps.depthDataCache;
+			if (!cache.Acquire(depthData, ComposeDepthFilePath(depthData.GetView().GetID(), "dmap"), DENSE_LOAD_READONLY)) {
+				// signal error and terminate
+				data.events.AddEventFirst(new EVTFail);
+				return;
+			}
 			const unsigned numMaxNeighbors(8);
 			IIndexArr idxNeighbors(0, depthData.neighbors.GetSize());
 			FOREACH(n, depthData.neighbors) {
@@ -2156,7 +3075,7 @@ void Scene::DenseReconstructionFilter(void* pData)
 				DepthData& depthDataPair = data.depthMaps.arrDepthData[idxView];
 				if (!depthDataPair.IsValid())
 					continue;
-				if (depthDataPair.IncRef(ComposeDepthFilePath(depthDataPair.GetView().GetID(), "dmap")) == 0) {
+				if (!cache.Acquire(depthDataPair, ComposeDepthFilePath(depthDataPair.GetView().GetID(), "dmap"), DENSE_LOAD_READONLY)) {
 					// signal error and terminate
 					data.events.AddEventFirst(new EVTFail);
 					return;
@@ -2165,6 +3084,22 @@ void Scene::DenseReconstructionFilter(void* pData)
 				if (idxNeighbors.GetSize() == numMaxNeighbors)
 					break;
 			}
+			// start loading the depth-maps needed by the next image
+			if (cache.IsEnabled() && evtImage.idxImage+1 < data.images.GetSize()) {
+				DepthData& depthDataNext(data.depthMaps.arrDepthData[data.images[evtImage.idxImage+1]]);
+				if (depthDataNext.IsValid()) {
+					cache.Prefetch(depthDataNext, ComposeDepthFilePath(depthDataNext.GetView().GetID(), "dmap"), DENSE_LOAD_READONLY);
+					unsigned numNeighbors(0);
+					for (const ViewScore& neighbor: depthDataNext.neighbors) {
+						DepthData& depthDataPair = data.depthMaps.arrDepthData[neighbor.ID];
+						if (!depthDataPair.IsValid())
+							continue;
+						cache.Prefetch(depthDataPair, ComposeDepthFilePath(depthDataPair.GetView().GetID(), "dmap"), DENSE_LOAD_READONLY);
+						if (++numNeighbors == numMaxNeighbors)
+							break;
+					}
+				}
+			}
 			// filter the depth-map for this image
 			if (data.depthMaps.FilterDepthMap(depthData, idxNeighbors, OPTDENSE::bFilterAdjust)) {
 				// load the filtered maps after all depth-maps were filtered
@@ -2174,9 +3109,9 @@ void Scene::DenseReconstructionFilter(void* pData)
 			FOREACHPTR(pIdxNeighbor, idxNeighbors) {
 				const IIndex idxView = depthData.neighbors[*pIdxNeighbor].ID;
 				DepthData& depthDataPair = data.depthMaps.arrDepthData[idxView];
-				depthDataPair.DecRef();
+				cache.Release(depthDataPair);
 			}
-			depthData.DecRef();
+			cache.Release(depthData);
 			data.SignalCompleteDepthmapFilter();
 			break; }
 
@@ -2185,7 +3120,13 @@ void Scene::DenseReconstructionFilter(void* pData)
 			const IIndex idx = data.images[evtImage.idxImage];
 			DepthData& depthData(data.depthMaps.arrDepthData[idx]);
 			ASSERT(depthData.IsValid());
-			data.sem.Wait();
+			{
+				TD_TRACE_SCOPE_ARG("wait filtering", idx);
+				data.sem.Wait();
+			}
+			TD_TRACE_SCOPE_ARG("adjust depth-map", idx);
+			// all depth-maps were filtered, the filtered maps are going to replace the cached ones
+			data.depthMaps.depthDataCache.Clear();
 			// load filtered maps
 			if (depthData.IncRef(ComposeDepthFilePath(depthData.GetView().GetID(), "dmap")) == 0 ||
 				!LoadDepthMap(ComposeDepthFilePath(depthData.GetView().GetID(), "filtered.dmap"), depthData.depthMap) ||
@@ -2206,7 +3147,8 @@ void Scene::DenseReconstructionFilter(void* pData)
 			}
 			#endif
 			// save filtered depth-map for this image
-			depthData.Save(ComposeDepthFilePath(depthData.GetView().GetID(), "dmap"));
+			depthData.fingerprint = data.fingerprints[idx];
+			depthData.Save(ComposeDepthFilePath(depthData.GetView().GetID(), "dmap"), OPTDENSE::nDepthMapEncoding);
 			depthData.DecRef();
 			data.progress->operator++();
 			break; }
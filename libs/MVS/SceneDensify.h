@@ -48,6 +48,32 @@ class MVS_API Scene;
 class PatchMatchCUDA;
 #endif // _USE_CUDA
 
+// share the available threads among the depth-maps estimated concurrently:
+// at most nMaxJobs depth-maps are estimated at once, and each one uses a number of threads
+// proportional to its remaining work (image area times remaining passes) relative to the other running jobs
+class MVS_API ThreadBudget
+{
+public:
+	ThreadBudget() : nMaxThreads(1), nMaxJobs(1) {}
+
+	void Init(unsigned _nMaxThreads, unsigned _nMaxJobs);
+
+	IDX Start(size_t workload);
+	unsigned GetThreads(IDX idxJob, size_t workload);
+	void Finish(IDX idxJob);
+
+	inline unsigned GetMaxThreads() const { return nMaxThreads; }
+	inline unsigned GetMaxJobs() const { return nMaxJobs; }
+
+protected:
+	unsigned nMaxThreads; // total number of threads to be shared
+	unsigned nMaxJobs; // maximum number of concurrent jobs
+	CLISTDEF0(size_t) workloads; // remaining work of each job slot (0 - free slot)
+	Semaphore sem; // number of free job slots
+	CriticalSection cs;
+};
+/*----------------------------------------------------------------*/
+
 // structure used to compute all depth-maps
 class MVS_API DepthMapsData
 {
@@ -56,19 +82,21 @@ public:
 	~DepthMapsData();
 
 	bool SelectViews(IIndexArr& images, IIndexArr& imagesMap, IIndexArr& neighborsMap);
-	bool SelectViews(DepthData& depthData);
+	bool SelectViews(DepthData& depthData, const ImagePointsIndex* pIndex=NULL);
 	bool InitViews(DepthData& depthData, IIndex idxNeighbor, IIndex numNeighbors, bool loadImages, int loadDepthMaps);
+	void ReleaseViewDepthMaps(DepthData& depthData);
 	bool InitDepthMap(DepthData& depthData);
-	bool EstimateDepthMap(IIndex idxImage, int nGeometricIter);
+	bool EstimateDepthMap(IIndex idxImage, int nGeometricIter, ThreadBudget* pThreadBudget=NULL, IDX idxJob=NO_IDX);
 
-	bool RemoveSmallSegments(DepthData& depthData);
-	bool GapInterpolation(DepthData& depthData);
+	bool RemoveSmallSegments(DepthData& depthData, unsigned nThreads=1);
+	bool GapInterpolation(DepthData& depthData, unsigned nThreads=1);
 
 	bool FilterDepthMap(DepthData& depthData, const IIndexArr& idxNeighbors, bool bAdjust=true);
 	void MergeDepthMaps(PointCloud& pointcloud, bool bEstimateColor, bool bEstimateNormal);
 	void FuseDepthMaps(PointCloud& pointcloud, bool bEstimateColor, bool bEstimateNormal);
+	bool FuseDepthMapsStream(const String& fileName, const OBB3f* pROI, bool bEstimateColor, bool bEstimateNormal, bool bViews=false, bool bLegacyTypes=false, size_t* pNumPoints=NULL);
 
-	static DepthData ScaleDepthData(const DepthData& inputDeptData, float scale);
+	static DepthData ScaleDepthData(const DepthData& inputDeptData, float scale, ImagePyramidCache* pImageCache=NULL);
 
 protected:
 	static void* STCALL ScoreDepthMapTmp(void*);
@@ -79,12 +107,9 @@ public:
 	Scene& scene;
 
 	DepthDataArr arrDepthData;
-
-	// used internally to estimate the depth-maps
-	Image8U::Size prevDepthMapSize; // remember the size of the last estimated depth-map
-	Image8U::Size prevDepthMapSizeTrg; // ... same for target image
-	DepthEstimator::MapRefArr coords; // map pixel index to zigzag matrix coordinates
-	DepthEstimator::MapRefArr coordsTrg; // ... same for target image
+	DepthDataCache depthDataCache; // keeps released depth-maps loaded during filtering and fusion
+	ImagePyramidCache imageCache; // shares the scaled gray-scale images between the estimated depth-maps
+	DepthMapStore depthMapStore; // shares the neighbor depth-maps between the geometric-consistent estimated depth-maps
 
 	#ifdef _USE_CUDA
 	// used internally to estimate the depth-maps using CUDA
@@ -94,6 +119,12 @@ public:
 /*----------------------------------------------------------------*/
 
 struct MVS_API DenseDepthMapData {
+	enum DepthMapState : uint8_t {
+		DMAP_ESTIMATE = 0, // depth-map missing or estimated from different or unknown inputs: estimate it
+		DMAP_REFINE, // some neighbor depth-map is re-estimated or refined: only refine it
+		DMAP_VALID, // depth-map estimated from the same inputs: reuse it as it is
+	};
+
 	Scene& scene;
 	IIndexArr images;
 	IIndexArr neighborsMap;
@@ -101,15 +132,26 @@ struct MVS_API DenseDepthMapData {
 	volatile Thread::safe_t idxImage;
 	SEACAVE::EventQueue events; // internal events queue (processed by the working threads)
 	Semaphore sem;
+	ThreadBudget threadBudget; // threads shared by the depth-maps estimated concurrently
 	CAutoPtr<Util::Progress> progress;
 	int nEstimationGeometricIter;
 	int nFusionMode;
-	STEREO::SemiGlobalMatcher sgm;
+	CAutoPtr<STEREO::SemiGlobalMatcher::Scheduler> sgmScheduler; // worker threads shared by the semi-global matchers
+	CLISTDEF2(STEREO::SemiGlobalMatcher) sgms; // one semi-global matcher per concurrent job
+	STEREO::SemiGlobalMatcher::MatchedPairs sgmPairs; // image pairs claimed by the semi-global matchers
+	CLISTDEF0IDX(uint64_t,IIndex) imageHashes; // hash of the pixels of each image, as loaded for estimation
+	CLISTDEF0IDX(uint64_t,IIndex) fingerprints; // hash of the inputs of each depth-map
+	CLISTDEF0IDX(uint8_t,IIndex) states; // what needs to be done for each depth-map (see DepthMapState)
 
 	DenseDepthMapData(Scene& _scene, int _nFusionMode=0);
 	~DenseDepthMapData();
 
+	void InitSemiGlobalMatchers(unsigned nMaxJobs);
 	void SignalCompleteDepthmapFilter();
+
+	uint64_t ComputeFingerprint(IIndex idxImage) const;
+	void InitDepthMapStates();
+	inline bool IsDepthMapValid(IIndex idxImage) const { return !states.empty() && states[idxImage] == DMAP_VALID; }
 };
 /*----------------------------------------------------------------*/
 
@@ -31,6 +31,7 @@
 
 #include "Common.h"
 #include "Scene.h"
+#include "MaxFlow.h"
 // Delaunay: mesh reconstruction
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <CGAL/Delaunay_triangulation_3.h>
@@ -55,140 +56,6 @@ using namespace MVS;
 // uncomment to enable reconstruction algorithm of weakly supported surfaces
 #define DELAUNAY_WEAKSURF
 
-// uncomment to use IBFS algorithm for max-flow
-// (faster, but not clear license policy)
-#define DELAUNAY_MAXFLOW_IBFS
-
-
-// S T R U C T S ///////////////////////////////////////////////////
-
-#ifdef DELAUNAY_MAXFLOW_IBFS
-#include "../Math/IBFS/IBFS.h"
-template <typename NType, typename VType>
-class MaxFlow
-{
-public:
-	// Type-Definitions
-	typedef NType node_type;
-	typedef VType value_type;
-	typedef IBFS::IBFSGraph graph_type;
-
-public:
-	MaxFlow(size_t numNodes) {
-		graph.initSize((int)numNodes, (int)numNodes*2);
-	}
-
-	inline void AddNode(node_type n, value_type source, value_type sink) {
-		ASSERT(ISFINITE(source) && source >= 0 && ISFINITE(sink) && sink >= 0);
-		graph.addNode((int)n, source, sink);
-	}
-
-	inline void AddEdge(node_type n1, node_type n2, value_type capacity, value_type reverseCapacity) {
-		ASSERT(ISFINITE(capacity) && capacity >= 0 && ISFINITE(reverseCapacity) && reverseCapacity >= 0);
-		graph.addEdge((int)n1, (int)n2, capacity, reverseCapacity);
-	}
-
-	value_type ComputeMaxFlow() {
-		graph.initGraph();
-		return graph.computeMaxFlow();
-	}
-
-	inline bool IsNodeOnSrcSide(node_type n) const {
-		return graph.isNodeOnSrcSide((int)n);
-	}
-
-protected:
-	graph_type graph;
-};
-#else
-#include <boost/graph/graph_traits.hpp>
-#include <boost/graph/one_bit_color_map.hpp>
-#include <boost/property_map/property_map.hpp>
-#include <boost/graph/adjacency_list.hpp>
-#include <boost/graph/boykov_kolmogorov_max_flow.hpp>
-template <typename NType, typename VType>
-class MaxFlow
-{
-public:
-	// Type-Definitions
-	typedef NType node_type;
-	typedef VType value_type;
-	typedef boost::vecS out_edge_list_t;
-	typedef boost::vecS vertex_list_t;
-	typedef boost::adjacency_list_traits<out_edge_list_t, vertex_list_t, boost::directedS> graph_traits;
-	typedef typename graph_traits::edge_descriptor edge_descriptor;
-	typedef typename graph_traits::vertex_descriptor vertex_descriptor;
-	typedef typename graph_traits::vertices_size_type vertex_size_type;
-	struct Edge {
-		value_type capacity;
-		value_type residual;
-		edge_descriptor reverse;
-	};
-	typedef boost::adjacency_list<out_edge_list_t, vertex_list_t, boost::directedS, size_t, Edge> graph_type;
-	typedef typename boost::graph_traits<graph_type>::edge_iterator edge_iterator;
-	typedef typename boost::graph_traits<graph_type>::out_edge_iterator out_edge_iterator;
-
-public:
-	MaxFlow(size_t numNodes) : graph(numNodes+2), S(node_type(numNodes)), T(node_type(numNodes+1)) {}
-
-	void AddNode(node_type n, value_type source, value_type sink) {
-		ASSERT(ISFINITE(source) && source >= 0 && ISFINITE(sink) && sink >= 0);
-		if (source > 0) {
-			edge_descriptor e(boost::add_edge(S, n, graph).first);
-			edge_descriptor er(boost::add_edge(n, S, graph).first);
-			graph[e].capacity = source;
-			graph[e].reverse = er;
-			graph[er].reverse = e;
-		}
-		if (sink > 0) {
-			edge_descriptor e(boost::add_edge(n, T, graph).first);
-			edge_descriptor er(boost::add_edge(T, n, graph).first);
-			graph[e].capacity = sink;
-			graph[e].reverse = er;
-			graph[er].reverse = e;
-		}
-	}
-
-	void AddEdge(node_type n1, node_type n2, value_type capacity, value_type reverseCapacity) {
-		ASSERT(ISFINITE(capacity) && capacity >= 0 && ISFINITE(reverseCapacity) && reverseCapacity >= 0);
-		edge_descriptor e(boost::add_edge(n1, n2, graph).first);
-		edge_descriptor er(boost::add_edge(n2, n1, graph).first);
-		graph[e].capacity = capacity;
-		graph[er].capacity = reverseCapacity;
-		graph[e].reverse = er;
-		graph[er].reverse = e;
-	}
-
-	value_type ComputeMaxFlow() {
-		vertex_size_type n_verts(boost::num_vertices(graph));
-		color.resize(n_verts);
-		std::vector<edge_descriptor> pred(n_verts);
-		std::vector<vertex_size_type> dist(n_verts);
-		return boost::boykov_kolmogorov_max_flow(graph,
-			boost::get(&Edge::capacity, graph),
-			boost::get(&Edge::residual, graph),
-			boost::get(&Edge::reverse, graph),
-			&pred[0],
-			&color[0],
-			&dist[0],
-			boost::get(boost::vertex_index, graph),
-			S, T
-		);
-	}
-
-	inline bool IsNodeOnSrcSide(node_type n) const {
-		return (color[n] != boost::white_color);
-	}
-
-protected:
-	graph_type graph;
-	std::vector<boost::default_color_type> color;
-	const node_type S;
-	const node_type T;
-};
-#endif
-/*----------------------------------------------------------------*/
-
 
 // S T R U C T S ///////////////////////////////////////////////////
 
@@ -209,9 +76,8 @@ typedef uint32_t cell_size_t;
 
 typedef float edge_cap_t;
 
-#ifdef DELAUNAY_WEAKSURF
-struct view_info_t;
-#endif
+// the views of a vertex are stored in an array shared by all vertices (see vert_views_t),
+// filled once all points are inserted, each vertex keeping only the position of its views
 struct vert_info_t {
 	typedef edge_cap_t Type;
 	struct view_t {
@@ -222,39 +88,10 @@ struct vert_info_t {
 		inline bool operator <(const view_t& v) const { return idxView < v.idxView; }
 		inline operator PointCloud::View() const { return idxView; }
 	};
-	typedef SEACAVE::cList<view_t,const view_t&,0,4,uint32_t> view_vec_t;
-	view_vec_t views; // faces' weight from the cell outwards
-	#ifdef DELAUNAY_WEAKSURF
-	view_info_t* viewsInfo; // each view caches the two faces from the point towards the camera and the end (used only by the weakly supported surfaces)
-	inline vert_info_t() : viewsInfo(NULL) {}
-	~vert_info_t();
-	void AllocateInfo();
-	#else
-	inline vert_info_t() {}
-	#endif
-	void InsertViews(const PointCloud& pc, PointCloud::Index idxPoint) {
-		const PointCloud::ViewArr& _views = pc.pointViews[idxPoint];
-		ASSERT(!_views.IsEmpty());
-		const PointCloud::WeightArr* pweights(pc.pointWeights.IsEmpty() ? NULL : pc.pointWeights.Begin()+idxPoint);
-		ASSERT(pweights == NULL || _views.GetSize() == pweights->GetSize());
-		FOREACH(i, _views) {
-			const PointCloud::View viewID(_views[i]);
-			const PointCloud::Weight weight(pweights ? (*pweights)[i] : PointCloud::Weight(1));
-			// insert viewID in increasing order
-			const uint32_t idx(views.FindFirstEqlGreater(viewID));
-			if (idx < views.GetSize() && views[idx] == viewID) {
-				// the new view is already in the array
-				ASSERT(views.FindFirst(viewID) == idx);
-				// update point's weight
-				views[idx].weight += weight;
-			} else {
-				// the new view is not in the array,
-				// insert it
-				views.InsertAt(idx, view_t(viewID, weight));
-				ASSERT(views.IsSorted());
-			}
-		}
-	}
+	uint32_t idx; // first point merged in this vertex while inserting the points, next the offset of its views
+	uint32_t numViews; // number of views
+	inline vert_info_t() : idx(NO_ID), numViews(0) {}
+	inline bool IsEmpty() const { return numViews == 0; }
 };
 
 struct cell_info_t {
@@ -280,18 +117,82 @@ struct view_info_t {
 	cell_handle_t cell2Cam;
 	cell_handle_t cell2End;
 };
-vert_info_t::~vert_info_t() {
-	delete[] viewsInfo;
-}
-void vert_info_t::AllocateInfo() {
-	ASSERT(!views.IsEmpty());
-	viewsInfo = new view_info_t[views.GetSize()];
-	#ifndef _RELEASE
-	memset(viewsInfo, 0, sizeof(view_info_t)*views.GetSize());
-	#endif
-}
 #endif
 
+// the views of all vertices, stored contiguously, sorted by view index for each vertex
+struct vert_views_t {
+	typedef vert_info_t::view_t view_t;
+	std::vector<view_t> views;
+	#ifdef DELAUNAY_WEAKSURF
+	std::vector<view_info_t> viewsInfo; // each view caches the two faces from the point towards the camera and the end (used only by the weakly supported surfaces)
+	#endif
+
+	inline const view_t& View(const vert_info_t& vert, uint32_t v) const { ASSERT(v < vert.numViews); return views[vert.idx+v]; }
+	#ifdef DELAUNAY_WEAKSURF
+	inline view_info_t& ViewInfo(const vert_info_t& vert, uint32_t v) { ASSERT(v < vert.numViews); return viewsInfo[vert.idx+v]; }
+	#endif
+
+	// collect the views of the points merged in each vertex, given for each point the ID of its vertex (as stored in vert_info_t::idx);
+	// the views seen by several points are merged, adding up their weights;
+	// fails if the views of all vertices can not be indexed on 32 bits
+	bool Init(delaunay_t& delaunay, const PointCloud& pc, const std::vector<uint32_t>& pointsVertex) {
+		// count the views of each vertex
+		std::vector<uint32_t> offsets(pointsVertex.size(), 0);
+		FOREACH(idxPoint, pointsVertex) {
+			const uint32_t idxVert(pointsVertex[idxPoint]);
+			if (idxVert != NO_ID)
+				offsets[idxVert] += pc.pointViews[idxPoint].GetSize();
+		}
+		size_t numViews(0);
+		for (delaunay_t::Finite_vertices_iterator vi=delaunay.finite_vertices_begin(), vie=delaunay.finite_vertices_end(); vi!=vie; ++vi) {
+			const vert_info_t& vert(vi->info());
+			ASSERT(vert.idx != NO_ID);
+			const uint32_t count(offsets[vert.idx]);
+			offsets[vert.idx] = (uint32_t)numViews;
+			numViews += count;
+		}
+		if (numViews >= std::numeric_limits<uint32_t>::max()) {
+			DEBUG("error: too many point views to index on 32 bits (%g)", (double)numViews);
+			return false;
+		}
+		// fill the views of each vertex, in the order of the points
+		views.resize(numViews);
+		const PointCloud::WeightArr* const pweights(pc.pointWeights.IsEmpty() ? NULL : pc.pointWeights.Begin());
+		FOREACH(idxPoint, pointsVertex) {
+			const uint32_t idxVert(pointsVertex[idxPoint]);
+			if (idxVert == NO_ID)
+				continue;
+			const PointCloud::ViewArr& _views = pc.pointViews[idxPoint];
+			ASSERT(!_views.IsEmpty());
+			ASSERT(pweights == NULL || _views.GetSize() == pweights[idxPoint].GetSize());
+			uint32_t& offset = offsets[idxVert];
+			FOREACH(i, _views)
+				views[offset++] = view_t(_views[i], pweights ? pweights[idxPoint][i] : PointCloud::Weight(1));
+		}
+		// sort and merge the views of each vertex, and compact the array
+		numViews = 0;
+		uint32_t bgn(0);
+		for (delaunay_t::Finite_vertices_iterator vi=delaunay.finite_vertices_begin(), vie=delaunay.finite_vertices_end(); vi!=vie; ++vi) {
+			vert_info_t& vert(vi->info());
+			const uint32_t end(offsets[vert.idx]);
+			std::stable_sort(views.begin()+bgn, views.begin()+end);
+			vert.idx = (uint32_t)numViews;
+			for (uint32_t i=bgn; i<end; ++i) {
+				const view_t& view = views[i];
+				if (numViews > vert.idx && views[numViews-1].idxView == view.idxView)
+					views[numViews-1].weight += view.weight;
+				else
+					views[numViews++] = view;
+			}
+			vert.numViews = (uint32_t)numViews-vert.idx;
+			bgn = end;
+		}
+		views.resize(numViews);
+		views.shrink_to_fit();
+		return true;
+	}
+};
+
 struct camera_cell_t {
 	cell_handle_t cell; // cell containing the camera
 	std::vector<facet_t> facets; // all facets on the convex-hull in view of the camera (ordered by importance)
@@ -756,6 +657,293 @@ float computePlaneSphereAngle(const delaunay_t& Tr, const facet_t& facet)
 	// compute the angle between the two vectors
 	return CLAMP((fn.dot(ct))/SQRT(fnLenSq*ctLenSq), -1.f, 1.f);
 }
+
+// Upper bound of the distance between the given point and a vertex it could be merged with:
+// the two must project closer than distInsert pixels and at similar depths in all the point views,
+// so the vertex lies in a small frustum around the point in each view
+// (enlarged to account for the depth difference seen by the off-axis views)
+float mergeDistance(const PointCloud& pointcloud, PointCloud::Index idx, const ImageArr& images, float distInsert)
+{
+	const PointCloud::Point& point = pointcloud.points[idx];
+	float dist(FLT_MAX);
+	for (const PointCloud::View viewID: pointcloud.pointViews[idx]) {
+		const Camera& camera = images[viewID].camera;
+		const float depth(camera.ProjectPointP3(point).z);
+		dist = MINF(dist, depth*3.f*(distInsert/(float)camera.GetFocalLength()+0.01f));
+	}
+	return dist;
+}
+
+// Insert the given point in the triangulation iif it is not closer than distInsert pixels
+// in at least one of its views to the projection of its nearest vertex, otherwise merge it
+// with the nearest vertex; the point views are added to the returned vertex;
+// if the nearest vertex is farther than sqrt(maxDistSq), or if there is no vertex yet and the point
+// could be merged with a vertex farther than sqrt(maxDistSq), nothing is done and a NULL handle is returned
+// (used to defer the points whose nearest vertex might be in another partition);
+// the vertex the point is merged into is stored in pointsVertex (see vert_views_t::Init())
+vertex_handle_t insertPoint(delaunay_t& delaunay, const point_t& p, const PointCloud& pointcloud, PointCloud::Index idx, std::vector<uint32_t>& pointsVertex,
+	const ImageArr& images, float distInsert, vertex_handle_t hint, double maxDistSq=std::numeric_limits<double>::max())
+{
+	if (hint == vertex_handle_t()) {
+		// this is the first point,
+		// insert it if it can not be merged with a vertex outside the allowed distance
+		if (distInsert > 0 && maxDistSq < std::numeric_limits<double>::max() &&
+			SQUARE((double)mergeDistance(pointcloud, idx, images, distInsert)) >= maxDistSq)
+			return vertex_handle_t();
+		hint = delaunay.insert(p);
+		ASSERT(hint != vertex_handle_t());
+	} else
+	if (distInsert <= 0) {
+		// insert all points
+		hint = delaunay.insert(p, hint);
+		ASSERT(hint != vertex_handle_t());
+	} else {
+		// locate cell containing this point
+		delaunay_t::Locate_type lt;
+		int li, lj;
+		const cell_handle_t c(delaunay.locate(p, lt, li, lj, hint->cell()));
+		if (lt == delaunay_t::VERTEX) {
+			// duplicate point, nothing to insert,
+			// just update its visibility info
+			hint = c->vertex(li);
+			ASSERT(hint != delaunay.infinite_vertex());
+		} else {
+			// locate the nearest vertex
+			vertex_handle_t nearest;
+			if (delaunay.dimension() < 3) {
+				// use a brute-force algorithm if dimension < 3
+				delaunay_t::Finite_vertices_iterator vit = delaunay.finite_vertices_begin();
+				nearest = vit;
+				++vit;
+				adjacent_vertex_back_inserter_t inserter(delaunay, p, nearest);
+				for (delaunay_t::Finite_vertices_iterator end = delaunay.finite_vertices_end(); vit != end; ++vit)
+					inserter = vit;
+			} else {
+				// - start with the closest vertex from the located cell
+				// - repeatedly take the nearest of its incident vertices if any
+				// - if not, we're done
+				ASSERT(c != cell_handle_t());
+				nearest = delaunay.nearest_vertex_in_cell(p, c);
+				while (true) {
+					const vertex_handle_t v(nearest);
+					delaunay.adjacent_vertices(nearest, adjacent_vertex_back_inserter_t(delaunay, p, nearest));
+					if (v == nearest)
+						break;
+				}
+			}
+			ASSERT(nearest == delaunay.nearest_vertex(p, hint->cell()));
+			if (CGAL::squared_distance(p, nearest->point()) > maxDistSq)
+				return vertex_handle_t();
+			hint = nearest;
+			// check if point is far enough to all existing points
+			const PointCloud::Point& point = pointcloud.points[idx];
+			const float distInsertSq(SQUARE(distInsert));
+			for (const PointCloud::View viewID: pointcloud.pointViews[idx]) {
+				const Image& imageData = images[viewID];
+				const Point3f pn(imageData.camera.ProjectPointP3(point));
+				const Point3f pe(imageData.camera.ProjectPointP3(CGAL2MVS<float>(nearest->point())));
+				if (!IsDepthSimilar(pn.z, pe.z) || normSq(Point2f(pn)-Point2f(pe)) > distInsertSq) {
+					// point far enough to an existing point,
+					// insert as a new point
+					hint = delaunay.insert(p, lt, c, li, lj);
+					ASSERT(hint != vertex_handle_t());
+					break;
+				}
+			}
+		}
+	}
+	// update point visibility info
+	vert_info_t& vert(hint->info());
+	if (vert.idx == NO_ID)
+		vert.idx = (uint32_t)idx;
+	pointsVertex[idx] = vert.idx;
+	return hint;
+}
+
+#ifdef DELAUNAY_USE_OPENMP
+// slab of the points, split along one axis, triangulated independently of the others
+struct point_partition_t {
+	typedef std::pair<point_t,vert_info_t> vertex_t;
+	std::vector<std::ptrdiff_t> indices; // points in this partition, spatially sorted
+	double minBound, maxBound; // extent of the partition along the split axis
+	std::vector<vertex_t> vertices; // vertices inserted in this partition, with their info
+	std::vector<std::ptrdiff_t> deferred; // points whose nearest vertex might be in another partition
+
+	// insert the points in their spatial order, except the ones closer to the partition border
+	// than to their nearest vertex (or, till the first vertex is inserted, the ones that could be merged
+	// with a vertex across the border), which are deferred as the decision depends on the neighbor partitions;
+	// note that the local decisions ignore the deferred points, and the spatial order is interrupted at each
+	// border, so the merged vertices differ slightly from the sequential insertion and depend on the number of partitions
+	void Insert(const std::vector<point_t>& points, int axis, const PointCloud& pointcloud, std::vector<uint32_t>& pointsVertex, const ImageArr& images, float distInsert, Util::Progress& progress) {
+		delaunay_t delaunay;
+		vertex_handle_t hint;
+		for (const std::ptrdiff_t idx: indices) {
+			const point_t& p = points[idx];
+			const double distBorder(MINF(p[axis]-minBound, maxBound-p[axis]));
+			const vertex_handle_t v(insertPoint(delaunay, p, pointcloud, idx, pointsVertex, images, distInsert, hint, SQUARE(distBorder)));
+			if (v == vertex_handle_t()) {
+				deferred.push_back(idx);
+				continue;
+			}
+			hint = v;
+			++progress;
+		}
+		vertices.reserve(delaunay.number_of_vertices());
+		for (delaunay_t::Finite_vertices_iterator vi=delaunay.finite_vertices_begin(), vie=delaunay.finite_vertices_end(); vi!=vie; ++vi)
+			vertices.emplace_back(vi->point(), vi->info());
+	}
+};
+
+// sparse buffer accumulating the weights of the cells touched while processing a chunk of the vertices:
+// the (cell weight index, value) pairs are appended and, each time the buffer doubles in size, compacted
+// by sorting them by index and reducing the values of the same index in the order they were added;
+// the chunks are reduced in their order, so the result does not depend on the threads scheduling
+struct cell_weights_t {
+	typedef std::pair<size_t,edge_cap_t> weight_t;
+	enum { numWeights = sizeof(cell_info_t)/sizeof(edge_cap_t) };
+	enum { minCompactSize = 1<<16 }; // minimum number of values before compacting the buffer
+	static const size_t idxT = offsetof(cell_info_t, t)/sizeof(edge_cap_t);
+	std::vector<weight_t> weights; // accumulated values (sorted by the cell weight index after Finalize())
+	size_t numCompact; // buffer size triggering the next compaction
+
+	cell_weights_t() : numCompact(minCompactSize) {}
+
+	static inline size_t index(cell_size_t cellID, size_t idxWeight) { return (size_t)cellID*numWeights+idxWeight; }
+	inline void Add(size_t idx, edge_cap_t w) {
+		weights.emplace_back(idx, w);
+		if (weights.size() >= numCompact)
+			Compact<false>();
+	}
+	inline void Mul(size_t idx, edge_cap_t w) {
+		weights.emplace_back(idx, w);
+		if (weights.size() >= numCompact)
+			Compact<true>();
+	}
+	// sort the values by index and reduce the ones with the same index (sum or product)
+	template <bool bMultiply>
+	void Compact() {
+		ASSERT(!weights.empty());
+		std::stable_sort(weights.begin(), weights.end(), [](const weight_t& a, const weight_t& b) { return a.first < b.first; });
+		std::vector<weight_t>::iterator dst(weights.begin());
+		for (std::vector<weight_t>::const_iterator it=weights.cbegin()+1; it!=weights.cend(); ++it) {
+			if (dst->first != it->first)
+				*++dst = *it;
+			else if (bMultiply)
+				dst->second *= it->second;
+			else
+				dst->second += it->second;
+		}
+		weights.erase(dst+1, weights.end());
+		numCompact = MAXF(weights.size()*2, size_t(minCompactSize));
+	}
+	template <bool bMultiply>
+	void Finalize() {
+		if (!weights.empty())
+			Compact<bMultiply>();
+		weights.shrink_to_fit();
+	}
+};
+
+// reduce the chunks' weights into the cells' weights (sum or product),
+// in parallel over ranges of cells, each value being updated by the chunks in order
+template <bool bMultiply>
+void reduceCellWeights(const std::vector<cell_weights_t>& chunks, std::vector<cell_info_t>& infoCells)
+{
+	edge_cap_t* const values(infoCells.front().ptr());
+	const size_t numValues(infoCells.size()*cell_weights_t::numWeights);
+	const int numRanges((int)chunks.size());
+	#pragma omp parallel for schedule(static,1)
+	for (int r=0; r<numRanges; ++r) {
+		const size_t bgn(numValues*r/numRanges), end(numValues*(r+1)/numRanges);
+		for (const cell_weights_t& chunk: chunks) {
+			std::vector<cell_weights_t::weight_t>::const_iterator it(std::lower_bound(chunk.weights.cbegin(), chunk.weights.cend(), bgn,
+				[](const cell_weights_t::weight_t& w, size_t idx) { return w.first < idx; }));
+			for (; it != chunk.weights.cend() && it->first < end; ++it) {
+				if (bMultiply)
+					values[it->first] *= it->second;
+				else
+					values[it->first] += it->second;
+			}
+		}
+	}
+}
+#endif
+
+// insert the given points (spatially sorted) in the triangulation, merging the ones closer than distInsert pixels (see insertPoint());
+// if more than one partition is requested, the points are split in slabs triangulated in parallel (see point_partition_t)
+void insertPoints(delaunay_t& delaunay, const std::vector<point_t>& vertices, const std::vector<std::ptrdiff_t>& indices, const PointCloud& pointcloud,
+	std::vector<uint32_t>& pointsVertex, const ImageArr& images, float distInsert, unsigned numPartitions, Util::Progress& progress)
+{
+	#ifdef DELAUNAY_USE_OPENMP
+	if (numPartitions > 1) {
+		// split the points in slabs along the largest dimension, with the same number of points each,
+		// and triangulate them in parallel
+		typedef CGAL::Spatial_sort_traits_adapter_3<delaunay_t::Geom_traits, point_t*> Search_traits;
+		AABB3f aabb(true);
+		for (const std::ptrdiff_t idx: indices)
+			aabb.InsertFull(CGAL2MVS<float>(vertices[idx]));
+		int axis;
+		aabb.GetSize().maxCoeff(&axis);
+		std::vector<double> coords(indices.size());
+		FOREACH(i, coords)
+			coords[i] = vertices[indices[i]][axis];
+		std::vector<point_partition_t> partitions(numPartitions);
+		std::vector<double> bounds(numPartitions+1);
+		bounds.front() = -std::numeric_limits<double>::max();
+		bounds.back() = std::numeric_limits<double>::max();
+		for (unsigned i=1; i<numPartitions; ++i) {
+			std::vector<double>::iterator it(coords.begin()+coords.size()*i/numPartitions);
+			std::nth_element(coords.begin(), it, coords.end());
+			bounds[i] = *it;
+		}
+		coords.clear();
+		for (unsigned i=0; i<numPartitions; ++i) {
+			point_partition_t& partition = partitions[i];
+			partition.minBound = bounds[i];
+			partition.maxBound = bounds[i+1];
+			partition.indices.reserve(indices.size()/numPartitions);
+		}
+		// distribute the points keeping their spatial order
+		for (const std::ptrdiff_t idx: indices) {
+			const size_t i(std::upper_bound(bounds.cbegin()+1, bounds.cend()-1, vertices[idx][axis])-(bounds.cbegin()+1));
+			partitions[i].indices.push_back(idx);
+		}
+		#pragma omp parallel for schedule(dynamic) num_threads(numPartitions)
+		for (int i=0; i<(int)numPartitions; ++i) {
+			point_partition_t& partition = partitions[i];
+			partition.Insert(vertices, axis, pointcloud, pointsVertex, images, distInsert, progress);
+			std::vector<std::ptrdiff_t>().swap(partition.indices);
+		}
+		// insert the vertices of all partitions at once
+		std::vector<point_partition_t::vertex_t> partitionVertices;
+		std::vector<std::ptrdiff_t> deferred;
+		for (point_partition_t& partition: partitions) {
+			partitionVertices.insert(partitionVertices.end(), partition.vertices.cbegin(), partition.vertices.cend());
+			deferred.insert(deferred.end(), partition.deferred.cbegin(), partition.deferred.cend());
+			std::vector<point_partition_t::vertex_t>().swap(partition.vertices);
+		}
+		delaunay.insert(partitionVertices.begin(), partitionVertices.end());
+		std::vector<point_partition_t::vertex_t>().swap(partitionVertices);
+		// insert the deferred points one by one, as these depend on the vertices of several partitions
+		CGAL::spatial_sort(deferred.begin(), deferred.end(), Search_traits(&vertices[0], delaunay.geom_traits()));
+		vertex_handle_t hint;
+		if (delaunay.number_of_vertices() > 0)
+			hint = delaunay.finite_vertices_begin();
+		for (const std::ptrdiff_t idx: deferred) {
+			hint = insertPoint(delaunay, vertices[idx], pointcloud, idx, pointsVertex, images, distInsert, hint);
+			++progress;
+		}
+		DEBUG_ULTIMATE("Delaunay tetrahedralization of %u partitions: %u points deferred", numPartitions, (unsigned)deferred.size());
+	} else
+	#endif
+	{
+		vertex_handle_t hint;
+		for (const std::ptrdiff_t idx: indices) {
+			hint = insertPoint(delaunay, vertices[idx], pointcloud, idx, pointsVertex, images, distInsert, hint);
+			++progress;
+		}
+	}
+}
 } // namespace DELAUNAY
 
 // First, iteratively create a Delaunay triangulation of the existing point-cloud by inserting point by point,
@@ -767,7 +955,7 @@ float computePlaneSphereAngle(const delaunay_t& Tr, const facet_t& facet)
 bool Scene::ReconstructMesh(float distInsert, bool bUseFreeSpaceSupport, bool bUseOnlyROI, unsigned nItersFixNonManifold,
 							float kSigma, float kQual, float kb,
 							float kf, float kRel, float kAbs, float kOutl,
-							float kInf, Util::Progress::Callback callback
+							float kInf, Util::Progress::Callback callback, int nMaxFlowType, const String& fileExportGraph
 )
 {
 	using namespace DELAUNAY;
@@ -776,6 +964,7 @@ bool Scene::ReconstructMesh(float distInsert, bool bUseFreeSpaceSupport, bool bU
 
 	// create the Delaunay triangulation
 	delaunay_t delaunay;
+	vert_views_t vertsViews;
 	std::vector<cell_info_t> infoCells;
 	std::vector<camera_cell_t> camCells;
 	std::vector<facet_t> hullFacets;
@@ -798,82 +987,21 @@ bool Scene::ReconstructMesh(float distInsert, bool bUseFreeSpaceSupport, bool bU
 		typedef CGAL::Spatial_sort_traits_adapter_3<delaunay_t::Geom_traits, point_t*> Search_traits;
 		CGAL::spatial_sort(indices.begin(), indices.end(), Search_traits(&vertices[0], delaunay.geom_traits()));
 		// insert vertices
+		std::vector<uint32_t> pointsVertex(pointcloud.points.GetSize(), NO_ID);
 		Util::Progress progress(_T("Points inserted"), indices.size());
 		if (callback)
 			progress.setCallback(callback);
-		const float distInsertSq(SQUARE(distInsert));
-		vertex_handle_t hint;
-		delaunay_t::Locate_type lt;
-		int li, lj;
-		std::for_each(indices.cbegin(), indices.cend(), [&](size_t idx) {
-			const point_t& p = vertices[idx];
-			const PointCloud::Point& point = pointcloud.points[idx];
-			const PointCloud::ViewArr& views = pointcloud.pointViews[idx];
-			ASSERT(!views.IsEmpty());
-			if (hint == vertex_handle_t()) {
-				// this is the first point,
-				// insert it
-				hint = delaunay.insert(p);
-				ASSERT(hint != vertex_handle_t());
-			} else
-			if (distInsert <= 0) {
-				// insert all points
-				hint = delaunay.insert(p, hint);
-				ASSERT(hint != vertex_handle_t());
-			} else {
-				// locate cell containing this point
-				const cell_handle_t c(delaunay.locate(p, lt, li, lj, hint->cell()));
-				if (lt == delaunay_t::VERTEX) {
-					// duplicate point, nothing to insert,
-					// just update its visibility info
-					hint = c->vertex(li);
-					ASSERT(hint != delaunay.infinite_vertex());
-				} else {
-					// locate the nearest vertex
-					vertex_handle_t nearest;
-					if (delaunay.dimension() < 3) {
-						// use a brute-force algorithm if dimension < 3
-						delaunay_t::Finite_vertices_iterator vit = delaunay.finite_vertices_begin();
-						nearest = vit;
-						++vit;
-						adjacent_vertex_back_inserter_t inserter(delaunay, p, nearest);
-						for (delaunay_t::Finite_vertices_iterator end = delaunay.finite_vertices_end(); vit != end; ++vit)
-							inserter = vit;
-					} else {
-						// - start with the closest vertex from the located cell
-						// - repeatedly take the nearest of its incident vertices if any
-						// - if not, we're done
-						ASSERT(c != cell_handle_t());
-						nearest = delaunay.nearest_vertex_in_cell(p, c);
-						while (true) {
-							const vertex_handle_t v(nearest);
-							delaunay.adjacent_vertices(nearest, adjacent_vertex_back_inserter_t(delaunay, p, nearest));
-							if (v == nearest)
-								break;
-						}
-					}
-					ASSERT(nearest == delaunay.nearest_vertex(p, hint->cell()));
-					hint = nearest;
-					// check if point is far enough to all existing points
-					FOREACHPTR(pViewID, views) {
-						const Image& imageData = images[*pViewID];
-						const Point3f pn(imageData.camera.ProjectPointP3(point));
-						const Point3f pe(imageData.camera.ProjectPointP3(CGAL2MVS<float>(nearest->point())));
-						if (!IsDepthSimilar(pn.z, pe.z) || normSq(Point2f(pn)-Point2f(pe)) > distInsertSq) {
-							// point far enough to an existing point,
-							// insert as a new point
-							hint = delaunay.insert(p, lt, c, li, lj);
-							ASSERT(hint != vertex_handle_t());
-							break;
-						}
-					}
-				}
-			}
-			// update point visibility info
-			hint->info().InsertViews(pointcloud, idx);
-			++progress;
-		});
+		#ifdef DELAUNAY_USE_OPENMP
+		const size_t minPointsPartition(100000); // fewer points do not pay the cost of merging the partitions
+		const unsigned numPartitions(distInsert > 0 ? MINF(nMaxThreads, (unsigned)(indices.size()/minPointsPartition)) : 1u);
+		#else
+		const unsigned numPartitions(1);
+		#endif
+		insertPoints(delaunay, vertices, indices, pointcloud, pointsVertex, images, distInsert, numPartitions, progress);
 		progress.close();
+		if (!vertsViews.Init(delaunay, pointcloud, pointsVertex))
+			return false;
+		std::vector<uint32_t>().swap(pointsVertex);
 		pointcloud.Release();
 		// init cells weights and
 		// loop over all cells and store the finite facet of the infinite cells
@@ -932,33 +1060,47 @@ bool Scene::ReconstructMesh(float distInsert, bool bUseFreeSpaceSupport, bool bU
 
 		std::vector<facet_t> facets;
 
+		// snapshot the vertices seen by at least one view
+		std::vector<vertex_handle_t> verts;
+		verts.reserve(delaunay.number_of_vertices());
+		for (delaunay_t::Finite_vertices_iterator vi=delaunay.finite_vertices_begin(), vie=delaunay.finite_vertices_end(); vi!=vie; ++vi) {
+			if (!vi->info().IsEmpty())
+				verts.push_back(vi);
+		}
+		#ifdef DELAUNAY_USE_OPENMP
+		// the vertices are split in a fixed number of chunks, independent of the number of threads,
+		// each accumulating its weights in a separate buffer, reduced in order at the end,
+		// making the weights the same from run to run
+		const int numChunks((int)MINF(verts.size(), size_t(256)));
+		std::vector<cell_weights_t> chunksWeights;
+		#endif
+
 		// compute the weights for each edge
 		{
 		TD_TIMER_STARTD();
-		Util::Progress progress(_T("Points weighted"), delaunay.number_of_vertices());
+		Util::Progress progress(_T("Points weighted"), verts.size());
 		if (callback)
 			progress.setCallback(callback);
+		#ifdef DELAUNAY_WEAKSURF
+		vertsViews.viewsInfo.resize(vertsViews.views.size());
+		#endif
 		#ifdef DELAUNAY_USE_OPENMP
-		delaunay_t::Vertex_iterator vertexIter(delaunay.vertices_begin());
-		const int64_t nVerts(delaunay.number_of_vertices()+1);
-		#pragma omp parallel for private(facets)
-		for (int64_t i=0; i<nVerts; ++i) {
-			delaunay_t::Vertex_iterator vi;
-			#pragma omp critical
-			vi = vertexIter++;
+		chunksWeights.resize(numChunks);
+		#pragma omp parallel for schedule(static,1) private(facets)
+		for (int c=0; c<numChunks; ++c) {
+			cell_weights_t& chunkWeights = chunksWeights[c];
+			const size_t bgn(verts.size()*c/numChunks), end(verts.size()*(c+1)/numChunks);
 		#else
-		for (delaunay_t::Vertex_iterator vi=delaunay.vertices_begin(), vie=delaunay.vertices_end(); vi!=vie; ++vi) {
+		{
+			const size_t bgn(0), end(verts.size());
 		#endif
-			vert_info_t& vert(vi->info());
-			if (vert.views.IsEmpty())
-				continue;
-			#ifdef DELAUNAY_WEAKSURF
-			vert.AllocateInfo();
-			#endif
+		for (size_t i=bgn; i<end; ++i) {
+			const vertex_handle_t vi(verts[i]);
+			const vert_info_t& vert(vi->info());
 			const point_t& p(vi->point());
 			const Point3 pt(CGAL2MVS<REAL>(p));
-			FOREACH(v, vert.views) {
-				const typename vert_info_t::view_t view(vert.views[v]);
+			for (uint32_t v=0; v<vert.numViews; ++v) {
+				const vert_info_t::view_t& view(vertsViews.View(vert, v));
 				const uint32_t imageID(view.idxView);
 				const edge_cap_t alpha_vis(view.weight);
 				const Image& imageData = images[imageID];
@@ -976,16 +1118,16 @@ bool Scene::ReconstructMesh(float distInsert, bool bUseFreeSpaceSupport, bool bU
 				do {
 					// assign score, weighted by the distance from the point to the intersection
 					const edge_cap_t w(alpha_vis*(1.f-EXP(-SQUARE((float)inter.dist)*inv2SigmaSq)));
-					edge_cap_t& f(infoCells[inter.facet.first->info()].f[inter.facet.second]);
 					#ifdef DELAUNAY_USE_OPENMP
-					#pragma omp atomic
+					chunkWeights.Add(cell_weights_t::index(inter.facet.first->info(), inter.facet.second), w);
+					#else
+					infoCells[inter.facet.first->info()].f[inter.facet.second] += w;
 					#endif
-					f += w;
 				} while (intersect(delaunay, segCamPoint, facets, facets, inter));
 				ASSERT(facets.empty() && inter.type == intersection_t::VERTEX && inter.v1 == vi);
 				#ifdef DELAUNAY_WEAKSURF
-				ASSERT(vert.viewsInfo[v].cell2Cam == NULL);
-				vert.viewsInfo[v].cell2Cam = inter.facet.first;
+				ASSERT(vertsViews.ViewInfo(vert, v).cell2Cam == NULL);
+				vertsViews.ViewInfo(vert, v).cell2Cam = inter.facet.first;
 				#endif
 				// find faces intersected by the endpoint-point segment
 				inter.dist = FLT_MAX; inter.bigger = false;
@@ -994,29 +1136,37 @@ bool Scene::ReconstructMesh(float distInsert, bool bUseFreeSpaceSupport, bool bU
 				const cell_handle_t endCell(delaunay.locate(segEndPoint.source(), vi->cell()));
 				ASSERT(endCell != cell_handle_t());
 				fetchCellFacets<CGAL::NEGATIVE>(delaunay, hullFacets, endCell, imageData, facets);
-				edge_cap_t& t(infoCells[endCell->info()].t);
 				#ifdef DELAUNAY_USE_OPENMP
-				#pragma omp atomic
+				chunkWeights.Add(cell_weights_t::index(endCell->info(), cell_weights_t::idxT), alpha_vis);
+				#else
+				infoCells[endCell->info()].t += alpha_vis;
 				#endif
-				t += alpha_vis;
 				while (intersect(delaunay, segEndPoint, facets, facets, inter)) {
 					// assign score, weighted by the distance from the point to the intersection
 					const facet_t& mf(delaunay.mirror_facet(inter.facet));
 					const edge_cap_t w(alpha_vis*(1.f-EXP(-SQUARE((float)inter.dist)*inv2SigmaSq)));
-					edge_cap_t& f(infoCells[mf.first->info()].f[mf.second]);
 					#ifdef DELAUNAY_USE_OPENMP
-					#pragma omp atomic
+					chunkWeights.Add(cell_weights_t::index(mf.first->info(), mf.second), w);
+					#else
+					infoCells[mf.first->info()].f[mf.second] += w;
 					#endif
-					f += w;
 				}
 				ASSERT(facets.empty() && inter.type == intersection_t::VERTEX && inter.v1 == vi);
 				#ifdef DELAUNAY_WEAKSURF
-				ASSERT(vert.viewsInfo[v].cell2End == NULL);
-				vert.viewsInfo[v].cell2End = inter.facet.first;
+				ASSERT(vertsViews.ViewInfo(vert, v).cell2End == NULL);
+				vertsViews.ViewInfo(vert, v).cell2End = inter.facet.first;
 				#endif
 			}
 			++progress;
 		}
+		#ifdef DELAUNAY_USE_OPENMP
+		chunkWeights.Finalize<false>();
+		#endif
+		}
+		#ifdef DELAUNAY_USE_OPENMP
+		reduceCellWeights<false>(chunksWeights, infoCells);
+		chunksWeights.clear();
+		#endif
 		progress.close();
 		DEBUG_ULTIMATE("\tweighting completed in %s", TD_TIMER_GET_FMT().c_str());
 		}
@@ -1027,23 +1177,22 @@ bool Scene::ReconstructMesh(float distInsert, bool bUseFreeSpaceSupport, bool bU
 		if (bUseFreeSpaceSupport) {
 		TD_TIMER_STARTD();
 		#ifdef DELAUNAY_USE_OPENMP
-		delaunay_t::Vertex_iterator vertexIter(delaunay.vertices_begin());
-		const int64_t nVerts(delaunay.number_of_vertices()+1);
-		#pragma omp parallel for private(facets)
-		for (int64_t i=0; i<nVerts; ++i) {
-			delaunay_t::Vertex_iterator vi;
-			#pragma omp critical
-			vi = vertexIter++;
+		chunksWeights.resize(numChunks);
+		#pragma omp parallel for schedule(static,1) private(facets)
+		for (int c=0; c<numChunks; ++c) {
+			cell_weights_t& chunkWeights = chunksWeights[c];
+			const size_t bgn(verts.size()*c/numChunks), end(verts.size()*(c+1)/numChunks);
 		#else
-		for (delaunay_t::Vertex_iterator vi=delaunay.vertices_begin(), vie=delaunay.vertices_end(); vi!=vie; ++vi) {
+		{
+			const size_t bgn(0), end(verts.size());
 		#endif
+		for (size_t i=bgn; i<end; ++i) {
+			const vertex_handle_t vi(verts[i]);
 			const vert_info_t& vert(vi->info());
-			if (vert.views.IsEmpty())
-				continue;
 			const point_t& p(vi->point());
 			const Point3f pt(CGAL2MVS<float>(p));
-			FOREACH(v, vert.views) {
-				const uint32_t imageID(vert.views[(vert_info_t::view_vec_t::IDX)v]);
+			for (uint32_t v=0; v<vert.numViews; ++v) {
+				const uint32_t imageID(vertsViews.View(vert, v).idxView);
 				const Image& imageData = images[imageID];
 				ASSERT(imageData.IsValid());
 				const Camera& camera = imageData.camera;
@@ -1054,7 +1203,7 @@ bool Scene::ReconstructMesh(float distInsert, bool bUseFreeSpaceSupport, bool bU
 				const Point3f bgnPoint(pt-vecCamPoint*(invLenCamPoint*sigma*kf));
 				const segment_t segPointBgn(p, MVS2CGAL(bgnPoint));
 				intersection_t inter;
-				if (!intersectFace(delaunay, segPointBgn, vi, vert.viewsInfo[v].cell2Cam, facets, inter))
+				if (!intersectFace(delaunay, segPointBgn, vi, vertsViews.ViewInfo(vert, v).cell2Cam, facets, inter))
 					continue;
 				edge_cap_t beta(0);
 				do {
@@ -1065,7 +1214,7 @@ bool Scene::ReconstructMesh(float distInsert, bool bUseFreeSpaceSupport, bool bU
 				// find faces intersected by the point-endpoint segment
 				const Point3f endPoint(pt+vecCamPoint*(invLenCamPoint*sigma*kb));
 				const segment_t segPointEnd(p, MVS2CGAL(endPoint));
-				if (!intersectFace(delaunay, segPointEnd, vi, vert.viewsInfo[v].cell2End, facets, inter))
+				if (!intersectFace(delaunay, segPointEnd, vi, vertsViews.ViewInfo(vert, v).cell2End, facets, inter))
 					continue;
 				edge_cap_t gammaMin(FLT_MAX), gammaMax(0);
 				do {
@@ -1081,14 +1230,22 @@ bool Scene::ReconstructMesh(float distInsert, bool bUseFreeSpaceSupport, bool bU
 				const edge_cap_t epsAbs(beta-gamma);
 				const edge_cap_t epsRel(gamma/beta);
 				if (epsRel < kRel && epsAbs > kAbs && gamma < kOutl) {
-					edge_cap_t& t(infoCells[inter.ncell->info()].t);
 					#ifdef DELAUNAY_USE_OPENMP
-					#pragma omp atomic
+					chunkWeights.Mul(cell_weights_t::index(inter.ncell->info(), cell_weights_t::idxT), epsAbs);
+					#else
+					infoCells[inter.ncell->info()].t *= epsAbs;
 					#endif
-					t *= epsAbs;
 				}
 			}
 		}
+		#ifdef DELAUNAY_USE_OPENMP
+		chunkWeights.Finalize<true>();
+		#endif
+		}
+		#ifdef DELAUNAY_USE_OPENMP
+		reduceCellWeights<true>(chunksWeights, infoCells);
+		chunksWeights.clear();
+		#endif
 		DEBUG_ULTIMATE("\tt-edge reinforcement completed in %s", TD_TIMER_GET_FMT().c_str());
 		}
 		#endif
@@ -1100,14 +1257,26 @@ bool Scene::ReconstructMesh(float distInsert, bool bUseFreeSpaceSupport, bool bU
 	{
 		TD_TIMER_STARTD();
 
-		// create graph
-		MaxFlow<cell_size_t,edge_cap_t> graph(delaunay.number_of_cells());
+		// create graph, directly in the solver
+		// (and in a separate graph only if it has to be exported)
+		const MaxFlowPtr solver(MaxFlow::Create((MaxFlow::TYPE)nMaxFlowType, nMaxThreads));
+		if (solver == NULL) {
+			DEBUG("error: invalid max-flow algorithm %d", nMaxFlowType);
+			return false;
+		}
+		solver->Init(delaunay.number_of_cells(), delaunay.number_of_facets());
+		const bool bExportGraph(!fileExportGraph.empty());
+		MaxFlowGraph graph;
+		if (bExportGraph)
+			graph.Init(delaunay.number_of_cells(), delaunay.number_of_facets());
 		// set weights
 		constexpr edge_cap_t maxCap(3.402823466e+34f/*FLT_MAX*0.0001f*/);
 		for (delaunay_t::All_cells_iterator ci=delaunay.all_cells_begin(), ce=delaunay.all_cells_end(); ci!=ce; ++ci) {
 			const cell_size_t ciID(ci->info());
 			const cell_info_t& ciInfo(infoCells[ciID]);
-			graph.AddNode(ciID, ciInfo.s, MINF(ciInfo.t, maxCap));
+			solver->AddNode(ciID, ciInfo.s, MINF(ciInfo.t, maxCap));
+			if (bExportGraph)
+				graph.AddNode(ciID, ciInfo.s, MINF(ciInfo.t, maxCap));
 			for (int i=0; i<4; ++i) {
 				const cell_handle_t cj(ci->neighbor(i));
 				const cell_size_t cjID(cj->info());
@@ -1115,12 +1284,19 @@ bool Scene::ReconstructMesh(float distInsert, bool bUseFreeSpaceSupport, bool bU
 				const cell_info_t& cjInfo(infoCells[cjID]);
 				const int j(cj->index(ci));
 				const edge_cap_t q((1.f - MINF(computePlaneSphereAngle(delaunay, facet_t(ci,i)), computePlaneSphereAngle(delaunay, facet_t(cj,j))))*kQual);
-				graph.AddEdge(ciID, cjID, ciInfo.f[i]+q, cjInfo.f[j]+q);
+				solver->AddEdge(ciID, cjID, ciInfo.f[i]+q, cjInfo.f[j]+q);
+				if (bExportGraph)
+					graph.AddEdge(ciID, cjID, ciInfo.f[i]+q, cjInfo.f[j]+q);
 			}
 		}
-		infoCells.clear();
+		std::vector<cell_info_t>().swap(infoCells);
+		if (bExportGraph) {
+			if (!graph.Save(fileExportGraph))
+				DEBUG("error: can not save the graph: %s", fileExportGraph.c_str());
+			graph.Release();
+		}
 		// find graph-cut solution
-		const float maxflow(graph.ComputeMaxFlow());
+		const float maxflow(solver->ComputeMaxFlow());
 		// extract surface formed by the facets between inside/outside cells
 		const size_t nEstimatedNumVerts(delaunay.number_of_vertices());
 		std::unordered_map<void*,Mesh::VIndex> mapVertices;
@@ -1136,8 +1312,8 @@ bool Scene::ReconstructMesh(float distInsert, bool bUseFreeSpaceSupport, bool bU
 				const cell_handle_t cj(ci->neighbor(i));
 				const cell_size_t cjID(cj->info());
 				if (ciID < cjID) continue;
-				const bool ciType(graph.IsNodeOnSrcSide(ciID));
-				if (ciType == graph.IsNodeOnSrcSide(cjID)) continue;
+				const bool ciType(solver->IsNodeOnSrcSide(ciID));
+				if (ciType == solver->IsNodeOnSrcSide(cjID)) continue;
 				Mesh::Face& face = mesh.faces.AddEmpty();
 				const triangle_vhandles_t tri(getTriangle(ci, i));
 				for (int v=0; v<3; ++v) {
@@ -1156,7 +1332,7 @@ bool Scene::ReconstructMesh(float distInsert, bool bUseFreeSpaceSupport, bool bU
 		}
 		delaunay.clear();
 
-		DEBUG_EXTRA("Delaunay tetrahedras graph-cut completed (%g flow): %u vertices, %u faces (%s)", maxflow, mesh.vertices.GetSize(), mesh.faces.GetSize(), TD_TIMER_GET_FMT().c_str());
+		DEBUG_EXTRA("Delaunay tetrahedras graph-cut completed (%g %s flow): %u vertices, %u faces (%s)", maxflow, MaxFlow::GetName((MaxFlow::TYPE)nMaxFlowType), mesh.vertices.GetSize(), mesh.faces.GetSize(), TD_TIMER_GET_FMT().c_str());
 	}
 
 	// fix non-manifold vertices and edges
@@ -1164,3 +1340,334 @@ bool Scene::ReconstructMesh(float distInsert, bool bUseFreeSpaceSupport, bool bU
 	return true;
 }
 /*----------------------------------------------------------------*/
+
+
+namespace {
+// hash of the vertex position, used to find the vertices shared by the meshes of neighbor tiles
+struct VertexHash {
+	inline size_t operator()(const Mesh::Vertex& v) const {
+		const uint32_t* const bits(reinterpret_cast<const uint32_t*>(v.ptr()));
+		return ((size_t)bits[0]*73856093u) ^ ((size_t)bits[1]*19349663u) ^ ((size_t)bits[2]*83492791u);
+	}
+};
+} // unnamed namespace
+
+// Reconstruct the mesh out-of-core, tile by tile:
+// split the point-cloud in tiles, recursively halving the points along the longest axis
+// till each tile contains at most nMaxPointsTile points;
+// merge the points closer than distInsert pixels once for all tiles, each point only with the points of its own tile,
+// such that the neighbor tiles triangulate exactly the same points near the seams;
+// reconstruct each tile independently from the merged points inside its bounding-box enlarged by fOverlapTile
+// relative to its size, such that the surface near the tile border is supported by the points on both sides;
+// finally keep from each tile mesh only the faces with the centroid inside the tile,
+// stitch them together by merging the vertices with the same position (the input points),
+// and close the small gaps left where the surfaces of the neighbor tiles do not agree;
+// the memory needed by the triangulation and graph-cut is limited this way to a single tile
+bool Scene::ReconstructMeshTiled(unsigned nMaxPointsTile, float fOverlapTile, float distInsert, bool bUseFreeSpaceSupport, bool bUseOnlyROI,
+								 unsigned nItersFixNonManifold, float kSigma, float kQual, int nMaxFlowType)
+{
+	using namespace DELAUNAY;
+	ASSERT(!pointcloud.IsEmpty());
+	if (pointcloud.GetSize() <= nMaxPointsTile)
+		return ReconstructMesh(distInsert, bUseFreeSpaceSupport, bUseOnlyROI, nItersFixNonManifold, kSigma, kQual,
+			4.f, 3.f, 0.1f, 1000.f, 400.f, (float)(INT_MAX/8), nullptr, nMaxFlowType);
+	TD_TIMER_STARTD();
+
+	// fetch points
+	if (bUseOnlyROI && !IsBounded())
+		bUseOnlyROI = false;
+	Unsigned32Arr indices(0, (uint32_t)pointcloud.GetSize());
+	FOREACH(i, pointcloud.points)
+		if (!bUseOnlyROI || obb.Intersects(pointcloud.points[i]))
+			indices.emplace_back(i);
+	if (indices.empty())
+		return false;
+
+	// split the points in tiles
+	struct Tile {
+		AABB3f core; // tile space (the faces with the centroid inside belong to this tile)
+		uint32_t bgn, end; // range of the points inside the tile
+	};
+	std::vector<Tile> tiles;
+	{
+		std::vector<Tile> stack{Tile{AABB3f(AABB3f::POINT::Constant(-FLT_MAX), AABB3f::POINT::Constant(FLT_MAX)), 0, (uint32_t)indices.size()}};
+		while (!stack.empty()) {
+			const Tile tile(stack.back());
+			stack.pop_back();
+			if (tile.end-tile.bgn <= nMaxPointsTile) {
+				tiles.push_back(tile);
+				continue;
+			}
+			AABB3f aabb(true);
+			for (uint32_t i=tile.bgn; i<tile.end; ++i)
+				aabb.InsertFull(pointcloud.points[indices[i]]);
+			int axis;
+			aabb.GetSize().maxCoeff(&axis);
+			const uint32_t mid((tile.bgn+tile.end)/2);
+			std::nth_element(indices.begin()+tile.bgn, indices.begin()+mid, indices.begin()+tile.end,
+				[&](uint32_t i, uint32_t j) { return pointcloud.points[i][axis] < pointcloud.points[j][axis]; });
+			const float split(pointcloud.points[indices[mid]][axis]);
+			Tile left(tile), right(tile);
+			left.core.ptMax[axis] = right.core.ptMin[axis] = split;
+			left.end = right.bgn = mid;
+			stack.push_back(right);
+			stack.push_back(left);
+		}
+	}
+
+	// merge the points of each tile closer than distInsert pixels,
+	// and collect the merged points of all tiles, adding up the weights of the views seen by several points
+	PointCloud pointcloudFull;
+	pointcloudFull.Swap(pointcloud);
+	PointCloud pointcloudMerged;
+	if (distInsert > 0 || bUseOnlyROI) {
+		std::vector<uint32_t> pointsVertex(pointcloudFull.GetSize(), NO_ID);
+		if (distInsert > 0) {
+			typedef CGAL::Spatial_sort_traits_adapter_3<delaunay_t::Geom_traits, point_t*> Search_traits;
+			for (const Tile& tile: tiles) {
+				if (tile.end == tile.bgn)
+					continue;
+				delaunay_t delaunay;
+				std::vector<point_t> vertices(tile.end-tile.bgn);
+				std::vector<std::ptrdiff_t> order(tile.end-tile.bgn);
+				FOREACH(i, vertices) {
+					const PointCloud::Point& X(pointcloudFull.points[indices[tile.bgn+i]]);
+					vertices[i] = point_t(X.x, X.y, X.z);
+					order[i] = i;
+				}
+				CGAL::spatial_sort(order.begin(), order.end(), Search_traits(&vertices[0], delaunay.geom_traits()));
+				vertex_handle_t hint;
+				for (const std::ptrdiff_t i: order)
+					hint = insertPoint(delaunay, vertices[i], pointcloudFull, indices[tile.bgn+(uint32_t)i], pointsVertex, images, distInsert, hint);
+			}
+		} else {
+			for (const uint32_t idx: indices)
+				pointsVertex[idx] = idx;
+		}
+		// keep the first point merged in each vertex, in the order of the tiles
+		std::vector<uint32_t> pointsMerged(pointcloudFull.GetSize(), NO_ID);
+		uint32_t numPoints(0);
+		for (Tile& tile: tiles) {
+			const uint32_t bgn(numPoints);
+			for (uint32_t i=tile.bgn; i<tile.end; ++i) {
+				const uint32_t idx(indices[i]);
+				if (pointsVertex[idx] != idx)
+					continue;
+				pointsMerged[idx] = numPoints;
+				indices[numPoints++] = pointsMerged[idx];
+				const PointCloud::ViewArr& views = pointcloudFull.pointViews[idx];
+				pointcloudMerged.points.emplace_back(pointcloudFull.points[idx]);
+				pointcloudMerged.pointViews.emplace_back(views);
+				if (!pointcloudFull.pointWeights.empty()) {
+					pointcloudMerged.pointWeights.emplace_back(pointcloudFull.pointWeights[idx]);
+				} else if (distInsert > 0) {
+					PointCloud::WeightArr& weights = pointcloudMerged.pointWeights.emplace_back(views.size());
+					for (PointCloud::Weight& weight: weights)
+						weight = PointCloud::Weight(1);
+				}
+			}
+			tile.bgn = bgn;
+			tile.end = numPoints;
+		}
+		indices.resize(numPoints);
+		// add the views of the other points to their vertex (same as vert_views_t::Init())
+		const PointCloud::WeightArr* const pweights(pointcloudFull.pointWeights.IsEmpty() ? NULL : pointcloudFull.pointWeights.Begin());
+		FOREACH(idx, pointsVertex) {
+			const uint32_t idxVert(pointsVertex[idx]);
+			if (idxVert == NO_ID || idxVert == idx)
+				continue;
+			const uint32_t idxPoint(pointsMerged[idxVert]);
+			PointCloud::ViewArr& views = pointcloudMerged.pointViews[idxPoint];
+			PointCloud::WeightArr& weights = pointcloudMerged.pointWeights[idxPoint];
+			const PointCloud::ViewArr& _views = pointcloudFull.pointViews[idx];
+			FOREACH(v, _views) {
+				const PointCloud::Weight weight(pweights ? pweights[idx][v] : PointCloud::Weight(1));
+				const uint32_t i(views.FindFirstEqlGreater(_views[v]));
+				if (i < views.size() && views[i] == _views[v]) {
+					weights[i] += weight;
+				} else {
+					views.InsertAt(i, _views[v]);
+					weights.InsertAt(i, weight);
+				}
+			}
+		}
+		DEBUG_ULTIMATE("Points merged for tiling: %u out of %u", (unsigned)pointcloudMerged.GetSize(), (unsigned)pointcloudFull.GetSize());
+	}
+	const PointCloud& pointcloudTiles(distInsert > 0 || bUseOnlyROI ? pointcloudMerged : pointcloudFull);
+
+	// collect the points inside each tile enlarged by the overlap
+	std::vector<PointCloud::Octree::IDXARR_TYPE> tilesPoints(tiles.size());
+	{
+		const PointCloud::Octree octree(pointcloudTiles.points, [](PointCloud::Octree::IDX_TYPE size, PointCloud::Octree::Type /*radius*/) {
+			return size > 128;
+		});
+		FOREACH(idxTile, tiles) {
+			const Tile& tile = tiles[idxTile];
+			AABB3f aabb(true);
+			for (uint32_t i=tile.bgn; i<tile.end; ++i)
+				aabb.InsertFull(pointcloudTiles.points[indices[i]]);
+			aabb.Enlarge(aabb.GetSize().maxCoeff()*fOverlapTile);
+			octree.Collect(tilesPoints[idxTile], aabb);
+		}
+	}
+	indices.Release();
+
+	// reconstruct each tile and stitch the meshes
+	Mesh meshFull;
+	std::unordered_map<Mesh::Vertex,Mesh::VIndex,VertexHash> mapVertices;
+	FOREACH(idxTile, tiles) {
+		const Tile& tile = tiles[idxTile];
+		PointCloud::Octree::IDXARR_TYPE& tilePoints = tilesPoints[idxTile];
+		const PointCloud::Index numPoints(tilePoints.size());
+		if (numPoints < 4)
+			continue;
+		pointcloud.Release();
+		pointcloud.points.reserve(numPoints);
+		pointcloud.pointViews.reserve(numPoints);
+		if (!pointcloudTiles.pointWeights.empty())
+			pointcloud.pointWeights.reserve(numPoints);
+		for (const uint32_t idxPoint: tilePoints) {
+			pointcloud.points.emplace_back(pointcloudTiles.points[idxPoint]);
+			pointcloud.pointViews.emplace_back(pointcloudTiles.pointViews[idxPoint]);
+			if (!pointcloudTiles.pointWeights.empty())
+				pointcloud.pointWeights.emplace_back(pointcloudTiles.pointWeights[idxPoint]);
+		}
+		tilePoints.Release();
+		// reconstruct the tile (the points are already merged)
+		if (!ReconstructMesh(0.f, bUseFreeSpaceSupport, false, nItersFixNonManifold, kSigma, kQual,
+			4.f, 3.f, 0.1f, 1000.f, 400.f, (float)(INT_MAX/8), nullptr, nMaxFlowType)) {
+			pointcloud.Swap(pointcloudFull);
+			return false;
+		}
+		// keep only the faces inside the tile, merging the vertices shared with the previous tiles
+		const Mesh::FIndex numFaces(meshFull.faces.size());
+		FOREACH(idxFace, mesh.faces) {
+			const Mesh::Vertex c(mesh.ComputeCentroid(idxFace));
+			if (c.x < tile.core.ptMin.x() || c.y < tile.core.ptMin.y() || c.z < tile.core.ptMin.z() ||
+				c.x >= tile.core.ptMax.x() || c.y >= tile.core.ptMax.y() || c.z >= tile.core.ptMax.z())
+				continue;
+			const Mesh::Face& face = mesh.faces[idxFace];
+			Mesh::Face newFace;
+			for (int v=0; v<3; ++v) {
+				const Mesh::Vertex& X = mesh.vertices[face[v]];
+				const auto itVertex(mapVertices.emplace(X, meshFull.vertices.size()));
+				if (itVertex.second)
+					meshFull.vertices.emplace_back(X);
+				newFace[v] = itVertex.first->second;
+			}
+			if (newFace[0] != newFace[1] && newFace[0] != newFace[2] && newFace[1] != newFace[2])
+				meshFull.faces.emplace_back(newFace);
+		}
+		DEBUG_EXTRA("Tile %u/%u reconstructed: %u points, %u faces kept out of %u", (unsigned)idxTile+1, (unsigned)tiles.size(), (unsigned)numPoints, meshFull.faces.size()-numFaces, mesh.faces.size());
+		mesh.Release();
+	}
+	mapVertices.clear();
+	pointcloudMerged.Release();
+	pointcloud.Swap(pointcloudFull);
+	mesh.Swap(meshFull);
+
+	// close the gaps along the seams, where the surfaces of the neighbor tiles do not agree:
+	// follow the loops of border edges (the edges not matched by an opposite edge)
+	// and triangulate each small loop
+	const Mesh::VIndex maxSeamHole(30);
+	unsigned numSeamHoles(0);
+	{
+		std::unordered_map<uint64_t,int> edges;
+		const auto makeEdge = [](Mesh::VIndex v0, Mesh::VIndex v1) { return ((uint64_t)v0 << 32) | v1; };
+		for (const Mesh::Face& face: mesh.faces)
+			for (int v=0; v<3; ++v)
+				++edges[makeEdge(face[v], face[(v+1)%3])];
+		std::unordered_multimap<Mesh::VIndex,Mesh::VIndex> borderEdges;
+		for (const auto& edge: edges) {
+			const Mesh::VIndex v0((Mesh::VIndex)(edge.first >> 32)), v1((Mesh::VIndex)(edge.first & 0xFFFFFFFFu));
+			const auto itOpposite(edges.find(makeEdge(v1, v0)));
+			for (int n=edge.second-(itOpposite == edges.end() ? 0 : itOpposite->second); n>0; --n)
+				borderEdges.emplace(v0, v1);
+		}
+		edges.clear();
+		if (!borderEdges.empty()) {
+			mesh.ListIncidenteFaces();
+			const auto closeHole = [&](Mesh::VertexIdxArr& loop) {
+				if (loop.size() < 3 || loop.size() > maxSeamHole)
+					return;
+				// the new faces are oriented opposite to the border edges
+				std::reverse(loop.begin(), loop.end());
+				mesh.CloseHole(loop);
+				++numSeamHoles;
+			};
+			Mesh::VertexIdxArr loop, subloop;
+			while (!borderEdges.empty()) {
+				auto itEdge(borderEdges.begin());
+				loop.Empty();
+				loop.emplace_back(itEdge->first);
+				Mesh::VIndex v(itEdge->second);
+				borderEdges.erase(itEdge);
+				while (v != loop.front()) {
+					// split the loop in two if passing again through the same vertex
+					const Mesh::VIndex i(loop.size() <= maxSeamHole ? loop.Find(v) : Mesh::VertexIdxArr::NO_INDEX);
+					if (i != Mesh::VertexIdxArr::NO_INDEX) {
+						subloop.CopyOf(loop.data()+i, loop.size()-i);
+						loop.resize(i);
+						closeHole(subloop);
+					}
+					loop.emplace_back(v);
+					itEdge = borderEdges.find(v);
+					if (itEdge == borderEdges.end()) {
+						loop.Empty();
+						break;
+					}
+					v = itEdge->second;
+					borderEdges.erase(itEdge);
+				}
+				closeHole(loop);
+			}
+		}
+	}
+
+	// fix non-manifold vertices and edges along the seams
+	mesh.FixNonManifold();
+	mesh.ReleaseExtra();
+	DEBUG_EXTRA("Tiled mesh reconstruction completed: %u tiles, %u seam holes closed, %u vertices, %u faces (%s)", (unsigned)tiles.size(), numSeamHoles, mesh.vertices.size(), mesh.faces.size(), TD_TIMER_GET_FMT().c_str());
+	return true;
+}
+/*----------------------------------------------------------------*/
+
+
+// check the points triangulated in parallel slabs are merged about the same as when inserted sequentially:
+// the merged vertices depend on the number of partitions, but their number and the number of their views
+// must stay within the given relative tolerance
+bool MVS::TestDelaunayPartitions(const Scene& scene, unsigned numPartitions, float distInsert, float tolerance)
+{
+	using namespace DELAUNAY;
+	const PointCloud& pointcloud = scene.pointcloud;
+	if (pointcloud.IsEmpty() || numPartitions < 2)
+		return false;
+	std::vector<point_t> vertices(pointcloud.points.GetSize());
+	std::vector<std::ptrdiff_t> indices(pointcloud.points.GetSize());
+	FOREACH(i, pointcloud.points) {
+		const PointCloud::Point& X(pointcloud.points[i]);
+		vertices[i] = point_t(X.x, X.y, X.z);
+		indices[i] = i;
+	}
+	typedef CGAL::Spatial_sort_traits_adapter_3<delaunay_t::Geom_traits, point_t*> Search_traits;
+	CGAL::spatial_sort(indices.begin(), indices.end(), Search_traits(&vertices[0], delaunay_t::Geom_traits()));
+	size_t numVertices[2], numViews[2];
+	for (int i=0; i<2; ++i) {
+		delaunay_t delaunay;
+		std::vector<uint32_t> pointsVertex(pointcloud.points.GetSize(), NO_ID);
+		Util::Progress progress(_T("Points inserted"), indices.size());
+		insertPoints(delaunay, vertices, indices, pointcloud, pointsVertex, scene.images, distInsert, i == 0 ? 1u : numPartitions, progress);
+		progress.close();
+		vert_views_t vertsViews;
+		if (!vertsViews.Init(delaunay, pointcloud, pointsVertex))
+			return false;
+		numVertices[i] = delaunay.number_of_vertices();
+		numViews[i] = vertsViews.views.size();
+	}
+	DEBUG("Delaunay insertion of %u points: %u vertices and %u views sequentially, %u vertices and %u views in %u partitions", (unsigned)indices.size(),
+		(unsigned)numVertices[0], (unsigned)numViews[0], (unsigned)numVertices[1], (unsigned)numViews[1], numPartitions);
+	return
+		ABS((double)numVertices[1]-(double)numVertices[0]) <= tolerance*numVertices[0] &&
+		ABS((double)numViews[1]-(double)numViews[0]) <= tolerance*numViews[0];
+}
+/*----------------------------------------------------------------*/
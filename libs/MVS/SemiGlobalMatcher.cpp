@@ -32,6 +32,9 @@
 #include "Common.h"
 #include "SemiGlobalMatcher.h"
 #include "Scene.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 using namespace MVS;
 
@@ -43,6 +46,14 @@ using namespace STEREO;
 // uncomment to enable OpenCV filter demo
 //#define _USE_FILTER_DEMO
 
+// SIMD instruction sets available to aggregate the path costs (the best one is used)
+#if defined(__AVX2__)
+#define SGM_AGGREGATE_USE_AVX2
+#endif
+#if defined(_USE_SSE) || defined(__AVX2__)
+#define SGM_AGGREGATE_USE_SSE
+#endif
+
 
 // S T R U C T S ///////////////////////////////////////////////////
 
@@ -445,50 +456,61 @@ class EVTClose : public Event
 public:
 	EVTClose() : Event(EVT_CLOSE) {}
 };
-class EVTPixelProcess : public Event
+class EVTJob : public Event
+{
+public:
+	const SemiGlobalMatcher::Scheduler::FncJob& fncJob;
+	Semaphore& sem;
+	bool Run(void*) override {
+		fncJob();
+		sem.Signal();
+		return true;
+	}
+	EVTJob(const SemiGlobalMatcher::Scheduler::FncJob& f, Semaphore& s) : Event(EVT_JOB), fncJob(f), sem(s) {}
+};
+
+// jobs sharing the pixels to be processed between all the threads running them
+class JobPixelProcess
 {
 public:
 	typedef std::function<void (int,int,int)> FncPixel;
 	const cv::Size size;
 	volatile Thread::safe_t& idxPixel;
 	const FncPixel fncPixel;
-	bool Run(void*) override {
+	void operator()() const {
 		const int numPixels(size.area());
 		int idx;
 		while ((idx=(int)Thread::safeInc(idxPixel)) < numPixels)
 			fncPixel(idx, idx/size.width, idx%size.width);
-		return true;
 	}
-	EVTPixelProcess(cv::Size s, volatile Thread::safe_t& idx, FncPixel f) : Event(EVT_JOB), size(s), idxPixel(idx), fncPixel(f) {}
+	JobPixelProcess(cv::Size s, volatile Thread::safe_t& idx, FncPixel f) : size(s), idxPixel(idx), fncPixel(f) {}
 };
-class EVTPixelAccumInc : public Event
+class JobPixelAccumInc
 {
 public:
 	typedef std::function<void (int)> FncPixel;
 	const int numPixels;
 	volatile Thread::safe_t& idxPixel;
 	const FncPixel fncPixel;
-	bool Run(void*) override {
+	void operator()() const {
 		int idx;
 		while ((idx=(int)Thread::safeInc(idxPixel)) < numPixels)
 			fncPixel(idx);
-		return true;
 	}
-	EVTPixelAccumInc(int s, volatile Thread::safe_t& idx, FncPixel f) : Event(EVT_JOB), numPixels(s), idxPixel(idx), fncPixel(f) {}
+	JobPixelAccumInc(int s, volatile Thread::safe_t& idx, FncPixel f) : numPixels(s), idxPixel(idx), fncPixel(f) {}
 };
-class EVTPixelAccumDec : public Event
+class JobPixelAccumDec
 {
 public:
 	typedef std::function<void (int)> FncPixel;
 	volatile Thread::safe_t& idxPixel;
 	const FncPixel fncPixel;
-	bool Run(void*) override {
+	void operator()() const {
 		int idx;
 		while ((idx=(int)Thread::safeDec(idxPixel)) >= 0)
 			fncPixel(idx);
-		return true;
 	}
-	EVTPixelAccumDec(volatile Thread::safe_t& idx, FncPixel f) : Event(EVT_JOB), idxPixel(idx), fncPixel(f) {}
+	JobPixelAccumDec(volatile Thread::safe_t& idx, FncPixel f) : idxPixel(idx), fncPixel(f) {}
 };
 /*----------------------------------------------------------------*/
 
@@ -507,7 +529,12 @@ SemiGlobalMatcher::SemiGlobalMatcher(SgmSubpixelMode _subpixelMode, Disparity _s
 	:
 	subpixelMode(_subpixelMode),
 	subpixelSteps(_subpixelSteps),
-	P1(_P1), P2s(GenerateP2s(P2, P2alpha, P2beta))
+	P1(_P1), P2s(GenerateP2s(P2, P2alpha, P2beta)),
+	numDirs(maxNumDirs),
+	maxMemCosts(0), stripOverlap(32),
+	peakMemCosts(0),
+	scheduler(NULL),
+	matchedPairs(NULL)
 {
 }
 
@@ -538,12 +565,16 @@ void SemiGlobalMatcher::Match(const Scene& scene, IIndex idxImage, IIndex numNei
 		if ((numNeighbors && idxNeighbor >= numNeighbors) ||
 			(neighbor.score < fMinScore))
 			break;
-		// check if the disparity-map was already estimated for the same image pairs
+		// check if the disparity-map was already estimated for the same image pairs,
+		// or is being estimated by a concurrent matcher
+		if (matchedPairs != NULL && !matchedPairs->Claim(idxImage, neighbor.ID))
+			continue;
 		const Image& rightImage = scene.images[neighbor.ID];
 		const String pairName(MAKE_PATH(String::FormatString("%04u_%04u", leftImage.ID, rightImage.ID)));
 		if (File::isPresent((pairName+".dimap").c_str()) || File::isPresent(MAKE_PATH(String::FormatString("%04u_%04u.dimap", rightImage.ID, leftImage.ID))))
 			continue;
 		TD_TIMER_STARTD();
+		peakMemCosts = 0;
 		IndexArr points;
 		Matrix3x3 H; Matrix4x4 Q;
 		ViewData leftData, rightData;
@@ -600,8 +631,8 @@ void SemiGlobalMatcher::Match(const Scene& scene, IIndex idxImage, IIndex numNei
 			}
 			#endif
 			// initialize
-			const ViewData leftDataLevel(leftData.GetImage(scale));
-			const ViewData rightDataLevel(rightData.GetImage(scale));
+			const ViewData leftDataLevel(leftData.GetImage(scale, scheduler));
+			const ViewData rightDataLevel(rightData.GetImage(scale, scheduler));
 			const cv::Size size(leftDataLevel.imageGray.size());
 			const cv::Size sizeValid(size.width-2*halfWindowSizeX, size.height-2*halfWindowSizeY);
 			const bool bFirstLevel(leftDisparityMap.empty());
@@ -667,14 +698,10 @@ void SemiGlobalMatcher::Match(const Scene& scene, IIndex idxImage, IIndex numNei
 					numCosts += maxNumDisp;
 				}
 			}
-			imageCosts.resize(numCosts);
-			imageAccumCosts.resize(numCosts);
-			Match(rightDataLevel, leftDataLevel, rightDisparityMap, costMap);
+			Match(rightDataLevel, leftDataLevel, numCosts, rightDisparityMap, costMap);
 			// estimate left-right disparity-map
 			if (tSGM) {
 				numCosts = Disparity2RangeMap(leftDisparityMap, leftMaskMap, bFirstLevel?11:5, bFirstLevel?33:7);
-				imageCosts.resize(numCosts);
-				imageAccumCosts.resize(numCosts);
 			} else {
 				for (PixelData& pixel: imagePixels) {
 					const Disparity maxDisp(-pixel.range.minDisp);
@@ -682,7 +709,7 @@ void SemiGlobalMatcher::Match(const Scene& scene, IIndex idxImage, IIndex numNei
 					pixel.range.maxDisp = maxDisp;
 				}
 			}
-			Match(leftDataLevel, rightDataLevel, leftDisparityMap, costMap);
+			Match(leftDataLevel, rightDataLevel, numCosts, leftDisparityMap, costMap);
 			// check disparity-map cross-consistency
 			#if 0
 			if (ISEQUAL(scale, REAL(1))) {
@@ -718,8 +745,8 @@ void SemiGlobalMatcher::Match(const Scene& scene, IIndex idxImage, IIndex numNei
 		RefineDisparityMap(leftDisparityMap);
 		#if 1
 		// export disparity-map for the left image
-		DEBUG_EXTRA("Disparity-map for images %3u and %3u: %dx%d (%s)", leftImage.ID, rightImage.ID,
-			leftImage.width, leftImage.height, TD_TIMER_GET_FMT().c_str());
+		DEBUG_EXTRA("Disparity-map for images %3u and %3u: %dx%d, %s cost volume (%s)", leftImage.ID, rightImage.ID,
+			leftImage.width, leftImage.height, Util::formatBytes(peakMemCosts).c_str(), TD_TIMER_GET_FMT().c_str());
 		ExportPointCloud(pairName+".ply", leftImage, leftDisparityMap, Q, subpixelSteps);
 		ExportDisparityMap(pairName+".png", leftDisparityMap);
 		ExportDisparityDataRawFull(pairName+".dimap", leftDisparityMap, costMap, leftImage.GetSize(), H, Q, subpixelSteps);
@@ -859,23 +886,76 @@ void SemiGlobalMatcher::Fuse(const Scene& scene, IIndex idxImage, IIndex numNeig
 }
 
 
-// Compute SGM stereo on the images
-void SemiGlobalMatcher::Match(const ViewData& leftImage, const ViewData& rightImage, DisparityMap& disparityMap, AccumCostMap& costMap)
+// Compute SGM stereo on the images:
+// if the cost volume does not fit in the memory limit, the image is split in horizontal strips
+// processed one by one, each extended on both sides by the overlap rows; the aggregation paths
+// start at the strip borders, so the overlap rows only serve to converge the paths entering the strip
+// and only the disparities of the strip rows are kept
+void SemiGlobalMatcher::Match(const ViewData& leftImage, const ViewData& rightImage, Index numCosts, DisparityMap& disparityMap, AccumCostMap& costMap)
 {
 	const cv::Size size(leftImage.imageGray.size());
 	const cv::Size sizeValid(size.width-2*halfWindowSizeX, size.height-2*halfWindowSizeY);
 	ASSERT(leftImage.imageColor.size() == size);
+	ASSERT(imagePixels.size() == (Index)sizeValid.area());
 
 	#if 0 && !defined(_RELEASE)
 	// display search info (average disparity and range)
 	DisplayState(sizeValid);
 	#endif
 
+	disparityMap.create(sizeValid);
+	costMap.create(sizeValid);
+	imageBestAccums.resize((Index)sizeValid.area()*3);
+	// index of the first cost of the given row
+	const auto rowCosts = [&](int r) -> Index {
+		return r < sizeValid.height ? imagePixels[r*sizeValid.width].idx : numCosts;
+	};
+	const auto matchStrip = [&](int rowBegin, int rowEnd, int rowValidBegin, int rowValidEnd) {
+		const Index numStripCosts(rowCosts(rowEnd)-rowCosts(rowBegin));
+		imageCosts.resize(numStripCosts);
+		imageAccumCosts.resize(numStripCosts);
+		const size_t memCosts(imageCosts.capacity()*sizeof(Cost)+imageAccumCosts.capacity()*sizeof(AccumCost));
+		if (peakMemCosts < memCosts)
+			peakMemCosts = memCosts;
+		MatchStrip(leftImage, rightImage, rowBegin, rowEnd, rowValidBegin, rowValidEnd, disparityMap, costMap);
+	};
+	const Index maxNumCosts(maxMemCosts/(sizeof(Cost)+sizeof(AccumCost)));
+	if (maxMemCosts == 0 || numCosts <= maxNumCosts) {
+		matchStrip(0, sizeValid.height, 0, sizeValid.height);
+		return;
+	}
+	// grow each strip while the costs of its extended rows fit in the memory limit
+	// (at least one row is processed per strip)
+	unsigned numStrips(0);
+	for (int rowValidBegin=0; rowValidBegin<sizeValid.height; ++numStrips) {
+		const int rowBegin(MAXF(rowValidBegin-stripOverlap, 0));
+		int rowValidEnd(rowValidBegin+1);
+		while (rowValidEnd < sizeValid.height && rowCosts(MINF(rowValidEnd+1+stripOverlap, sizeValid.height))-rowCosts(rowBegin) <= maxNumCosts)
+			++rowValidEnd;
+		matchStrip(rowBegin, MINF(rowValidEnd+stripOverlap, sizeValid.height), rowValidBegin, rowValidEnd);
+		rowValidBegin = rowValidEnd;
+	}
+	DEBUG_ULTIMATE("Cost volume of %s matched in %u strips of at most %s", Util::formatBytes(numCosts*(sizeof(Cost)+sizeof(AccumCost))).c_str(), numStrips, Util::formatBytes(maxMemCosts).c_str());
+}
+
+// Compute SGM stereo on the rows [rowBegin,rowEnd) of the images,
+// storing the disparities and costs only for the rows [rowValidBegin,rowValidEnd);
+// the costs buffers are expected to be allocated for the strip rows
+void SemiGlobalMatcher::MatchStrip(const ViewData& leftImage, const ViewData& rightImage, int rowBegin, int rowEnd, int rowValidBegin, int rowValidEnd, DisparityMap& disparityMap, AccumCostMap& costMap)
+{
+	ASSERT(rowBegin <= rowValidBegin && rowValidBegin < rowValidEnd && rowValidEnd <= rowEnd);
+	const cv::Size sizeStrip(disparityMap.width(), rowEnd-rowBegin);
+	const int offsetStrip(rowBegin*sizeStrip.width); // index of the first pixel of the strip
+	const Index idxCosts(imagePixels[offsetStrip].idx); // index of the first cost of the strip
+
 	// compute costs
 	{
-	ASSERT(!imageCosts.empty());
+	ASSERT(imageCosts.size() == imageAccumCosts.size());
 	const float eps(1e-3f); // used suppress the effect of noise in untextured regions
 	auto pixel = [&](int idx, int r, int c) {
+		// convert from strip to image coordinates
+		idx += offsetStrip;
+		r += rowBegin;
 		// ignore pixel if not valid
 		const PixelData& pixel = imagePixels[idx];
 		if (!pixel.range.isValid())
@@ -887,7 +967,7 @@ void SemiGlobalMatcher::Match(const ViewData& leftImage, const ViewData& rightIm
 			}
 		};
 		// compute pixel cost
-		Cost* costs = imageCosts.data()+pixel.idx;
+		Cost* costs = imageCosts.data()+(pixel.idx-idxCosts);
 		const Census lc(leftImage.imageCensus(r,c));
 		for (int d=pixel.range.minDisp; d<pixel.range.maxDisp; ++d) {
 			const ImageRef x(c+d,r);
@@ -945,7 +1025,7 @@ void SemiGlobalMatcher::Match(const ViewData& leftImage, const ViewData& rightIm
 			w.normSq0 += (pw.tempWeight = pw.weight * t) * t;
 		} while (++n < numTexels);
 		// compute pixel cost
-		Cost* costs = imageCosts.data()+pixel.idx;
+		Cost* costs = imageCosts.data()+(pixel.idx-idxCosts);
 		for (int d=pixel.range.minDisp; d<pixel.range.maxDisp; ++d) {
 			float sum(0), sumSq(0), nom(0);
 			for (int i=-halfWindowSizeY, n=0; i<=halfWindowSizeY; ++i) {
@@ -972,21 +1052,17 @@ void SemiGlobalMatcher::Match(const ViewData& leftImage, const ViewData& rightIm
 		}
 		#endif
 	};
-	ASSERT(threads.IsEmpty());
-	if (!threads.empty()) {
+	if (scheduler != NULL) {
 		volatile Thread::safe_t idxPixel(-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelProcess(sizeValid, idxPixel, pixel));
-		WaitThreadWorkers(threads.size());
+		scheduler->Run(JobPixelProcess(sizeStrip, idxPixel, pixel));
 	} else
-	for (int r=0; r<sizeValid.height; ++r)
-		for (int c=0; c<sizeValid.width; ++c)
-			pixel(r*sizeValid.width+c, r, c);
+	for (int r=0; r<sizeStrip.height; ++r)
+		for (int c=0; c<sizeStrip.width; ++c)
+			pixel(r*sizeStrip.width+c, r, c);
 	}
 
 	// accumulate costs
 	{
-	ASSERT(!imageAccumCosts.empty());
 	imageAccumCosts.Memset(0);
 	#if SGM_SIMILARITY == SGM_SIMILARITY_CENSUS
 	const ImageGray::Type Igray(127);
@@ -1001,51 +1077,14 @@ void SemiGlobalMatcher::Match(const ViewData& leftImage, const ViewData& rightIm
 		AccumCost& operator[] (int i) { return L[i]; }
 	};
 	auto pixelAccum = [&](const Cost* costs, const LineData& Lp, LineData& Ls, AccumCost* accums, ImageGray::Type DI) {
-		struct Compute {
-			static inline void MINS(AccumCost& m, AccumCost v) { if (m > v) m = v; }
-		};
-		ASSERT(Ls.R.isValid());
 		#if SGM_SIMILARITY == SGM_SIMILARITY_CENSUS
 		const AccumCost P2(P2s[DI]);
 		#else
 		const AccumCost P2(P2s[ABS(ROUND2INT(255.f*DI))]);
 		#endif
-		const Disparity minDisp(MAXF(Lp.R.minDisp, Ls.R.minDisp));
-		const Disparity maxDisp(MINF(Lp.R.maxDisp, Ls.R.maxDisp));
-		if (minDisp >= maxDisp) {
-			// the disparity ranges for the two pixels do not intersect;
-			// fill all accumulated costs with L(d)=C(d)+P2
-			const Disparity numDisp(Ls.R.numDisp());
-			for (int idxDisp=0; idxDisp<numDisp; ++idxDisp)
-				accums[idxDisp] += (Ls[idxDisp] = costs[idxDisp]+P2);
-		} else {
-			// accumulate cost as L(d)=C(d)+min(Lp(d)+V(d,dp))-min(Lp)
-			// where V(d,dp) is:
-			//  0  if d=dp
-			//  P1 if |d-dp|=1
-			//  P2 if |d-dp|>1
-			AccumCost minLp(std::numeric_limits<AccumCost>::max());
-			for (const AccumCost *L=Lp.L+(minDisp-Lp.R.minDisp), *endL=L+(maxDisp-minDisp); L<endL; ++L)
-				Compute::MINS(minLp, *L);
-			for (Disparity d=Ls.R.minDisp; d<Ls.R.maxDisp; ++d) {
-				const int idxDisp(d-Ls.R.minDisp);
-				AccumCost& L = Ls[idxDisp];
-				L = std::numeric_limits<AccumCost>::max();
-				for (Disparity dp=minDisp; dp<maxDisp; ++dp) {
-					const int idxDispp(dp-Lp.R.minDisp);
-					if (dp == d)
-						Compute::MINS(L, Lp[idxDispp]);
-					else if (dp == d-1 || dp == d+1)
-						Compute::MINS(L, Lp[idxDispp]+P1);
-					else
-						Compute::MINS(L, Lp[idxDispp]+P2);
-				}
-				accums[idxDisp] += (L = costs[idxDisp]+L-minLp);
-			}
-		}
+		AggregatePathCosts(costs, Lp.L, Lp.R, Ls.L, Ls.R, accums, P1, P2);
 	};
-	ASSERT(threads.IsEmpty());
-	if (!threads.empty()) {
+	if (scheduler != NULL) {
 		struct AccumLines {
 			LineData linesBuffer[2];
 			LineData* lines[2];
@@ -1066,16 +1105,16 @@ void SemiGlobalMatcher::Match(const ViewData& leftImage, const ViewData& rightIm
 			AccumLines lines(maxNumDisp); \
 			ImageGray::Type Ip(Igray); \
 			do { \
-				const int idx(u.y*sizeValid.width+u.x); \
+				const int idx(offsetStrip+u.y*sizeStrip.width+u.x); \
 				const PixelData& pixel = imagePixels[idx]; \
 				if (!pixel.range.isValid()) \
 					continue; \
-				const Cost* costs = imageCosts.cdata()+pixel.idx; \
-				AccumCost* accums = imageAccumCosts.data()+pixel.idx; \
+				const Cost* costs = imageCosts.cdata()+(pixel.idx-idxCosts); \
+				AccumCost* accums = imageAccumCosts.data()+(pixel.idx-idxCosts); \
 				const LineData& Lp = lines(0); \
 				LineData& Ls = lines(1); \
 				Ls.R = pixel.range; \
-				const ImageGray::Type I(leftImage.imageGray(u)); \
+				const ImageGray::Type I(leftImage.imageGray(rowBegin+u.y, u.x)); \
 				pixelAccum(costs, Lp, Ls, accums, I-Ip); \
 				Ip = I; \
 				lines.NextLine(); \
@@ -1083,120 +1122,92 @@ void SemiGlobalMatcher::Match(const ViewData& leftImage, const ViewData& rightIm
 		{ // width-down
 		auto pixels = [&](int x) {
 			ImageRef u(x,0);
-			ACCUM_PIXELS(++u.y < sizeValid.height);
+			ACCUM_PIXELS(++u.y < sizeStrip.height);
 		};
 		volatile Thread::safe_t idxPixel(-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelAccumInc(sizeValid.width, idxPixel, pixels));
-		WaitThreadWorkers(threads.size());
+		scheduler->Run(JobPixelAccumInc(sizeStrip.width, idxPixel, pixels));
 		}
 		{ // height-right
 		auto pixels = [&](int y) {
 			ImageRef u(0,y);
-			ACCUM_PIXELS(++u.x < sizeValid.width);
+			ACCUM_PIXELS(++u.x < sizeStrip.width);
 		};
 		volatile Thread::safe_t idxPixel(-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelAccumInc(sizeValid.height, idxPixel, pixels));
-		WaitThreadWorkers(threads.size());
+		scheduler->Run(JobPixelAccumInc(sizeStrip.height, idxPixel, pixels));
 		}
 		{ // width-up
 		auto pixels = [&](int x) {
-			ImageRef u(x,sizeValid.height-1);
+			ImageRef u(x,sizeStrip.height-1);
 			ACCUM_PIXELS(--u.y >= 0);
 		};
 		volatile Thread::safe_t idxPixel(-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelAccumInc(sizeValid.width, idxPixel, pixels));
-		WaitThreadWorkers(threads.size());
+		scheduler->Run(JobPixelAccumInc(sizeStrip.width, idxPixel, pixels));
 		}
 		{ // height-left
 		auto pixels = [&](int y) {
-			ImageRef u(sizeValid.width-1,y);
+			ImageRef u(sizeStrip.width-1,y);
 			ACCUM_PIXELS(--u.x >= 0);
 		};
 		volatile Thread::safe_t idxPixel(-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelAccumInc(sizeValid.height, idxPixel, pixels));
-		WaitThreadWorkers(threads.size());
+		scheduler->Run(JobPixelAccumInc(sizeStrip.height, idxPixel, pixels));
 		}
 		if (numDirs == 4) {
-		{ // width-right-down
-		auto pixels = [&](int x) {
+		{ // width-right-down and height-right-down
+		auto pixelsW = [&](int x) {
 			ImageRef u(x,0);
-			ACCUM_PIXELS(++u.x < sizeValid.width && ++u.y < sizeValid.height);
+			ACCUM_PIXELS(++u.x < sizeStrip.width && ++u.y < sizeStrip.height);
 		};
-		volatile Thread::safe_t idxPixel(-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelAccumInc(sizeValid.width, idxPixel, pixels));
-		}
-		{ // height-right-down
-		auto pixels = [&](int y) {
+		auto pixelsH = [&](int y) {
 			ImageRef u(0,y);
-			ACCUM_PIXELS(++u.x < sizeValid.width && ++u.y < sizeValid.height);
+			ACCUM_PIXELS(++u.x < sizeStrip.width && ++u.y < sizeStrip.height);
 		};
-		volatile Thread::safe_t idxPixel(0);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelAccumInc(sizeValid.height, idxPixel, pixels));
+		volatile Thread::safe_t idxPixelW(-1), idxPixelH(0);
+		const JobPixelAccumInc jobW(sizeStrip.width, idxPixelW, pixelsW);
+		const JobPixelAccumInc jobH(sizeStrip.height, idxPixelH, pixelsH);
+		scheduler->Run([&]() { jobW(); jobH(); });
 		}
-		WaitThreadWorkers(threads.size()*2);
-		{ // width-left-down
-		auto pixels = [&](int x) {
+		{ // width-left-down and height-left-down
+		auto pixelsW = [&](int x) {
 			ImageRef u(x,0);
-			ACCUM_PIXELS(--u.x >= 0  && ++u.y < sizeValid.height);
+			ACCUM_PIXELS(--u.x >= 0  && ++u.y < sizeStrip.height);
 		};
-		volatile Thread::safe_t idxPixel(-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelAccumInc(sizeValid.width-1, idxPixel, pixels));
-		}
-		{ // height-left-down
-		auto pixels = [&](int y) {
-			ImageRef u(sizeValid.width-1,y);
-			ACCUM_PIXELS(--u.x >= 0 && ++u.y < sizeValid.height);
+		auto pixelsH = [&](int y) {
+			ImageRef u(sizeStrip.width-1,y);
+			ACCUM_PIXELS(--u.x >= 0 && ++u.y < sizeStrip.height);
 		};
-		volatile Thread::safe_t idxPixel(-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelAccumInc(sizeValid.height, idxPixel, pixels));
-		}
-		WaitThreadWorkers(threads.size()*2);
-		{ // width-right-up
-		auto pixels = [&](int x) {
-			ImageRef u(x,sizeValid.height-1);
-			ACCUM_PIXELS(++u.x < sizeValid.width && --u.y >= 0);
+		volatile Thread::safe_t idxPixelW(-1), idxPixelH(-1);
+		const JobPixelAccumInc jobW(sizeStrip.width-1, idxPixelW, pixelsW);
+		const JobPixelAccumInc jobH(sizeStrip.height, idxPixelH, pixelsH);
+		scheduler->Run([&]() { jobW(); jobH(); });
+		}
+		{ // width-right-up and height-right-up
+		auto pixelsW = [&](int x) {
+			ImageRef u(x,sizeStrip.height-1);
+			ACCUM_PIXELS(++u.x < sizeStrip.width && --u.y >= 0);
 		};
-		volatile Thread::safe_t idxPixel(0);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelAccumInc(sizeValid.width, idxPixel, pixels));
-		}
-		{ // height-right-up
-		auto pixels = [&](int y) {
+		auto pixelsH = [&](int y) {
 			ImageRef u(0,y);
-			ACCUM_PIXELS(++u.x < sizeValid.width && --u.y >= 0);
+			ACCUM_PIXELS(++u.x < sizeStrip.width && --u.y >= 0);
 		};
-		volatile Thread::safe_t idxPixel(sizeValid.height);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelAccumDec(idxPixel, pixels));
-		}
-		WaitThreadWorkers(threads.size()*2);
-		{ // width-left-up
-		auto pixels = [&](int x) {
-			ImageRef u(x,sizeValid.height-1);
+		volatile Thread::safe_t idxPixelW(0), idxPixelH(sizeStrip.height);
+		const JobPixelAccumInc jobW(sizeStrip.width, idxPixelW, pixelsW);
+		const JobPixelAccumDec jobH(idxPixelH, pixelsH);
+		scheduler->Run([&]() { jobW(); jobH(); });
+		}
+		{ // width-left-up and height-left-up
+		auto pixelsW = [&](int x) {
+			ImageRef u(x,sizeStrip.height-1);
 			ACCUM_PIXELS(--u.x >= 0 && --u.y >= 0);
 		};
-		volatile Thread::safe_t idxPixel(sizeValid.width);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelAccumDec(idxPixel, pixels));
-		}
-		{ // height-left-up
-		auto pixels = [&](int y) {
-			ImageRef u(sizeValid.width-1,y);
+		auto pixelsH = [&](int y) {
+			ImageRef u(sizeStrip.width-1,y);
 			ACCUM_PIXELS(--u.x >= 0 && --u.y >= 0);
 		};
-		volatile Thread::safe_t idxPixel(sizeValid.height-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelAccumDec(idxPixel, pixels));
+		volatile Thread::safe_t idxPixelW(sizeStrip.width), idxPixelH(sizeStrip.height-1);
+		const JobPixelAccumDec jobW(idxPixelW, pixelsW);
+		const JobPixelAccumDec jobH(idxPixelH, pixelsH);
+		scheduler->Run([&]() { jobW(); jobH(); });
 		}
-		WaitThreadWorkers(threads.size()*2);
 		}
 		#undef ACCUM_PIXELS
 	} else {
@@ -1204,8 +1215,9 @@ void SemiGlobalMatcher::Match(const ViewData& leftImage, const ViewData& rightIm
 	struct AccumLines {
 		const Disparity maxNumDisp;
 		LineData* linesBuffer;
-		LineData* lines[numDirs][2];
-		AccumLines(Disparity _maxNumDisp) : maxNumDisp(_maxNumDisp), linesBuffer(NULL) {}
+		const int numDirs;
+		LineData* lines[maxNumDirs][2];
+		AccumLines(Disparity _maxNumDisp, int _numDirs) : maxNumDisp(_maxNumDisp), linesBuffer(NULL), numDirs(_numDirs) {}
 		~AccumLines() { delete[] linesBuffer; }
 		void Init(int w) {
 			const int linewidth(w+2);
@@ -1233,34 +1245,34 @@ void SemiGlobalMatcher::Match(const ViewData& leftImage, const ViewData& rightIm
 		const LineData& operator() (int idxDir, int r, int c) const { return lines[idxDir][r][c]; }
 		LineData& operator() (int idxDir, int r, int c) { return lines[idxDir][r][c]; }
 	};
-	AccumLines lines(maxNumDisp);
+	AccumLines lines(maxNumDisp, numDirs);
 	#define ACCUM_PIXELS(dx, dy, _x) \
-		const int idx(r*sizeValid.width+c); \
+		const int idx(offsetStrip+r*sizeStrip.width+c); \
 		const PixelData& pixel = imagePixels[idx]; \
 		if (!pixel.range.isValid()) \
 			continue; \
-		const Cost* costs = imageCosts.cdata()+pixel.idx; \
-		AccumCost* accums = imageAccumCosts.data()+pixel.idx; \
+		const Cost* costs = imageCosts.cdata()+(pixel.idx-idxCosts); \
+		AccumCost* accums = imageAccumCosts.data()+(pixel.idx-idxCosts); \
 		for (int idxDir=0; idxDir<numDirs; ++idxDir) { \
 			const ImageRef& dir = dirs[idxDir]; \
 			const LineData& Lp = lines(idxDir,1+dir.y,_x+dir.x); \
 			LineData& Ls = lines(idxDir,1,_x); \
 			Ls.R = pixel.range; \
-			const ImageRef xp(c+dx, r+dy); \
-			const ImageGray::Type DI(leftImage.imageGray(r,c)-(leftImage.imageGray.isInside(xp)?leftImage.imageGray(xp):Igray)); \
+			const ImageRef xp(c+dx, rowBegin+r+dy); \
+			const ImageGray::Type DI(leftImage.imageGray(rowBegin+r,c)-(leftImage.imageGray.isInside(xp)?leftImage.imageGray(xp):Igray)); \
 			pixelAccum(costs, Lp, Ls, accums, DI); \
 		}
-	lines.Init(sizeValid.width);
-	for (int r=0; r<sizeValid.height; ++r) {
-		for (int c=0; c<sizeValid.width; ++c) {
+	lines.Init(sizeStrip.width);
+	for (int r=0; r<sizeStrip.height; ++r) {
+		for (int c=0; c<sizeStrip.width; ++c) {
 			ACCUM_PIXELS(dir.x, dir.y, c);
 		}
 		lines.NextLine();
 	}
-	lines.Init(sizeValid.width);
-	for (int r=sizeValid.height; --r>=0; ) {
-		for (int c=sizeValid.width; --c>=0; ) {
-			ACCUM_PIXELS(-dir.x, -dir.y, sizeValid.width-1-c);
+	lines.Init(sizeStrip.width);
+	for (int r=sizeStrip.height; --r>=0; ) {
+		for (int c=sizeStrip.width; --c>=0; ) {
+			ACCUM_PIXELS(-dir.x, -dir.y, sizeStrip.width-1-c);
 		}
 		lines.NextLine();
 	}
@@ -1270,40 +1282,148 @@ void SemiGlobalMatcher::Match(const ViewData& leftImage, const ViewData& rightIm
 
 	// select best disparity and cost
 	{
-	disparityMap.create(sizeValid);
-	costMap.create(sizeValid);
+	const int offsetValid(rowValidBegin*sizeStrip.width); // index of the first pixel kept
 	auto pixel = [&](int idx) {
+		idx += offsetValid;
 		const PixelData& pixel = imagePixels[idx];
+		AccumCost* const bestAccums = imageBestAccums.data()+idx*3;
 		if (pixel.range.isValid()) {
-			const AccumCost* accums = imageAccumCosts.cdata()+pixel.idx;
+			const AccumCost* accums = imageAccumCosts.cdata()+(pixel.idx-idxCosts);
+			const AccumCost* const accumEnd = accums+pixel.range.numDisp();
 			const AccumCost* bestAccum = accums;
-			for (const AccumCost *accum=accums+1, *accumEnd=accums+pixel.range.numDisp(); accum<accumEnd; ++accum) {
+			for (const AccumCost* accum=accums+1; accum<accumEnd; ++accum) {
 				if (*bestAccum > *accum)
 					bestAccum = accum;
 			}
 			disparityMap(idx) = pixel.range.minDisp+(Disparity)(bestAccum-accums);
 			costMap(idx) = *bestAccum;
+			// remember the neighbor costs for the sub-pixel refinement, as the accumulated costs are not kept
+			bestAccums[0] = (bestAccum > accums ? bestAccum[-1] : *bestAccum);
+			bestAccums[1] = *bestAccum;
+			bestAccums[2] = (bestAccum+1 < accumEnd ? bestAccum[1] : *bestAccum);
 		} else {
 			disparityMap(idx) = pixel.range.minDisp;
 			costMap(idx) = NO_ACCUMCOST;
 		}
 	};
-	ASSERT(threads.IsEmpty());
-	if (!threads.empty()) {
+	const int numPixels((rowValidEnd-rowValidBegin)*sizeStrip.width);
+	if (scheduler != NULL) {
 		volatile Thread::safe_t idxPixel(-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelAccumInc(sizeValid.area(), idxPixel, pixel));
-		WaitThreadWorkers(threads.size());
+		scheduler->Run(JobPixelAccumInc(numPixels, idxPixel, pixel));
 	} else
-	for (int r=0; r<sizeValid.height; ++r)
-		for (int c=0; c<sizeValid.width; ++c)
-			pixel(r*sizeValid.width+c);
+	for (int idx=0; idx<numPixels; ++idx)
+		pixel(idx);
 	}
 }
 
+// Aggregate the costs of a pixel along a path, given the aggregated costs Lp (over disparity range Rp)
+// of the previous pixel on the path, as L(d)=C(d)+min(Lp(d)+V(d,dp))-min(Lp), where V(d,dp) is:
+//  0  if d=dp
+//  P1 if |d-dp|=1
+//  P2 if |d-dp|>1
+// storing L (over disparity range Rs) and adding it to the accumulated costs of the pixel;
+// simd selects the instruction set used (any not compiled falls back to the scalar code)
+void SemiGlobalMatcher::AggregatePathCosts(const Cost* costs, const AccumCost* Lp, const Range& Rp, AccumCost* Ls, const Range& Rs, AccumCost* accums, AccumCost P1, AccumCost P2, AggregateSIMD simd)
+{
+	struct Compute {
+		static inline void MINS(AccumCost& m, AccumCost v) { if (m > v) m = v; }
+	};
+	if (simd == AGGREGATE_BEST) {
+		#if defined(SGM_AGGREGATE_USE_AVX2)
+		simd = AGGREGATE_AVX2;
+		#elif defined(SGM_AGGREGATE_USE_SSE)
+		simd = AGGREGATE_SSE;
+		#else
+		simd = AGGREGATE_SCALAR;
+		#endif
+	}
+	ASSERT(Rs.isValid());
+	const Disparity minDisp(MAXF(Rp.minDisp, Rs.minDisp));
+	const Disparity maxDisp(MINF(Rp.maxDisp, Rs.maxDisp));
+	if (minDisp >= maxDisp) {
+		// the disparity ranges for the two pixels do not intersect;
+		// fill all accumulated costs with L(d)=C(d)+P2
+		const Disparity numDisp(Rs.numDisp());
+		for (int idxDisp=0; idxDisp<numDisp; ++idxDisp)
+			accums[idxDisp] += (Ls[idxDisp] = costs[idxDisp]+P2);
+		return;
+	}
+	// computed as L(d)=C(d)+min(Lp(d),Lp(d-1)+P1,Lp(d+1)+P1,min(Lp)+P2)-min(Lp)
+	// (equivalent as P1<=P2), only over the disparities in the intersection of the two ranges
+	ASSERT(P1 <= P2);
+	AccumCost minLp(std::numeric_limits<AccumCost>::max());
+	for (const AccumCost *L=Lp+(minDisp-Rp.minDisp), *endL=L+(maxDisp-minDisp); L<endL; ++L)
+		Compute::MINS(minLp, *L);
+	const AccumCost minLpP2(minLp+P2);
+	const auto accumDisp = [&](Disparity d) {
+		AccumCost L(minLpP2);
+		const int idxDispp(d-Rp.minDisp);
+		if (d >= minDisp && d < maxDisp)
+			Compute::MINS(L, Lp[idxDispp]);
+		if (d > minDisp && d <= maxDisp)
+			Compute::MINS(L, Lp[idxDispp-1]+P1);
+		if (d+1 >= minDisp && d+1 < maxDisp)
+			Compute::MINS(L, Lp[idxDispp+1]+P1);
+		const int idxDisp(d-Rs.minDisp);
+		accums[idxDisp] += (Ls[idxDisp] = costs[idxDisp]+L-minLp);
+	};
+	// the disparities having all three neighbor disparities inside the intersection
+	// are processed in batches, the remaining ones at the range ends one by one
+	const Disparity beginDisp(MAXF(Rs.minDisp, (Disparity)(minDisp+1)));
+	const Disparity endDisp(MAXF(beginDisp, MINF(Rs.maxDisp, (Disparity)(maxDisp-1))));
+	Disparity d(Rs.minDisp);
+	while (d < beginDisp)
+		accumDisp(d++);
+	#ifdef SGM_AGGREGATE_USE_AVX2
+	if (simd == AGGREGATE_AVX2) {
+		const __m256i vP1(_mm256_set1_epi16((short)P1));
+		const __m256i vMinLp(_mm256_set1_epi16((short)minLp));
+		const __m256i vMinLpP2(_mm256_set1_epi16((short)minLpP2));
+		for (; d+16 <= endDisp; d+=16) {
+			const AccumCost* const Lpd(Lp+(d-Rp.minDisp));
+			const int idxDisp(d-Rs.minDisp);
+			__m256i L(_mm256_min_epu16(_mm256_loadu_si256((const __m256i*)Lpd), vMinLpP2));
+			L = _mm256_min_epu16(L, _mm256_adds_epu16(_mm256_loadu_si256((const __m256i*)(Lpd-1)), vP1));
+			L = _mm256_min_epu16(L, _mm256_adds_epu16(_mm256_loadu_si256((const __m256i*)(Lpd+1)), vP1));
+			const __m256i C(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(costs+idxDisp))));
+			L = _mm256_sub_epi16(_mm256_add_epi16(C, L), vMinLp);
+			_mm256_storeu_si256((__m256i*)(Ls+idxDisp), L);
+			__m256i* const accum((__m256i*)(accums+idxDisp));
+			_mm256_storeu_si256(accum, _mm256_add_epi16(_mm256_loadu_si256(accum), L));
+		}
+	}
+	#endif
+	#ifdef SGM_AGGREGATE_USE_SSE
+	if (simd == AGGREGATE_SSE) {
+		struct SSE {
+			// unsigned 16-bit minimum using only SSE2 instructions
+			static inline __m128i min_epu16(__m128i a, __m128i b) { return _mm_sub_epi16(a, _mm_subs_epu16(a, b)); }
+		};
+		const __m128i vZero(_mm_setzero_si128());
+		const __m128i vP1(_mm_set1_epi16((short)P1));
+		const __m128i vMinLp(_mm_set1_epi16((short)minLp));
+		const __m128i vMinLpP2(_mm_set1_epi16((short)minLpP2));
+		for (; d+8 <= endDisp; d+=8) {
+			const AccumCost* const Lpd(Lp+(d-Rp.minDisp));
+			const int idxDisp(d-Rs.minDisp);
+			__m128i L(SSE::min_epu16(_mm_loadu_si128((const __m128i*)Lpd), vMinLpP2));
+			L = SSE::min_epu16(L, _mm_adds_epu16(_mm_loadu_si128((const __m128i*)(Lpd-1)), vP1));
+			L = SSE::min_epu16(L, _mm_adds_epu16(_mm_loadu_si128((const __m128i*)(Lpd+1)), vP1));
+			const __m128i C(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(costs+idxDisp)), vZero));
+			L = _mm_sub_epi16(_mm_add_epi16(C, L), vMinLp);
+			_mm_storeu_si128((__m128i*)(Ls+idxDisp), L);
+			__m128i* const accum((__m128i*)(accums+idxDisp));
+			_mm_storeu_si128(accum, _mm_add_epi16(_mm_loadu_si128(accum), L));
+		}
+	}
+	#endif
+	while (d < Rs.maxDisp)
+		accumDisp(d++);
+}
+
 #if SGM_SIMILARITY == SGM_SIMILARITY_CENSUS
 // Compute the census bit-mask for all the pixels of the image
-void SemiGlobalMatcher::CensusTransform(const Image8U& imageGray, CensusMap& imageCensus)
+void SemiGlobalMatcher::CensusTransform(const Image8U& imageGray, CensusMap& imageCensus, Scheduler* scheduler)
 {
 	ASSERT(!imageGray.empty());
 	const cv::Size size(imageGray.size());
@@ -1331,12 +1451,9 @@ void SemiGlobalMatcher::CensusTransform(const Image8U& imageGray, CensusMap& ima
 			}
 		}
 	};
-	ASSERT(threads.IsEmpty());
-	if (!threads.empty()) {
+	if (scheduler != NULL) {
 		volatile Thread::safe_t idxPixel(-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelProcess(imageCensus.size(), idxPixel, pixel));
-		WaitThreadWorkers(threads.size());
+		scheduler->Run(JobPixelProcess(imageCensus.size(), idxPixel, pixel));
 	} else
 	for (int r=0; r<imageCensus.rows; ++r)
 		for (int c=0; c<imageCensus.cols; ++c)
@@ -1446,7 +1563,7 @@ SemiGlobalMatcher::Index SemiGlobalMatcher::Disparity2RangeMap(const DisparityMa
 // Check for consistency between a left-to-right and right-to-left pair of stereo results;
 // the results are expected to be opposite in sign but equal in magnitude;
 // the valid disparities are returned in the left map
-void SemiGlobalMatcher::ConsistencyCrossCheck(DisparityMap& l2r, const DisparityMap& r2l, Disparity thCross)
+void SemiGlobalMatcher::ConsistencyCrossCheck(DisparityMap& l2r, const DisparityMap& r2l, Disparity thCross) const
 {
 	ASSERT(thCross >= 0);
 	ASSERT(!l2r.empty() && !r2l.empty());
@@ -1476,12 +1593,9 @@ void SemiGlobalMatcher::ConsistencyCrossCheck(DisparityMap& l2r, const Disparity
 		if (ABS(ld + rd) > thCross)
 			ld = NO_DISP;
 	};
-	ASSERT(threads.IsEmpty());
-	if (!threads.empty()) {
+	if (scheduler != NULL) {
 		volatile Thread::safe_t idxPixel(-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelProcess(l2r.size(), idxPixel, pixel));
-		WaitThreadWorkers(threads.size());
+		scheduler->Run(JobPixelProcess(l2r.size(), idxPixel, pixel));
 	} else
 	for (int r=0; r<l2r.rows; ++r)
 		for (int c=0; c<l2r.cols; ++c)
@@ -1489,7 +1603,7 @@ void SemiGlobalMatcher::ConsistencyCrossCheck(DisparityMap& l2r, const Disparity
 }
 
 // Discard disparities that have a high similarity score
-void SemiGlobalMatcher::FilterByCost(DisparityMap& disparityMap, const AccumCostMap& costMap, AccumCost th)
+void SemiGlobalMatcher::FilterByCost(DisparityMap& disparityMap, const AccumCostMap& costMap, AccumCost th) const
 {
 	ASSERT(th > 0);
 	ASSERT(!disparityMap.empty() && disparityMap.size() == costMap.size());
@@ -1501,12 +1615,9 @@ void SemiGlobalMatcher::FilterByCost(DisparityMap& disparityMap, const AccumCost
 		if (costMap(r,c) > th)
 			d = NO_DISP;
 	};
-	ASSERT(threads.IsEmpty());
-	if (!threads.empty()) {
+	if (scheduler != NULL) {
 		volatile Thread::safe_t idxPixel(-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelProcess(disparityMap.size(), idxPixel, pixel));
-		WaitThreadWorkers(threads.size());
+		scheduler->Run(JobPixelProcess(disparityMap.size(), idxPixel, pixel));
 	} else
 	for (int r=0; r<disparityMap.rows; ++r)
 		for (int c=0; c<disparityMap.cols; ++c)
@@ -1515,7 +1626,7 @@ void SemiGlobalMatcher::FilterByCost(DisparityMap& disparityMap, const AccumCost
 
 // Mark empty regions on the border of the disparity-map as invalid;
 //  thValid is the number of valid disparities encountered to consider the valid region starts
-void SemiGlobalMatcher::ExtractMask(const DisparityMap& disparityMap, MaskMap& maskMap, int thValid)
+void SemiGlobalMatcher::ExtractMask(const DisparityMap& disparityMap, MaskMap& maskMap, int thValid) const
 {
 	ASSERT(!disparityMap.empty());
 	ASSERT(maskMap.empty() || disparityMap.size() == maskMap.size());
@@ -1542,12 +1653,9 @@ void SemiGlobalMatcher::ExtractMask(const DisparityMap& disparityMap, MaskMap& m
 			MASK_PIXEL();
 		}
 	};
-	ASSERT(threads.IsEmpty());
-	if (!threads.empty()) {
+	if (scheduler != NULL) {
 		volatile Thread::safe_t idxPixel(-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelAccumInc(disparityMap.height(), idxPixel, pixel));
-		WaitThreadWorkers(threads.size());
+		scheduler->Run(JobPixelAccumInc(disparityMap.height(), idxPixel, pixel));
 	} else
 	for (int r=0; r<disparityMap.rows; ++r)
 		pixel(r);
@@ -1561,12 +1669,9 @@ void SemiGlobalMatcher::ExtractMask(const DisparityMap& disparityMap, MaskMap& m
 			MASK_PIXEL();
 		}
 	};
-	ASSERT(threads.IsEmpty());
-	if (!threads.empty()) {
+	if (scheduler != NULL) {
 		volatile Thread::safe_t idxPixel(-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelAccumInc(disparityMap.height(), idxPixel, pixel));
-		WaitThreadWorkers(threads.size());
+		scheduler->Run(JobPixelAccumInc(disparityMap.height(), idxPixel, pixel));
 	} else
 	for (int r=0; r<disparityMap.rows; ++r)
 		pixel(r);
@@ -1590,12 +1695,9 @@ void SemiGlobalMatcher::ExtractMask(const DisparityMap& disparityMap, MaskMap& m
 			MASK_PIXEL();
 		}
 	};
-	ASSERT(threads.IsEmpty());
-	if (!threads.empty()) {
+	if (scheduler != NULL) {
 		volatile Thread::safe_t idxPixel(-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelAccumInc(disparityMap.width(), idxPixel, pixel));
-		WaitThreadWorkers(threads.size());
+		scheduler->Run(JobPixelAccumInc(disparityMap.width(), idxPixel, pixel));
 	} else
 	for (int c=0; c<disparityMap.cols; ++c)
 		pixel(c);
@@ -1608,12 +1710,9 @@ void SemiGlobalMatcher::ExtractMask(const DisparityMap& disparityMap, MaskMap& m
 			MASK_PIXEL();
 		}
 	};
-	ASSERT(threads.IsEmpty());
-	if (!threads.empty()) {
+	if (scheduler != NULL) {
 		volatile Thread::safe_t idxPixel(-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelAccumInc(disparityMap.width(), idxPixel, pixel));
-		WaitThreadWorkers(threads.size());
+		scheduler->Run(JobPixelAccumInc(disparityMap.width(), idxPixel, pixel));
 	} else
 	for (int c=0; c<disparityMap.cols; ++c)
 		pixel(c);
@@ -1627,7 +1726,7 @@ void SemiGlobalMatcher::ExtractMask(const DisparityMap& disparityMap, MaskMap& m
 // by translating to the x coordinated dictated by the disparity and negating the sign;
 // the sub-pixel steps is assumed to be one and
 // the input disparity-map has been cross-checked for consistency
-void SemiGlobalMatcher::FlipDirection(const DisparityMap& l2r, DisparityMap& r2l)
+void SemiGlobalMatcher::FlipDirection(const DisparityMap& l2r, DisparityMap& r2l) const
 {
 	ASSERT(!l2r.empty());
 	ASSERT(r2l.empty() || l2r.height() == r2l.height());
@@ -1645,12 +1744,9 @@ void SemiGlobalMatcher::FlipDirection(const DisparityMap& l2r, DisparityMap& r2l
 				r2l(r,x) = -d;
 		}
 	};
-	ASSERT(threads.IsEmpty());
-	if (!threads.empty()) {
+	if (scheduler != NULL) {
 		volatile Thread::safe_t idxPixel(-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelAccumInc(l2r.rows, idxPixel, pixel));
-		WaitThreadWorkers(threads.size());
+		scheduler->Run(JobPixelAccumInc(l2r.rows, idxPixel, pixel));
 	} else
 	for (int r=0; r<l2r.rows; ++r)
 		pixel(r);
@@ -1659,7 +1755,7 @@ void SemiGlobalMatcher::FlipDirection(const DisparityMap& l2r, DisparityMap& r2l
 // Translate disparity-map between left-to-right and right-to-left stereo pair
 // by translating to the x coordinated dictated by the disparity and negating the sign;
 // the input disparity-map has been cross-checked for consistency
-void SemiGlobalMatcher::UpscaleMask(MaskMap& maskMap, const cv::Size& size2x)
+void SemiGlobalMatcher::UpscaleMask(MaskMap& maskMap, const cv::Size& size2x) const
 {
 	ASSERT(!maskMap.empty());
 	MaskMap maskMap2x(size2x, INVALID);
@@ -1675,12 +1771,9 @@ void SemiGlobalMatcher::UpscaleMask(MaskMap& maskMap, const cv::Size& size2x)
 			}
 		}
 	};
-	ASSERT(threads.IsEmpty());
-	if (!threads.empty()) {
+	if (scheduler != NULL) {
 		volatile Thread::safe_t idxPixel(-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelProcess(maskMap.size(), idxPixel, pixel));
-		WaitThreadWorkers(threads.size());
+		scheduler->Run(JobPixelProcess(maskMap.size(), idxPixel, pixel));
 	} else
 	for (int r=0; r<maskMap.rows; ++r)
 		for (int c=0; c<maskMap.cols; ++c)
@@ -1705,12 +1798,9 @@ void SemiGlobalMatcher::RefineDisparityMap(DisparityMap& disparityMap) const
 			ASSERT((int)d*subpixelSteps < (int)std::numeric_limits<Disparity>::max());
 			d *= subpixelSteps;
 		};
-		ASSERT(threads.IsEmpty());
-		if (!threads.empty()) {
+		if (scheduler != NULL) {
 			volatile Thread::safe_t idxPixel(-1);
-			FOREACH(i, threads)
-				threads.AddEvent(new EVTPixelProcess(disparityMap.size(), idxPixel, pixel));
-			WaitThreadWorkers(threads.size());
+			scheduler->Run(JobPixelProcess(disparityMap.size(), idxPixel, pixel));
 		} else
 		for (int r=0; r<disparityMap.rows; ++r)
 			for (int c=0; c<disparityMap.cols; ++c)
@@ -1785,25 +1875,21 @@ void SemiGlobalMatcher::RefineDisparityMap(DisparityMap& disparityMap) const
 		Disparity& d = disparityMap(idx);
 		if (d == NO_DISP)
 			return;
-		const AccumCost* accums = imageAccumCosts.cdata()+pixel.idx;
-		const int idxDisp(d-pixel.range.minDisp);
+		const AccumCost* accums = imageBestAccums.cdata()+idx*3;
 		real disparity((real)d);
 		if (d == pixel.range.minDisp)
-			disparity += Fit::semisubpixel(accums[idxDisp], accums[idxDisp+1]);
+			disparity += Fit::semisubpixel(accums[1], accums[2]);
 		else if (d+1 == pixel.range.maxDisp)
-			disparity -= Fit::semisubpixel(accums[idxDisp], accums[idxDisp-1]);
+			disparity -= Fit::semisubpixel(accums[1], accums[0]);
 		else
-			disparity += Fit::subpixelMode(accums[idxDisp-1], accums[idxDisp], accums[idxDisp+1], subpixelMode);
+			disparity += Fit::subpixelMode(accums[0], accums[1], accums[2], subpixelMode);
 		ASSERT(ROUND2INT(disparity*subpixelSteps) > (int)std::numeric_limits<Disparity>::min());
 		ASSERT(ROUND2INT(disparity*subpixelSteps) < (int)std::numeric_limits<Disparity>::max());
 		d = (Disparity)ROUND2INT(disparity*subpixelSteps);
 	};
-	ASSERT(threads.IsEmpty());
-	if (!threads.empty()) {
+	if (scheduler != NULL) {
 		volatile Thread::safe_t idxPixel(-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelAccumInc(disparityMap.size().area(), idxPixel, pixel));
-		WaitThreadWorkers(threads.size());
+		scheduler->Run(JobPixelAccumInc(disparityMap.size().area(), idxPixel, pixel));
 	} else
 	for (int r=0; r<disparityMap.rows; ++r)
 		for (int c=0; c<disparityMap.cols; ++c)
@@ -1836,7 +1922,7 @@ void SemiGlobalMatcher::DisplayState(const cv::Size& size) const
 
 // Compute the disparity-map for the rectified image from the given depth-map of the un-rectified image;
 // the disparity map needs to be already constructed at the desired size (valid size, excluding the border)
-void SemiGlobalMatcher::Depth2DisparityMap(const DepthMap& depthMap, const Matrix3x3& invH, const Matrix4x4& invQ, Disparity subpixelSteps, DisparityMap& disparityMap)
+void SemiGlobalMatcher::Depth2DisparityMap(const DepthMap& depthMap, const Matrix3x3& invH, const Matrix4x4& invQ, Disparity subpixelSteps, DisparityMap& disparityMap) const
 {
 	auto pixel = [&](int, int r, int c) {
 		const ImageRef x(c+halfWindowSizeX,r+halfWindowSizeY); Point2f u;
@@ -1847,12 +1933,9 @@ void SemiGlobalMatcher::Depth2DisparityMap(const DepthMap& depthMap, const Matri
 		else
 			disparityMap(r,c) = (Disparity)ROUND2INT(disparity*subpixelSteps);
 	};
-	ASSERT(threads.IsEmpty());
-	if (!threads.empty()) {
+	if (scheduler != NULL) {
 		volatile Thread::safe_t idxPixel(-1);
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTPixelProcess(disparityMap.size(), idxPixel, pixel));
-		WaitThreadWorkers(threads.size());
+		scheduler->Run(JobPixelProcess(disparityMap.size(), idxPixel, pixel));
 	} else
 	for (int r=0; r<disparityMap.rows; ++r)
 		for (int c=0; c<disparityMap.cols; ++c)
@@ -1860,7 +1943,7 @@ void SemiGlobalMatcher::Depth2DisparityMap(const DepthMap& depthMap, const Matri
 }
 
 // Compute the depth-map for the un-rectified image from the given disparity-map of the rectified image
-void SemiGlobalMatcher::Disparity2DepthMap(const DisparityMap& disparityMap, const AccumCostMap& costMap, const Matrix3x3& H, const Matrix4x4& Q, Disparity subpixelSteps, DepthMap& depthMap, ConfidenceMap& confMap)
+void SemiGlobalMatcher::Disparity2DepthMap(const DisparityMap& disparityMap, const AccumCostMap& costMap, const Matrix3x3& H, const Matrix4x4& Q, Disparity subpixelSteps, DepthMap& depthMap, ConfidenceMap& confMap) const
 {
 	ASSERT(costMap.empty() || costMap.size() == disparityMap.size());
 	ASSERT(!depthMap.empty());
@@ -1884,12 +1967,9 @@ void SemiGlobalMatcher::Disparity2DepthMap(const DisparityMap& disparityMap, con
 			depthMap(x) = Image::Disparity2Depth(Q, u, disparity/subpixelSteps);
 			confMap(x) = 1.f/(cost+1);
 		};
-		ASSERT(threads.IsEmpty());
-		if (!threads.empty()) {
+		if (scheduler != NULL) {
 			volatile Thread::safe_t idxPixel(-1);
-			FOREACH(i, threads)
-				threads.AddEvent(new EVTPixelProcess(depthMap.size(), idxPixel, pixel));
-			WaitThreadWorkers(threads.size());
+			scheduler->Run(JobPixelProcess(depthMap.size(), idxPixel, pixel));
 		} else
 		for (int r=0; r<depthMap.rows; ++r)
 			for (int c=0; c<depthMap.cols; ++c)
@@ -1906,12 +1986,9 @@ void SemiGlobalMatcher::Disparity2DepthMap(const DisparityMap& disparityMap, con
 			else
 				depthMap(x) = Image::Disparity2Depth(Q, u, disparity/subpixelSteps);
 		};
-		ASSERT(threads.IsEmpty());
-		if (!threads.empty()) {
+		if (scheduler != NULL) {
 			volatile Thread::safe_t idxPixel(-1);
-			FOREACH(i, threads)
-				threads.AddEvent(new EVTPixelProcess(depthMap.size(), idxPixel, pixel));
-			WaitThreadWorkers(threads.size());
+			scheduler->Run(JobPixelProcess(depthMap.size(), idxPixel, pixel));
 		} else
 		for (int r=0; r<depthMap.rows; ++r)
 			for (int c=0; c<depthMap.cols; ++c)
@@ -2039,33 +2116,66 @@ bool SemiGlobalMatcher::ProjectDisparity2DepthMap(const DisparityMap& disparityM
 }
 
 
-EventThreadPool SemiGlobalMatcher::threads;
-Semaphore SemiGlobalMatcher::sem;
-
-// start worker threads
-void SemiGlobalMatcher::CreateThreads(unsigned nMaxThreads)
+// start the worker threads: the thread waiting for a batch of jobs takes part in the work,
+// so only nMaxThreads-1 workers are created
+SemiGlobalMatcher::Scheduler::Scheduler(unsigned nMaxThreads)
 {
 	ASSERT(nMaxThreads > 0);
-	ASSERT(threads.IsEmpty() && threads.empty());
 	if (nMaxThreads > 1) {
-		threads.resize(nMaxThreads);
-		threads.start(ThreadWorker);
+		workers.resize(nMaxThreads-1);
+		workers.start(ThreadWorker, this);
 	}
 }
-// destroy worker threads
-void SemiGlobalMatcher::DestroyThreads()
+// destroy the worker threads
+SemiGlobalMatcher::Scheduler::~Scheduler()
 {
-	ASSERT(threads.IsEmpty());
-	if (!threads.empty()) {
-		FOREACH(i, threads)
-			threads.AddEvent(new EVTClose());
-		threads.Release();
+	ASSERT(workers.IsEmpty());
+	if (!workers.empty()) {
+		FOREACH(i, workers)
+			workers.AddEvent(new EVTClose());
+		workers.Release();
 	}
 }
 
-void* SemiGlobalMatcher::ThreadWorker(void*) {
+// run the given job on all the worker threads and on the calling thread, and wait for all of them to finish;
+// while waiting, the calling thread runs also the pending jobs of other batches, as their workers
+// might be waiting in turn for this batch, so concurrent (or nested) batches can not deadlock
+void SemiGlobalMatcher::Scheduler::Run(const FncJob& fncJob)
+{
+	Semaphore sem;
+	const unsigned numJobs((unsigned)workers.size());
+	for (unsigned i=0; i<numJobs; ++i)
+		workers.AddEvent(new EVTJob(fncJob, sem));
+	fncJob();
+	for (unsigned numDone=0; numDone<numJobs; ++numDone) {
+		while (!sem.Wait(0)) {
+			CAutoPtr<Event> evt(workers.GetEvent(0));
+			if (evt == NULL) {
+				// all jobs of this batch already started, wait for them
+				sem.Wait();
+				break;
+			}
+			ASSERT(evt->GetID() == EVT_JOB);
+			evt->Run();
+		}
+	}
+}
+
+// claim the given image pair for matching;
+// returns false if the pair (in either order) was already claimed
+bool SemiGlobalMatcher::MatchedPairs::Claim(IIndex idxImageA, IIndex idxImageB)
+{
+	const uint64_t key(idxImageA < idxImageB ?
+		((uint64_t)idxImageA << 32) | idxImageB :
+		((uint64_t)idxImageB << 32) | idxImageA);
+	Lock l(cs);
+	return pairs.insert(key).second;
+}
+
+void* SemiGlobalMatcher::Scheduler::ThreadWorker(void* pData) {
+	Scheduler& scheduler = *((Scheduler*)pData);
 	while (true) {
-		CAutoPtr<Event> evt(threads.GetEvent());
+		CAutoPtr<Event> evt(scheduler.workers.GetEvent());
 		switch (evt->GetID()) {
 		case EVT_JOB:
 			evt->Run();
@@ -2075,16 +2185,9 @@ void* SemiGlobalMatcher::ThreadWorker(void*) {
 		default:
 			ASSERT("Should not happen!" == NULL);
 		}
-		sem.Signal();
 	}
 	return NULL;
 }
-void SemiGlobalMatcher::WaitThreadWorkers(unsigned nJobs)
-{
-	while (nJobs-- > 0)
-		sem.Wait();
-	ASSERT(threads.IsEmpty());
-}
 /*----------------------------------------------------------------*/
 
 
@@ -2363,3 +2466,108 @@ bool MVS::STEREO::ExportCamerasEngin(const Scene& scene, const String& fileName)
 	return true;
 } // ExportCamerasEngin
 /*----------------------------------------------------------------*/
+
+
+// check the vectorized aggregation of the path costs gives the same results as the scalar code,
+// on random disparity ranges (overlapping or not) and random costs
+bool MVS::STEREO::TestSemiGlobalAggregation(unsigned iters)
+{
+	typedef SemiGlobalMatcher SGM;
+	const auto randomRange = []() {
+		SGM::Range R;
+		R.minDisp = (SGM::Disparity)(RAND()%128)-64;
+		R.maxDisp = R.minDisp+1+(SGM::Disparity)(RAND()%160);
+		return R;
+	};
+	for (unsigned iter=0; iter<iters; ++iter) {
+		const SGM::Range Rp(randomRange()), Rs(randomRange());
+		const SGM::AccumCost P1((SGM::AccumCost)(1+RAND()%16));
+		const SGM::AccumCost P2((SGM::AccumCost)(P1+RAND()%128));
+		std::vector<SGM::Cost> costs(Rs.numDisp());
+		for (SGM::Cost& cost: costs)
+			cost = (SGM::Cost)(RAND()%256);
+		std::vector<SGM::AccumCost> Lp(Rp.numDisp());
+		for (SGM::AccumCost& L: Lp)
+			L = (SGM::AccumCost)(RAND()%4096);
+		std::vector<SGM::AccumCost> accums(Rs.numDisp());
+		for (SGM::AccumCost& accum: accums)
+			accum = (SGM::AccumCost)(RAND()%32768);
+		std::vector<SGM::AccumCost> LsRef(Rs.numDisp()), accumsRef(accums);
+		SGM::AggregatePathCosts(costs.data(), Lp.data(), Rp, LsRef.data(), Rs, accumsRef.data(), P1, P2, SGM::AGGREGATE_SCALAR);
+		for (int simd=SGM::AGGREGATE_SSE; simd<=SGM::AGGREGATE_BEST; ++simd) {
+			std::vector<SGM::AccumCost> Ls(Rs.numDisp()), accumsSIMD(accums);
+			SGM::AggregatePathCosts(costs.data(), Lp.data(), Rp, Ls.data(), Rs, accumsSIMD.data(), P1, P2, (SGM::AggregateSIMD)simd);
+			if (Ls != LsRef || accumsSIMD != accumsRef)
+				return false;
+		}
+	}
+	return true;
+}
+/*----------------------------------------------------------------*/
+
+// check matching the cost volume in overlapping strips, as when the memory is limited by SetMaxMemory,
+// gives the same disparities as matching it at once, up to a few pixels near the strip borders:
+// on a random textured image pair with a known disparity slowly varying across the rows,
+// at most 1% of the pixels may differ by more than one disparity
+bool MVS::STEREO::TestSemiGlobalStrips(int nOverlapRows)
+{
+	struct Matcher : public SemiGlobalMatcher {
+		bool Test(int nOverlapRows) {
+			// generate the image pair
+			const cv::Size size(160, 120);
+			const Disparity minDisp(0), maxDisp(24);
+			ViewData left, right;
+			left.imageColor.create(size);
+			right.imageColor.create(size);
+			for (int r=0; r<size.height; ++r) {
+				for (int c=0; c<size.width; ++c)
+					left.imageColor(r,c) = Pixel8U((uint8_t)(RAND()%256), (uint8_t)(RAND()%256), (uint8_t)(RAND()%256));
+				const int disp(6+r*8/size.height);
+				for (int c=0; c<size.width; ++c)
+					right.imageColor(r,c) = (c >= disp ? left.imageColor(r,c-disp) : Pixel8U((uint8_t)(RAND()%256), (uint8_t)(RAND()%256), (uint8_t)(RAND()%256)));
+			}
+			#if SGM_SIMILARITY == SGM_SIMILARITY_CENSUS
+			left.imageColor.toGray(left.imageGray, cv::COLOR_BGR2GRAY, false, true);
+			right.imageColor.toGray(right.imageGray, cv::COLOR_BGR2GRAY, false, true);
+			#else
+			left.imageColor.toGray(left.imageGray, cv::COLOR_BGR2GRAY, true, true);
+			right.imageColor.toGray(right.imageGray, cv::COLOR_BGR2GRAY, true, true);
+			#endif
+			const ViewData leftData(left.GetImage(1)), rightData(right.GetImage(1));
+			// search the same disparity range for all pixels
+			const cv::Size sizeValid(size.width-2*halfWindowSizeX, size.height-2*halfWindowSizeY);
+			maxNumDisp = maxDisp-minDisp;
+			Index numCosts(0);
+			imagePixels.resize(sizeValid.area());
+			for (PixelData& pixel: imagePixels) {
+				pixel.range.minDisp = minDisp;
+				pixel.range.maxDisp = maxDisp;
+				pixel.idx = numCosts;
+				numCosts += maxNumDisp;
+			}
+			// match the whole cost volume, next in strips of about a quarter of it
+			DisparityMap disparityMap, disparityMapStrips;
+			AccumCostMap costMap, costMapStrips;
+			SetMaxMemory(0);
+			Match(leftData, rightData, numCosts, disparityMap, costMap);
+			const size_t memCosts(numCosts*(sizeof(Cost)+sizeof(AccumCost)));
+			SetMaxMemory(memCosts/4, nOverlapRows);
+			peakMemCosts = 0;
+			Match(leftData, rightData, numCosts, disparityMapStrips, costMapStrips);
+			if (peakMemCosts >= memCosts)
+				return false;
+			// compare the disparities
+			unsigned numPixels(0), numDiffs(0);
+			for (int i=0; i<disparityMap.area(); ++i) {
+				if (costMap(i) == NO_ACCUMCOST)
+					continue;
+				++numPixels;
+				if (ABS(disparityMap(i)-disparityMapStrips(i)) > 1)
+					++numDiffs;
+			}
+			return numPixels > 0 && numDiffs*100 <= numPixels;
+		}
+	};
+	return Matcher().Test(nOverlapRows);
+}
+/*----------------------------------------------------------------*/
@@ -68,6 +68,7 @@ public:
 	enum : Disparity { NO_DISP = DECLARE_NO_INDEX(Disparity) }; // invalid disparity value
 	enum : AccumCost { NO_ACCUMCOST = DECLARE_NO_INDEX(AccumCost) }; // invalid accumulated cost value
 	enum : Index     { NO_INDEX = DECLARE_NO_INDEX(Index) }; // invalid index value
+	enum AggregateSIMD { AGGREGATE_SCALAR = 0, AGGREGATE_SSE, AGGREGATE_AVX2, AGGREGATE_BEST }; // instruction set used to aggregate the path costs
 
 	struct Range {
 		Disparity minDisp;
@@ -88,7 +89,7 @@ public:
 	typedef CLISTDEF0IDX(Cost,Index) CostsMap; // map of pre-computed disparity costs
 	typedef CLISTDEF0IDX(AccumCost,Index) AccumCostsMap; // map of accumulated disparity costs
 
-	enum : int { numDirs = 4 }; // 2 or 4 directions accumulated per pixel pass
+	enum : int { maxNumDirs = 4 }; // maximum number of directions accumulated per pixel pass
 	#if SGM_SIMILARITY == SGM_SIMILARITY_CENSUS
 	enum : int { halfWindowSizeX = 3, halfWindowSizeY = 4 }; // patch kernel size
 	#else
@@ -118,16 +119,48 @@ public:
 		SUBPIXEL_LC_BLEND // probably the best option
 	};
 
+	// pool of worker threads running the parallel jobs of one or more matchers:
+	// each batch of jobs is waited for separately, so several matchers sharing
+	// the same scheduler can match image pairs concurrently from different threads
+	class Scheduler {
+	public:
+		typedef std::function<void()> FncJob;
+
+		Scheduler(unsigned nMaxThreads);
+		~Scheduler();
+
+		inline unsigned GetNumThreads() const { return (unsigned)workers.size()+1; }
+
+		void Run(const FncJob&);
+
+	protected:
+		static void* ThreadWorker(void*);
+
+	protected:
+		EventThreadPool workers; // worker threads (the thread waiting for a batch of jobs works too)
+	};
+
+	// image pairs claimed for matching by the matchers sharing it,
+	// so that each pair (in either order) is matched only once, even by concurrent matchers
+	class MatchedPairs {
+	public:
+		bool Claim(IIndex idxImageA, IIndex idxImageB);
+
+	protected:
+		std::unordered_set<uint64_t> pairs; // claimed pairs, keyed by the ordered image indices
+		CriticalSection cs;
+	};
+
 	struct ViewData {
 		Image8U3 imageColor; // color image
 		ImageGray imageGray; // intensity image
 		#if SGM_SIMILARITY == SGM_SIMILARITY_CENSUS
 		CensusMap imageCensus; // image of Census transforms (valid per scale)
 		#endif
-		ViewData GetImage(REAL scale) const {
+		ViewData GetImage(REAL scale, Scheduler* scheduler=NULL) const {
 			if (ISEQUAL(scale, REAL(1))) {
 				#if SGM_SIMILARITY == SGM_SIMILARITY_CENSUS
-				CensusTransform(imageGray, const_cast<CensusMap&>(imageCensus));
+				CensusTransform(imageGray, const_cast<CensusMap&>(imageCensus), scheduler);
 				#endif
 				return *this;
 			}
@@ -136,7 +169,7 @@ public:
 			cv::resize(imageColor, scaledView.imageColor, cv::Size(), scale, scale, cv::INTER_AREA);
 			cv::resize(imageGray, scaledView.imageGray, cv::Size(), scale, scale, cv::INTER_AREA);
 			#if SGM_SIMILARITY == SGM_SIMILARITY_CENSUS
-			CensusTransform(scaledView.imageGray, scaledView.imageCensus);
+			CensusTransform(scaledView.imageGray, scaledView.imageCensus, scheduler);
 			#endif
 			return scaledView;
 		}
@@ -149,13 +182,22 @@ public:
 	SemiGlobalMatcher(SgmSubpixelMode subpixelMode=SUBPIXEL_LC_BLEND, Disparity subpixelSteps=4, AccumCost P1=3, AccumCost P2=4, float P2alpha=14, float P2beta=38);
 	~SemiGlobalMatcher();
 
+	// set the number of paths the costs are aggregated along: 4 (horizontal and vertical) or 8 (also diagonal)
+	inline void SetNumPaths(unsigned numPaths) { ASSERT(numPaths == 4 || numPaths == 8); numDirs = numPaths > 4 ? 4 : 2; }
+	inline unsigned GetNumPaths() const { return numDirs*2; }
+	// limit the memory used by the cost volume (in bytes, 0 - unlimited): when exceeded, the costs are computed
+	// and aggregated in horizontal strips of the image, each extended by the given number of overlap rows
+	inline void SetMaxMemory(size_t nMaxBytes, int nOverlapRows=32) { ASSERT(nOverlapRows >= 0); maxMemCosts = nMaxBytes; stripOverlap = nOverlapRows; }
+	inline size_t GetPeakMemory() const { return peakMemCosts; }
+
 	void Match(const Scene& scene, IIndex idxImage, IIndex numNeighbors, unsigned minResolution=320);
 	void Fuse(const Scene& scene, IIndex idxImage, IIndex numNeighbors, unsigned minViews, DepthMap& depthMap, ConfidenceMap& confMap);
 
-	static void CreateThreads(unsigned nMaxThreads=1);
-	static void DestroyThreads();
-	static void* ThreadWorker(void*);
-	static void WaitThreadWorkers(unsigned nJobs);
+	// set the scheduler running the parallel jobs (NULL - run them on the calling thread)
+	inline void SetScheduler(Scheduler* _scheduler) { scheduler = _scheduler; }
+	inline Scheduler* GetScheduler() const { return scheduler; }
+	// set the image pairs shared with the concurrent matchers (NULL - match all pairs not already on disk)
+	inline void SetMatchedPairs(MatchedPairs* _matchedPairs) { matchedPairs = _matchedPairs; }
 
 	static bool ExportDisparityDataRaw(const String& fileName, const DisparityMap&, const AccumCostMap&, const cv::Size& imageSize, const Matrix3x3& H, const Matrix4x4& Q, Disparity subpixelSteps);
 	static bool ExportDisparityDataRawFull(const String& fileName, const DisparityMap&, const AccumCostMap&, const cv::Size& imageSize, const Matrix3x3& H, const Matrix4x4& Q, Disparity subpixelSteps);
@@ -166,25 +208,28 @@ public:
 	static bool ExportPointCloud(const String& fileName, const Image&, const DisparityMap&, const Matrix4x4& Q, Disparity subpixelSteps);
 	static bool ImportPointCloud(const String& fileName, const ImageArr& images, PointCloud&);
 
+	static void AggregatePathCosts(const Cost* costs, const AccumCost* Lp, const Range& Rp, AccumCost* Ls, const Range& Rs, AccumCost* accums, AccumCost P1, AccumCost P2, AggregateSIMD simd=AGGREGATE_BEST);
+
 protected:
-	void Match(const ViewData& leftImage, const ViewData& rightImage, DisparityMap& disparityMap, AccumCostMap& costMap);
+	void Match(const ViewData& leftImage, const ViewData& rightImage, Index numCosts, DisparityMap& disparityMap, AccumCostMap& costMap);
+	void MatchStrip(const ViewData& leftImage, const ViewData& rightImage, int rowBegin, int rowEnd, int rowValidBegin, int rowValidEnd, DisparityMap& disparityMap, AccumCostMap& costMap);
 	Index Disparity2RangeMap(const DisparityMap& disparityMap, const MaskMap& maskMap, Disparity minNumDisp=3, Disparity minNumDispInvalid=16);
 	#if SGM_SIMILARITY == SGM_SIMILARITY_CENSUS
-	static void CensusTransform(const Image8U& imageGray, CensusMap& imageCensus);
+	static void CensusTransform(const Image8U& imageGray, CensusMap& imageCensus, Scheduler* scheduler=NULL);
 	#endif
-	static void ConsistencyCrossCheck(DisparityMap& l2r, const DisparityMap& r2l, Disparity thCross=1);
-	static void FilterByCost(DisparityMap&, const AccumCostMap&, AccumCost th);
-	static void ExtractMask(const DisparityMap&, MaskMap&, int thValid=3);
-	static void FlipDirection(const DisparityMap& l2r, DisparityMap& r2l);
-	static void UpscaleMask(MaskMap& maskMap, const cv::Size& size2x);
+	void ConsistencyCrossCheck(DisparityMap& l2r, const DisparityMap& r2l, Disparity thCross=1) const;
+	void FilterByCost(DisparityMap&, const AccumCostMap&, AccumCost th) const;
+	void ExtractMask(const DisparityMap&, MaskMap&, int thValid=3) const;
+	void FlipDirection(const DisparityMap& l2r, DisparityMap& r2l) const;
+	void UpscaleMask(MaskMap& maskMap, const cv::Size& size2x) const;
 	void RefineDisparityMap(DisparityMap& disparityMap) const;
 	#ifndef _RELEASE
 	void DisplayState(const cv::Size& size) const;
 	#endif
 
 	static CLISTDEF0IDX(AccumCost,int) GenerateP2s(AccumCost P2, float P2alpha, float P2beta);
-	static void Depth2DisparityMap(const DepthMap&, const Matrix3x3& invH, const Matrix4x4& invQ, Disparity subpixelSteps, DisparityMap&);
-	static void Disparity2DepthMap(const DisparityMap&, const AccumCostMap&, const Matrix3x3& H, const Matrix4x4& Q, Disparity subpixelSteps, DepthMap&, ConfidenceMap&);
+	void Depth2DisparityMap(const DepthMap&, const Matrix3x3& invH, const Matrix4x4& invQ, Disparity subpixelSteps, DisparityMap&) const;
+	void Disparity2DepthMap(const DisparityMap&, const AccumCostMap&, const Matrix3x3& H, const Matrix4x4& Q, Disparity subpixelSteps, DepthMap&, ConfidenceMap&) const;
 	static bool ProjectDisparity2DepthMap(const DisparityMap&, const AccumCostMap&, const Matrix4x4& Q, Disparity subpixelSteps, DepthMap&, DepthRangeMap&, ConfidenceMap&);
 
 protected:
@@ -193,21 +238,28 @@ protected:
 	Disparity subpixelSteps;
 	AccumCost P1;
 	CLISTDEF0IDX(AccumCost,int) P2s;
+	int numDirs; // 2 or 4 directions accumulated per pixel pass (each direction is aggregated along two opposite paths)
+	size_t maxMemCosts; // maximum memory used by the costs and accumulated costs buffers (0 - unlimited)
+	int stripOverlap; // number of rows each strip is extended with on both sides when the costs are processed in strips
 
 	// main memory buffers that must be allocated
 	PixelMap imagePixels;
 	CostsMap imageCosts;
 	AccumCostsMap imageAccumCosts;
+	AccumCostsMap imageBestAccums; // accumulated costs of the best disparity and its two neighbors for each pixel (used by the sub-pixel refinement)
 	Disparity maxNumDisp; // maximum number of disparities per-pixel
+	size_t peakMemCosts; // maximum memory used by the costs buffers while matching the last image pair
 
 	// multi-threading
-	static EventThreadPool threads; // worker threads
-	static Semaphore sem; // signal job end
+	Scheduler* scheduler; // runs the parallel jobs (not owned)
+	MatchedPairs* matchedPairs; // image pairs claimed by all the matchers (not owned)
 };
 /*----------------------------------------------------------------*/
 
 
 MVS_API bool ExportCamerasEngin(const Scene&, const String& fileName);
+MVS_API bool TestSemiGlobalAggregation(unsigned iters);
+MVS_API bool TestSemiGlobalStrips(int nOverlapRows);
 /*----------------------------------------------------------------*/
 
 } // namespace STEREO
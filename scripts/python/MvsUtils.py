@@ -9,18 +9,23 @@ import numpy as np
 def loadDMAP(dmap_path):
   with open(dmap_path, 'rb') as dmap:
     file_type = dmap.read(2).decode()
-    content_type = np.frombuffer(dmap.read(1), dtype=np.dtype('B'))
-    reserve = np.frombuffer(dmap.read(1), dtype=np.dtype('B'))
-    
-    has_depth = content_type > 0
-    has_normal = content_type in [3, 7, 11, 15]
-    has_conf = content_type in [5, 7, 13, 15]
-    has_views = content_type in [9, 11, 13, 15]
+    content_type = np.frombuffer(dmap.read(1), dtype=np.dtype('B'))[0]
+    version = np.frombuffer(dmap.read(1), dtype=np.dtype('B'))[0]
+    
+    has_depth = (content_type & 1) != 0
+    has_normal = (content_type & 2) != 0
+    has_conf = (content_type & 4) != 0
+    has_views = (content_type & 8) != 0
+    # compact encodings
+    depth_half = (content_type & 16) != 0
+    normal_oct = (content_type & 32) != 0
+    conf_half = (content_type & 64) != 0
+    conf_byte = (content_type & 128) != 0
     
     image_width, image_height = np.frombuffer(dmap.read(8), dtype=np.dtype('I'))
     depth_width, depth_height = np.frombuffer(dmap.read(8), dtype=np.dtype('I'))
     
-    if (file_type != 'DR' or has_depth == False or depth_width <= 0 or depth_height <= 0 or image_width < depth_width or image_height < depth_height):
+    if (file_type != 'DR' or version > 2 or has_depth == False or depth_width <= 0 or depth_height <= 0 or image_width < depth_width or image_height < depth_height):
       print('error: opening file \'{}\' for reading depth-data'.format(dmap_path))
       return
     
@@ -36,6 +41,11 @@ def loadDMAP(dmap_path):
     R = np.frombuffer(dmap.read(72), dtype=np.dtype('d')).reshape(3, 3)
     C = np.frombuffer(dmap.read(24), dtype=np.dtype('d'))
     
+    # starting with version 1, each map is stored at its own (aligned) offset
+    offsets = np.frombuffer(dmap.read(32), dtype=np.dtype('Q')) if version >= 1 else None
+    # starting with version 2, the fingerprint of the estimation inputs follows (0 if unknown)
+    fingerprint = int(np.frombuffer(dmap.read(8), dtype=np.dtype('Q'))[0]) if version >= 2 else 0
+    
     data = {
       'has_normal': has_normal,
       'has_conf': has_conf,
@@ -51,19 +61,51 @@ def loadDMAP(dmap_path):
       'neighbor_view_ids': neighbor_view_ids,
       'K': K,
       'R': R,
-      'C': C
+      'C': C,
+      'fingerprint': fingerprint
     }
     
     map_size = depth_width * depth_height
-    depth_map = np.frombuffer(dmap.read(4 * map_size), dtype=np.dtype('f')).reshape(depth_height, depth_width)
+    if offsets is not None:
+      dmap.seek(int(offsets[0]))
+    if depth_half:
+      depth_map = np.frombuffer(dmap.read(2 * map_size), dtype=np.dtype('e')).astype(np.float32).reshape(depth_height, depth_width)
+    else:
+      depth_map = np.frombuffer(dmap.read(4 * map_size), dtype=np.dtype('f')).reshape(depth_height, depth_width)
     data.update({'depth_map': depth_map})
     if has_normal:
-      normal_map = np.frombuffer(dmap.read(4 * map_size * 3), dtype=np.dtype('f')).reshape(depth_height, depth_width, 3)
+      if offsets is not None:
+        dmap.seek(int(offsets[1]))
+      if normal_oct:
+        # octahedral encoding: two 16-bit signed normalized values (both -32768 for an invalid normal)
+        code = np.frombuffer(dmap.read(4 * map_size), dtype=np.dtype('h')).reshape(depth_height, depth_width, 2)
+        invalid = (code[..., 0] == -32768) & (code[..., 1] == -32768)
+        uv = code.astype(np.float32) / 32767
+        x, y = uv[..., 0], uv[..., 1]
+        z = 1 - np.abs(x) - np.abs(y)
+        fold = z < 0
+        x, y = np.where(fold, (1 - np.abs(y)) * np.where(x >= 0, 1, -1), x), np.where(fold, (1 - np.abs(x)) * np.where(y >= 0, 1, -1), y)
+        normal_map = np.stack((x, y, z), axis=-1)
+        normal_map /= np.linalg.norm(normal_map, axis=-1, keepdims=True)
+        normal_map[invalid] = 0
+      else:
+        normal_map = np.frombuffer(dmap.read(4 * map_size * 3), dtype=np.dtype('f')).reshape(depth_height, depth_width, 3)
       data.update({'normal_map': normal_map})
     if has_conf:
-      confidence_map = np.frombuffer(dmap.read(4 * map_size), dtype=np.dtype('f')).reshape(depth_height, depth_width)
+      if offsets is not None:
+        dmap.seek(int(offsets[2]))
+      if conf_byte:
+        # 8-bit encoding of c/(1+c)
+        q = np.frombuffer(dmap.read(map_size), dtype=np.dtype('B')).astype(np.float32).reshape(depth_height, depth_width)
+        confidence_map = q / (255 - q)
+      elif conf_half:
+        confidence_map = np.frombuffer(dmap.read(2 * map_size), dtype=np.dtype('e')).astype(np.float32).reshape(depth_height, depth_width)
+      else:
+        confidence_map = np.frombuffer(dmap.read(4 * map_size), dtype=np.dtype('f')).reshape(depth_height, depth_width)
       data.update({'confidence_map': confidence_map})
     if has_views:
+      if offsets is not None:
+        dmap.seek(int(offsets[3]))
       views_map = np.frombuffer(dmap.read(map_size * 4), dtype=np.dtype('B')).reshape(depth_height, depth_width, 4)
       data.update({'views_map': views_map})
   